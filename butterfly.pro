@@ -26,15 +26,32 @@ DEFINES += QT_DEPRECATED_WARNINGS
 SOURCES += main.cpp\
         zmainwidget.cpp \
     src/ALSACapture.cpp \
+    src/PCMByteSwap.cpp \
+    src/AudioFilter.cpp \
+    src/SpectralDenoiser.cpp \
+    src/AudioEncoder.cpp \
+    src/AudioResampler.cpp \
+    src/VoiceActivity.cpp \
+    src/AudioClock.cpp \
+    src/AudioMixer.cpp \
+    src/AACEncoderSource.cpp \
     src/DeviceSource.cpp \
     src/H264_V4l2DeviceSource.cpp \
     src/HTTPServer.cpp \
     src/MemoryBufferSink.cpp \
+    src/MemorySegment.cpp \
+    src/CMAFMemoryBufferSink.cpp \
+    src/WebrootCache.cpp \
     src/MJPEGVideoSource.cpp \
     src/MulticastServerMediaSubsession.cpp \
     src/ServerMediaSubsession.cpp \
     src/TSServerMediaSubsession.cpp \
     src/UnicastServerMediaSubsession.cpp \
+    src/RTPOutputGroupsock.cpp \
+    src/TCPInterleavedWriter.cpp \
+    src/RTPPacer.cpp \
+    src/RTCPFeedback.cpp \
+    src/RTPRateController.cpp \
     libv4l2wrapper/src/logger.cpp  \
     libv4l2wrapper/src/V4l2Capture.cpp  \
     libv4l2wrapper/src/V4l2Device.cpp  \
@@ -46,16 +63,33 @@ SOURCES += main.cpp\
 HEADERS  += zmainwidget.h \
     inc/AddH26xMarkerFilter.h \
     inc/ALSACapture.h \
+    inc/PCMByteSwap.h \
+    inc/AudioFilter.h \
+    inc/SpectralDenoiser.h \
+    inc/AudioEncoder.h \
+    inc/AudioResampler.h \
+    inc/VoiceActivity.h \
+    inc/AudioClock.h \
+    inc/AudioMixer.h \
+    inc/AACEncoderSource.h \
     inc/DeviceInterface.h \
     inc/DeviceSource.h \
     inc/H264_V4l2DeviceSource.h \
     inc/HTTPServer.h \
     inc/MemoryBufferSink.h \
+    inc/MemorySegment.h \
+    inc/CMAFMemoryBufferSink.h \
+    inc/WebrootCache.h \
     inc/MJPEGVideoSource.h \
     inc/MulticastServerMediaSubsession.h \
     inc/ServerMediaSubsession.h \
     inc/TSServerMediaSubsession.h \
     inc/UnicastServerMediaSubsession.h \
+    inc/RTPOutputGroupsock.h \
+    inc/TCPInterleavedWriter.h \
+    inc/RTPPacer.h \
+    inc/RTCPFeedback.h \
+    inc/RTPRateController.h \
     libv4l2wrapper/inc/logger.h \
     libv4l2wrapper/inc/V4l2Access.h \
     libv4l2wrapper/inc/V4l2Capture.h \
@@ -81,3 +115,15 @@ LIBS += $$PWD/../3rdlibs/live/groupsock/libgroupsock.a
 LIBS += $$PWD/../3rdlibs/live/BasicUsageEnvironment/libBasicUsageEnvironment.a
 LIBS += -lgstreamer-1.0 -lgobject-2.0 -lglib-2.0 -lgstapp-1.0
 LIBS += -lasound
+# optional audio codecs, enabled when their development package is installed
+CONFIG += link_pkgconfig
+# Opus audio encoding
+packagesExist(opus) {
+    DEFINES += HAVE_OPUS
+    PKGCONFIG += opus
+}
+# AAC audio in the HLS transport stream
+packagesExist(fdk-aac) {
+    DEFINES += HAVE_FDKAAC
+    PKGCONFIG += fdk-aac
+}
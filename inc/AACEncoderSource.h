@@ -0,0 +1,80 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AACEncoderSource.h
+**
+** live555 filter that encodes PCM to AAC-LC ADTS frames on a worker thread
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <list>
+#include <vector>
+#include <string>
+#include <pthread.h>
+
+// live555
+#include <liveMedia.hh>
+
+#ifdef HAVE_FDKAAC
+#include <fdk-aac/aacenc_lib.h>
+#endif
+
+class AACEncoderSource : public FramedFilter
+{
+	public:
+		// format is audio/L16, audio/PCMU or audio/PCMA with its rate and channels, NULL without an AAC encoder
+		static AACEncoderSource* createNew(UsageEnvironment& env, FramedSource* source, const std::string& format, unsigned int bitrate = 64000);
+
+	protected:
+		AACEncoderSource(UsageEnvironment& env, FramedSource* source, const std::string& codec, unsigned int sampleRate, unsigned int channels);
+		virtual ~AACEncoderSource();
+		bool initEncoder(unsigned int bitrate);
+
+		virtual void doGetNextFrame();
+		virtual void doStopGettingFrames();
+
+		static void afterGettingFrame(void* clientData, unsigned frameSize, unsigned /*numTruncatedBytes*/, struct timeval presentationTime, unsigned /*durationInMicroseconds*/)
+		{
+			((AACEncoderSource*)clientData)->afterGettingFrame(frameSize, presentationTime);
+		}
+		void afterGettingFrame(unsigned frameSize, struct timeval presentationTime);
+		void readInput();
+		static void deliverFrameStub(void* clientData) { ((AACEncoderSource*)clientData)->deliverFrame(); }
+		void deliverFrame();
+
+		static void* threadStub(void* clientData) { return ((AACEncoderSource*)clientData)->thread(); }
+		void* thread();
+
+	protected:
+		struct Frame
+		{
+			std::vector<unsigned char> m_data;
+			struct timeval             m_timestamp;
+		};
+
+		std::string                m_codec;
+		unsigned int               m_sampleRate;
+		unsigned int               m_channels;
+		unsigned int               m_frameLength;    // samples per channel of an AAC frame
+		std::vector<unsigned char> m_input;
+		bool                       m_reading;
+
+		// PCM of the event loop to the worker, ADTS frames back
+		std::vector<short>         m_samples;
+		size_t                     m_samplesRead;     // samples of m_samples already handed to the encoder
+		struct timeval             m_samplesTime;     // timestamp of the first waiting sample
+		std::list<struct timeval>  m_pts;             // timestamps of the AAC frames being encoded
+		std::list<Frame>           m_output;
+		bool                       m_stop;
+		pthread_t                  m_thid;
+		pthread_mutex_t            m_mutex;
+		pthread_cond_t             m_cond;
+		EventTriggerId             m_eventTriggerId;
+#ifdef HAVE_FDKAAC
+		HANDLE_AACENCODER          m_encoder;
+#endif
+};
@@ -22,7 +22,7 @@
 struct ALSACaptureParameters 
 {
 	ALSACaptureParameters(const char* devname, const std::list<snd_pcm_format_t> & formatList, unsigned int sampleRate, unsigned int channels, int verbose) : 
-		m_devName(devname), m_formatList(formatList), m_sampleRate(sampleRate), m_channels(channels), m_verbose(verbose) {
+		m_devName(devname), m_formatList(formatList), m_sampleRate(sampleRate), m_channels(channels), m_verbose(verbose), m_mmap(false), m_periodTime(0), m_bufferTime(0) {
 			
 	}
 		
@@ -31,6 +31,26 @@ struct ALSACaptureParameters
 	unsigned int     m_sampleRate;
 	unsigned int     m_channels;
 	int              m_verbose;
+	bool             m_mmap;          // read the periods from the mmap ring of the driver
+	unsigned int     m_periodTime;    // us, 0 keeps the driver default
+	unsigned int     m_bufferTime;    // us, 0 keeps the driver default
+};
+
+// ---------------------------------
+// Latency of the capture and xrun counters
+// ---------------------------------
+struct ALSACaptureLatency
+{
+	ALSACaptureLatency() : m_periodSize(0), m_bufferSize(0), m_delay(0), m_maxDelay(0), m_xruns(0), m_suspends(0), m_recoveries(0), m_failures(0) {}
+
+	unsigned long m_periodSize;   // frames
+	unsigned long m_bufferSize;   // frames
+	long          m_delay;        // frames waiting in the buffer after the last read
+	long          m_maxDelay;     // highest delay since the last report
+	unsigned long m_xruns;
+	unsigned long m_suspends;
+	unsigned long m_recoveries;
+	unsigned long m_failures;
 };
 
 class ALSACapture 
@@ -43,22 +63,32 @@ class ALSACapture
 	protected:
 		ALSACapture(const ALSACaptureParameters & params);
 		int configureFormat(snd_pcm_hw_params_t *hw_params);
+		int configureAccess(snd_pcm_hw_params_t *hw_params);
+		snd_pcm_sframes_t readMmap(char* buffer, snd_pcm_uframes_t frames);
+		snd_pcm_sframes_t readFrames(char* buffer, snd_pcm_uframes_t frames);
+		int recover(int err);
+		void updateLatency();
 			
 	public:
 		virtual size_t read(char* buffer, size_t bufferSize);		
 		virtual int getFd();
 		
+        // bytes of a period, the frames read at once
         virtual unsigned long getBufferSize()
         {
-            return m_bufferSize;
+            return m_periodSize * m_params.m_channels * snd_pcm_format_physical_width(m_fmt) / 8;
         }
 		virtual int getWidth()  {return -1;}
 		virtual int getHeight() {return -1;}	
 		virtual int getCaptureFormat() {return -1;}	
+		virtual bool requestKeyFrame() {return false;}
+		virtual bool setBitrate(unsigned int) {return false;}
+		virtual unsigned int getBitrate() {return 0;}
 		
 		unsigned long getSampleRate() { return m_params.m_sampleRate; }
 		unsigned long getChannels  () { return m_params.m_channels;   }
 		snd_pcm_format_t getFormat () { return m_fmt;                 }
+		const ALSACaptureLatency & getLatency() { return m_latency;   }
 		
 	private:
 		snd_pcm_t*            m_pcm;
@@ -66,6 +96,9 @@ class ALSACapture
 		unsigned long         m_periodSize;
 		ALSACaptureParameters m_params;
 		snd_pcm_format_t      m_fmt;
+		bool                  m_mmap;
+		ALSACaptureLatency    m_latency;
+		time_t                m_reportTime;
 };
 
 #endif
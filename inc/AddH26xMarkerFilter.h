@@ -11,8 +11,8 @@
 
 class AddH26xMarkerFilter : public FramedFilter {
 	public:
-		AddH26xMarkerFilter (UsageEnvironment& env, FramedSource* inputSource): FramedFilter(env, inputSource) {
-			m_bufferSize = OutPacketBuffer::maxSize;
+		AddH26xMarkerFilter (UsageEnvironment& env, FramedSource* inputSource, unsigned int bufferSize = OutPacketBuffer::maxSize): FramedFilter(env, inputSource) {
+			m_bufferSize = bufferSize;
 			m_buffer = new unsigned char[m_bufferSize];
 		}
 		virtual ~AddH26xMarkerFilter () {
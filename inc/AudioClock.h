@@ -0,0 +1,79 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioClock.h
+**
+** Audio presentation times from the sample clock of the device, locked on the system clock
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <time.h>
+#include <sys/time.h>
+
+#include "DeviceInterface.h"
+
+// ---------------------------------
+// Drift of the audio device against the system clock
+// ---------------------------------
+struct AudioClockStats
+{
+	AudioClockStats() : m_skew(0), m_drift(0), m_jitter(0), m_resyncs(0) {}
+	double        m_skew;      // ppm, positive when the device is slower than its nominal rate
+	double        m_drift;     // ms, time of the samples read behind the system clock since the last resync
+	double        m_jitter;    // ms, highest distance of a read to the locked clock since the last report
+	unsigned long m_resyncs;   // start, xrun or suspend
+};
+
+// ---------------------------------
+// Device decorator that stamps the periods with a delay-locked loop on the samples count,
+// the times follow the system clock without the jitter of the reads, the drift is slewed
+// ---------------------------------
+class AudioClockDevice : public DeviceInterface
+{
+	public:
+		// bandwidth of the loop in Hz, lower is smoother but slower to lock
+		static AudioClockDevice* createNew(DeviceInterface* device, unsigned int sampleRate, unsigned int channels, int format, double bandwidth = 0.05);
+		virtual ~AudioClockDevice();
+
+		const AudioClockStats & getStats() { return m_stats; }
+
+		virtual size_t read(char* buffer, size_t bufferSize);
+		virtual int getFd()                        { return m_device->getFd(); }
+		virtual unsigned long getBufferSize()      { return m_device->getBufferSize(); }
+		virtual int getWidth()                     { return m_device->getWidth(); }
+		virtual int getHeight()                    { return m_device->getHeight(); }
+		virtual int getCaptureFormat()             { return m_device->getCaptureFormat(); }
+		virtual bool requestKeyFrame()             { return m_device->requestKeyFrame(); }
+		virtual bool setBitrate(unsigned int kbps) { return m_device->setBitrate(kbps); }
+		virtual unsigned int getBitrate()          { return m_device->getBitrate(); }
+		virtual void adjustPresentationTime(timeval & tv);
+
+	protected:
+		AudioClockDevice(DeviceInterface* device, unsigned int sampleRate, unsigned int frameSize, double bandwidth);
+		void update(unsigned int frames, double now, const timeval & wall);
+		void updateStats(double error, double duration);
+
+	protected:
+		DeviceInterface*         m_device;
+		unsigned int             m_sampleRate;
+		unsigned int             m_frameSize;     // bytes of a sample of all the channels
+		double                   m_bandwidth;
+
+		// loop state on the monotonic clock, in seconds
+		bool                     m_locked;
+		double                   m_next;          // time of the first sample of the next read
+		double                   m_period;        // duration of a sample
+		double                   m_origin;        // time of the first sample after the last resync
+		unsigned long long       m_frames;        // read since the last resync
+
+		// time of the first read since the last frame was stamped, on the system clock
+		bool                     m_pending;
+		timeval                  m_presentationTime;
+
+		AudioClockStats          m_stats;
+		time_t                   m_reportTime;
+};
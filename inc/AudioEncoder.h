@@ -0,0 +1,81 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioEncoder.h
+**
+** Audio encoding stage (G.711 A-law/u-law, Opus) between the capture and the live555 source
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <time.h>
+
+#include "DeviceInterface.h"
+
+#ifdef HAVE_OPUS
+#include <opus/opus.h>
+#endif
+
+// G.711 codes to 16 bits samples in host order, for the stages that need PCM
+void decodeG711(const unsigned char* codes, size_t count, short* samples, bool ulaw);
+
+// ---------------------------------
+// Device decorator that encodes the 16 bits network order periods of the device
+// ---------------------------------
+class AudioEncoderDevice : public DeviceInterface
+{
+	public:
+		// codec is "PCMU", "PCMA" or "OPUS", NULL when the codec cannot encode this capture
+		static AudioEncoderDevice* createNew(DeviceInterface* device, const std::string & codec, unsigned int sampleRate, unsigned int channels, int format, unsigned int bitrate = 32000);
+		virtual ~AudioEncoderDevice();
+
+		// RTP format of the encoded stream, e.g. audio/PCMU/8000/1
+		std::string getRtpFormat();
+
+		virtual size_t read(char* buffer, size_t bufferSize);
+		virtual int getFd()                        { return m_device->getFd(); }
+		virtual unsigned long getBufferSize()      { return m_device->getBufferSize(); }
+		virtual int getWidth()                     { return m_device->getWidth(); }
+		virtual int getHeight()                    { return m_device->getHeight(); }
+		virtual int getCaptureFormat();
+		virtual bool requestKeyFrame()             { return m_device->requestKeyFrame(); }
+		virtual bool setBitrate(unsigned int kbps) { return m_device->setBitrate(kbps); }
+		virtual unsigned int getBitrate()          { return m_device->getBitrate(); }
+		virtual void adjustPresentationTime(timeval & tv);
+
+	protected:
+		AudioEncoderDevice(DeviceInterface* device, const std::string & codec, unsigned int sampleRate, unsigned int channels);
+		bool initOpus(unsigned int bitrate);
+		size_t readOpus(char* buffer, size_t bufferSize);
+		void updateStats(size_t inSize, size_t outSize, const timespec & start);
+
+	protected:
+		DeviceInterface*         m_device;
+		std::string              m_codec;
+		unsigned int             m_sampleRate;
+		unsigned int             m_channels;
+
+		// samples waiting for a complete Opus frame, read from an offset
+		std::vector<char>        m_period;
+		std::vector<short>       m_samples;
+		size_t                   m_samplesRead;
+		timeval                  m_samplesTime;   // of the first sample not encoded
+		timeval                  m_frameTime;     // of the last encoded frame
+		bool                     m_pending;
+		unsigned int             m_frameSize;
+#ifdef HAVE_OPUS
+		OpusEncoder*             m_opus;
+#endif
+
+		// bandwidth and cost of the encoding
+		unsigned long            m_inBytes;
+		unsigned long            m_outBytes;
+		double                   m_encodeTime;
+		unsigned long            m_periods;
+		time_t                   m_reportTime;
+};
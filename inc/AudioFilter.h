@@ -0,0 +1,72 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioFilter.h
+**
+** Audio processing stage between the ALSA capture and the live555 source
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <list>
+#include <string>
+#include <time.h>
+
+#include "DeviceInterface.h"
+
+// ---------------------------------
+// Filter of interleaved 16 bits samples in host order, modified in place
+// ---------------------------------
+class AudioFilter
+{
+	public:
+		virtual ~AudioFilter() {}
+		virtual const char* getName() = 0;
+		virtual void process(short* samples, unsigned int frames) = 0;
+};
+
+// ---------------------------------
+// Device decorator that runs the filters on each period read
+// ---------------------------------
+class AudioFilterDevice : public DeviceInterface
+{
+	public:
+		// NULL when the format is not supported, the caller keeps the device
+		static AudioFilterDevice* createNew(DeviceInterface* device, unsigned int sampleRate, unsigned int channels, int format);
+		virtual ~AudioFilterDevice();
+
+		// the device owns the filter
+		void addFilter(AudioFilter* filter);
+
+		virtual size_t read(char* buffer, size_t bufferSize);
+		virtual int getFd()                        { return m_device->getFd(); }
+		virtual unsigned long getBufferSize()      { return m_device->getBufferSize(); }
+		virtual int getWidth()                     { return m_device->getWidth(); }
+		virtual int getHeight()                    { return m_device->getHeight(); }
+		virtual int getCaptureFormat()             { return m_device->getCaptureFormat(); }
+		virtual bool requestKeyFrame()             { return m_device->requestKeyFrame(); }
+		virtual bool setBitrate(unsigned int kbps) { return m_device->setBitrate(kbps); }
+		virtual unsigned int getBitrate()          { return m_device->getBitrate(); }
+		virtual void adjustPresentationTime(timeval & tv) { m_device->adjustPresentationTime(tv); }
+
+	protected:
+		AudioFilterDevice(DeviceInterface* device, unsigned int sampleRate, unsigned int channels);
+		void updateBudget(size_t frames, const timespec & start);
+
+	protected:
+		DeviceInterface*         m_device;
+		unsigned int             m_sampleRate;
+		unsigned int             m_channels;
+		std::list<AudioFilter*>  m_filters;
+		std::string              m_names;
+
+		// processing time against the duration of the periods
+		double                   m_processTime;
+		double                   m_maxProcessTime;
+		double                   m_audioTime;
+		unsigned long            m_periods;
+		time_t                   m_reportTime;
+};
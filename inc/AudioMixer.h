@@ -0,0 +1,82 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioMixer.h
+**
+** Mix of several audio captures, aligned on their presentation times
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "DeviceInterface.h"
+
+// ---------------------------------
+// Device that mixes the 16 bits network order periods of its inputs,
+// the first input gives the pace and the presentation times of the mix
+// ---------------------------------
+class AudioMixerDevice : public DeviceInterface
+{
+	public:
+		// the inputs have the same rate, channels and format, the mixer owns them (the caller keeps them on NULL)
+		static AudioMixerDevice* createNew(const std::vector<DeviceInterface*> & inputs, unsigned int sampleRate, unsigned int channels, int format);
+		virtual ~AudioMixerDevice();
+
+		// can be called from any thread, gain is linear from 0 to 7.99
+		unsigned int getInputs()                   { return m_inputs.size(); }
+		bool setGain(unsigned int input, float gain);
+		bool setMute(unsigned int input, bool mute);
+		float getGain(unsigned int input);
+		bool isMuted(unsigned int input);
+
+		virtual size_t read(char* buffer, size_t bufferSize);
+		virtual int getFd()                        { return m_inputs[0].m_device->getFd(); }
+		virtual unsigned long getBufferSize()      { return m_inputs[0].m_device->getBufferSize(); }
+		virtual int getWidth()                     { return 0; }
+		virtual int getHeight()                    { return 0; }
+		virtual int getCaptureFormat()             { return m_inputs[0].m_device->getCaptureFormat(); }
+		virtual bool requestKeyFrame()             { return false; }
+		virtual bool setBitrate(unsigned int)      { return false; }
+		virtual unsigned int getBitrate()          { return 0; }
+		virtual void adjustPresentationTime(timeval & tv);
+
+	protected:
+		struct Input
+		{
+			Input(DeviceInterface* device) : m_device(device), m_failures(0), m_failed(false), m_aligned(false), m_gain(1 << 12), m_mute(false), m_dropped(0), m_inserted(0) { timerclear(&m_time); }
+			DeviceInterface*   m_device;
+			std::vector<short> m_samples;   // host order, read but not mixed yet
+			timeval            m_time;      // time of the first sample waiting
+			unsigned int       m_failures;  // consecutive reads without data
+			bool               m_failed;    // too many failures, the input is not read anymore
+			bool               m_aligned;   // offset to the first input corrected
+			short              m_gain;      // Q12
+			bool               m_mute;
+			unsigned long      m_dropped;   // frames dropped to align on the first input
+			unsigned long      m_inserted;  // frames of silence inserted to align on the first input
+		};
+
+		AudioMixerDevice(const std::vector<DeviceInterface*> & inputs, unsigned int sampleRate, unsigned int channels);
+		ssize_t readInput(Input & input, timeval & time);
+		bool alignInput(Input & input, const timeval & time, unsigned int frames);
+		void updateStats();
+
+	protected:
+		std::vector<Input>       m_inputs;
+		unsigned int             m_sampleRate;
+		unsigned int             m_channels;
+		pthread_mutex_t          m_mutex;    // gains and mutes
+
+		std::vector<char>        m_period;
+		std::vector<short>       m_mix;
+		timeval                  m_time;     // presentation time of the last mix
+		bool                     m_pending;
+		time_t                   m_reportTime;
+};
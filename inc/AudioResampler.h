@@ -0,0 +1,71 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioResampler.h
+**
+** Channel down-mix and polyphase resampling stage after the ALSA capture
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "DeviceInterface.h"
+
+// ---------------------------------
+// Device decorator that converts the 16 bits network order periods of the device
+// to another rate and channel count, in network order too
+// ---------------------------------
+class AudioResamplerDevice : public DeviceInterface
+{
+	public:
+		// NULL when the conversion is not supported, the caller keeps the device
+		static AudioResamplerDevice* createNew(DeviceInterface* device, unsigned int inRate, unsigned int inChannels, int format, unsigned int outRate, unsigned int outChannels);
+		virtual ~AudioResamplerDevice();
+
+		unsigned int getSampleRate() { return m_outRate;     }
+		unsigned int getChannels()   { return m_outChannels; }
+
+		// RTP format of the converted stream, e.g. audio/L16/16000/1
+		std::string getRtpFormat();
+
+		virtual size_t read(char* buffer, size_t bufferSize);
+		virtual int getFd()                        { return m_device->getFd(); }
+		virtual unsigned long getBufferSize();
+		virtual int getWidth()                     { return m_device->getWidth(); }
+		virtual int getHeight()                    { return m_device->getHeight(); }
+		virtual int getCaptureFormat()             { return m_device->getCaptureFormat(); }
+		virtual bool requestKeyFrame()             { return m_device->requestKeyFrame(); }
+		virtual bool setBitrate(unsigned int kbps) { return m_device->setBitrate(kbps); }
+		virtual unsigned int getBitrate()          { return m_device->getBitrate(); }
+		virtual void adjustPresentationTime(timeval & tv) { m_device->adjustPresentationTime(tv); }
+
+	protected:
+		AudioResamplerDevice(DeviceInterface* device, unsigned int inRate, unsigned int inChannels, unsigned int outRate, unsigned int outChannels);
+		bool initFilter();
+		void downmix(const unsigned char* data, unsigned int frames);
+		unsigned int resample(std::vector<short> & history, short* out, unsigned int frames, unsigned int & phase, unsigned int & position);
+
+	protected:
+		DeviceInterface*                 m_device;
+		unsigned int                     m_inRate;
+		unsigned int                     m_inChannels;
+		unsigned int                     m_outRate;
+		unsigned int                     m_outChannels;
+
+		// ratio outRate/inRate reduced to up/down, one phase of the filter by up step
+		unsigned int                     m_up;
+		unsigned int                     m_down;
+		unsigned int                     m_taps;
+		std::vector<short>               m_coefs;     // Q14, phase by phase, taps reversed
+		unsigned int                     m_phase;
+		unsigned int                     m_position;  // next input sample of the output, in the new samples
+
+		std::vector<char>                m_period;
+		std::vector< std::vector<short> > m_history;  // per output channel, taps-1 previous samples then the period
+		std::vector<short>               m_output;
+};
@@ -0,0 +1,73 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** CMAFMemoryBufferSink.h
+**
+** Implement a live555 Sink that store H264/H265 fragmented MP4 (CMAF) slices in memory
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+
+#include "MemoryBufferSink.h"
+
+class CMAFMemoryBufferSink : public MemoryBufferSink
+{
+	public:
+		static CMAFMemoryBufferSink* createNew(UsageEnvironment& env, const std::string& format, int width, int height, unsigned int bufferSize, unsigned int sliceDuration, unsigned int windowDuration, unsigned int segmentCapacity, unsigned int partDurationMs = 0)
+		{
+			return new CMAFMemoryBufferSink(env, format, width, height, bufferSize, sliceDuration, windowDuration, segmentCapacity, partDurationMs);
+		}
+
+		virtual MemorySegmentRef getInitSegment()  { return this->getInitSegment(m_initId); }
+		virtual MemorySegmentRef getInitSegment(unsigned int initId);
+		virtual const char*      getMimeType()     { return "video/mp4"; }
+		virtual std::string      getCodecs()       { return m_codecs; }
+
+	protected:
+		CMAFMemoryBufferSink(UsageEnvironment& env, const std::string& format, int width, int height, unsigned int bufferSize, unsigned int sliceDuration, unsigned int windowDuration, unsigned int segmentCapacity, unsigned int partDurationMs);
+
+		virtual void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime);
+		void processNal(const unsigned char* nal, unsigned int size, u_int64_t pts);
+		void closeSample(u_int64_t nextPts);
+		void flushFragment();
+		void buildInitSegment();
+
+	protected:
+		struct Sample
+		{
+			Sample(u_int32_t size, u_int32_t duration, bool keyFrame) : m_size(size), m_duration(duration), m_keyFrame(keyFrame) {}
+			u_int32_t m_size;
+			u_int32_t m_duration;
+			bool      m_keyFrame;
+		};
+
+		bool                               m_hevc;
+		int                                m_width;
+		int                                m_height;
+		std::string                        m_vps;
+		std::string                        m_sps;
+		std::string                        m_pps;
+		MemorySegmentRef                   m_init;       // matches the current parameter sets
+		std::map<unsigned int, MemorySegmentRef> m_inits; // the last init segments, older segments of the window use them
+		std::string                        m_codecs;
+		bool                               m_parameterSetsChanged;
+
+		// access unit being gathered, NAL units with the same timestamp
+		std::vector<unsigned char>         m_sample;
+		bool                               m_sampleKeyFrame;
+		u_int64_t                          m_samplePts;
+
+		// samples of the fragment being gathered, written as moof+mdat
+		std::vector<unsigned char>         m_mdat;
+		std::vector<Sample>                m_samples;
+		u_int64_t                          m_fragmentPts;
+		unsigned int                       m_fragmentSequence;
+		std::vector<unsigned char>         m_moof;
+};
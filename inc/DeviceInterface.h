@@ -11,6 +11,7 @@
 #ifndef DEVICE_INTERFACE
 #define DEVICE_INTERFACE
 
+#include <sys/time.h>
 
 // ---------------------------------
 // Device Interface
@@ -24,6 +25,11 @@ class DeviceInterface
 		virtual int getWidth() = 0;	
 		virtual int getHeight() = 0;	
 		virtual int getCaptureFormat() = 0;
+		virtual bool requestKeyFrame() = 0;
+		virtual bool setBitrate(unsigned int kbps) = 0;
+		virtual unsigned int getBitrate() = 0; // encoder bitrate in kbps, 0 when unknown
+		// frames are stamped with the time the read started, stages that drop or hold samples correct it
+		virtual void adjustPresentationTime(timeval & /*tv*/) {}
 		virtual ~DeviceInterface() {};
 };
 
@@ -44,6 +50,9 @@ class DeviceCaptureAccess : public DeviceInterface
 		virtual int getWidth()                               { return m_device->getWidth(); }
 		virtual int getHeight()                              { return m_device->getHeight(); }
 		virtual int getCaptureFormat()                       { return m_device->getFormat(); }
+		virtual bool requestKeyFrame()                       { return m_device->requestKeyFrame(); }
+		virtual bool setBitrate(unsigned int kbps)           { return m_device->setBitrate(kbps); }
+		virtual unsigned int getBitrate()                    { return m_device->getBitrate(); }
 			
 	protected:
 		T* m_device;
@@ -49,15 +49,19 @@ class V4L2DeviceSource: public FramedSource
 		class Stats
 		{
 			public:
-				Stats(const std::string & msg) : m_fps(0), m_fps_sec(0), m_size(0), m_msg(msg) {};
+				Stats(const std::string & msg) : m_fps(0), m_fps_sec(0), m_size(0), m_lastFps(0), m_lastSize(0), m_msg(msg) {};
 				
 			public:
 				int notify(int tv_sec, int framesize);
+				int getFps() const     { return m_lastFps;  }
+				int getBitrate() const { return m_lastSize; } // bytes per second
 			
 			protected:
 				int m_fps;
 				int m_fps_sec;
 				int m_size;
+				int m_lastFps;
+				int m_lastSize;
 				const std::string m_msg;
 		};
 		
@@ -68,6 +72,13 @@ class V4L2DeviceSource: public FramedSource
 		int getWidth() { return m_device->getWidth(); };	
 		int getHeight() { return m_device->getHeight(); };	
 		int getCaptureFormat() { return m_device->getCaptureFormat(); };	
+		bool requestKeyFrame() { return m_device->requestKeyFrame(); };	
+		bool setBitrate(unsigned int kbps) { return m_device->setBitrate(kbps); };	
+		unsigned int getBitrate() { return m_device->getBitrate(); };	
+		static void setBitrateStub(void* clientData, unsigned int kbps) { ((V4L2DeviceSource*) clientData)->setBitrate(kbps); };
+		const Stats& getStats() { return m_out; };	
+		unsigned long getBufferSize() { return m_device->getBufferSize(); };
+		unsigned int getMaxFrameSize();
 
 	protected:
 		V4L2DeviceSource(UsageEnvironment& env, DeviceInterface * device, int outputFd, unsigned int queueSize, bool useThread);
@@ -99,6 +110,7 @@ class V4L2DeviceSource: public FramedSource
 		int m_outfd;
 		DeviceInterface * m_device;
 		unsigned int m_queueSize;
+		unsigned int m_maxFrameSize;
 		pthread_t m_thid;
 		pthread_mutex_t m_mutex;
 		std::string m_auxLine;
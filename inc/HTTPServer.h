@@ -12,9 +12,17 @@
 ** -------------------------------------------------------------------------*/
 
 
+#include <sstream>
+#include <list>
+#include <map>
+
 #include "RTSPServer.hh"
 #include "RTSPCommon.hh"
 
+#include "MemoryBufferSink.h"
+#include "TSServerMediaSubsession.h"
+#include "WebrootCache.h"
+
 // ---------------------------------------------------------
 //  Extend RTSP server to add support for HLS and MPEG-DASH
 // ---------------------------------------------------------
@@ -25,22 +33,48 @@ class HTTPServer : public RTSPServer
 	{
 		public:
 			HTTPClientConnection(RTSPServer& ourServer, int clientSocket, struct sockaddr_in clientAddr)
-			  : RTSPServer::RTSPClientConnection(ourServer, clientSocket, clientAddr), fTCPSink(NULL), fStreamToken(NULL), fSubsession(NULL), fSource(NULL) {
+			  : RTSPServer::RTSPClientConnection(ourServer, clientSocket, clientAddr), fTCPSink(NULL), fStreamToken(NULL), fSubsession(NULL), fSource(NULL), fWaitSink(NULL), fWaitTask(NULL)
+			  , fKeepAlive(false), fChunked(true), fEndTask(NULL), fIdleTask(NULL), fFileSender(NULL) {
 			}
 			virtual ~HTTPClientConnection();
 
 		private:
 
-			void sendHeader(const char* contentType, unsigned int contentLength);		
+			void sendHeader(const char* contentType, unsigned int contentLength, const char* extraHeaders = "");
+			void sendChunkedHeader(const char* contentType);		
+			void setStatusResponse(const char* status);
 			void streamSource(FramedSource* source);	
 			void streamSource(const std::string & content);
 			ServerMediaSubsession* getSubsesion(const char* urlSuffix);
+			typedef std::pair<std::string, TSServerMediaSubsession*> Rendition; // stream name, subsession
+			void getRenditions(const char* urlSuffix, std::list<Rendition> & renditions);
+			MemoryBufferSink* getHlsSink(const char* urlSuffix);
 			bool sendFile(char const* urlSuffix);
 			bool sendM3u8PlayList(char const* urlSuffix);
+			bool sendMasterPlayList(char const* urlSuffix, const std::list<Rendition> & renditions);
 			bool sendMpdPlayList(char const* urlSuffix);
+			void addInitChange(std::ostringstream & os, char const* urlSuffix, unsigned int & initId, const MemorySegmentRef & segment);
+			void addParts(std::ostringstream & os, MemoryBufferSink* sink, char const* urlSuffix, unsigned int slice);
+			bool sendPart(MemoryBufferSink* sink, char const* urlSuffix, unsigned int part);
+			void waitFor(MemoryBufferSink* sink, char const* urlSuffix);
+			void cancelWait();
+			static void wakeUpStub(void* clientData) { ((HTTPClientConnection*)clientData)->wakeUp(); }
+			void wakeUp();
+			static void waitTimeoutStub(void* clientData) { ((HTTPClientConnection*)clientData)->waitTimeout(); }
+			void waitTimeout();
 			virtual void handleHTTPCmd_StreamingGET(char const* urlSuffix, char const* fullRequestStr);
 			virtual void handleCmd_notFound();
+			void handleRequest(char const* urlSuffix, char const* fullRequestStr);
+			bool runRequest(const std::string & urlSuffix, const std::string & fullRequestStr);
 			static void afterStreaming(void* clientData);
+			static void endResponseStub(void* clientData) { ((HTTPClientConnection*)clientData)->endResponse(); }
+			void endResponse();
+			void nextRequest();
+			bool isBusy();
+			void startIdleTimer();
+			static void idleTimeoutStub(void* clientData) { ((HTTPClientConnection*)clientData)->idleTimeout(); }
+			void idleTimeout();
+			const char* connectionHeader();
 		
 		private:
 			static u_int32_t fClientSessionId;
@@ -48,28 +82,52 @@ class HTTPServer : public RTSPServer
 			void*          fStreamToken;
 			ServerMediaSubsession* fSubsession;
 			FramedSource*          fSource;
+
+			// LL-HLS request held until the sink has the part
+			std::string            fPendingRequest;
+			MemoryBufferSink*      fWaitSink;
+			TaskToken              fWaitTask;
+
+			// persistent connection, pipelined requests are answered in order
+			bool                   fKeepAlive;
+			bool                   fChunked;    // HTTP/1.1 request, the segment being written can be sent chunked
+			std::list< std::pair<std::string,std::string> > fRequests;
+			TaskToken              fEndTask;
+			TaskToken              fIdleTask;
+			char                   fConnectionHeader[64];
+			FileSender*            fFileSender;
 	};
 	
 	public:
-		static HTTPServer* createNew(UsageEnvironment& env, Port rtspPort, UserAuthenticationDatabase* authDatabase, unsigned reclamationTestSeconds, unsigned int hlsSegment, const std::string webroot) 
+		static HTTPServer* createNew(UsageEnvironment& env, Port rtspPort, UserAuthenticationDatabase* authDatabase, unsigned reclamationTestSeconds, unsigned int hlsSegment, const std::string webroot, unsigned int keepAliveTimeout = 15) 
 		{
 			HTTPServer* httpServer = NULL;
 			int ourSocket = setUpOurSocket(env, rtspPort);
 			if (ourSocket != -1) 
 			{
-				httpServer = new HTTPServer(env, ourSocket, rtspPort, authDatabase, reclamationTestSeconds, hlsSegment, webroot);
+				httpServer = new HTTPServer(env, ourSocket, rtspPort, authDatabase, reclamationTestSeconds, hlsSegment, webroot, keepAliveTimeout);
 			}
 			return httpServer;
 		}
 
-		HTTPServer(UsageEnvironment& env, int ourSocket, Port rtspPort, UserAuthenticationDatabase* authDatabase, unsigned reclamationTestSeconds, unsigned int hlsSegment, const std::string & webroot)
-		  : RTSPServer(env, ourSocket, rtspPort, authDatabase, reclamationTestSeconds), m_hlsSegment(hlsSegment), m_webroot(webroot)
+		HTTPServer(UsageEnvironment& env, int ourSocket, Port rtspPort, UserAuthenticationDatabase* authDatabase, unsigned reclamationTestSeconds, unsigned int hlsSegment, const std::string & webroot, unsigned int keepAliveTimeout)
+		  : RTSPServer(env, ourSocket, rtspPort, authDatabase, reclamationTestSeconds), m_hlsSegment(hlsSegment), m_webroot(webroot), m_keepAliveTimeout(keepAliveTimeout), m_streamListTime(0)
 		{
+			m_webrootCache = WebrootCache::createNew(env);
                        if ( (!m_webroot.empty()) && (*m_webroot.rend() != '/') ) {
                                m_webroot += "/";
                        }
 		}
 
+		MemorySegmentRef getManifest(const std::string & key, unsigned int version);
+		MemorySegmentRef setManifest(const std::string & key, unsigned int version, const std::string & content);
+		MemorySegmentRef getStreamList(const std::string & var);
+
+		virtual ~HTTPServer()
+		{
+			delete m_webrootCache;
+		}
+
 		RTSPServer::RTSPClientConnection* createNewClientConnection(int clientSocket, struct sockaddr_in clientAddr) 
 		{
 			return new HTTPClientConnection(*this, clientSocket, clientAddr);
@@ -78,5 +136,19 @@ class HTTPServer : public RTSPServer
         private:
 		const unsigned int m_hlsSegment;
 		std::string  m_webroot;
+		const unsigned int m_keepAliveTimeout; // seconds an idle HTTP connection is kept, 0 closes after each response
+		WebrootCache*      m_webrootCache;
+
+		// manifests served by reference until their sink changes
+		struct Manifest
+		{
+			Manifest() : m_version(0) {}
+			unsigned int     m_version;
+			MemorySegmentRef m_content;
+		};
+		std::map<std::string, Manifest> m_manifests;
+		MemorySegmentRef   m_streamList;
+		std::string        m_streamListVar;
+		time_t             m_streamListTime;
 };
 
@@ -11,21 +11,30 @@
 
 #pragma once
 
+#include <vector>
+#include <list>
 #include <string>
-#include <map>
 
 #include "MediaSink.hh"
 
+#include "MemorySegment.h"
+
+#ifndef TRANSPORT_PACKET_SIZE
+#define TRANSPORT_PACKET_SIZE 188
+#endif
+
+class ChunkedSegmentSource;
+
 class MemoryBufferSink : public MediaSink
 {
 	public:
-		static MemoryBufferSink* createNew(UsageEnvironment& env, unsigned int bufferSize, unsigned int sliceDuration) 
+		static MemoryBufferSink* createNew(UsageEnvironment& env, unsigned int bufferSize, unsigned int sliceDuration, unsigned int windowDuration, unsigned int segmentCapacity, unsigned int partDurationMs = 0) 
 		{
-			return new MemoryBufferSink(env, bufferSize, sliceDuration);
+			return new MemoryBufferSink(env, bufferSize, sliceDuration, windowDuration, segmentCapacity, partDurationMs);
 		}
 		
 	protected:
-		MemoryBufferSink(UsageEnvironment& env, unsigned bufferSize, unsigned int sliceDuration);
+		MemoryBufferSink(UsageEnvironment& env, unsigned bufferSize, unsigned int sliceDuration, unsigned int windowDuration, unsigned int segmentCapacity, unsigned int partDurationMs);
 		virtual ~MemoryBufferSink(); 
 		
 		virtual Boolean continuePlaying();
@@ -38,20 +47,142 @@ class MemoryBufferSink : public MediaSink
 			sink->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime);
 		}
 
-		void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime);
+		virtual void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime);
+		void processPacket(const unsigned char* packet);
+		void emitPacket(const unsigned char* packet);
+		void startVideoPES(u_int64_t pts);
+		void scanVideoES(const unsigned char* es, unsigned int size);
+		void cutOnVideoPES(bool keyFrame);
+		void parsePAT(const unsigned char* section, unsigned int size);
+		void parsePMT(const unsigned char* section, unsigned int size);
+		bool isSegmentEnd(u_int64_t pts, bool keyFrame);
+		bool isPartEnd(u_int64_t pts);
+		void openSegment(u_int64_t pts);
+		void openPart(u_int64_t pts, bool independent);
+		void appendData(const unsigned char* data, unsigned int size);
+		void notifyWaiters();
+		unsigned int firstSlice();
 		
 	public:
-		unsigned int getBufferSize(unsigned int slice);
-		std::string  getBuffer(unsigned int slice);			
-		unsigned int firstTime();
-		unsigned int duration();
-		unsigned int getSliceDuration() 	{ return m_sliceDuration; }
+		unsigned int     getBufferSize(unsigned int slice);
+		MemorySegmentRef getSegment(unsigned int slice);
+		void             getSegmentList(std::list<MemorySegmentRef> & segments);
+		unsigned int     findSegment(double npt);
+		double           firstTime();
+		double           duration();
+		double           getTime(const MemorySegmentRef & segment); // seconds from the sink start
+		unsigned int     getBandwidth();
+		unsigned int     getTargetDuration();
+		unsigned int     getSliceDuration() 	{ return m_sliceDuration; }
+		unsigned int     getVersion()           { return m_version; } // changes when a part or a segment closes
+
+		// container of the segments, MPEG-TS segments do not need an init segment
+		virtual MemorySegmentRef getInitSegment()  { return MemorySegmentRef(); }
+		virtual MemorySegmentRef getInitSegment(unsigned int /*initId*/) { return MemorySegmentRef(); }
+		virtual const char*      getMimeType()     { return "video/mp2t"; }
+		virtual std::string      getCodecs()       { return ""; }
+
+		// LL-HLS partial segments
+		double           getPartTarget();
+		MemorySegmentRef getPart(unsigned int part);
+		void             getPartList(unsigned int slice, std::list<MemorySegmentRef> & parts);
+		unsigned int     getCurrentSlice()      { return m_current ? m_current->id() : 0; }
+		unsigned int     getNextPart()          { return m_partSequence; }
+		unsigned int     getNextPartIndex()     { return m_partIndex; }
+		bool             isAvailable(unsigned int slice, int partIndex);
+
+		// called once when the next part or segment is available
+		void             addWaiter(TaskFunc* func, void* clientData, bool onData = false);
+		void             removeWaiter(void* clientData);
+
+		// chunked readers of the segments, detached when the sink is destroyed
+		void             addReader(ChunkedSegmentSource* reader)    { m_readers.push_back(reader); }
+		void             removeReader(ChunkedSegmentSource* reader) { m_readers.remove(reader); }
+
+		// segment being written, it is not sealed
+		MemorySegmentRef getCurrentSegment();
 		
-	private:
+	protected:
 		unsigned char *                    m_buffer;
 		unsigned int                       m_bufferSize;
-		std::map<unsigned int,std::string> m_outputBuffers;
-		unsigned int                       m_refTime;
+		unsigned int                       m_initId;     // init segment of the segments opened from now
+		std::vector< std::shared_ptr<MemorySegment> > m_segments; // ring indexed by segment sequence number
+		std::shared_ptr<MemorySegment>     m_current;
+		unsigned int                       m_sequence;
+		unsigned int                       m_segmentCapacity;
+		unsigned int                       m_overflows;
 		unsigned int                       m_sliceDuration;
+
+		// parts of the last segments, ring indexed by part sequence number
+		u_int32_t                          m_partDuration;
+		std::vector< std::shared_ptr<MemorySegment> > m_parts;
+		std::shared_ptr<MemorySegment>     m_currentPart;
+		unsigned int                       m_partSequence;
+		unsigned int                       m_partIndex;
+		unsigned int                       m_segmentFirstPart;
+		unsigned int                       m_partCapacity;
+		u_int64_t                          m_partPts;
+		std::list< std::pair<TaskFunc*,void*> > m_waiters;
+		std::list< std::pair<TaskFunc*,void*> > m_dataWaiters;
+		std::list<ChunkedSegmentSource*>   m_readers;
+		bool                               m_notify;
+		unsigned int                       m_version;
+
+		// PSI section that may start anywhere in a packet and span several packets
+		struct PSISection
+		{
+			PSISection() : m_assembling(false) {}
+			bool        m_assembling;
+			std::string m_section;  // section being assembled
+			std::string m_packets;  // transport packets carrying it
+			std::string m_table;    // transport packets of the last complete section, repeated in each segment
+		};
+		void collectSection(PSISection & psi, int pid, const unsigned char* packet, bool unitStart, const unsigned char* payload, unsigned int payloadSize);
+		void appendSection(PSISection & psi, int pid, const unsigned char* data, unsigned int size);
+
+		// transport stream state used to cut on keyframes
+		PSISection                         m_pat;
+		PSISection                         m_pmt;
+		int                                m_pmtPid;
+		int                                m_videoPid;
+		unsigned char                      m_videoStreamType;
+
+		// packets held from a video PES start until its NAL units tell whether it is a keyframe
+		std::string                        m_held;
+		bool                               m_holding;
+		u_int64_t                          m_heldPts;
+		unsigned char                      m_scanTail[3];  // last bytes of the scanned ES, a start code may span packets
+		unsigned int                       m_scanTailSize;
+		int                                m_scanResult;
+		u_int64_t                          m_segmentPts;
+		u_int64_t                          m_timeOrigin;
 };
 	
+
+// -----------------------------------------
+//    Source that sends a segment with HTTP chunked transfer while it is written
+//    without chunks the body ends when the connection closes (HTTP/1.0)
+// -----------------------------------------
+class ChunkedSegmentSource : public FramedSource
+{
+	public:
+		static ChunkedSegmentSource* createNew(UsageEnvironment& env, MemoryBufferSink* sink, const MemorySegmentRef & segment, bool chunked = true);
+
+		// the sink is destroyed, the segment will not grow anymore
+		void detach() { m_sink = NULL; }
+
+	protected:
+		ChunkedSegmentSource(UsageEnvironment& env, MemoryBufferSink* sink, const MemorySegmentRef & segment, bool chunked);
+		virtual ~ChunkedSegmentSource();
+
+		virtual void doGetNextFrame();
+		static void newDataStub(void* clientData) { ((ChunkedSegmentSource*)clientData)->deliver(); }
+		void deliver();
+
+	protected:
+		MemoryBufferSink* m_sink;
+		MemorySegmentRef  m_segment;
+		unsigned int      m_offset;
+		bool              m_done;
+		bool              m_chunked;
+};
@@ -0,0 +1,96 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** MemorySegment.h
+** 
+** Immutable HLS/DASH segment shared between the sink and the HTTP readers
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+
+// live555
+#include <liveMedia.hh>
+
+// ---------------------------------
+// Preallocated segment buffer, written by the sink then sealed
+// ---------------------------------
+class MemorySegment
+{
+	public:
+		MemorySegment(unsigned int capacity) : m_buffer(capacity), m_size(0), m_sealed(false), m_id(0), m_startTime(0), m_duration(0)
+			, m_firstPart(0), m_nbParts(0), m_msn(0), m_partIndex(0), m_independent(false), m_initId(0) {}
+
+		bool append(const unsigned char* data, unsigned int size);
+		void seal()                              { m_sealed = true;         }
+		void reset(unsigned int id, unsigned int capacity);
+
+		bool isSealed() const                    { return m_sealed;         }
+		const unsigned char* data() const        { return m_buffer.data();  }
+		unsigned int size() const                { return m_size;           }
+		unsigned int capacity() const            { return m_buffer.size();  }
+		unsigned int id() const                  { return m_id;             }
+
+		// timing in 90kHz units from the start of the sink
+		void setStartTime(u_int64_t startTime)   { m_startTime = startTime; }
+		void setDuration(u_int32_t duration)     { m_duration = duration;   }
+		u_int64_t startTime() const              { return m_startTime;      }
+		u_int32_t duration() const               { return m_duration;       }
+		double getDuration() const               { return m_duration/90000.0; }
+
+		// LL-HLS : a segment knows its parts, a part knows its segment
+		void setParts(unsigned int firstPart, unsigned int nbParts) { m_firstPart = firstPart; m_nbParts = nbParts; }
+		void setPart(unsigned int msn, unsigned int partIndex, bool independent) { m_msn = msn; m_partIndex = partIndex; m_independent = independent; }
+		unsigned int firstPart() const           { return m_firstPart;      }
+		unsigned int nbParts() const             { return m_nbParts;        }
+		unsigned int msn() const                 { return m_msn;            }
+		unsigned int partIndex() const           { return m_partIndex;      }
+		bool isIndependent() const               { return m_independent;    }
+
+		// fragmented MP4 : init segment the segment is decoded with, it changes with the parameter sets
+		void setInitId(unsigned int initId)      { m_initId = initId;       }
+		unsigned int initId() const              { return m_initId;         }
+
+	private:
+		MemorySegment(const MemorySegment&);
+		MemorySegment& operator=(const MemorySegment&);
+
+	protected:
+		std::vector<unsigned char> m_buffer;
+		unsigned int               m_size;
+		bool                       m_sealed;
+		unsigned int               m_id;
+		u_int64_t                  m_startTime;
+		u_int32_t                  m_duration;
+		unsigned int               m_firstPart;
+		unsigned int               m_nbParts;
+		unsigned int               m_msn;
+		unsigned int               m_partIndex;
+		bool                       m_independent;
+		unsigned int               m_initId;
+};
+
+typedef std::shared_ptr<const MemorySegment> MemorySegmentRef;
+
+// ---------------------------------
+// Source that streams a sealed segment, keeping a reference on it
+// ---------------------------------
+class MemorySegmentSource : public FramedSource
+{
+	public:
+		static MemorySegmentSource* createNew(UsageEnvironment& env, const MemorySegmentRef & segment);
+
+	protected:
+		MemorySegmentSource(UsageEnvironment& env, const MemorySegmentRef & segment);
+
+		virtual void doGetNextFrame();
+
+	protected:
+		MemorySegmentRef m_segment;
+		unsigned int     m_offset;
+};
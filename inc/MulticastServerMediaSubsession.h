@@ -10,6 +10,7 @@
 #pragma once
 
 #include "ServerMediaSubsession.h"
+#include "RTPOutputGroupsock.h"
 
 // -----------------------------------------
 //    ServerMediaSubsession for Multicast
@@ -22,17 +23,19 @@ class MulticastServerMediaSubsession : public PassiveServerMediaSubsession , pub
 								, Port rtpPortNum, Port rtcpPortNum
 								, int ttl
 								, StreamReplicator* replicator
-								, const std::string& format);
+								, const std::string& format
+								, const RTPOutputParameters & params = RTPOutputParameters());
 		
 	protected:
-		MulticastServerMediaSubsession(StreamReplicator* replicator, RTPSink* rtpSink, RTCPInstance* rtcpInstance) 
-				: PassiveServerMediaSubsession(*rtpSink, rtcpInstance), BaseServerMediaSubsession(replicator), m_rtpSink(rtpSink) {};			
+		MulticastServerMediaSubsession(StreamReplicator* replicator, RTPSink* rtpSink, RTCPInstance* rtcpInstance, bool rtcpFeedback) 
+				: PassiveServerMediaSubsession(*rtpSink, rtcpInstance), BaseServerMediaSubsession(replicator), m_rtpSink(rtpSink), m_rtcpFeedback(rtcpFeedback) {};			
 
 		virtual char const* sdpLines() ;
 		virtual char const* getAuxSDPLine(RTPSink* rtpSink,FramedSource* inputSource);
 		
 	protected:
 		RTPSink* m_rtpSink;
+		bool m_rtcpFeedback;
 		std::string m_SDPLines;
 };
 
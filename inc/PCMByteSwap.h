@@ -0,0 +1,27 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** PCMByteSwap.h
+**
+** Byte order conversion of interleaved PCM samples, SIMD kernel selected at runtime
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stddef.h>
+
+// swap in place the bytes of the samples, width is the physical sample size in bytes (2, 3 or 4)
+// a trailing incomplete sample is left untouched
+void pcmByteSwap(unsigned char* data, size_t size, int width);
+
+// swap while copying, the single pass from the ALSA mmap ring to the frame buffer
+void pcmByteSwapCopy(unsigned char* dst, const unsigned char* src, size_t size, int width);
+
+// scalar implementation, reference of the SIMD kernels
+void pcmByteSwapScalar(unsigned char* data, size_t size, int width);
+
+// name of the kernel used by pcmByteSwap
+const char* pcmByteSwapKernel();
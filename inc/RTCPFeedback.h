@@ -0,0 +1,99 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** RTCPFeedback.h
+**
+** RTCP feedback (RFC 4585/5104) : generic NACK, PLI and FIR
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include <sys/time.h>
+
+// live555
+#include <liveMedia.hh>
+
+class RTPOutputGroupsock;
+class V4L2DeviceSource;
+
+// ---------------------------------
+// RTCP feedback parameters
+// ---------------------------------
+struct RTCPFeedbackParameters
+{
+	RTCPFeedbackParameters() : m_enable(true), m_cacheSize(512), m_maxPacketSize(1500), m_keyFrameIntervalMs(500) {}
+
+	bool         m_enable;
+	unsigned int m_cacheSize;          // number of sent RTP packets kept to answer NACK
+	unsigned int m_maxPacketSize;      // bigger packets are not kept
+	unsigned int m_keyFrameIntervalMs; // PLI/FIR received faster than this are merged
+};
+
+// ---------------------------------
+// Ring of the last sent RTP packets indexed by sequence number
+// ---------------------------------
+class RTPPacketCache
+{
+	public:
+		RTPPacketCache(unsigned int cacheSize, unsigned int maxPacketSize);
+
+		void addPacket(const unsigned char* packet, unsigned int size);
+		bool getPacket(u_int16_t seqNum, unsigned char* & packet, unsigned int & size);
+
+		unsigned long getHits()     { return m_hits;   }
+		unsigned long getMisses()   { return m_misses; }
+
+	protected:
+		struct Slot
+		{
+			Slot() : m_size(0), m_seqNum(0) {}
+			unsigned int m_size;
+			u_int16_t    m_seqNum;
+		};
+
+		unsigned int               m_maxPacketSize;
+		std::vector<unsigned char> m_data;
+		std::vector<Slot>          m_slots;
+		unsigned long              m_hits;
+		unsigned long              m_misses;
+};
+
+// ---------------------------------
+// RTCP instance that answers feedback messages of the receivers
+// ---------------------------------
+class RTCPFeedbackInstance : public RTCPInstance
+{
+	public:
+		static RTCPFeedbackInstance* createNew(UsageEnvironment& env, Groupsock* RTCPgs, unsigned totSessionBW, unsigned char const* cname, RTPSink* sink
+							, RTPOutputGroupsock* rtpGroupsock, V4L2DeviceSource* source, const RTCPFeedbackParameters & params);
+
+	protected:
+		RTCPFeedbackInstance(UsageEnvironment& env, Groupsock* RTCPgs, unsigned totSessionBW, unsigned char const* cname, RTPSink* sink
+							, RTPOutputGroupsock* rtpGroupsock, V4L2DeviceSource* source, const RTCPFeedbackParameters & params);
+		virtual ~RTCPFeedbackInstance();
+
+		static void incomingFeedbackStub(void* clientData, unsigned char* packet, unsigned& packetSize) { ((RTCPFeedbackInstance*)clientData)->incomingFeedback(packet, packetSize); }
+		void incomingFeedback(unsigned char* packet, unsigned packetSize);
+		void handleNack(u_int16_t pid, u_int16_t blp, const struct sockaddr_in* requester);
+		void handleKeyFrameRequest();
+		void logStats(bool force);
+
+	protected:
+		RTPSink*               m_sink;
+		RTPOutputGroupsock*    m_rtpGroupsock;
+		V4L2DeviceSource*      m_source;
+		RTCPFeedbackParameters m_params;
+		timeval                m_lastKeyFrameRequest;
+
+		// stats
+		int                    m_statsSec;
+		unsigned long          m_nacks;
+		unsigned long          m_retransmits;
+		unsigned long          m_plis;
+		unsigned long          m_firs;
+		unsigned long          m_keyFrameRequests;
+};
@@ -0,0 +1,91 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** RTPOutputGroupsock.h
+**
+** Groupsock that sees every RTP packet sent by a sink
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <list>
+#include <memory>
+
+// live555
+#include <liveMedia.hh>
+
+#include "TCPInterleavedWriter.h"
+#include "RTPPacer.h"
+#include "RTCPFeedback.h"
+
+// ---------------------------------
+// RTP output parameters
+// ---------------------------------
+struct RTPOutputParameters
+{
+	RTPOutputParameters() : m_vectoredInterleaved(true), m_gatherTimeoutUs(2000), m_reuseFirstSource(false), m_sinkBufferHeadroom(1.5), m_sinkBufferMinSize(8*1024) {}
+
+	bool                     m_vectoredInterleaved; // gather interleaved packets of a frame in one call
+	unsigned int             m_gatherTimeoutUs;     // flush delay for frames without marker bit (audio)
+	bool                     m_reuseFirstSource;    // share one source and sink between the unicast clients
+	double                   m_sinkBufferHeadroom;  // sink buffer relative to the peak frame size, at least a raw picture for video, 0 keeps OutPacketBuffer::maxSize
+	unsigned int             m_sinkBufferMinSize;
+	TCPInterleavedParameters m_interleaved;
+	RTPPacerParameters       m_pacer;
+	RTCPFeedbackParameters   m_feedback;
+};
+
+// ---------------------------------
+// RTP Groupsock
+// ---------------------------------
+class RTPOutputGroupsock : public Groupsock
+{
+	public:
+		RTPOutputGroupsock(UsageEnvironment& env, struct in_addr const& groupAddr, Port port, u_int8_t ttl, const RTPOutputParameters & params);
+		virtual ~RTPOutputGroupsock();
+
+		void addInterleavedDestination(int socketNum, unsigned char channel);
+		void removeInterleavedDestination(int socketNum, unsigned char channel);
+		bool hasInterleavedDestination()        { return !m_interleaved.empty(); }
+		void setSource(V4L2DeviceSource* source, const std::string& format);
+		void enablePacing(const V4L2DeviceSource::Stats* stats);
+		void enableRetransmission();
+		RTPPacer* getPacer()                    { return m_pacer; }
+		RTPPacketCache* getPacketCache()        { return m_cache; }
+		bool retransmit(u_int16_t seqNum, const struct sockaddr_in* requester);
+		const struct sockaddr_in* getLastSender() { return m_lastSender.sin_family ? &m_lastSender : NULL; }
+
+		// overide Groupsock
+		virtual Boolean output(UsageEnvironment& env, unsigned char* buffer, unsigned bufferSize, DirectedNetInterface* interfaceNotToFwdBackTo = NULL);
+		virtual Boolean handleRead(unsigned char* buffer, unsigned bufferMaxSize, unsigned& bytesRead, struct sockaddr_in& fromAddressAndPort);
+
+	protected:
+		void gatherPacket(unsigned char* buffer, unsigned bufferSize);
+		RTPFrame::Type packetType(const unsigned char* buffer, unsigned bufferSize);
+		static void flushStub(void* clientData) { ((RTPOutputGroupsock*)clientData)->flushFrame(); }
+		void flushFrame();
+		static void sendStub(void* clientData, unsigned char* packet, unsigned int size) { ((RTPOutputGroupsock*)clientData)->send(packet, size); }
+		void send(unsigned char* packet, unsigned int size);
+
+	protected:
+		struct InterleavedDestination
+		{
+			InterleavedDestination(TCPInterleavedWriter* writer, unsigned char channel) : m_writer(writer), m_channel(channel) {}
+			TCPInterleavedWriter* m_writer;
+			unsigned char         m_channel;
+		};
+
+		RTPOutputParameters               m_params;
+		V4L2DeviceSource*                 m_source;
+		std::string                       m_format;
+		std::list<InterleavedDestination> m_interleaved;
+		std::shared_ptr<RTPFrame>         m_frame;
+		u_int32_t                         m_frameTimestamp;
+		TaskToken                         m_flushTask;
+		RTPPacer*                         m_pacer;
+		RTPPacketCache*                   m_cache;
+		struct sockaddr_in                m_lastSender;  // of the last packet received, RTCP of a client
+};
@@ -0,0 +1,94 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** RTPPacer.h
+**
+** Token bucket that spreads the RTP packets of a frame over the frame interval
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <sys/time.h>
+
+// live555
+#include <UsageEnvironment.hh>
+
+#include "DeviceSource.h"
+
+// ---------------------------------
+// Pacer parameters
+// ---------------------------------
+struct RTPPacerParameters
+{
+	RTPPacerParameters() : m_enable(false), m_fraction(0.5), m_burstBytes(4*1500), m_defaultFps(25), m_minRate(64*1024) {}
+
+	bool         m_enable;
+	double       m_fraction;    // part of the frame interval a frame is spread over
+	unsigned int m_burstBytes;  // token bucket depth
+	unsigned int m_defaultFps;  // used until the source measured its frame rate
+	unsigned int m_minRate;     // bytes per second, floor used until the source measured its bitrate
+};
+
+// ---------------------------------
+// RTP Pacer
+// ---------------------------------
+class RTPPacer
+{
+	public:
+		typedef void (SendFunc)(void* clientData, unsigned char* packet, unsigned int size);
+
+		RTPPacer(UsageEnvironment& env, const RTPPacerParameters & params, const V4L2DeviceSource::Stats* stats, SendFunc* sendFunc, void* clientData);
+		virtual ~RTPPacer();
+
+		void queuePacket(unsigned char* packet, unsigned int size);
+
+		unsigned int getMaxBurst()    { return m_reportMaxBurst;   }
+		unsigned int getMaxDelayUs()  { return m_reportMaxDelayUs; }
+		unsigned int getAvgDelayUs()  { return m_reportAvgDelayUs; }
+
+	protected:
+		static void drainStub(void* clientData) { ((RTPPacer*)clientData)->drain(); }
+		void drain();
+		void refill(const timeval & now);
+		void updateRate();
+		void send(unsigned char* packet, unsigned int size, const timeval & now, const timeval & queued);
+		void notify(const timeval & now, unsigned int delayUs);
+		// system clock, the tests run the pacer on a simulated one
+		virtual void getTime(timeval & now) { gettimeofday(&now, NULL); }
+
+	protected:
+		struct Packet
+		{
+			Packet(std::vector<unsigned char>* data, const timeval & tv) : m_data(data), m_queued(tv) {}
+			std::vector<unsigned char>* m_data;
+			timeval                     m_queued;
+		};
+
+		UsageEnvironment&               m_env;
+		RTPPacerParameters              m_params;
+		const V4L2DeviceSource::Stats*  m_stats;
+		SendFunc*                       m_sendFunc;
+		void*                           m_clientData;
+		std::deque<Packet>              m_queue;
+		std::vector< std::vector<unsigned char>* > m_buffers; // packet copies reused once sent
+		unsigned int                    m_queuedBytes;
+		double                          m_rate;        // bytes per second, set when a frame is complete
+		double                          m_tokens;
+		timeval                         m_lastRefill;
+		TaskToken                       m_drainTask;
+
+		// stats for the current second, reported at the next one
+		int                             m_statsSec;
+		unsigned int                    m_maxBurst;
+		unsigned int                    m_maxDelayUs;
+		unsigned long                   m_sumDelayUs;
+		unsigned int                    m_nbPackets;
+		unsigned int                    m_reportMaxBurst;
+		unsigned int                    m_reportMaxDelayUs;
+		unsigned int                    m_reportAvgDelayUs;
+};
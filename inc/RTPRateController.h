@@ -0,0 +1,79 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** RTPRateController.h
+**
+** Encoder bitrate adaptation from RTCP receiver reports
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <map>
+#include <list>
+#include <sys/time.h>
+
+// live555
+#include <liveMedia.hh>
+
+// ---------------------------------
+// Rate controller parameters
+// ---------------------------------
+struct RTPRateControlParameters
+{
+	RTPRateControlParameters() : m_enable(false), m_minKbps(256), m_maxKbps(0), m_startKbps(0), m_intervalMs(1000)
+		, m_decreaseLoss(0.10), m_increaseLoss(0.02), m_maxJitterMs(80), m_increaseStep(0.05), m_holdMs(5000), m_minChangeKbps(32) {}
+
+	bool         m_enable;
+	unsigned int m_minKbps;
+	unsigned int m_maxKbps;        // 0 never goes above the start bitrate
+	unsigned int m_startKbps;      // bitrate the encoder is configured with, 0 when unknown
+	unsigned int m_intervalMs;     // receiver reports are checked at this period
+	double       m_decreaseLoss;   // loss fraction from which the bitrate is reduced
+	double       m_increaseLoss;   // loss fraction under which the bitrate may grow
+	unsigned int m_maxJitterMs;    // jitter above this is handled as congestion
+	double       m_increaseStep;   // relative growth per interval
+	unsigned int m_holdMs;         // no growth during this delay after a reduction
+	unsigned int m_minChangeKbps;  // smaller changes are not sent to the encoder
+};
+
+// ---------------------------------
+// One controller per encoder, fed by the RTP sinks streaming it
+// ---------------------------------
+class RTPRateController
+{
+	public:
+		typedef void (SetBitrateFunc)(void* clientData, unsigned int kbps);
+
+		static RTPRateController* createNew(UsageEnvironment& env, FramedSource* source, const RTPRateControlParameters & params, SetBitrateFunc* setBitrateFunc, void* clientData);
+		static RTPRateController* lookup(FramedSource* source);
+		static void close(FramedSource* source);
+		virtual ~RTPRateController();
+
+		void addSink(RTPSink* sink);
+		void removeSink(RTPSink* sink);
+		unsigned int getBitrate()     { return m_kbps; }
+
+	protected:
+		RTPRateController(UsageEnvironment& env, FramedSource* source, const RTPRateControlParameters & params, SetBitrateFunc* setBitrateFunc, void* clientData);
+
+		static void evaluateStub(void* clientData) { ((RTPRateController*)clientData)->evaluate(); }
+		void evaluate();
+		void apply(unsigned int kbps, double loss, unsigned int jitterMs);
+
+	protected:
+		UsageEnvironment&          m_env;
+		FramedSource*              m_source;
+		RTPRateControlParameters   m_params;
+		SetBitrateFunc*            m_setBitrateFunc;
+		void*                      m_clientData;
+		std::list<RTPSink*>        m_sinks;
+		unsigned int               m_kbps;
+		timeval                    m_lastEvaluation;
+		timeval                    m_lastDecrease;
+		TaskToken                  m_evaluateTask;
+
+		static std::map<FramedSource*, RTPRateController*> m_controllers;
+};
@@ -22,6 +22,20 @@
 // forward declaration
 class V4L2DeviceSource;
 
+// ---------------------------------
+//   Scoped OutPacketBuffer::maxSize
+//   live555 sizes sink and fragmenter buffers from this global
+// ---------------------------------
+class OutPacketBufferSize
+{
+	public:
+		OutPacketBufferSize(unsigned int size) : m_previous(OutPacketBuffer::maxSize) { if (size != 0) OutPacketBuffer::maxSize = size; }
+		~OutPacketBufferSize()                                                       { OutPacketBuffer::maxSize = m_previous; }
+
+	private:
+		unsigned int m_previous;
+};
+
 // ---------------------------------
 //   BaseServerMediaSubsession
 // ---------------------------------
@@ -33,7 +47,8 @@ class BaseServerMediaSubsession
 	public:
 		static FramedSource* createSource(UsageEnvironment& env, FramedSource * videoES, const std::string& format);
 		static RTPSink* createSink(UsageEnvironment& env, Groupsock * rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, const std::string& format, V4L2DeviceSource* source);
-		char const* getAuxLine(V4L2DeviceSource* source,unsigned char rtpPayloadType);
+		char const* getAuxLine(V4L2DeviceSource* source,unsigned char rtpPayloadType,bool rtcpFeedback = false);
+		static unsigned int getSinkBufferSize(V4L2DeviceSource* source, double headroom, unsigned int minSize);
 		
 	protected:
 		StreamReplicator* m_replicator;
@@ -0,0 +1,54 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** SpectralDenoiser.h
+**
+** Noise suppression by spectral subtraction, stationary noise is tracked per frequency
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+
+#include "AudioFilter.h"
+
+class SpectralDenoiser : public AudioFilter
+{
+	public:
+		// reduction is the attenuation floor of the noise in dB
+		SpectralDenoiser(unsigned int sampleRate, unsigned int channels, float reduction = 20.0f);
+
+		virtual const char* getName() { return "denoiser"; }
+		virtual void process(short* samples, unsigned int frames);
+
+	protected:
+		struct Channel
+		{
+			std::vector<float> m_input;     // analysis frame, the last hop is being filled
+			std::vector<float> m_overlap;   // overlap-add of the synthesis
+			std::vector<float> m_output;    // hop of filtered samples sent during the next hop
+			std::vector<float> m_noise;     // noise power per bin
+			std::vector<float> m_gain;      // smoothed gain per bin
+			unsigned int       m_fill;
+			unsigned int       m_frames;
+		};
+
+		void processFrame(Channel & channel);
+		void fft(float* re, float* im);
+
+	protected:
+		unsigned int         m_channels;
+		unsigned int         m_size;       // FFT size, about 10ms
+		unsigned int         m_hop;        // half of the frame
+		float                m_floor;
+		std::vector<float>   m_window;     // sqrt-Hann for analysis and synthesis
+		std::vector<float>   m_cos;        // twiddles of each stage
+		std::vector<float>   m_sin;
+		std::vector<unsigned int> m_reverse;
+		std::vector<float>   m_re;
+		std::vector<float>   m_im;
+		std::vector<Channel> m_state;
+};
@@ -0,0 +1,131 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** TCPInterleavedWriter.h
+**
+** Vectored writer for RTP-over-RTSP interleaved streaming (RFC 2326 10.12)
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <memory>
+
+// live555
+#include <UsageEnvironment.hh>
+
+// ---------------------------------
+// RTP packets of one frame, sealed before being queued
+// ---------------------------------
+class RTPFrame
+{
+	public:
+		// what a decoder loses when the frame is dropped, ordered by importance
+		enum Type { OTHER, NON_REFERENCE, REFERENCE, KEY };
+
+		RTPFrame() : m_type(OTHER) {}
+
+		void         addPacket(const unsigned char* packet, unsigned int size);
+		void         setType(Type type)                 { if (type > m_type) m_type = type; }
+		Type         type() const                       { return m_type; }
+		unsigned int packetCount() const                { return m_packets.size(); }
+		unsigned int size() const                       { return m_data.size(); }
+		const unsigned char* packet(unsigned int index) const { return (const unsigned char*)m_data.data() + m_packets[index].first; }
+		unsigned int packetSize(unsigned int index) const     { return m_packets[index].second; }
+
+		// '$' framing headers (4 bytes per packet) for an interleaved channel
+		const unsigned char* headers(unsigned char channel);
+
+	private:
+		RTPFrame(const RTPFrame&);
+		RTPFrame& operator=(const RTPFrame&);
+
+	protected:
+		Type                                              m_type;
+		std::string                                       m_data;
+		std::vector< std::pair<unsigned int,unsigned int> > m_packets;
+		std::map<unsigned char, std::string>              m_headers;
+};
+
+// ---------------------------------
+// Interleaved writer parameters
+// ---------------------------------
+struct TCPInterleavedParameters
+{
+	TCPInterleavedParameters() :
+		m_zeroCopyThreshold(0), m_maxPendingBytes(2*1024*1024), m_retryDelayUs(2000) {}
+
+	unsigned int m_zeroCopyThreshold; // frame size from which MSG_ZEROCOPY is used, 0 to disable
+	unsigned int m_maxPendingBytes;   // backlog above which queued frames are dropped
+	unsigned int m_retryDelayUs;      // delay before retrying a socket that would block
+};
+
+// ---------------------------------
+// One writer per RTSP TCP connection, shared by all its interleaved channels
+// ---------------------------------
+class TCPInterleavedWriter
+{
+	public:
+		static TCPInterleavedWriter* lookup(UsageEnvironment& env, int socketNum, const TCPInterleavedParameters & params);
+		void release();
+
+		void queueFrame(const std::shared_ptr<RTPFrame> & frame, unsigned char channel);
+		int  getSocket()           { return m_socket; }
+		bool isBroken()            { return m_broken; }
+		bool needKeyFrame(unsigned char channel);
+
+	protected:
+		TCPInterleavedWriter(UsageEnvironment& env, int socketNum, const TCPInterleavedParameters & params);
+		virtual ~TCPInterleavedWriter();
+
+		static void retryStub(void* clientData) { ((TCPInterleavedWriter*)clientData)->retry(); }
+		void retry();
+		void flush();
+		bool dropPending(unsigned int frameBytes, RTPFrame::Type type);
+		void waitKeyFrame(unsigned char channel);
+		void reapZeroCopy();
+		void logStats();
+
+	protected:
+		struct Pending
+		{
+			Pending(const std::shared_ptr<RTPFrame> & frame, unsigned char channel) : m_frame(frame), m_channel(channel), m_packet(0), m_offset(0) {}
+			std::shared_ptr<RTPFrame> m_frame;
+			unsigned char             m_channel;
+			unsigned int              m_packet;  // next packet to send
+			unsigned int              m_offset;  // bytes of that packet (header included) already sent
+		};
+		std::list<Pending>::iterator dropFrame(std::list<Pending>::iterator it);
+
+		UsageEnvironment&          m_env;
+		int                        m_socket;
+		TCPInterleavedParameters   m_params;
+		unsigned int               m_refCount;
+		bool                       m_broken;
+		bool                       m_zeroCopy;
+		TaskToken                  m_retryTask;
+		std::list<Pending>         m_queue;
+		unsigned int               m_pendingBytes;
+
+		// channels that lost a reference frame, true until the keyframe request is taken
+		std::map<unsigned char, bool> m_waitKeyFrame;
+
+		// frames pinned by the kernel until MSG_ZEROCOPY completion
+		std::list< std::pair<unsigned int, std::shared_ptr<RTPFrame> > > m_inFlight;
+		unsigned int               m_zeroCopySeq;
+
+		// stats
+		unsigned long              m_frames;
+		unsigned long              m_packets;
+		unsigned long              m_syscalls;
+		unsigned long              m_shortWrites;
+		unsigned long              m_dropped;
+
+		static std::map<int, TCPInterleavedWriter*> m_writers;
+};
@@ -19,13 +19,20 @@
 class TSServerMediaSubsession : public UnicastServerMediaSubsession
 {
 	public:
-		static TSServerMediaSubsession* createNew(UsageEnvironment& env, StreamReplicator* videoreplicator, const std::string& videoformat, StreamReplicator* audioreplicator, const std::string& audioformat, unsigned int sliceDuration)
+		static TSServerMediaSubsession* createNew(UsageEnvironment& env, StreamReplicator* videoreplicator, const std::string& videoformat, StreamReplicator* audioreplicator, const std::string& audioformat, unsigned int sliceDuration, unsigned int windowDuration = 0, unsigned int partDurationMs = 0, bool cmaf = false, const std::string& rendition = "")
 		{
-			return new TSServerMediaSubsession(env, videoreplicator, videoformat, audioreplicator, audioformat, sliceDuration);
+			return new TSServerMediaSubsession(env, videoreplicator, videoformat, audioreplicator, audioformat, sliceDuration, windowDuration, partDurationMs, cmaf, rendition);
 		}
 		
+		MemoryBufferSink*  getHlsSink()   { return m_hlsSink; }
+
+		// ABR ladder : name of the rendition in the session, its resolution when the device gives it
+		const std::string& getRendition() { return m_rendition; }
+		int                getWidth()     { return m_width; }
+		int                getHeight()    { return m_height; }
+
 	protected:
-		TSServerMediaSubsession(UsageEnvironment& env, StreamReplicator* videoreplicator, const std::string& videoformat, StreamReplicator* audioreplicator, const std::string& audioformat, unsigned int sliceDuration); 
+		TSServerMediaSubsession(UsageEnvironment& env, StreamReplicator* videoreplicator, const std::string& videoformat, StreamReplicator* audioreplicator, const std::string& audioformat, unsigned int sliceDuration, unsigned int windowDuration, unsigned int partDurationMs, bool cmaf, const std::string& rendition); 
 		virtual ~TSServerMediaSubsession();
 			
 		virtual float         getCurrentNPT(void* streamToken);
@@ -36,6 +43,9 @@ class TSServerMediaSubsession : public UnicastServerMediaSubsession
 	protected:
 		unsigned int      m_slice;
 		MemoryBufferSink* m_hlsSink;
+		std::string       m_rendition;
+		int               m_width;
+		int               m_height;
 };
 
 
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "ServerMediaSubsession.h"
+#include "RTPOutputGroupsock.h"
 
 // -----------------------------------------
 //    ServerMediaSubsession for Unicast
@@ -17,18 +18,26 @@
 class UnicastServerMediaSubsession : public OnDemandServerMediaSubsession , public BaseServerMediaSubsession
 {
 	public:
-		static UnicastServerMediaSubsession* createNew(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format);
+		static UnicastServerMediaSubsession* createNew(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format, const RTPOutputParameters & params = RTPOutputParameters());
 		
 	protected:
-		UnicastServerMediaSubsession(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format) 
-				: OnDemandServerMediaSubsession(env, False), BaseServerMediaSubsession(replicator), m_format(format) {};
+		UnicastServerMediaSubsession(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format, const RTPOutputParameters & params = RTPOutputParameters()) 
+				: OnDemandServerMediaSubsession(env, params.m_reuseFirstSource), BaseServerMediaSubsession(replicator), m_format(format), m_params(params) {};
 			
 		virtual FramedSource* createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate);
 		virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock,  unsigned char rtpPayloadTypeIfDynamic, FramedSource* inputSource);		
 		virtual char const* getAuxSDPLine(RTPSink* rtpSink,FramedSource* inputSource);	
+		virtual Groupsock* createGroupsock(struct in_addr const& addr, Port port);
+		virtual void startStream(unsigned clientSessionId, void* streamToken, TaskFunc* rtcpRRHandler, void* rtcpRRHandlerClientData, unsigned short& rtpSeqNum, unsigned& rtpTimestamp, ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler, void* serverRequestAlternativeByteHandlerClientData);
+		virtual void deleteStream(unsigned clientSessionId, void*& streamToken);
+		virtual RTCPInstance* createRTCP(Groupsock* RTCPgs, unsigned totSessionBW, unsigned char const* cname, RTPSink* sink);
+
+		RTPOutputGroupsock* getRTPGroupsock(void* streamToken);
+		Destinations*       getDestinations(unsigned clientSessionId);
+		unsigned int        getSinkBufferSize();
 					
 	protected:
-		const std::string m_format;
+		const std::string   m_format;
+		RTPOutputParameters m_params;
 };
 
-
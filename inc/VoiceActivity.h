@@ -0,0 +1,80 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** VoiceActivity.h
+**
+** Voice activity detection, the silent periods are not streamed
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include <time.h>
+
+#include "DeviceInterface.h"
+
+// ---------------------------------
+// Counters of a stream, periods are the reads of the device
+// ---------------------------------
+struct VoiceActivityStats
+{
+	VoiceActivityStats() : m_periods(0), m_voice(0), m_hangover(0), m_suppressed(0), m_keepAlives(0) {}
+	unsigned long m_periods;
+	unsigned long m_voice;       // sent, voice detected
+	unsigned long m_hangover;    // sent, silence just after the voice
+	unsigned long m_suppressed;  // not sent
+	unsigned long m_keepAlives;  // sent as comfort noise during the silence
+};
+
+// ---------------------------------
+// Device decorator that only delivers the 16 bits network order periods with voice,
+// the silence is replaced by a comfort noise period from time to time
+// ---------------------------------
+class VoiceActivityDevice : public DeviceInterface
+{
+	public:
+		// threshold is the level above the noise floor in dB, hangover and keepAlive are in ms (0 for no keep-alive)
+		static VoiceActivityDevice* createNew(DeviceInterface* device, unsigned int sampleRate, unsigned int channels, int format, float threshold = 9.0f, unsigned int hangover = 300, unsigned int keepAlive = 200);
+		virtual ~VoiceActivityDevice();
+
+		const VoiceActivityStats & getStats() { return m_stats; }
+
+		virtual size_t read(char* buffer, size_t bufferSize);
+		virtual int getFd()                        { return m_device->getFd(); }
+		virtual unsigned long getBufferSize()      { return m_device->getBufferSize(); }
+		virtual int getWidth()                     { return m_device->getWidth(); }
+		virtual int getHeight()                    { return m_device->getHeight(); }
+		virtual int getCaptureFormat()             { return m_device->getCaptureFormat(); }
+		virtual bool requestKeyFrame()             { return m_device->requestKeyFrame(); }
+		virtual bool setBitrate(unsigned int kbps) { return m_device->setBitrate(kbps); }
+		virtual unsigned int getBitrate()          { return m_device->getBitrate(); }
+		virtual void adjustPresentationTime(timeval & tv);
+
+	protected:
+		VoiceActivityDevice(DeviceInterface* device, unsigned int sampleRate, unsigned int channels, float threshold, unsigned int hangover, unsigned int keepAlive);
+		bool detect(const unsigned char* data, size_t size);
+		void comfortNoise(unsigned char* data, size_t size);
+		void updateStats();
+
+	protected:
+		DeviceInterface*         m_device;
+		unsigned int             m_sampleRate;
+		unsigned int             m_channels;
+		float                    m_threshold;
+		unsigned int             m_hangoverFrames;
+		unsigned int             m_keepAliveFrames;
+
+		std::vector<short>       m_samples;
+		double                   m_noise;          // mean square of the silence, 0 before the first period
+		unsigned int             m_hangoverLeft;
+		unsigned int             m_silentFrames;   // suppressed since the last period sent
+		unsigned int             m_skippedFrames;  // suppressed before the period of the last read
+		unsigned int             m_seed;
+
+		VoiceActivityStats       m_stats;
+		VoiceActivityStats       m_reportStats;
+		time_t                   m_reportTime;
+};
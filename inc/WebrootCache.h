@@ -0,0 +1,88 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** WebrootCache.h
+**
+** Cache of the webroot files invalidated by inotify, large files are sent with sendfile
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <memory>
+#include <sys/types.h>
+
+// live555
+#include <liveMedia.hh>
+
+#include "MemorySegment.h"
+
+// ---------------------------------
+// File of the webroot, small ones keep their content in memory
+// ---------------------------------
+struct WebrootFile
+{
+	std::string      m_path;
+	off_t            m_size;
+	time_t           m_mtime;
+	std::string      m_etag;
+	std::string      m_lastModified;
+	const char*      m_mimeType;
+	MemorySegmentRef m_content;      // empty for files sent with sendfile
+};
+typedef std::shared_ptr<const WebrootFile> WebrootFileRef;
+
+class WebrootCache
+{
+	public:
+		static WebrootCache* createNew(UsageEnvironment& env, unsigned int maxCachedSize = 256*1024);
+		virtual ~WebrootCache();
+
+		WebrootFileRef lookup(const std::string & path);
+		static const char* getMimeType(const std::string & path);
+
+	protected:
+		WebrootCache(UsageEnvironment& env, unsigned int maxCachedSize);
+
+		void watch(const std::string & path);
+		static void inotifyHandlerStub(void* clientData, int) { ((WebrootCache*)clientData)->inotifyHandler(); }
+		void inotifyHandler();
+
+	protected:
+		UsageEnvironment&                     m_env;
+		unsigned int                          m_maxCachedSize;
+		int                                   m_inotifyFd;
+		std::map<std::string, WebrootFileRef> m_files;
+		std::map<int, std::string>            m_watches;  // watch descriptor => directory
+		unsigned long                         m_hits;
+		unsigned long                         m_misses;
+};
+
+// ---------------------------------
+// Send a file to a non blocking socket with sendfile, from the event loop
+// ---------------------------------
+class FileSender
+{
+	public:
+		static FileSender* createNew(UsageEnvironment& env, int socket, const WebrootFileRef & file, TaskFunc* afterFunc, void* clientData);
+		virtual ~FileSender();
+
+	protected:
+		FileSender(UsageEnvironment& env, int socket, int fd, const WebrootFileRef & file, TaskFunc* afterFunc, void* clientData);
+
+		static void writableHandlerStub(void* clientData, int) { ((FileSender*)clientData)->send(); }
+		void send();
+
+	protected:
+		UsageEnvironment& m_env;
+		int               m_socket;
+		int               m_fd;
+		WebrootFileRef    m_file;
+		off_t             m_offset;
+		TaskFunc*         m_afterFunc;
+		void*             m_clientData;
+};
@@ -15,6 +15,10 @@
 
 #include "V4l2Device.h"
 
+#ifndef V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME
+#define V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME (V4L2_CID_MPEG_BASE+229)
+#endif
+
 class V4l2Access
 {
 	public:
@@ -33,6 +37,11 @@ class V4l2Access
 		unsigned int getWidth()      { return m_device->getWidth();      }
 		unsigned int getHeight()     { return m_device->getHeight();     }
 		void queryFormat()  { m_device->queryFormat();          }
+		int setControl(unsigned int id, int value)   { return m_device->setControl(id, value); }
+		int getControl(unsigned int id, int & value) { return m_device->getControl(id, value); }
+		bool requestKeyFrame() { return (m_device->setControl(V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 1) == 0); }
+		bool setBitrate(unsigned int kbps) { return (m_device->setControl(V4L2_CID_MPEG_VIDEO_BITRATE, kbps*1000) == 0); }
+		unsigned int getBitrate() { int value = 0; return (m_device->getControl(V4L2_CID_MPEG_VIDEO_BITRATE, value) == 0) && (value > 0) ? value/1000 : 0; }
 
 		int isReady()       { return m_device->isReady();       }
 		int start()         { return m_device->start();         }
@@ -85,6 +85,8 @@ class V4l2Device
 		unsigned int getHeight()     { return m_height;     }
 		int getFd()         { return m_fd;         }
 		void queryFormat();	
+		int setControl(unsigned int id, int value);
+		int getControl(unsigned int id, int & value);
 
 	protected:
 		V4L2DeviceParameters m_params;
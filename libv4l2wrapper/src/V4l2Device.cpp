@@ -253,4 +253,31 @@ int V4l2Device::configureParam(int fd)
     return 0;
 }
 
+// set a device control (encoder controls of H264 cameras)
+int V4l2Device::setControl(unsigned int id, int value)
+{
+    struct v4l2_control control;
+    memset(&control, 0, sizeof(control));
+    control.id    = id;
+    control.value = value;
+    if (ioctl(m_fd, VIDIOC_S_CTRL, &control) == -1)
+    {
+        std::cout<< "Cannot set control:" << std::hex << id << std::dec << " for device:" << m_params.m_devName << " " << strerror(errno)<<"\n";
+        return -1;
+    }
+    return 0;
+}
 
+// get a device control
+int V4l2Device::getControl(unsigned int id, int & value)
+{
+    struct v4l2_control control;
+    memset(&control, 0, sizeof(control));
+    control.id = id;
+    if (ioctl(m_fd, VIDIOC_G_CTRL, &control) == -1)
+    {
+        return -1;
+    }
+    value = control.value;
+    return 0;
+}
@@ -0,0 +1,302 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AACEncoderSource.cpp
+**
+** live555 filter that encodes PCM to AAC-LC ADTS frames on a worker thread
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+
+#include "logger.h"
+#include "AACEncoderSource.h"
+#include "AudioEncoder.h"
+
+// ADTS frames waiting for the muxer, older ones are dropped
+#define AAC_MAX_QUEUED_FRAMES 64
+
+AACEncoderSource* AACEncoderSource::createNew(UsageEnvironment& env, FramedSource* source, const std::string& format, unsigned int bitrate)
+{
+	std::istringstream is(format);
+	std::string dummy;
+	getline(is, dummy, '/');
+	std::string codec;
+	getline(is, codec, '/');
+	std::string sampleRate("44100");
+	getline(is, sampleRate, '/');
+	std::string channels("2");
+	getline(is, channels);
+	if ( (codec != "L16") && (codec != "PCMU") && (codec != "PCMA") )
+	{
+		LOG(WARN) << "AAC encoder cannot encode " << format;
+		return NULL;
+	}
+
+#ifdef HAVE_FDKAAC
+	AACEncoderSource* aac = new AACEncoderSource(env, source, codec, atoi(sampleRate.c_str()), atoi(channels.c_str()));
+	if (!aac->initEncoder(bitrate))
+	{
+		// the caller keeps the source
+		aac->detachInputSource();
+		Medium::close(aac);
+		aac = NULL;
+	}
+	return aac;
+#else
+	(void)env;
+	(void)source;
+	(void)bitrate;
+	LOG(WARN) << "AAC encoder not available, build with HAVE_FDKAAC";
+	return NULL;
+#endif
+}
+
+AACEncoderSource::AACEncoderSource(UsageEnvironment& env, FramedSource* source, const std::string& codec, unsigned int sampleRate, unsigned int channels)
+	: FramedFilter(env, source), m_codec(codec), m_sampleRate(sampleRate), m_channels(channels), m_frameLength(1024), m_input(64*1024), m_reading(false)
+	, m_samplesRead(0), m_stop(false), m_eventTriggerId(0)
+#ifdef HAVE_FDKAAC
+	, m_encoder(NULL)
+#endif
+{
+	memset(&m_samplesTime, 0, sizeof(m_samplesTime));
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+}
+
+AACEncoderSource::~AACEncoderSource()
+{
+	if (m_eventTriggerId != 0)
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_stop = true;
+		pthread_cond_signal(&m_cond);
+		pthread_mutex_unlock(&m_mutex);
+		pthread_join(m_thid, NULL);
+		envir().taskScheduler().deleteEventTrigger(m_eventTriggerId);
+	}
+#ifdef HAVE_FDKAAC
+	if (m_encoder != NULL)
+	{
+		aacEncClose(&m_encoder);
+	}
+#endif
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+bool AACEncoderSource::initEncoder(unsigned int bitrate)
+{
+#ifdef HAVE_FDKAAC
+	if ( (m_channels < 1) || (m_channels > 2) || (aacEncOpen(&m_encoder, 0, m_channels) != AACENC_OK) )
+	{
+		LOG(WARN) << "cannot open AAC encoder channels:" << m_channels;
+		return false;
+	}
+	aacEncoder_SetParam(m_encoder, AACENC_AOT, AOT_AAC_LC);
+	aacEncoder_SetParam(m_encoder, AACENC_SAMPLERATE, m_sampleRate);
+	aacEncoder_SetParam(m_encoder, AACENC_CHANNELMODE, (m_channels == 1) ? MODE_1 : MODE_2);
+	aacEncoder_SetParam(m_encoder, AACENC_CHANNELORDER, 1);
+	aacEncoder_SetParam(m_encoder, AACENC_BITRATE, bitrate);
+	aacEncoder_SetParam(m_encoder, AACENC_TRANSMUX, TT_MP4_ADTS);
+	aacEncoder_SetParam(m_encoder, AACENC_AFTERBURNER, 1);
+	AACENC_InfoStruct info;
+	if ( (aacEncEncode(m_encoder, NULL, NULL, NULL, NULL) != AACENC_OK) || (aacEncInfo(m_encoder, &info) != AACENC_OK) )
+	{
+		LOG(WARN) << "cannot initialize AAC encoder rate:" << m_sampleRate << " channels:" << m_channels;
+		return false;
+	}
+	m_frameLength = info.frameLength;
+
+	m_eventTriggerId = envir().taskScheduler().createEventTrigger(AACEncoderSource::deliverFrameStub);
+	pthread_create(&m_thid, NULL, threadStub, this);
+	LOG(NOTICE) << "AAC encoder rate:" << m_sampleRate << " channels:" << m_channels << " bitrate:" << bitrate << " frame:" << m_frameLength;
+	return true;
+#else
+	(void)bitrate;
+	return false;
+#endif
+}
+
+void AACEncoderSource::doGetNextFrame()
+{
+	this->readInput();
+	this->deliverFrame();
+}
+
+void AACEncoderSource::doStopGettingFrames()
+{
+	m_reading = false;
+	FramedFilter::doStopGettingFrames();
+}
+
+void AACEncoderSource::readInput()
+{
+	if (!m_reading)
+	{
+		m_reading = true;
+		fInputSource->getNextFrame(&m_input[0], m_input.size(), afterGettingFrame, this, FramedSource::handleClosure, this);
+	}
+}
+
+// PCM is handed to the worker, the capture is read continuously to not hold the other replicas
+void AACEncoderSource::afterGettingFrame(unsigned frameSize, struct timeval presentationTime)
+{
+	m_reading = false;
+
+	std::vector<short> samples;
+	if (m_codec == "L16")
+	{
+		samples.resize(frameSize/2);
+		for (unsigned int i = 0; i < samples.size(); ++i)
+		{
+			samples[i] = (short)((m_input[2*i] << 8) | m_input[2*i+1]);
+		}
+	}
+	else
+	{
+		samples.resize(frameSize);
+		decodeG711(&m_input[0], frameSize, &samples[0], (m_codec == "PCMU"));
+	}
+
+	pthread_mutex_lock(&m_mutex);
+	size_t waiting = m_samples.size() - m_samplesRead;
+	if (waiting != 0)
+	{
+		// the silence suppression leaves gaps, they are filled to keep the AAC timeline on the capture clock
+		int64_t end = (int64_t)m_samplesTime.tv_sec*1000000 + m_samplesTime.tv_usec + (int64_t)waiting/m_channels*1000000/m_sampleRate;
+		int64_t gap = ((int64_t)presentationTime.tv_sec*1000000 + presentationTime.tv_usec - end)*m_sampleRate/1000000;
+		if (gap >= m_sampleRate)
+		{
+			waiting = 0;
+		}
+		else if (gap > m_sampleRate/50)
+		{
+			m_samples.insert(m_samples.end(), gap*m_channels, 0);
+		}
+	}
+	if (waiting == 0)
+	{
+		m_samples.clear();
+		m_samplesRead = 0;
+		// the AAC frames get the capture clock, the one of the video too
+		m_samplesTime = presentationTime;
+	}
+	m_samples.insert(m_samples.end(), samples.begin(), samples.end());
+	pthread_cond_signal(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+
+	this->readInput();
+}
+
+void AACEncoderSource::deliverFrame()
+{
+	if (!isCurrentlyAwaitingData())
+	{
+		return;
+	}
+	Frame frame;
+	pthread_mutex_lock(&m_mutex);
+	bool ready = !m_output.empty();
+	if (ready)
+	{
+		frame.m_data.swap(m_output.front().m_data);
+		frame.m_timestamp = m_output.front().m_timestamp;
+		m_output.pop_front();
+	}
+	pthread_mutex_unlock(&m_mutex);
+
+	if (ready)
+	{
+		fFrameSize = frame.m_data.size();
+		fNumTruncatedBytes = 0;
+		if (fFrameSize > fMaxSize)
+		{
+			fNumTruncatedBytes = fFrameSize - fMaxSize;
+			fFrameSize = fMaxSize;
+		}
+		memcpy(fTo, &frame.m_data[0], fFrameSize);
+		fPresentationTime = frame.m_timestamp;
+		fDurationInMicroseconds = (unsigned int)((u_int64_t)m_frameLength*1000000/m_sampleRate);
+		FramedSource::afterGetting(this);
+	}
+}
+
+// encoding off the event loop, a frame is about 23ms of work budget at 44.1kHz
+void* AACEncoderSource::thread()
+{
+#ifdef HAVE_FDKAAC
+	std::vector<short> pcm(m_frameLength*m_channels);
+	std::vector<unsigned char> out(768*m_channels + 64);
+	while (true)
+	{
+		pthread_mutex_lock(&m_mutex);
+		while (!m_stop && (m_samples.size() - m_samplesRead < pcm.size()))
+		{
+			pthread_cond_wait(&m_cond, &m_mutex);
+		}
+		if (m_stop)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			break;
+		}
+		// the frames are read at an offset, the buffer is compacted once half of it was read
+		std::copy(m_samples.begin() + m_samplesRead, m_samples.begin() + m_samplesRead + pcm.size(), pcm.begin());
+		m_samplesRead += pcm.size();
+		if (2*m_samplesRead >= m_samples.size())
+		{
+			m_samples.erase(m_samples.begin(), m_samples.begin() + m_samplesRead);
+			m_samplesRead = 0;
+		}
+		m_pts.push_back(m_samplesTime);
+		u_int64_t usec = m_samplesTime.tv_usec + (u_int64_t)m_frameLength*1000000/m_sampleRate;
+		m_samplesTime.tv_sec += usec/1000000;
+		m_samplesTime.tv_usec = usec%1000000;
+		pthread_mutex_unlock(&m_mutex);
+
+		void* inPtr = &pcm[0];
+		INT inId = IN_AUDIO_DATA;
+		INT inSize = pcm.size()*sizeof(short);
+		INT inElSize = sizeof(short);
+		AACENC_BufDesc inBuf = { 1, &inPtr, &inId, &inSize, &inElSize };
+		void* outPtr = &out[0];
+		INT outId = OUT_BITSTREAM_DATA;
+		INT outSize = out.size();
+		INT outElSize = 1;
+		AACENC_BufDesc outBuf = { 1, &outPtr, &outId, &outSize, &outElSize };
+		AACENC_InArgs inArgs;
+		memset(&inArgs, 0, sizeof(inArgs));
+		inArgs.numInSamples = pcm.size();
+		AACENC_OutArgs outArgs;
+		memset(&outArgs, 0, sizeof(outArgs));
+		if (aacEncEncode(m_encoder, &inBuf, &outBuf, &inArgs, &outArgs) != AACENC_OK)
+		{
+			LOG(WARN) << "AAC encoding failed";
+			m_pts.pop_front();
+			continue;
+		}
+		if (outArgs.numOutBytes > 0)
+		{
+			// the first input frames only prime the encoder, the outputs keep their order
+			Frame frame;
+			frame.m_data.assign(out.begin(), out.begin() + outArgs.numOutBytes);
+			frame.m_timestamp = m_pts.front();
+			m_pts.pop_front();
+
+			pthread_mutex_lock(&m_mutex);
+			m_output.push_back(frame);
+			while (m_output.size() > AAC_MAX_QUEUED_FRAMES)
+			{
+				m_output.pop_front();
+			}
+			pthread_mutex_unlock(&m_mutex);
+			envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
+		}
+	}
+#endif
+	return NULL;
+}
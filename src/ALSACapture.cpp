@@ -15,7 +15,12 @@
 
 #ifdef HAVE_ALSA
 
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
 #include "ALSACapture.h"
+#include "PCMByteSwap.h"
 
 
 ALSACapture* ALSACapture::createNew(const ALSACaptureParameters & params) 
@@ -46,7 +51,7 @@ void ALSACapture::close()
 	}
 }
 	
-ALSACapture::ALSACapture(const ALSACaptureParameters & params) : m_pcm(NULL), m_bufferSize(0), m_periodSize(0), m_params(params)
+ALSACapture::ALSACapture(const ALSACaptureParameters & params) : m_pcm(NULL), m_bufferSize(0), m_periodSize(0), m_params(params), m_fmt(SND_PCM_FORMAT_UNKNOWN), m_mmap(false), m_reportTime(0)
 {
 	LOG(NOTICE) << "Open ALSA device: \"" << params.m_devName << "\"";
 	
@@ -67,8 +72,7 @@ ALSACapture::ALSACapture(const ALSACaptureParameters & params) : m_pcm(NULL), m_
 		LOG(ERROR) << "cannot initialize hardware parameter structure device: " << m_params.m_devName << " error:" <<  snd_strerror (err);
 		this->close();
 	}			
-	else if ((err = snd_pcm_hw_params_set_access (m_pcm, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
-		LOG(ERROR) << "cannot set access type device: " << m_params.m_devName << " error:" <<  snd_strerror (err);
+	else if (this->configureAccess(hw_params) < 0) {
 		this->close();
 	}
 	else if (this->configureFormat(hw_params) < 0) {
@@ -82,6 +86,16 @@ ALSACapture::ALSACapture(const ALSACaptureParameters & params) : m_pcm(NULL), m_
 		LOG(ERROR) << "cannot set channel count device: " << m_params.m_devName << " error:" <<  snd_strerror (err);
 		this->close();
 	}
+	
+	// short periods for low latency, the driver default is often 100ms
+	else if ( (m_params.m_bufferTime != 0) && ((err = snd_pcm_hw_params_set_buffer_time_near (m_pcm, hw_params, &m_params.m_bufferTime, 0)) < 0) ) {
+		LOG(ERROR) << "cannot set buffer time device: " << m_params.m_devName << " error:" <<  snd_strerror (err);
+		this->close();
+	}
+	else if ( (m_params.m_periodTime != 0) && ((err = snd_pcm_hw_params_set_period_time_near (m_pcm, hw_params, &m_params.m_periodTime, 0)) < 0) ) {
+		LOG(ERROR) << "cannot set period time device: " << m_params.m_devName << " error:" <<  snd_strerror (err);
+		this->close();
+	}
 	else if ((err = snd_pcm_hw_params (m_pcm, hw_params)) < 0) {
 		LOG(ERROR) << "cannot set parameters device: " << m_params.m_devName << " error:" <<  snd_strerror (err);
 		this->close();
@@ -102,14 +116,51 @@ ALSACapture::ALSACapture(const ALSACaptureParameters & params) : m_pcm(NULL), m_
 		LOG(ERROR) << "cannot start audio interface for use device: " << m_params.m_devName << " error:" <<  snd_strerror (err);
 		this->close();
 	}			
+	if (hw_params != NULL) {
+		snd_pcm_hw_params_free (hw_params);
+	}
+	m_latency.m_periodSize = m_periodSize;
+	m_latency.m_bufferSize = m_bufferSize;
 	
-	LOG(NOTICE) << "ALSA device: \"" << m_params.m_devName << "\" buffer_size:" << m_bufferSize << " period_size:" << m_periodSize << " rate:" << m_params.m_sampleRate;
+	LOG(NOTICE) << "ALSA device: \"" << m_params.m_devName << "\" buffer_size:" << m_bufferSize << " period_size:" << m_periodSize << " rate:" << m_params.m_sampleRate
+		<< " period:" << m_periodSize*1000/m_params.m_sampleRate << "ms buffer:" << m_bufferSize*1000/m_params.m_sampleRate << "ms"
+		<< " access:" << (m_mmap ? "mmap" : "rw") << " swap:" << (snd_pcm_format_big_endian(m_fmt) ? "none" : pcmByteSwapKernel());
 }
 			
+int ALSACapture::configureAccess(snd_pcm_hw_params_t *hw_params) {
+
+	int err = 0;
+	if (m_params.m_mmap) {
+		if ((err = snd_pcm_hw_params_set_access (m_pcm, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED)) == 0) {
+			m_mmap = true;
+			return 0;
+		}
+		LOG(NOTICE) << "cannot set mmap access device: " << m_params.m_devName << " error:" <<  snd_strerror (err);
+	}
+	if ((err = snd_pcm_hw_params_set_access (m_pcm, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+		LOG(ERROR) << "cannot set access type device: " << m_params.m_devName << " error:" <<  snd_strerror (err);
+		return -1;
+	}
+	return 0;
+}
+
 int ALSACapture::configureFormat(snd_pcm_hw_params_t *hw_params) {
 	
-	// try to set format, widht, height
 	std::list<snd_pcm_format_t>::iterator it;
+
+	// network order needs no swap, but a plug device would convert it in alsa-lib
+	if (snd_pcm_type(m_pcm) != SND_PCM_TYPE_PLUG) {
+		for (it = m_params.m_formatList.begin(); it != m_params.m_formatList.end(); ++it) {
+			snd_pcm_format_t format = *it;
+			if ( (snd_pcm_format_big_endian(format) == 1) && (snd_pcm_hw_params_set_format (m_pcm, hw_params, format) == 0) ) {
+				LOG(NOTICE) << "set sample format device: " << m_params.m_devName << " to:" << format << " ok";
+				m_fmt = format;
+				return 0;
+			}
+		}
+	}
+
+	// try to set format, widht, height
 	for (it = m_params.m_formatList.begin(); it != m_params.m_formatList.end(); ++it) {
 		snd_pcm_format_t format = *it;
 		int err = snd_pcm_hw_params_set_format (m_pcm, hw_params, format);
@@ -133,38 +184,141 @@ size_t ALSACapture::read(char* buffer, size_t bufferSize)
 		int fmt_phys_width_bits = snd_pcm_format_physical_width(m_fmt);
 		fmt_phys_width_bytes = fmt_phys_width_bits / 8;
 
-		snd_pcm_sframes_t ret = snd_pcm_readi (m_pcm, buffer, m_periodSize*fmt_phys_width_bytes);
-		LOG(DEBUG) << "ALSA buffer in_size:" << m_periodSize*fmt_phys_width_bytes << " read_size:" << ret;
-
-        LOG(NOTICE) << "read pcm bytes:"<<ret;
-        //here read pcm from ALSA device.
-        //so we should put noise suppression code here.
-        //this work will be done after porting to jetson tx2 platform.
+		// a period, or what fits in the buffer
+		snd_pcm_uframes_t frames = bufferSize / (fmt_phys_width_bytes * m_params.m_channels);
+		if (frames > m_periodSize) {
+			frames = m_periodSize;
+		}
+		snd_pcm_sframes_t ret = this->readFrames(buffer, frames);
+		if ( (ret < 0) && (this->recover(ret) == 0) ) {
+			// the source goes on after an overrun
+			ret = this->readFrames(buffer, frames);
+		}
+		LOG(DEBUG) << "ALSA buffer in_size:" << frames << " read_size:" << ret;
+		this->updateLatency();
 
+        //noise suppression is done by the AudioFilterDevice that wraps the capture.
 
 		if (ret > 0) {
 			size = ret;				
 			
-			// swap if capture in not in network order
-			if (!snd_pcm_format_big_endian(m_fmt)) {
-				for(unsigned int i = 0; i < size; i++){
-					char * ptr = &buffer[i * fmt_phys_width_bytes * m_params.m_channels];
-					
-					for(unsigned int j = 0; j < m_params.m_channels; j++){
-						ptr += j * fmt_phys_width_bytes;
-						for (int k = 0; k < fmt_phys_width_bytes/2; k++) {
-							char byte = ptr[k];
-							ptr[k] = ptr[fmt_phys_width_bytes - 1 - k];
-							ptr[fmt_phys_width_bytes - 1 - k] = byte; 
-						}
-					}
-				}
+			// swap if capture in not in network order, done while copying from the mmap ring
+			if (!m_mmap && !snd_pcm_format_big_endian(m_fmt)) {
+				pcmByteSwap((unsigned char*)buffer, size * m_params.m_channels * fmt_phys_width_bytes, fmt_phys_width_bytes);
 			}
 		}
 	}
 	return size * m_params.m_channels * fmt_phys_width_bytes;
 }
 		
+snd_pcm_sframes_t ALSACapture::readFrames(char* buffer, snd_pcm_uframes_t frames)
+{
+	return m_mmap ? this->readMmap(buffer, frames) : snd_pcm_readi (m_pcm, buffer, frames);
+}
+
+// overrun, suspend or interrupted read : prepare and start the capture again
+int ALSACapture::recover(int err)
+{
+	if (err == -EPIPE) {
+		m_latency.m_xruns++;
+	} else if (err == -ESTRPIPE) {
+		m_latency.m_suspends++;
+	}
+	LOG(WARN) << "ALSA device: \"" << m_params.m_devName << "\" recover from:" << snd_strerror (err) << " xruns:" << m_latency.m_xruns;
+
+	err = snd_pcm_recover (m_pcm, err, 1);
+	if ( (err == 0) && (snd_pcm_state (m_pcm) != SND_PCM_STATE_RUNNING) ) {
+		err = snd_pcm_start (m_pcm);
+	}
+	if (err < 0) {
+		m_latency.m_failures++;
+		LOG(ERROR) << "cannot recover audio device: " << m_params.m_devName << " error:" <<  snd_strerror (err);
+	} else {
+		m_latency.m_recoveries++;
+	}
+	return err;
+}
+
+// frames left in the buffer after the read, reported every 10s
+void ALSACapture::updateLatency()
+{
+	snd_pcm_sframes_t delay = 0;
+	if (snd_pcm_delay (m_pcm, &delay) == 0) {
+		m_latency.m_delay = delay;
+		if (delay > m_latency.m_maxDelay) {
+			m_latency.m_maxDelay = delay;
+		}
+	}
+
+	time_t now = time(NULL);
+	if (now - m_reportTime >= 10) {
+		unsigned long rate = m_params.m_sampleRate;
+		LOG(NOTICE) << "ALSA device: \"" << m_params.m_devName << "\" period:" << m_latency.m_periodSize*1000/rate << "ms"
+			<< " buffer:" << m_latency.m_bufferSize*1000/rate << "ms"
+			<< " delay:" << m_latency.m_delay*1000/(long)rate << "ms max:" << m_latency.m_maxDelay*1000/(long)rate << "ms"
+			<< " xruns:" << m_latency.m_xruns << " suspends:" << m_latency.m_suspends
+			<< " recoveries:" << m_latency.m_recoveries << " failures:" << m_latency.m_failures;
+		m_latency.m_maxDelay = 0;
+		m_reportTime = now;
+	}
+}
+
+// copy the available frames from the ring of the driver, swapped to network order in the same pass
+snd_pcm_sframes_t ALSACapture::readMmap(char* buffer, snd_pcm_uframes_t frames)
+{
+	snd_pcm_sframes_t avail = snd_pcm_avail_update(m_pcm);
+	while (avail == 0) {
+		// nothing yet, block like snd_pcm_readi does, a read of 0 would stop the source
+		int err = snd_pcm_wait(m_pcm, 1000);
+		if (err < 0) {
+			return err;
+		}
+		// 0 is a timeout, wait again
+		avail = snd_pcm_avail_update(m_pcm);
+	}
+	if (avail < 0) {
+		return avail;
+	}
+	if ((snd_pcm_uframes_t)avail < frames) {
+		frames = avail;
+	}
+
+	int width = snd_pcm_format_physical_width(m_fmt) / 8;
+	size_t frameSize = width * m_params.m_channels;
+	snd_pcm_uframes_t done = 0;
+	while (done < frames) {
+		const snd_pcm_channel_area_t* areas = NULL;
+		snd_pcm_uframes_t offset = 0;
+		snd_pcm_uframes_t count = frames - done;
+		int err = snd_pcm_mmap_begin(m_pcm, &areas, &offset, &count);
+		if (err < 0) {
+			return err;
+		}
+		if (count == 0) {
+			break;
+		}
+
+		// interleaved, the channels share the area of the first one
+		const unsigned char* ring = (const unsigned char*)areas[0].addr + areas[0].first/8 + offset*areas[0].step/8;
+		unsigned char* out = (unsigned char*)buffer + done*frameSize;
+		if (snd_pcm_format_big_endian(m_fmt)) {
+			memcpy(out, ring, count*frameSize);
+		} else {
+			pcmByteSwapCopy(out, ring, count*frameSize, width);
+		}
+
+		snd_pcm_sframes_t committed = snd_pcm_mmap_commit(m_pcm, offset, count);
+		if (committed < 0) {
+			return committed;
+		}
+		done += committed;
+		if ((snd_pcm_uframes_t)committed != count) {
+			break;
+		}
+	}
+	return done;
+}
+		
 int ALSACapture::getFd()
 {
 	unsigned int nbfs = 1;
@@ -0,0 +1,134 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioClock.cpp
+**
+** Audio presentation times from the sample clock of the device, locked on the system clock
+**
+** -------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <alsa/asoundlib.h>
+
+#include "logger.h"
+#include "AudioClock.h"
+
+// a read further than this from the loop is a discontinuity, the loop starts again
+#define AUDIO_CLOCK_RESYNC 0.1
+// seconds of the skew average
+#define AUDIO_CLOCK_SKEW_AVERAGE 10.0
+
+AudioClockDevice* AudioClockDevice::createNew(DeviceInterface* device, unsigned int sampleRate, unsigned int channels, int format, double bandwidth)
+{
+	int width = snd_pcm_format_physical_width((snd_pcm_format_t)format);
+	if ( (sampleRate == 0) || (channels == 0) || (width <= 0) || (bandwidth <= 0) )
+	{
+		LOG(WARN) << "audio clock cannot follow rate:" << sampleRate << " channels:" << channels << " format:" << format;
+		return NULL;
+	}
+	return new AudioClockDevice(device, sampleRate, channels*width/8, bandwidth);
+}
+
+AudioClockDevice::AudioClockDevice(DeviceInterface* device, unsigned int sampleRate, unsigned int frameSize, double bandwidth)
+	: m_device(device), m_sampleRate(sampleRate), m_frameSize(frameSize), m_bandwidth(bandwidth)
+	, m_locked(false), m_next(0), m_period(1.0/sampleRate), m_origin(0), m_frames(0), m_pending(false), m_reportTime(time(NULL))
+{
+	timerclear(&m_presentationTime);
+}
+
+AudioClockDevice::~AudioClockDevice()
+{
+	LOG(NOTICE) << "audio clock skew:" << m_stats.m_skew << "ppm drift:" << m_stats.m_drift << "ms resyncs:" << m_stats.m_resyncs;
+	delete m_device;
+}
+
+size_t AudioClockDevice::read(char* buffer, size_t bufferSize)
+{
+	int size = m_device->read(buffer, bufferSize);
+	if (size > 0)
+	{
+		timespec mono;
+		clock_gettime(CLOCK_MONOTONIC, &mono);
+		timeval wall;
+		gettimeofday(&wall, NULL);
+		this->update(size / m_frameSize, mono.tv_sec + mono.tv_nsec/1e9, wall);
+	}
+	return size;
+}
+
+// the frame gets the time of its first read, the stages that drop samples shift it after
+void AudioClockDevice::adjustPresentationTime(timeval & tv)
+{
+	m_device->adjustPresentationTime(tv);
+	if (m_pending)
+	{
+		tv = m_presentationTime;
+		m_pending = false;
+	}
+}
+
+// second order delay-locked loop, the read returns when the last sample of the period is captured
+// now is the monotonic time of the read, wall the same instant on the system clock
+void AudioClockDevice::update(unsigned int frames, double now, const timeval & wall)
+{
+	if (frames == 0)
+	{
+		return;
+	}
+
+	double predicted = m_next + frames*m_period;
+	double error = now - predicted;
+	if (!m_locked || (fabs(error) > AUDIO_CLOCK_RESYNC))
+	{
+		if (m_locked)
+		{
+			LOG(NOTICE) << "audio clock resync error:" << (int)(error*1000) << "ms";
+		}
+		m_next = now - frames*m_period;
+		m_origin = m_next;
+		m_frames = 0;
+		predicted = now;
+		error = 0;
+		m_locked = true;
+		m_stats.m_resyncs++;
+	}
+
+	double start = m_next;
+	double omega = 2*M_PI*m_bandwidth*frames*m_period;
+	m_next = predicted + sqrt(2.0)*omega*error;
+	m_period += omega*omega*error/frames;
+	m_frames += frames;
+
+	if (!m_pending)
+	{
+		// locked time on the monotonic clock, moved to the system clock the video uses
+		double offset = start - now;
+		long long usec = (long long)wall.tv_sec*1000000 + wall.tv_usec + (long long)(offset*1e6);
+		m_presentationTime.tv_sec = usec/1000000;
+		m_presentationTime.tv_usec = usec%1000000;
+		m_pending = true;
+	}
+	this->updateStats(error, frames*m_period);
+}
+
+void AudioClockDevice::updateStats(double error, double duration)
+{
+	// the period follows the jitter of the reads, its skew is averaged over about 10s
+	double skew = (m_period*m_sampleRate - 1)*1e6;
+	m_stats.m_skew += ((duration < AUDIO_CLOCK_SKEW_AVERAGE) ? duration/AUDIO_CLOCK_SKEW_AVERAGE : 1)*(skew - m_stats.m_skew);
+	m_stats.m_drift = (m_next - m_origin - (double)m_frames/m_sampleRate)*1000;
+	if (fabs(error)*1000 > m_stats.m_jitter)
+	{
+		m_stats.m_jitter = fabs(error)*1000;
+	}
+
+	time_t now = time(NULL);
+	if (now - m_reportTime >= 10)
+	{
+		LOG(NOTICE) << "audio clock skew:" << m_stats.m_skew << "ppm drift:" << m_stats.m_drift << "ms jitter:" << m_stats.m_jitter << "ms resyncs:" << m_stats.m_resyncs;
+		m_stats.m_jitter = 0;
+		m_reportTime = now;
+	}
+}
@@ -0,0 +1,396 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioEncoder.cpp
+**
+** Audio encoding stage (G.711 A-law/u-law, Opus) between the capture and the live555 source
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <sstream>
+#include <alsa/asoundlib.h>
+
+#include "logger.h"
+#include "AudioEncoder.h"
+
+// ---------------------------------
+// G.711 reference encoders (ITU-T G.191 / Sun g711.c), used to fill the tables
+// ---------------------------------
+static const short s_segUEnd[8] = { 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF };
+static const short s_segAEnd[8] = { 0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF };
+
+static int segment(int value, const short* table)
+{
+	int seg = 0;
+	while ( (seg < 8) && (value > table[seg]) )
+	{
+		seg++;
+	}
+	return seg;
+}
+
+static unsigned char linearToUlaw(int sample)
+{
+	int mask = 0xFF;
+	int value = sample >> 2;
+	if (value < 0)
+	{
+		value = -value;
+		mask = 0x7F;
+	}
+	if (value > 8159)
+	{
+		value = 8159;
+	}
+	value += 0x84 >> 2;
+	int seg = segment(value, s_segUEnd);
+	if (seg >= 8)
+	{
+		return 0x7F ^ mask;
+	}
+	return ((seg << 4) | ((value >> (seg + 1)) & 0xF)) ^ mask;
+}
+
+static unsigned char linearToAlaw(int sample)
+{
+	int mask = 0xD5;
+	int value = sample >> 3;
+	if (value < 0)
+	{
+		mask = 0x55;
+		value = -value - 1;
+	}
+	int seg = segment(value, s_segAEnd);
+	if (seg >= 8)
+	{
+		return 0x7F ^ mask;
+	}
+	int aval = seg << 4;
+	aval |= (seg < 2) ? ((value >> 1) & 0xF) : ((value >> seg) & 0xF);
+	return aval ^ mask;
+}
+
+static short ulawToLinear(unsigned char code)
+{
+	code = ~code;
+	int value = (((code & 0x0F) << 3) + 0x84) << ((code & 0x70) >> 4);
+	return (code & 0x80) ? (0x84 - value) : (value - 0x84);
+}
+
+static short alawToLinear(unsigned char code)
+{
+	code ^= 0x55;
+	int value = (code & 0x0F) << 4;
+	int seg = (code & 0x70) >> 4;
+	if (seg == 0)
+	{
+		value += 8;
+	}
+	else
+	{
+		value = (value + 0x108) << (seg - 1);
+	}
+	return (code & 0x80) ? value : -value;
+}
+
+// the codes only depend on the 14 (u-law) or 13 (A-law) high bits of the sample
+struct G711Tables
+{
+	G711Tables()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			m_ulawToLinear[i] = ulawToLinear(i);
+			m_alawToLinear[i] = alawToLinear(i);
+		}
+		for (int i = 0; i < 16384; ++i)
+		{
+			m_ulaw[i] = linearToUlaw((short)(i << 2));
+		}
+		for (int i = 0; i < 8192; ++i)
+		{
+			m_alaw[i] = linearToAlaw((short)(i << 3));
+		}
+	}
+	unsigned char m_ulaw[16384];
+	unsigned char m_alaw[8192];
+	short         m_ulawToLinear[256];
+	short         m_alawToLinear[256];
+};
+
+static const G711Tables & getG711Tables()
+{
+	static const G711Tables tables;
+	return tables;
+}
+
+// network order 16 bits samples to 8 bits codes, in place
+static void encodeG711(unsigned char* buffer, size_t samples, const unsigned char* table, int shift)
+{
+	unsigned int mask = 0xFFFF >> shift;
+	for (size_t i = 0; i < samples; ++i)
+	{
+		unsigned int sample = (buffer[2*i] << 8) | buffer[2*i+1];
+		buffer[i] = table[(sample >> shift) & mask];
+	}
+}
+
+void decodeG711(const unsigned char* codes, size_t count, short* samples, bool ulaw)
+{
+	const G711Tables & tables = getG711Tables();
+	const short* table = ulaw ? tables.m_ulawToLinear : tables.m_alawToLinear;
+	for (size_t i = 0; i < count; ++i)
+	{
+		samples[i] = table[codes[i]];
+	}
+}
+
+// ---------------------------------
+// AudioEncoderDevice
+// ---------------------------------
+AudioEncoderDevice* AudioEncoderDevice::createNew(DeviceInterface* device, const std::string & codec, unsigned int sampleRate, unsigned int channels, int format, unsigned int bitrate)
+{
+	snd_pcm_format_t fmt = (snd_pcm_format_t)format;
+	if ( (fmt != SND_PCM_FORMAT_S16_LE) && (fmt != SND_PCM_FORMAT_S16_BE) )
+	{
+		LOG(WARN) << "audio encoder " << codec << " needs 16 bits samples, format:" << format;
+		return NULL;
+	}
+	if ( ((codec == "PCMU") || (codec == "PCMA")) && (sampleRate != 8000) )
+	{
+		// clients play G.711 at 8000Hz whatever the SDP announces
+		LOG(WARN) << "audio encoder " << codec << " needs 8000Hz, rate:" << sampleRate;
+		return NULL;
+	}
+
+	AudioEncoderDevice* encoder = new AudioEncoderDevice(device, codec, sampleRate, channels);
+	if ( (codec == "PCMU") || (codec == "PCMA") )
+	{
+		getG711Tables();
+	}
+	else if ( (codec != "OPUS") || !encoder->initOpus(bitrate) )
+	{
+		LOG(WARN) << "audio encoder " << codec << " not available for " << sampleRate << "Hz";
+		encoder->m_device = NULL; // the caller keeps the device
+		delete encoder;
+		encoder = NULL;
+	}
+	return encoder;
+}
+
+AudioEncoderDevice::AudioEncoderDevice(DeviceInterface* device, const std::string & codec, unsigned int sampleRate, unsigned int channels)
+	: m_device(device), m_codec(codec), m_sampleRate(sampleRate), m_channels(channels), m_samplesRead(0), m_pending(false), m_frameSize(0)
+#ifdef HAVE_OPUS
+	, m_opus(NULL)
+#endif
+	, m_inBytes(0), m_outBytes(0), m_encodeTime(0), m_periods(0), m_reportTime(time(NULL))
+{
+	timerclear(&m_samplesTime);
+	timerclear(&m_frameTime);
+}
+
+AudioEncoderDevice::~AudioEncoderDevice()
+{
+#ifdef HAVE_OPUS
+	if (m_opus != NULL)
+	{
+		opus_encoder_destroy(m_opus);
+	}
+#endif
+	delete m_device;
+}
+
+std::string AudioEncoderDevice::getRtpFormat()
+{
+	std::ostringstream os;
+	if (m_codec == "OPUS")
+	{
+		// RFC 7587 : always announced as 48000 Hz stereo
+		os << "audio/OPUS/48000/2";
+	}
+	else
+	{
+		os << "audio/" << m_codec << "/" << m_sampleRate << "/" << m_channels;
+	}
+	return os.str();
+}
+
+int AudioEncoderDevice::getCaptureFormat()
+{
+	int format = m_device->getCaptureFormat();
+	if (m_codec == "PCMU")
+	{
+		format = SND_PCM_FORMAT_MU_LAW;
+	}
+	else if (m_codec == "PCMA")
+	{
+		format = SND_PCM_FORMAT_A_LAW;
+	}
+	return format;
+}
+
+// one Opus frame per read, up to 60ms; a longer period leaves whole frames buffered that the next reads return
+bool AudioEncoderDevice::initOpus(unsigned int bitrate)
+{
+#ifdef HAVE_OPUS
+	int err = 0;
+	m_opus = opus_encoder_create(m_sampleRate, m_channels, OPUS_APPLICATION_VOIP, &err);
+	if (m_opus == NULL)
+	{
+		LOG(WARN) << "opus encoder error:" << opus_strerror(err);
+		return false;
+	}
+	opus_encoder_ctl(m_opus, OPUS_SET_BITRATE(bitrate));
+
+	unsigned int periodFrames = m_device->getBufferSize() / (2*m_channels);
+	static const unsigned int durations[] = { 10, 20, 40, 60 };
+	for (unsigned int i = 0; i < sizeof(durations)/sizeof(durations[0]); ++i)
+	{
+		m_frameSize = m_sampleRate*durations[i]/1000;
+		if (m_frameSize >= periodFrames)
+		{
+			break;
+		}
+	}
+	m_period.resize(m_device->getBufferSize());
+	LOG(NOTICE) << "opus encoder rate:" << m_sampleRate << " channels:" << m_channels << " frame:" << m_frameSize*1000/m_sampleRate << "ms bitrate:" << bitrate;
+	return true;
+#else
+	(void)bitrate;
+	return false;
+#endif
+}
+
+size_t AudioEncoderDevice::read(char* buffer, size_t bufferSize)
+{
+	if (m_codec == "OPUS")
+	{
+		return this->readOpus(buffer, bufferSize);
+	}
+
+	// a negative read is an error of the device, it is forwarded unencoded
+	ssize_t size = m_device->read(buffer, bufferSize);
+	if (size > 0)
+	{
+		timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		const G711Tables & tables = getG711Tables();
+		if (m_codec == "PCMU")
+		{
+			encodeG711((unsigned char*)buffer, size/2, tables.m_ulaw, 2);
+		}
+		else
+		{
+			encodeG711((unsigned char*)buffer, size/2, tables.m_alaw, 3);
+		}
+		this->updateStats(size, size/2, start);
+		size /= 2;
+	}
+	return size;
+}
+
+// the Opus frames get the time of their first sample, the G.711 codes the one of the device
+void AudioEncoderDevice::adjustPresentationTime(timeval & tv)
+{
+	if (m_codec != "OPUS")
+	{
+		m_device->adjustPresentationTime(tv);
+	}
+	else if (m_pending)
+	{
+		tv = m_frameTime;
+		m_pending = false;
+	}
+}
+
+// periods are gathered until an Opus frame is complete, a frame already buffered is encoded
+// before the device is read again so that the backlog stays under a frame and a period
+size_t AudioEncoderDevice::readOpus(char* buffer, size_t bufferSize)
+{
+	ssize_t size = 0;
+#ifdef HAVE_OPUS
+	size_t frameSamples = m_frameSize*m_channels;
+	while (m_samples.size() - m_samplesRead < frameSamples)
+	{
+		timeval readTime;
+		gettimeofday(&readTime, NULL);
+		ssize_t read = m_device->read(&m_period[0], m_period.size());
+		if (read <= 0)
+		{
+			return read;
+		}
+		m_device->adjustPresentationTime(readTime);
+
+		// the samples left from the previous reads come just before this period
+		size_t waiting = (m_samples.size() - m_samplesRead)/m_channels;
+		int64_t usec = (int64_t)readTime.tv_sec*1000000 + readTime.tv_usec - (int64_t)waiting*1000000/m_sampleRate;
+		m_samplesTime.tv_sec = usec/1000000;
+		m_samplesTime.tv_usec = usec%1000000;
+
+		const unsigned char* data = (const unsigned char*)&m_period[0];
+		for (ssize_t i = 0; i + 1 < read; i += 2)
+		{
+			m_samples.push_back((short)((data[i] << 8) | data[i+1]));
+		}
+	}
+
+	timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	opus_int32 ret = opus_encode(m_opus, &m_samples[m_samplesRead], m_frameSize, (unsigned char*)buffer, bufferSize);
+
+	// the frames are read at an offset, the buffer is compacted once half of it was read
+	m_samplesRead += frameSamples;
+	if (2*m_samplesRead >= m_samples.size())
+	{
+		m_samples.erase(m_samples.begin(), m_samples.begin() + m_samplesRead);
+		m_samplesRead = 0;
+	}
+	m_frameTime = m_samplesTime;
+	m_pending = true;
+	int64_t usec = (int64_t)m_samplesTime.tv_usec + (int64_t)m_frameSize*1000000/m_sampleRate;
+	m_samplesTime.tv_sec += usec/1000000;
+	m_samplesTime.tv_usec = usec%1000000;
+
+	if (ret < 0)
+	{
+		LOG(WARN) << "opus encode error:" << opus_strerror(ret);
+		return 0;
+	}
+	size = ret;
+	this->updateStats(frameSamples*2, size, start);
+#else
+	(void)buffer;
+	(void)bufferSize;
+#endif
+	return size;
+}
+
+// PCM and encoded bandwidth with the encoding time, logged every 10s
+void AudioEncoderDevice::updateStats(size_t inSize, size_t outSize, const timespec & start)
+{
+	timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	m_encodeTime += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+	m_inBytes += inSize;
+	m_outBytes += outSize;
+	m_periods++;
+
+	time_t now = time(NULL);
+	if (now - m_reportTime >= 10)
+	{
+		double duration = now - m_reportTime;
+		double audioTime = (double)m_inBytes/(2*m_channels*m_sampleRate);
+		LOG(NOTICE) << "audio encoder:" << m_codec << " pcm:" << (int)(m_inBytes*8/duration/1000) << "kbps"
+			<< " encoded:" << (int)(m_outBytes*8/duration/1000) << "kbps"
+			<< " encode avg:" << (int)(m_encodeTime*1e6/m_periods) << "us"
+			<< " load:" << ((audioTime > 0) ? m_encodeTime*100/audioTime : 0) << "%";
+		m_inBytes = 0;
+		m_outBytes = 0;
+		m_encodeTime = 0;
+		m_periods = 0;
+		m_reportTime = now;
+	}
+}
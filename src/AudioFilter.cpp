@@ -0,0 +1,115 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioFilter.cpp
+**
+** Audio processing stage between the ALSA capture and the live555 source
+**
+** -------------------------------------------------------------------------*/
+
+#include <alsa/asoundlib.h>
+
+#include "logger.h"
+#include "AudioFilter.h"
+#include "PCMByteSwap.h"
+
+AudioFilterDevice* AudioFilterDevice::createNew(DeviceInterface* device, unsigned int sampleRate, unsigned int channels, int format)
+{
+	// the capture delivers the samples in network order
+	snd_pcm_format_t fmt = (snd_pcm_format_t)format;
+	if ( (fmt != SND_PCM_FORMAT_S16_LE) && (fmt != SND_PCM_FORMAT_S16_BE) )
+	{
+		LOG(WARN) << "audio filters need 16 bits samples, format:" << format << " is not filtered";
+		return NULL;
+	}
+	if ( (sampleRate == 0) || (channels == 0) )
+	{
+		LOG(WARN) << "audio filters cannot process " << sampleRate << "Hz/" << channels;
+		return NULL;
+	}
+	return new AudioFilterDevice(device, sampleRate, channels);
+}
+
+AudioFilterDevice::AudioFilterDevice(DeviceInterface* device, unsigned int sampleRate, unsigned int channels)
+	: m_device(device), m_sampleRate(sampleRate), m_channels(channels)
+	, m_processTime(0), m_maxProcessTime(0), m_audioTime(0), m_periods(0), m_reportTime(time(NULL))
+{
+}
+
+AudioFilterDevice::~AudioFilterDevice()
+{
+	while (!m_filters.empty())
+	{
+		delete m_filters.front();
+		m_filters.pop_front();
+	}
+	delete m_device;
+}
+
+void AudioFilterDevice::addFilter(AudioFilter* filter)
+{
+	m_filters.push_back(filter);
+	if (!m_names.empty())
+	{
+		m_names += ",";
+	}
+	m_names += filter->getName();
+}
+
+// a negative read is an error of the device, it is forwarded unprocessed
+size_t AudioFilterDevice::read(char* buffer, size_t bufferSize)
+{
+	ssize_t size = m_device->read(buffer, bufferSize);
+	if ( (size > 0) && !m_filters.empty() )
+	{
+		timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		unsigned int frames = size / (2*m_channels);
+		short* samples = (short*)buffer;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		pcmByteSwap((unsigned char*)buffer, size, 2);
+#endif
+		std::list<AudioFilter*>::iterator it;
+		for (it = m_filters.begin(); it != m_filters.end(); ++it)
+		{
+			(*it)->process(samples, frames);
+		}
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		pcmByteSwap((unsigned char*)buffer, size, 2);
+#endif
+		this->updateBudget(frames, start);
+	}
+	return size;
+}
+
+// time spent in the filters for each period, logged every 10s
+void AudioFilterDevice::updateBudget(size_t frames, const timespec & start)
+{
+	timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+
+	m_processTime += elapsed;
+	m_audioTime += (double)frames/m_sampleRate;
+	m_periods++;
+	if (elapsed > m_maxProcessTime)
+	{
+		m_maxProcessTime = elapsed;
+	}
+
+	time_t now = time(NULL);
+	if ( (now - m_reportTime >= 10) && (m_periods > 0) && (m_audioTime > 0) )
+	{
+		LOG(NOTICE) << "audio filters:" << m_names << " period:" << (int)(m_audioTime*1000/m_periods) << "ms"
+			<< " process avg:" << (int)(m_processTime*1e6/m_periods) << "us max:" << (int)(m_maxProcessTime*1e6) << "us"
+			<< " load:" << (int)(m_processTime*100/m_audioTime) << "%";
+		m_processTime = 0;
+		m_maxProcessTime = 0;
+		m_audioTime = 0;
+		m_periods = 0;
+		m_reportTime = now;
+	}
+}
@@ -0,0 +1,352 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioMixer.cpp
+**
+** Mix of several audio captures, aligned on their presentation times
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <sys/types.h>
+#include <alsa/asoundlib.h>
+
+#include "logger.h"
+#include "AudioMixer.h"
+#include "PCMByteSwap.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MIXER_KERNEL "sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MIXER_KERNEL "neon"
+#else
+#define MIXER_KERNEL "scalar"
+#endif
+
+// an input further than this from the first one is realigned, in us
+#define AUDIO_MIXER_TOLERANCE 10000
+#define AUDIO_MIXER_GAIN_SHIFT 12
+// consecutive reads without data before an input is given up, the capture recovers the xruns itself
+#define AUDIO_MIXER_MAX_FAILURES 10
+
+// mix += samples*gain, saturated
+static void mixSamples(short* mix, const short* samples, unsigned int count, short gain)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	__m128i g = _mm_set1_epi16(gain);
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i*)(samples + i));
+		__m128i lo = _mm_mullo_epi16(s, g);
+		__m128i hi = _mm_mulhi_epi16(s, g);
+		__m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), AUDIO_MIXER_GAIN_SHIFT);
+		__m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), AUDIO_MIXER_GAIN_SHIFT);
+		__m128i m = _mm_loadu_si128((const __m128i*)(mix + i));
+		_mm_storeu_si128((__m128i*)(mix + i), _mm_adds_epi16(m, _mm_packs_epi32(p0, p1)));
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	int16x4_t g = vdup_n_s16(gain);
+	for (; i + 8 <= count; i += 8)
+	{
+		int16x8_t s = vld1q_s16(samples + i);
+		int16x4_t lo = vqshrn_n_s32(vmull_s16(vget_low_s16(s), g), AUDIO_MIXER_GAIN_SHIFT);
+		int16x4_t hi = vqshrn_n_s32(vmull_s16(vget_high_s16(s), g), AUDIO_MIXER_GAIN_SHIFT);
+		vst1q_s16(mix + i, vqaddq_s16(vld1q_s16(mix + i), vcombine_s16(lo, hi)));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		int value = mix[i] + ((samples[i]*gain) >> AUDIO_MIXER_GAIN_SHIFT);
+		if (value > 32767)
+		{
+			value = 32767;
+		}
+		else if (value < -32768)
+		{
+			value = -32768;
+		}
+		mix[i] = (short)value;
+	}
+}
+
+static long long toMicroseconds(const timeval & tv)
+{
+	return (long long)tv.tv_sec*1000000 + tv.tv_usec;
+}
+
+static void addMicroseconds(timeval & tv, long long usec)
+{
+	usec += toMicroseconds(tv);
+	tv.tv_sec = usec/1000000;
+	tv.tv_usec = usec%1000000;
+}
+
+AudioMixerDevice* AudioMixerDevice::createNew(const std::vector<DeviceInterface*> & inputs, unsigned int sampleRate, unsigned int channels, int format)
+{
+	snd_pcm_format_t fmt = (snd_pcm_format_t)format;
+	if ( (fmt != SND_PCM_FORMAT_S16_LE) && (fmt != SND_PCM_FORMAT_S16_BE) )
+	{
+		LOG(WARN) << "audio mixer needs 16 bits samples, format:" << format;
+		return NULL;
+	}
+	if ( inputs.empty() || (sampleRate == 0) || (channels == 0) )
+	{
+		return NULL;
+	}
+	return new AudioMixerDevice(inputs, sampleRate, channels);
+}
+
+AudioMixerDevice::AudioMixerDevice(const std::vector<DeviceInterface*> & inputs, unsigned int sampleRate, unsigned int channels)
+	: m_inputs(inputs.begin(), inputs.end()), m_sampleRate(sampleRate), m_channels(channels), m_pending(false), m_reportTime(time(NULL))
+{
+	pthread_mutex_init(&m_mutex, NULL);
+	timerclear(&m_time);
+
+	unsigned long bufferSize = 0;
+	for (unsigned int i = 0; i < m_inputs.size(); ++i)
+	{
+		if (m_inputs[i].m_device->getBufferSize() > bufferSize)
+		{
+			bufferSize = m_inputs[i].m_device->getBufferSize();
+		}
+	}
+	m_period.resize(bufferSize);
+	LOG(NOTICE) << "audio mixer inputs:" << m_inputs.size() << " rate:" << sampleRate << " channels:" << channels << " kernel:" << MIXER_KERNEL;
+}
+
+AudioMixerDevice::~AudioMixerDevice()
+{
+	for (unsigned int i = 0; i < m_inputs.size(); ++i)
+	{
+		delete m_inputs[i].m_device;
+	}
+	pthread_mutex_destroy(&m_mutex);
+}
+
+bool AudioMixerDevice::setGain(unsigned int input, float gain)
+{
+	if (input >= m_inputs.size())
+	{
+		return false;
+	}
+	float max = 32767.0f/(1 << AUDIO_MIXER_GAIN_SHIFT);
+	gain = (gain < 0) ? 0 : ((gain > max) ? max : gain);
+	pthread_mutex_lock(&m_mutex);
+	m_inputs[input].m_gain = (short)(gain*(1 << AUDIO_MIXER_GAIN_SHIFT) + 0.5f);
+	pthread_mutex_unlock(&m_mutex);
+	LOG(NOTICE) << "audio mixer input:" << input << " gain:" << gain;
+	return true;
+}
+
+bool AudioMixerDevice::setMute(unsigned int input, bool mute)
+{
+	if (input >= m_inputs.size())
+	{
+		return false;
+	}
+	pthread_mutex_lock(&m_mutex);
+	m_inputs[input].m_mute = mute;
+	pthread_mutex_unlock(&m_mutex);
+	LOG(NOTICE) << "audio mixer input:" << input << " mute:" << mute;
+	return true;
+}
+
+float AudioMixerDevice::getGain(unsigned int input)
+{
+	float gain = 0;
+	if (input < m_inputs.size())
+	{
+		pthread_mutex_lock(&m_mutex);
+		gain = (float)m_inputs[input].m_gain/(1 << AUDIO_MIXER_GAIN_SHIFT);
+		pthread_mutex_unlock(&m_mutex);
+	}
+	return gain;
+}
+
+bool AudioMixerDevice::isMuted(unsigned int input)
+{
+	bool mute = false;
+	if (input < m_inputs.size())
+	{
+		pthread_mutex_lock(&m_mutex);
+		mute = m_inputs[input].m_mute;
+		pthread_mutex_unlock(&m_mutex);
+	}
+	return mute;
+}
+
+// a period of the first input, mixed with the same time span of the others
+// the error of the first input is returned once it failed persistently
+size_t AudioMixerDevice::read(char* buffer, size_t bufferSize)
+{
+	Input & first = m_inputs[0];
+	timeval readTime;
+	ssize_t size = 0;
+	do
+	{
+		size = this->readInput(first, readTime);
+	}
+	while ( (size <= 0) && !first.m_failed );
+	if (size <= 0)
+	{
+		return size;
+	}
+	m_time = first.m_time;
+	unsigned int frames = first.m_samples.size() / m_channels;
+	unsigned int maxFrames = bufferSize / (2*m_channels);
+	if (frames > maxFrames)
+	{
+		frames = maxFrames;
+	}
+	unsigned int count = frames*m_channels;
+	m_pending = true;
+
+	std::vector<short> gains(m_inputs.size());
+	pthread_mutex_lock(&m_mutex);
+	for (unsigned int i = 0; i < m_inputs.size(); ++i)
+	{
+		gains[i] = m_inputs[i].m_mute ? 0 : m_inputs[i].m_gain;
+	}
+	pthread_mutex_unlock(&m_mutex);
+
+	m_mix.assign(count, 0);
+	for (unsigned int i = 0; i < m_inputs.size(); ++i)
+	{
+		Input & input = m_inputs[i];
+		// the muted inputs are read too, they stay aligned
+		if ( (i == 0) || this->alignInput(input, m_time, frames) )
+		{
+			if (gains[i] != 0)
+			{
+				mixSamples(&m_mix[0], &input.m_samples[0], count, gains[i]);
+			}
+			input.m_samples.erase(input.m_samples.begin(), input.m_samples.begin() + count);
+			addMicroseconds(input.m_time, (long long)frames*1000000/m_sampleRate);
+		}
+	}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	pcmByteSwapCopy((unsigned char*)buffer, (const unsigned char*)&m_mix[0], count*2, 2);
+#else
+	memcpy(buffer, &m_mix[0], count*2);
+#endif
+	this->updateStats();
+	return count*2;
+}
+
+// the time of the first input, the inputs are aligned on it
+void AudioMixerDevice::adjustPresentationTime(timeval & tv)
+{
+	if (m_pending)
+	{
+		tv = m_time;
+		m_pending = false;
+	}
+}
+
+// append a read of the input, time is the one of its first sample
+ssize_t AudioMixerDevice::readInput(Input & input, timeval & time)
+{
+	if (input.m_failed)
+	{
+		return 0;
+	}
+	gettimeofday(&time, NULL);
+	ssize_t size = input.m_device->read(&m_period[0], m_period.size());
+	if (size <= 0)
+	{
+		input.m_failures++;
+		LOG(WARN) << "audio mixer input:" << (&input - &m_inputs[0]) << " read failed:" << size << " failures:" << input.m_failures;
+		if (input.m_failures >= AUDIO_MIXER_MAX_FAILURES)
+		{
+			LOG(ERROR) << "audio mixer input:" << (&input - &m_inputs[0]) << " failed";
+			input.m_failed = true;
+		}
+		return size;
+	}
+	input.m_failures = 0;
+	input.m_device->adjustPresentationTime(time);
+	if (input.m_samples.empty())
+	{
+		input.m_time = time;
+	}
+	unsigned int count = size/2;
+	size_t offset = input.m_samples.size();
+	input.m_samples.resize(offset + count);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	pcmByteSwapCopy((unsigned char*)&input.m_samples[offset], (const unsigned char*)&m_period[0], count*2, 2);
+#else
+	memcpy(&input.m_samples[offset], &m_period[0], count*2);
+#endif
+	return size;
+}
+
+// the samples of the input from the time of the first input, older ones are dropped and missing ones are silence
+bool AudioMixerDevice::alignInput(Input & input, const timeval & time, unsigned int frames)
+{
+	while (true)
+	{
+		if (!input.m_samples.empty())
+		{
+			// out of the tolerance the offset is corrected completely, the small drifts do not make glitches
+			long long offset = toMicroseconds(input.m_time) - toMicroseconds(time);
+			if ( (offset < -AUDIO_MIXER_TOLERANCE) || (offset > AUDIO_MIXER_TOLERANCE) )
+			{
+				input.m_aligned = false;
+			}
+			if (!input.m_aligned && (offset < 0))
+			{
+				unsigned int drop = -offset*m_sampleRate/1000000;
+				input.m_aligned = (drop <= input.m_samples.size()/m_channels);
+				if (!input.m_aligned)
+				{
+					drop = input.m_samples.size()/m_channels;
+				}
+				input.m_samples.erase(input.m_samples.begin(), input.m_samples.begin() + drop*m_channels);
+				addMicroseconds(input.m_time, (long long)drop*1000000/m_sampleRate);
+				input.m_dropped += drop;
+			}
+			else if (!input.m_aligned)
+			{
+				unsigned int insert = offset*m_sampleRate/1000000;
+				input.m_samples.insert(input.m_samples.begin(), insert*m_channels, 0);
+				addMicroseconds(input.m_time, -(long long)insert*1000000/m_sampleRate);
+				input.m_inserted += insert;
+				input.m_aligned = true;
+			}
+		}
+		if (input.m_samples.size() >= frames*m_channels)
+		{
+			return true;
+		}
+		// an input without data is silent for this period and aligned again on its next read
+		timeval readTime;
+		if (this->readInput(input, readTime) <= 0)
+		{
+			input.m_samples.clear();
+			input.m_aligned = false;
+			return false;
+		}
+	}
+}
+
+void AudioMixerDevice::updateStats()
+{
+	time_t now = time(NULL);
+	if (now - m_reportTime >= 10)
+	{
+		for (unsigned int i = 0; i < m_inputs.size(); ++i)
+		{
+			Input & input = m_inputs[i];
+			LOG(NOTICE) << "audio mixer input:" << i << " gain:" << this->getGain(i) << " mute:" << this->isMuted(i)
+				<< " failed:" << input.m_failed << " dropped:" << input.m_dropped << " inserted:" << input.m_inserted
+				<< " waiting:" << input.m_samples.size()/m_channels*1000/m_sampleRate << "ms";
+		}
+		m_reportTime = now;
+	}
+}
@@ -0,0 +1,283 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioResampler.cpp
+**
+** Channel down-mix and polyphase resampling stage after the ALSA capture
+**
+** -------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <sstream>
+#include <alsa/asoundlib.h>
+
+#include "logger.h"
+#include "AudioResampler.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RESAMPLER_KERNEL "sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESAMPLER_KERNEL "neon"
+#else
+#define RESAMPLER_KERNEL "scalar"
+#endif
+
+// Q14 coefficients, a phase sums to 1 so the 32 bits accumulator cannot overflow
+#define RESAMPLER_SHIFT 14
+
+// more phases would make the coefficients table too large for the cache
+#define RESAMPLER_MAX_PHASES 1024
+
+// count is a multiple of 8
+static int dotProduct(const short* coefs, const short* samples, unsigned int count)
+{
+#if defined(__SSE2__)
+	__m128i acc = _mm_setzero_si128();
+	for (unsigned int i = 0; i < count; i += 8)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i*)(coefs + i));
+		__m128i s = _mm_loadu_si128((const __m128i*)(samples + i));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(c, s));
+	}
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(acc);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	int32x4_t acc = vdupq_n_s32(0);
+	for (unsigned int i = 0; i < count; i += 8)
+	{
+		acc = vmlal_s16(acc, vld1_s16(coefs + i), vld1_s16(samples + i));
+		acc = vmlal_s16(acc, vld1_s16(coefs + i + 4), vld1_s16(samples + i + 4));
+	}
+	int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+	return vget_lane_s32(vpadd_s32(sum, sum), 0);
+#else
+	int acc = 0;
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		acc += coefs[i] * samples[i];
+	}
+	return acc;
+#endif
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while (b != 0)
+	{
+		unsigned int r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+AudioResamplerDevice* AudioResamplerDevice::createNew(DeviceInterface* device, unsigned int inRate, unsigned int inChannels, int format, unsigned int outRate, unsigned int outChannels)
+{
+	snd_pcm_format_t fmt = (snd_pcm_format_t)format;
+	if ( (fmt != SND_PCM_FORMAT_S16_LE) && (fmt != SND_PCM_FORMAT_S16_BE) )
+	{
+		LOG(WARN) << "audio resampler needs 16 bits samples, format:" << format;
+		return NULL;
+	}
+	// down-mix to mono, duplicate a mono capture, or keep the channels
+	if ( (inRate == 0) || (outRate == 0) || (inChannels == 0) || (outChannels == 0)
+		|| ((outChannels != 1) && (outChannels != inChannels) && (inChannels != 1)) )
+	{
+		LOG(WARN) << "audio resampler cannot convert " << inRate << "Hz/" << inChannels << " to " << outRate << "Hz/" << outChannels;
+		return NULL;
+	}
+
+	AudioResamplerDevice* resampler = new AudioResamplerDevice(device, inRate, inChannels, outRate, outChannels);
+	if (!resampler->initFilter())
+	{
+		resampler->m_device = NULL; // the caller keeps the device
+		delete resampler;
+		resampler = NULL;
+	}
+	return resampler;
+}
+
+AudioResamplerDevice::AudioResamplerDevice(DeviceInterface* device, unsigned int inRate, unsigned int inChannels, unsigned int outRate, unsigned int outChannels)
+	: m_device(device), m_inRate(inRate), m_inChannels(inChannels), m_outRate(outRate), m_outChannels(outChannels)
+	, m_up(1), m_down(1), m_taps(8), m_phase(0), m_position(0)
+{
+}
+
+AudioResamplerDevice::~AudioResamplerDevice()
+{
+	delete m_device;
+}
+
+std::string AudioResamplerDevice::getRtpFormat()
+{
+	std::ostringstream os;
+	os << "audio/L16/" << m_outRate << "/" << m_outChannels;
+	return os.str();
+}
+
+// output of the longest period, plus the sample the phase can add
+unsigned long AudioResamplerDevice::getBufferSize()
+{
+	unsigned long frames = m_device->getBufferSize() / (2*m_inChannels);
+	frames = (frames*m_up + m_down - 1)/m_down + 1;
+	return frames*2*m_outChannels;
+}
+
+// windowed sinc at the up-sampled rate, split in phases of m_taps input samples
+bool AudioResamplerDevice::initFilter()
+{
+	unsigned int divisor = gcd(m_inRate, m_outRate);
+	m_up = m_outRate / divisor;
+	m_down = m_inRate / divisor;
+	if (m_up > RESAMPLER_MAX_PHASES)
+	{
+		LOG(WARN) << "audio resampler ratio " << m_outRate << "/" << m_inRate << " needs too many phases";
+		return false;
+	}
+
+	// the filter spans 32 output samples, longer when decimating so the transition stays below the new Nyquist
+	double ratio = (double)m_down/m_up;
+	m_taps = (unsigned int)ceil(32*((ratio > 1) ? ratio : 1));
+	m_taps = (m_taps + 7) & ~7;
+	double transition = 5.5/m_taps;  // Blackman window, in cycles per input sample
+	double cutoff = 0.5*((ratio > 1) ? 1/ratio : 1) - transition/2;
+
+	unsigned int length = m_up*m_taps;
+	double center = (length - 1)/2.0;
+	double fc = cutoff/m_up;
+	std::vector<double> prototype(length);
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		double t = i - center;
+		double sinc = (t == 0) ? 2*fc : sin(2*M_PI*fc*t)/(M_PI*t);
+		double window = 0.42 - 0.5*cos(2*M_PI*i/(length - 1)) + 0.08*cos(4*M_PI*i/(length - 1));
+		prototype[i] = sinc*window;
+	}
+
+	m_coefs.resize(length);
+	for (unsigned int phase = 0; phase < m_up; ++phase)
+	{
+		double sum = 0;
+		for (unsigned int k = 0; k < m_taps; ++k)
+		{
+			sum += prototype[phase + k*m_up];
+		}
+		for (unsigned int k = 0; k < m_taps; ++k)
+		{
+			// reversed, the newest sample is the last of the window
+			double coef = prototype[phase + k*m_up]/sum;
+			m_coefs[phase*m_taps + m_taps - 1 - k] = (short)lrint(coef*(1 << RESAMPLER_SHIFT));
+		}
+	}
+
+	m_period.resize(m_device->getBufferSize());
+	m_history.assign(m_outChannels, std::vector<short>(m_taps - 1, 0));
+	LOG(NOTICE) << "audio resampler " << m_inRate << "Hz/" << m_inChannels << " to " << m_outRate << "Hz/" << m_outChannels
+		<< " phases:" << m_up << " taps:" << m_taps << " cutoff:" << (int)(cutoff*m_inRate) << "Hz kernel:" << RESAMPLER_KERNEL;
+	return true;
+}
+
+size_t AudioResamplerDevice::read(char* buffer, size_t bufferSize)
+{
+	int size = m_device->read(&m_period[0], m_period.size());
+	if (size <= 0)
+	{
+		return size;
+	}
+	unsigned int frames = size / (2*m_inChannels);
+	this->downmix((const unsigned char*)&m_period[0], frames);
+
+	unsigned int maxFrames = bufferSize / (2*m_outChannels);
+	m_output.resize((frames*m_up/m_down + 2)*m_outChannels);
+	unsigned int count = 0;
+	unsigned int phase = m_phase;
+	unsigned int position = m_position;
+	for (unsigned int channel = 0; channel < m_outChannels; ++channel)
+	{
+		// the channels advance together, the state is kept from the last one
+		phase = m_phase;
+		position = m_position;
+		count = this->resample(m_history[channel], &m_output[channel], frames, phase, position);
+	}
+	m_phase = phase;
+	m_position = position;
+
+	if (count > maxFrames)
+	{
+		LOG(WARN) << "audio resampler drop " << (count - maxFrames) << " frames";
+		count = maxFrames;
+	}
+	unsigned char* out = (unsigned char*)buffer;
+	for (unsigned int i = 0; i < count*m_outChannels; ++i)
+	{
+		out[2*i]   = (unsigned char)(m_output[i] >> 8);
+		out[2*i+1] = (unsigned char)(m_output[i] & 0xFF);
+	}
+	return count*2*m_outChannels;
+}
+
+// network order interleaved samples appended to the history of each output channel
+void AudioResamplerDevice::downmix(const unsigned char* data, unsigned int frames)
+{
+	for (unsigned int channel = 0; channel < m_outChannels; ++channel)
+	{
+		m_history[channel].reserve(m_taps - 1 + frames);
+	}
+	for (unsigned int i = 0; i < frames; ++i)
+	{
+		const unsigned char* frame = data + 2*m_inChannels*i;
+		if (m_outChannels == 1)
+		{
+			int sum = 0;
+			for (unsigned int channel = 0; channel < m_inChannels; ++channel)
+			{
+				sum += (short)((frame[2*channel] << 8) | frame[2*channel+1]);
+			}
+			m_history[0].push_back((short)(sum / (int)m_inChannels));
+		}
+		else
+		{
+			for (unsigned int channel = 0; channel < m_outChannels; ++channel)
+			{
+				unsigned int in = (m_inChannels == 1) ? 0 : channel;
+				m_history[channel].push_back((short)((frame[2*in] << 8) | frame[2*in+1]));
+			}
+		}
+	}
+}
+
+// polyphase FIR, an output sample every m_down/m_up input samples, written with a stride of m_outChannels
+unsigned int AudioResamplerDevice::resample(std::vector<short> & history, short* out, unsigned int frames, unsigned int & phase, unsigned int & position)
+{
+	const short* samples = &history[0];
+	unsigned int count = 0;
+	while (position < frames)
+	{
+		int acc = dotProduct(&m_coefs[phase*m_taps], samples + position, m_taps);
+		acc = (acc + (1 << (RESAMPLER_SHIFT - 1))) >> RESAMPLER_SHIFT;
+		if (acc > 32767)
+		{
+			acc = 32767;
+		}
+		else if (acc < -32768)
+		{
+			acc = -32768;
+		}
+		out[count*m_outChannels] = (short)acc;
+		count++;
+
+		phase += m_down;
+		position += phase / m_up;
+		phase %= m_up;
+	}
+	position -= frames;
+
+	// keep the samples of the next windows
+	history.erase(history.begin(), history.end() - (m_taps - 1));
+	return count;
+}
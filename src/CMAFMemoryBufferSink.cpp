@@ -0,0 +1,553 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** CMAFMemoryBufferSink.cpp
+**
+** Implement a live555 Sink that store H264/H265 fragmented MP4 (CMAF) slices in memory
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <sstream>
+#include <iomanip>
+
+#include "logger.h"
+#include "CMAFMemoryBufferSink.h"
+
+// -----------------------------------------
+//    ISO BMFF box writing
+// -----------------------------------------
+static void put8(std::vector<unsigned char> & out, unsigned char value)
+{
+	out.push_back(value);
+}
+
+static void put16(std::vector<unsigned char> & out, u_int16_t value)
+{
+	out.push_back(value>>8);
+	out.push_back(value&0xFF);
+}
+
+static void put32(std::vector<unsigned char> & out, u_int32_t value)
+{
+	out.push_back(value>>24);
+	out.push_back((value>>16)&0xFF);
+	out.push_back((value>>8)&0xFF);
+	out.push_back(value&0xFF);
+}
+
+static void put64(std::vector<unsigned char> & out, u_int64_t value)
+{
+	put32(out, value>>32);
+	put32(out, value&0xFFFFFFFF);
+}
+
+static void putData(std::vector<unsigned char> & out, const void* data, unsigned int size)
+{
+	out.insert(out.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+}
+
+static void set32(std::vector<unsigned char> & out, size_t pos, u_int32_t value)
+{
+	out[pos]   = value>>24;
+	out[pos+1] = (value>>16)&0xFF;
+	out[pos+2] = (value>>8)&0xFF;
+	out[pos+3] = value&0xFF;
+}
+
+// the size is written by endBox
+static size_t beginBox(std::vector<unsigned char> & out, const char* type)
+{
+	size_t pos = out.size();
+	put32(out, 0);
+	putData(out, type, 4);
+	return pos;
+}
+
+static size_t beginFullBox(std::vector<unsigned char> & out, const char* type, unsigned char version, u_int32_t flags)
+{
+	size_t pos = beginBox(out, type);
+	put32(out, (version<<24) | (flags&0xFFFFFF));
+	return pos;
+}
+
+static void endBox(std::vector<unsigned char> & out, size_t pos)
+{
+	set32(out, pos, out.size() - pos);
+}
+
+static void putMatrix(std::vector<unsigned char> & out)
+{
+	const u_int32_t unity[] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+	for (unsigned int i = 0; i < sizeof(unity)/sizeof(unity[0]); ++i)
+	{
+		put32(out, unity[i]);
+	}
+}
+
+// remove the emulation prevention bytes to read the SPS fields
+static std::string unescapeRbsp(const std::string & nal)
+{
+	std::string rbsp;
+	for (size_t i = 0; i < nal.size(); ++i)
+	{
+		if ( (i >= 2) && (nal[i] == 3) && (nal[i-1] == 0) && (nal[i-2] == 0) )
+		{
+			continue;
+		}
+		rbsp += nal[i];
+	}
+	return rbsp;
+}
+
+// -----------------------------------------
+//    CMAFMemoryBufferSink
+// -----------------------------------------
+CMAFMemoryBufferSink::CMAFMemoryBufferSink(UsageEnvironment& env, const std::string& format, int width, int height, unsigned int bufferSize, unsigned int sliceDuration, unsigned int windowDuration, unsigned int segmentCapacity, unsigned int partDurationMs)
+	: MemoryBufferSink(env, bufferSize, sliceDuration, windowDuration, segmentCapacity, partDurationMs)
+	, m_hevc(format == "video/H265"), m_width(width), m_height(height), m_parameterSetsChanged(false), m_sampleKeyFrame(false), m_samplePts(0), m_fragmentPts(0), m_fragmentSequence(0)
+{
+	LOG(NOTICE) << "CMAF format:" << format << " " << m_width << "x" << m_height;
+}
+
+void CMAFMemoryBufferSink::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime)
+{
+	if (numTruncatedBytes > 0)
+	{
+		envir() << "CMAFMemoryBufferSink::afterGettingFrame(): The input frame data was too large for our buffer size \n";
+		// realloc a bigger buffer
+		m_bufferSize += numTruncatedBytes;
+		delete[] m_buffer;
+		m_buffer = new unsigned char[m_bufferSize];
+	}
+	else
+	{
+		u_int64_t pts = (u_int64_t)presentationTime.tv_sec*90000 + presentationTime.tv_usec*9/100;
+
+		// the source may keep the start codes, then a frame can hold several NAL units
+		unsigned int start = 0;
+		if ( (frameSize >= 4) && (m_buffer[0] == 0) && (m_buffer[1] == 0) && ((m_buffer[2] == 1) || ((m_buffer[2] == 0) && (m_buffer[3] == 1))) )
+		{
+			start = (m_buffer[2] == 1) ? 3 : 4;
+			unsigned int i = start;
+			while (i + 3 <= frameSize)
+			{
+				if ( (m_buffer[i] == 0) && (m_buffer[i+1] == 0) && (m_buffer[i+2] == 1) )
+				{
+					unsigned int end = i;
+					while ( (end > start) && (m_buffer[end-1] == 0) )
+					{
+						end--;
+					}
+					this->processNal(m_buffer + start, end - start, pts);
+					i += 3;
+					start = i;
+				}
+				else
+				{
+					i++;
+				}
+			}
+		}
+		this->processNal(m_buffer + start, frameSize - start, pts);
+
+		this->notifyWaiters();
+	}
+
+	continuePlaying();
+}
+
+// parameter sets go to the init segment, the other NAL units to the current sample
+void CMAFMemoryBufferSink::processNal(const unsigned char* nal, unsigned int size, u_int64_t pts)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	std::string* parameterSet = NULL;
+	bool keyFrame = false;
+	if (m_hevc)
+	{
+		int type = (nal[0]&0x7E)>>1;
+		if (type == 32)      parameterSet = &m_vps;
+		else if (type == 33) parameterSet = &m_sps;
+		else if (type == 34) parameterSet = &m_pps;
+		else if (type == 35) return; // access unit delimiter
+		keyFrame = ( (type >= 16) && (type <= 21) );
+	}
+	else
+	{
+		int type = nal[0]&0x1F;
+		if (type == 7)       parameterSet = &m_sps;
+		else if (type == 8)  parameterSet = &m_pps;
+		else if (type == 9)  return; // access unit delimiter
+		keyFrame = (type == 5);
+	}
+
+	if (parameterSet != NULL)
+	{
+		std::string value((const char*)nal, size);
+		if (value != *parameterSet)
+		{
+			*parameterSet = value;
+			if (m_init)
+			{
+				// the samples gathered so far still use the previous init segment,
+				// a new one starts with the next keyframe, after a discontinuity
+				LOG(NOTICE) << "CMAF parameter sets changed";
+				m_parameterSetsChanged = true;
+			}
+		}
+		return;
+	}
+
+	if (!m_sample.empty() && (pts != m_samplePts))
+	{
+		this->closeSample(pts);
+	}
+	m_samplePts = pts;
+	m_sampleKeyFrame = m_sampleKeyFrame || keyFrame;
+	put32(m_sample, size);
+	putData(m_sample, nal, size);
+}
+
+// the sample duration is known when the next one starts, segments and parts are cut before it
+void CMAFMemoryBufferSink::closeSample(u_int64_t nextPts)
+{
+	u_int32_t duration = (nextPts > m_samplePts) ? (u_int32_t)(nextPts - m_samplePts) : 0;
+	if ( !m_init || (m_parameterSetsChanged && m_sampleKeyFrame) )
+	{
+		m_parameterSetsChanged = false;
+		this->buildInitSegment();
+	}
+
+	if (m_init)
+	{
+		if (!m_current)
+		{
+			// wait for a keyframe, players cannot start decoding elsewhere
+			if (m_sampleKeyFrame)
+			{
+				this->openSegment(m_samplePts);
+			}
+		}
+		else if (m_current->initId() != m_initId)
+		{
+			// a segment is decoded with a single init segment
+			this->flushFragment();
+			this->openSegment(m_samplePts);
+		}
+		else
+		{
+			if (this->isSegmentEnd(m_samplePts, m_sampleKeyFrame))
+			{
+				this->flushFragment();
+				this->openSegment(m_samplePts);
+			}
+			else if (this->isPartEnd(m_samplePts))
+			{
+				// one fragment per part
+				this->flushFragment();
+				this->openPart(m_samplePts, m_sampleKeyFrame);
+			}
+		}
+
+		if (m_current)
+		{
+			if (m_samples.empty())
+			{
+				m_fragmentPts = m_samplePts;
+			}
+			m_samples.push_back(Sample(m_sample.size(), duration, m_sampleKeyFrame));
+			m_mdat.insert(m_mdat.end(), m_sample.begin(), m_sample.end());
+		}
+	}
+
+	m_sample.clear();
+	m_sampleKeyFrame = false;
+}
+
+// moof+mdat of the gathered samples, appended to the current segment and part
+void CMAFMemoryBufferSink::flushFragment()
+{
+	if (m_samples.empty() || !m_current)
+	{
+		return;
+	}
+
+	m_moof.clear();
+	size_t moof = beginBox(m_moof, "moof");
+
+	size_t mfhd = beginFullBox(m_moof, "mfhd", 0, 0);
+	put32(m_moof, ++m_fragmentSequence);
+	endBox(m_moof, mfhd);
+
+	size_t traf = beginBox(m_moof, "traf");
+	size_t tfhd = beginFullBox(m_moof, "tfhd", 0, 0x020000); // default-base-is-moof
+	put32(m_moof, 1);
+	endBox(m_moof, tfhd);
+
+	// same timeline as the segments, the first one starts at 0
+	size_t tfdt = beginFullBox(m_moof, "tfdt", 1, 0);
+	put64(m_moof, m_current->startTime() + (m_fragmentPts - m_segmentPts));
+	endBox(m_moof, tfdt);
+
+	size_t trun = beginFullBox(m_moof, "trun", 0, 0x000701); // data offset, duration, size, flags
+	put32(m_moof, m_samples.size());
+	size_t dataOffset = m_moof.size();
+	put32(m_moof, 0);
+	std::vector<Sample>::iterator it;
+	for (it = m_samples.begin(); it != m_samples.end(); ++it)
+	{
+		put32(m_moof, it->m_duration);
+		put32(m_moof, it->m_size);
+		put32(m_moof, it->m_keyFrame ? 0x02000000 : 0x01010000);
+	}
+	endBox(m_moof, trun);
+	endBox(m_moof, traf);
+	endBox(m_moof, moof);
+
+	set32(m_moof, dataOffset, m_moof.size() + 8);
+	put32(m_moof, m_mdat.size() + 8);
+	putData(m_moof, "mdat", 4);
+
+	this->appendData(m_moof.data(), m_moof.size());
+	this->appendData(m_mdat.data(), m_mdat.size());
+
+	// buffers keep their capacity for the next fragment
+	m_samples.clear();
+	m_mdat.clear();
+}
+
+// ftyp+moov with a single video track, samples are described by the fragments
+void CMAFMemoryBufferSink::buildInitSegment()
+{
+	if ( (m_sps.size() < 4) || m_pps.empty() || (m_hevc && m_vps.empty()) )
+	{
+		return;
+	}
+	std::string sps(unescapeRbsp(m_sps));
+	if (m_hevc && (sps.size() < 15))
+	{
+		return;
+	}
+
+	std::vector<unsigned char> out;
+	size_t ftyp = beginBox(out, "ftyp");
+	putData(out, "iso6", 4);
+	put32(out, 0);
+	putData(out, "iso6cmfcmp41", 12);
+	endBox(out, ftyp);
+
+	size_t moov = beginBox(out, "moov");
+	size_t mvhd = beginFullBox(out, "mvhd", 0, 0);
+	put32(out, 0);              // creation time
+	put32(out, 0);              // modification time
+	put32(out, 1000);           // timescale
+	put32(out, 0);              // duration
+	put32(out, 0x00010000);     // rate
+	put16(out, 0x0100);         // volume
+	put16(out, 0);
+	put64(out, 0);
+	putMatrix(out);
+	for (int i = 0; i < 6; ++i) put32(out, 0);
+	put32(out, 2);              // next track id
+	endBox(out, mvhd);
+
+	size_t trak = beginBox(out, "trak");
+	size_t tkhd = beginFullBox(out, "tkhd", 0, 3); // enabled, in movie
+	put32(out, 0);
+	put32(out, 0);
+	put32(out, 1);              // track id
+	put32(out, 0);
+	put32(out, 0);              // duration
+	put64(out, 0);
+	put16(out, 0);              // layer
+	put16(out, 0);              // alternate group
+	put16(out, 0);              // volume
+	put16(out, 0);
+	putMatrix(out);
+	put32(out, m_width<<16);
+	put32(out, m_height<<16);
+	endBox(out, tkhd);
+
+	size_t mdia = beginBox(out, "mdia");
+	size_t mdhd = beginFullBox(out, "mdhd", 0, 0);
+	put32(out, 0);
+	put32(out, 0);
+	put32(out, 90000);          // same timescale as the segments
+	put32(out, 0);
+	put16(out, 0x55C4);         // und
+	put16(out, 0);
+	endBox(out, mdhd);
+
+	size_t hdlr = beginFullBox(out, "hdlr", 0, 0);
+	put32(out, 0);
+	putData(out, "vide", 4);
+	for (int i = 0; i < 3; ++i) put32(out, 0);
+	putData(out, "VideoHandler", 13);
+	endBox(out, hdlr);
+
+	size_t minf = beginBox(out, "minf");
+	size_t vmhd = beginFullBox(out, "vmhd", 0, 1);
+	put64(out, 0);
+	endBox(out, vmhd);
+
+	size_t dinf = beginBox(out, "dinf");
+	size_t dref = beginFullBox(out, "dref", 0, 0);
+	put32(out, 1);
+	size_t url = beginFullBox(out, "url ", 0, 1); // data in the same file
+	endBox(out, url);
+	endBox(out, dref);
+	endBox(out, dinf);
+
+	size_t stbl = beginBox(out, "stbl");
+	size_t stsd = beginFullBox(out, "stsd", 0, 0);
+	put32(out, 1);
+	size_t entry = beginBox(out, m_hevc ? "hvc1" : "avc1");
+	for (int i = 0; i < 6; ++i) put8(out, 0);
+	put16(out, 1);              // data reference index
+	put16(out, 0);
+	put16(out, 0);
+	for (int i = 0; i < 3; ++i) put32(out, 0);
+	put16(out, m_width);
+	put16(out, m_height);
+	put32(out, 0x00480000);     // 72 dpi
+	put32(out, 0x00480000);
+	put32(out, 0);
+	put16(out, 1);              // frame count
+	for (int i = 0; i < 32; ++i) put8(out, 0);
+	put16(out, 0x0018);         // depth
+	put16(out, 0xFFFF);
+
+	std::ostringstream codecs;
+	codecs << std::hex << std::uppercase;
+	if (m_hevc)
+	{
+		// profile_tier_level follows the NAL header and the first SPS byte
+		const unsigned char* ptl = (const unsigned char*)sps.data() + 3;
+		size_t hvcC = beginBox(out, "hvcC");
+		put8(out, 1);
+		putData(out, ptl, 12);  // profile, compatibility, constraints, level
+		put16(out, 0xF000);     // min spatial segmentation
+		put8(out, 0xFC);        // parallelism type
+		put8(out, 0xFD);        // 4:2:0
+		put8(out, 0xF8);        // 8 bits luma
+		put8(out, 0xF8);        // 8 bits chroma
+		put16(out, 0);          // average frame rate
+		put8(out, 0x0F);        // 1 temporal layer, nested, 4 bytes NAL length
+		put8(out, 3);
+		const std::string* arrays[] = { &m_vps, &m_sps, &m_pps };
+		const unsigned char types[] = { 32, 33, 34 };
+		for (int i = 0; i < 3; ++i)
+		{
+			put8(out, 0x80 | types[i]);
+			put16(out, 1);
+			put16(out, arrays[i]->size());
+			putData(out, arrays[i]->data(), arrays[i]->size());
+		}
+		endBox(out, hvcC);
+
+		// RFC 6381 : hvc1.<space><profile>.<compatibility reversed>.<tier><level>.<constraints>
+		u_int32_t compatibility = (ptl[1]<<24)|(ptl[2]<<16)|(ptl[3]<<8)|ptl[4];
+		u_int32_t reversed = 0;
+		for (int i = 0; i < 32; ++i)
+		{
+			reversed |= ((compatibility>>i)&1) << (31-i);
+		}
+		const char* space[] = { "", "A", "B", "C" };
+		codecs << "hvc1." << space[ptl[0]>>6] << std::dec << (ptl[0]&0x1F)
+			<< "." << std::hex << reversed
+			<< "." << (((ptl[0]>>5)&1) ? "H" : "L") << std::dec << (int)ptl[11];
+		int last = 10;
+		while ( (last >= 5) && (ptl[last] == 0) )
+		{
+			last--;
+		}
+		for (int i = 5; i <= last; ++i)
+		{
+			codecs << "." << std::hex << (int)ptl[i];
+		}
+	}
+	else
+	{
+		size_t avcC = beginBox(out, "avcC");
+		put8(out, 1);
+		putData(out, m_sps.data() + 1, 3); // profile, compatibility, level
+		put8(out, 0xFF);        // 4 bytes NAL length
+		put8(out, 0xE1);        // 1 SPS
+		put16(out, m_sps.size());
+		putData(out, m_sps.data(), m_sps.size());
+		put8(out, 1);           // 1 PPS
+		put16(out, m_pps.size());
+		putData(out, m_pps.data(), m_pps.size());
+		endBox(out, avcC);
+
+		codecs << "avc1." << std::setfill('0');
+		for (int i = 1; i < 4; ++i)
+		{
+			codecs << std::setw(2) << (int)(unsigned char)m_sps[i];
+		}
+	}
+	endBox(out, entry);
+	endBox(out, stsd);
+
+	// empty sample tables, everything is in the fragments
+	const char* tables[] = { "stts", "stsc", "stco" };
+	for (int i = 0; i < 3; ++i)
+	{
+		size_t table = beginFullBox(out, tables[i], 0, 0);
+		put32(out, 0);
+		endBox(out, table);
+	}
+	size_t stsz = beginFullBox(out, "stsz", 0, 0);
+	put32(out, 0);
+	put32(out, 0);
+	endBox(out, stsz);
+	endBox(out, stbl);
+	endBox(out, minf);
+	endBox(out, mdia);
+	endBox(out, trak);
+
+	size_t mvex = beginBox(out, "mvex");
+	size_t trex = beginFullBox(out, "trex", 0, 0);
+	put32(out, 1);              // track id
+	put32(out, 1);              // sample description index
+	put32(out, 0);
+	put32(out, 0);
+	put32(out, 0);
+	endBox(out, trex);
+	endBox(out, mvex);
+	endBox(out, moov);
+
+	std::shared_ptr<MemorySegment> init(new MemorySegment(out.size()));
+	init->append(out.data(), out.size());
+	init->seal();
+	m_init = init;
+	if (!m_inits.empty())
+	{
+		m_initId++;
+	}
+	m_inits[m_initId] = init;
+	if (m_inits.size() > 4)
+	{
+		m_inits.erase(m_inits.begin());
+	}
+	m_codecs = codecs.str();
+	m_version++;
+	LOG(NOTICE) << "CMAF init segment:" << m_initId << " size:" << out.size() << " codecs:" << m_codecs;
+}
+
+MemorySegmentRef CMAFMemoryBufferSink::getInitSegment(unsigned int initId)
+{
+	MemorySegmentRef init;
+	std::map<unsigned int, MemorySegmentRef>::iterator it = m_inits.find(initId);
+	if (it != m_inits.end())
+	{
+		init = it->second;
+	}
+	return init;
+}
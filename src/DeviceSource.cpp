@@ -27,6 +27,8 @@ int  V4L2DeviceSource::Stats::notify(int tv_sec, int framesize)
 	if (tv_sec != m_fps_sec)
 	{
 		LOG(INFO) << m_msg  << "tv_sec:" <<   tv_sec << " fps:" << m_fps << " bandwidth:"<< (m_size/128) << "kbps";		
+		m_lastFps = m_fps;
+		m_lastSize = m_size;
 		m_fps_sec = tv_sec;
 		m_fps = 0;
 		m_size = 0;
@@ -54,7 +56,8 @@ V4L2DeviceSource::V4L2DeviceSource(UsageEnvironment& env, DeviceInterface * devi
 	m_out("out") , 
 	m_outfd(outputFd),
 	m_device(device),
-	m_queueSize(queueSize)
+	m_queueSize(queueSize),
+	m_maxFrameSize(0)
 {
 	m_eventTriggerId = envir().taskScheduler().createEventTrigger(V4L2DeviceSource::deliverFrameStub);
 	memset(&m_thid, 0, sizeof(m_thid));
@@ -157,6 +160,7 @@ void V4L2DeviceSource::deliverFrame()
 			{
 				fFrameSize = fMaxSize;
 				fNumTruncatedBytes = frame->m_size - fMaxSize;
+				LOG(WARN) << "frame truncated size:" << frame->m_size << " sink buffer:" << fMaxSize;
 			} 
 			else 
 			{
@@ -212,6 +216,7 @@ int V4L2DeviceSource::getNextFrame()
 		timeval diff;
 		timersub(&tv,&ref,&diff);
 		m_in.notify(tv.tv_sec, frameSize);
+		m_device->adjustPresentationTime(ref);
 		LOG(DEBUG) << "getNextFrame\ttimestamp:" << ref.tv_sec << "." << ref.tv_usec << "\tsize:" << frameSize <<"\tdiff:" <<  (diff.tv_sec*1000+diff.tv_usec/1000) << "ms";
 		processFrame(buffer,frameSize,ref);
 		if (m_outfd != -1) 
@@ -255,12 +260,25 @@ void V4L2DeviceSource::queueFrame(char * frame, int frameSize, const timeval &tv
 		m_captureQueue.pop_front();
 	}
 	m_captureQueue.push_back(new Frame(frame, frameSize, tv));	
+	if ((unsigned int)frameSize > m_maxFrameSize)
+	{
+		m_maxFrameSize = frameSize;
+	}
 	pthread_mutex_unlock (&m_mutex);
 	
 	// post an event to ask to deliver the frame
 	envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
 }	
 
+// biggest frame queued since the start
+unsigned int V4L2DeviceSource::getMaxFrameSize()
+{
+	pthread_mutex_lock (&m_mutex);
+	unsigned int maxFrameSize = m_maxFrameSize;
+	pthread_mutex_unlock (&m_mutex);
+	return maxFrameSize;
+}
+
 // split packet in frames					
 std::list< std::pair<unsigned char*,size_t> > V4L2DeviceSource::splitFrames(unsigned char* frame, unsigned frameSize) 
 {				
@@ -13,8 +13,8 @@
 
 
 #include <sstream>
-#include <fstream>
 #include <algorithm>
+#include <iomanip>
 
 #include "RTSPServer.hh"
 #include "RTSPCommon.hh"
@@ -23,10 +23,12 @@
 #include "TCPStreamSink.hh"
 
 #include "HTTPServer.h"
+#include "TSServerMediaSubsession.h"
+#include "WebrootCache.h"
 
 u_int32_t HTTPServer::HTTPClientConnection::fClientSessionId = 0;
 
-void HTTPServer::HTTPClientConnection::sendHeader(const char* contentType, unsigned int contentLength)
+void HTTPServer::HTTPClientConnection::sendHeader(const char* contentType, unsigned int contentLength, const char* extraHeaders)
 {
 	// Construct our response:
 	snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
@@ -36,17 +38,68 @@ void HTTPServer::HTTPClientConnection::sendHeader(const char* contentType, unsig
            "Access-Control-Allow-Origin: *\r\n" 
 	   "Content-Type: %s\r\n"
 	   "Content-Length: %d\r\n"
+	   "%s"
+	   "%s"
 	   "\r\n",
 	   dateHeader(),
 	   LIVEMEDIA_LIBRARY_VERSION_STRING,
 	   contentType,
-	   contentLength);
+	   contentLength,
+	   extraHeaders,
+	   this->connectionHeader());
 
 	  // Send the response header 
 	  send(fClientOutputSocket, (char const*)fResponseBuffer, strlen((char*)fResponseBuffer), 0);
 	  fResponseBuffer[0] = '\0'; // We've already sent the response.  This tells the calling code not to send it again.
 }
 		
+// HTTP/1.0 clients do not know chunked encoding, their body ends when the connection closes
+void HTTPServer::HTTPClientConnection::sendChunkedHeader(const char* contentType)
+{
+	if (!fChunked)
+	{
+		fKeepAlive = false;
+	}
+	snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
+	   "HTTP/1.1 200 OK\r\n"
+	   "%s"
+	   "Server: LIVE555 Streaming Media v%s\r\n"
+	   "Access-Control-Allow-Origin: *\r\n"
+	   "Content-Type: %s\r\n"
+	   "%s"
+	   "%s"
+	   "\r\n",
+	   dateHeader(),
+	   LIVEMEDIA_LIBRARY_VERSION_STRING,
+	   contentType,
+	   fChunked ? "Transfer-Encoding: chunked\r\n" : "",
+	   this->connectionHeader());
+
+	send(fClientOutputSocket, (char const*)fResponseBuffer, strlen((char*)fResponseBuffer), 0);
+	fResponseBuffer[0] = '\0';
+}
+
+// response without body, the connection stays open when the client keeps it alive
+void HTTPServer::HTTPClientConnection::setStatusResponse(const char* status)
+{
+	snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
+	   "HTTP/1.1 %s\r\n"
+	   "%s"
+	   "Server: LIVE555 Streaming Media v%s\r\n"
+	   "Access-Control-Allow-Origin: *\r\n"
+	   "Content-Length: 0\r\n"
+	   "%s"
+	   "\r\n",
+	   status,
+	   dateHeader(),
+	   LIVEMEDIA_LIBRARY_VERSION_STRING,
+	   this->connectionHeader());
+	if (!fKeepAlive)
+	{
+		fIsActive = False;
+	}
+}
+
 void HTTPServer::HTTPClientConnection::streamSource(const std::string & content)
 {
 	u_int8_t* buffer = new u_int8_t[content.size()];
@@ -87,97 +140,352 @@ ServerMediaSubsession* HTTPServer::HTTPClientConnection::getSubsesion(const char
 	return subsession;
 }
 		
-bool HTTPServer::HTTPClientConnection::sendM3u8PlayList(char const* urlSuffix)
+// HLS subsessions of a session with their stream name, a rendition of an ABR ladder is <session>_<rendition>
+void HTTPServer::HTTPClientConnection::getRenditions(const char* urlSuffix, std::list<Rendition> & renditions)
 {
-	ServerMediaSubsession* subsession = this->getSubsesion(urlSuffix);
-	if (subsession == NULL) 
+	ServerMediaSession* session = fOurServer.lookupServerMediaSession(urlSuffix);
+	if (session != NULL)
 	{
-		return false;			  
+		ServerMediaSubsessionIterator iter(*session);
+		ServerMediaSubsession* subsession = NULL;
+		while ((subsession = iter.next()) != NULL)
+		{
+			TSServerMediaSubsession* hls = dynamic_cast<TSServerMediaSubsession*>(subsession);
+			if (hls != NULL)
+			{
+				renditions.push_back(Rendition(std::string(urlSuffix) + "_" + hls->getRendition(), hls));
+			}
+		}
+		if (renditions.size() == 1)
+		{
+			renditions.front().first = urlSuffix;
+		}
+	}
+	else
+	{
+		std::string name(urlSuffix);
+		size_t pos = name.find_last_of("_");
+		session = (pos != std::string::npos) ? fOurServer.lookupServerMediaSession(name.substr(0, pos).c_str()) : NULL;
+		if (session != NULL)
+		{
+			ServerMediaSubsessionIterator iter(*session);
+			ServerMediaSubsession* subsession = NULL;
+			while ((subsession = iter.next()) != NULL)
+			{
+				TSServerMediaSubsession* hls = dynamic_cast<TSServerMediaSubsession*>(subsession);
+				if ( (hls != NULL) && (hls->getRendition() == name.substr(pos+1)) )
+				{
+					renditions.push_back(Rendition(name, hls));
+				}
+			}
+		}
 	}
+}
 
-	float duration = subsession->duration();
-	if (duration <= 0.0) 
+MemoryBufferSink* HTTPServer::HTTPClientConnection::getHlsSink(const char* urlSuffix)
+{
+	MemoryBufferSink* sink = NULL;
+	std::list<Rendition> renditions;
+	this->getRenditions(urlSuffix, renditions);
+	if (!renditions.empty()) 
+	{
+		sink = renditions.front().second->getHlsSink();
+	}
+	return sink;
+}
+		
+bool HTTPServer::HTTPClientConnection::sendM3u8PlayList(char const* urlSuffix)
+{
+	std::list<Rendition> renditions;
+	this->getRenditions(urlSuffix, renditions);
+	if (renditions.size() > 1)
+	{
+		return this->sendMasterPlayList(urlSuffix, renditions);
+	}
+	MemoryBufferSink* sink = renditions.empty() ? NULL : renditions.front().second->getHlsSink();
+	if (sink == NULL) 
 	{
 		return false;			  
 	}
-	
-	unsigned int startTime = subsession->getCurrentNPT(NULL);
-	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
-	unsigned sliceDuration = httpServer->m_hlsSegment;		  
-	std::ostringstream os;
-	os  	<< "#EXTM3U\r\n"
-		<< "#EXT-X-ALLOW-CACHE:NO\r\n"
-		<< "#EXT-X-MEDIA-SEQUENCE:" << startTime <<  "\r\n"
-		<< "#EXT-X-TARGETDURATION:" << sliceDuration << "\r\n";
 
-	for (unsigned int slice=0; slice*sliceDuration<duration; slice++)
+	// rebuilt only when the sink closed a part or a segment
+	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
+	std::string key(std::string(urlSuffix) + ".m3u8");
+	MemorySegmentRef playList = httpServer->getManifest(key, sink->getVersion());
+	if (!playList)
 	{
-		os << "#EXTINF:" << sliceDuration << ",\r\n";
-		os << urlSuffix << "?segment=" << (startTime+slice*sliceDuration) << "\r\n";
+		std::list<MemorySegmentRef> segments;
+		sink->getSegmentList(segments);
+		if (segments.empty()) 
+		{
+			return false;			  
+		}
+	
+		// segments are cut on keyframes, each one has its own duration
+		double partTarget = sink->getPartTarget();
+		bool lowLatency = (partTarget > 0);
+		bool fragmentedMP4 = (sink->getInitSegment() != NULL);
+		std::ostringstream os;
+		os << std::fixed << std::setprecision(3);
+		os  	<< "#EXTM3U\r\n"
+			<< "#EXT-X-VERSION:" << (fragmentedMP4 ? 7 : (lowLatency ? 6 : 3)) << "\r\n"
+			<< "#EXT-X-ALLOW-CACHE:NO\r\n"
+			<< "#EXT-X-MEDIA-SEQUENCE:" << segments.front()->id() <<  "\r\n"
+			<< "#EXT-X-TARGETDURATION:" << sink->getTargetDuration() << "\r\n";
+		if (lowLatency)
+		{
+			os	<< "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=" << 3*partTarget << "\r\n"
+				<< "#EXT-X-PART-INF:PART-TARGET=" << partTarget << "\r\n";
+		}
+		// a new init segment comes after a discontinuity, init ids count them
+		unsigned int initId = segments.front()->initId();
+		if (fragmentedMP4)
+		{
+			if (initId != 0)
+			{
+				os << "#EXT-X-DISCONTINUITY-SEQUENCE:" << initId << "\r\n";
+			}
+			os << "#EXT-X-MAP:URI=\"" << urlSuffix << "?init=" << initId << "\"\r\n";
+		}
+
+		std::list<MemorySegmentRef>::iterator it;
+		for (it = segments.begin(); it != segments.end(); ++it)
+		{
+			this->addInitChange(os, urlSuffix, initId, *it);
+			if (lowLatency)
+			{
+				this->addParts(os, sink, urlSuffix, (*it)->id());
+			}
+			os << "#EXTINF:" << (*it)->getDuration() << ",\r\n";
+			os << urlSuffix << "?segment=" << (*it)->id() << "\r\n";
+		}
+		if (lowLatency)
+		{
+			// parts of the segment being written, then the one to request in advance
+			this->addInitChange(os, urlSuffix, initId, sink->getCurrentSegment());
+			this->addParts(os, sink, urlSuffix, sink->getCurrentSlice());
+			os << "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"" << urlSuffix << "?part=" << sink->getNextPart() << "\"\r\n";
+		}
+		playList = httpServer->setManifest(key, sink->getVersion(), os.str());
 	}
 	
 	envir() << "send M3u8 playlist:" << urlSuffix <<"\n";
-	const std::string& playList(os.str());
 
 	// send response header
-	this->sendHeader("application/vnd.apple.mpegurl", playList.size());
+	this->sendHeader("application/vnd.apple.mpegurl", playList->size());
 	
-	// stream body
-	this->streamSource(playList);
+	// stream body, shared with the other viewers
+	this->streamSource(MemorySegmentSource::createNew(envir(), playList));
 
 	return true;			  
 }
 		
+// ABR ladder, the player picks the media playlist of a rendition from its bitrate
+bool HTTPServer::HTTPClientConnection::sendMasterPlayList(char const* urlSuffix, const std::list<Rendition> & renditions)
+{
+	// rebuilt when one of the renditions changed
+	unsigned int version = 0;
+	std::list<Rendition>::const_iterator it;
+	for (it = renditions.begin(); it != renditions.end(); ++it)
+	{
+		version += it->second->getHlsSink()->getVersion();
+	}
+
+	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
+	std::string key(std::string(urlSuffix) + ".master.m3u8");
+	MemorySegmentRef playList = httpServer->getManifest(key, version);
+	if (!playList)
+	{
+		std::ostringstream os;
+		os  	<< "#EXTM3U\r\n"
+			<< "#EXT-X-INDEPENDENT-SEGMENTS\r\n";
+		for (it = renditions.begin(); it != renditions.end(); ++it)
+		{
+			MemoryBufferSink* sink = it->second->getHlsSink();
+			unsigned int bandwidth = sink->getBandwidth();
+			if (bandwidth == 0)
+			{
+				// no segment yet
+				continue;
+			}
+			os << "#EXT-X-STREAM-INF:BANDWIDTH=" << bandwidth;
+			if ( (it->second->getWidth() > 0) && (it->second->getHeight() > 0) )
+			{
+				os << ",RESOLUTION=" << it->second->getWidth() << "x" << it->second->getHeight();
+			}
+			if (!sink->getCodecs().empty())
+			{
+				os << ",CODECS=\"" << sink->getCodecs() << "\"";
+			}
+			os << "\r\n";
+			os << it->first << ".m3u8\r\n";
+		}
+		if (os.str().find("#EXT-X-STREAM-INF") == std::string::npos)
+		{
+			return false;
+		}
+		playList = httpServer->setManifest(key, version, os.str());
+	}
+
+	envir() << "send M3u8 master playlist:" << urlSuffix <<"\n";
+
+	this->sendHeader("application/vnd.apple.mpegurl", playList->size());
+	this->streamSource(MemorySegmentSource::createNew(envir(), playList));
+
+	return true;
+}
+
+// the segment uses other parameter sets than the previous one
+void HTTPServer::HTTPClientConnection::addInitChange(std::ostringstream & os, char const* urlSuffix, unsigned int & initId, const MemorySegmentRef & segment)
+{
+	if ( segment && (segment->initId() != initId) )
+	{
+		initId = segment->initId();
+		os << "#EXT-X-DISCONTINUITY\r\n";
+		os << "#EXT-X-MAP:URI=\"" << urlSuffix << "?init=" << initId << "\"\r\n";
+	}
+}
+
+void HTTPServer::HTTPClientConnection::addParts(std::ostringstream & os, MemoryBufferSink* sink, char const* urlSuffix, unsigned int slice)
+{
+	std::list<MemorySegmentRef> parts;
+	sink->getPartList(slice, parts);
+	std::list<MemorySegmentRef>::iterator it;
+	for (it = parts.begin(); it != parts.end(); ++it)
+	{
+		os << "#EXT-X-PART:DURATION=" << (*it)->getDuration() << ",URI=\"" << urlSuffix << "?part=" << (*it)->id() << "\"";
+		if ((*it)->isIndependent())
+		{
+			os << ",INDEPENDENT=YES";
+		}
+		os << "\r\n";
+	}
+}
+
+// a Representation per rendition, their segments start on the same frames
 bool HTTPServer::HTTPClientConnection::sendMpdPlayList(char const* urlSuffix)
 {
-	ServerMediaSubsession* subsession = this->getSubsesion(urlSuffix);
-	if (subsession == NULL) 
+	std::list<Rendition> renditions;
+	this->getRenditions(urlSuffix, renditions);
+	if (renditions.empty()) 
 	{
 		return false;			  
 	}
-
-	float duration = subsession->duration();
-	if (duration <= 0.0) 
+	unsigned int version = 0;
+	std::list<Rendition>::iterator rendition;
+	for (rendition = renditions.begin(); rendition != renditions.end(); ++rendition)
 	{
-		return false;
+		version += rendition->second->getHlsSink()->getVersion();
 	}
-	
-	unsigned int startTime = subsession->getCurrentNPT(NULL);
+
 	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
-	unsigned sliceDuration = httpServer->m_hlsSegment;		  
-	std::ostringstream os;
+	std::string key(std::string(urlSuffix) + ".mpd");
+	MemorySegmentRef playList = httpServer->getManifest(key, version);
+	if (!playList)
+	{
+		unsigned sliceDuration = httpServer->m_hlsSegment;		  
+		std::ostringstream os;
 	
-	os  << "<?xml version='1.0' encoding='UTF-8'?>\r\n"
-		<< "<MPD type='dynamic' xmlns='urn:mpeg:DASH:schema:MPD:2011' profiles='urn:mpeg:dash:profile:full:2011' minimumUpdatePeriod='PT"<< sliceDuration <<"S' minBufferTime='" << sliceDuration << "'>\r\n"
-		<< "<Period start='PT0S'><AdaptationSet segmentAlignment='true'><Representation mimeType='video/mp2t' codecs='' >\r\n";
+		os  << "<?xml version='1.0' encoding='UTF-8'?>\r\n"
+			<< "<MPD type='dynamic' xmlns='urn:mpeg:DASH:schema:MPD:2011' profiles='urn:mpeg:dash:profile:full:2011' minimumUpdatePeriod='PT"<< sliceDuration <<"S' minBufferTime='PT" << sliceDuration << "S'>\r\n"
+			<< "<Period start='PT0S'><AdaptationSet segmentAlignment='true' startWithSAP='1'>\r\n";
+
+		bool empty = true;
+		for (rendition = renditions.begin(); rendition != renditions.end(); ++rendition)
+		{
+			MemoryBufferSink* sink = rendition->second->getHlsSink();
+			std::list<MemorySegmentRef> segments;
+			sink->getSegmentList(segments);
+			if (segments.empty()) 
+			{
+				continue;
+			}
+			// a Representation has one initialization, segments of previous parameter sets are not announced
+			unsigned int initId = segments.back()->initId();
+			while (segments.front()->initId() != initId)
+			{
+				segments.pop_front();
+			}
+			empty = false;
 
-	os << "<SegmentTemplate duration='" << sliceDuration << "' media='" << urlSuffix << "?segment=$Number$' startNumber='" << startTime << "' />\r\n";
-	os << "</Representation></AdaptationSet></Period>\r\n";
-	os << "</MPD>\r\n";
+			const std::string & name = rendition->first;
+			os << "<Representation id='" << name << "' bandwidth='" << sink->getBandwidth() << "' mimeType='" << sink->getMimeType() << "' codecs='" << sink->getCodecs() << "'";
+			if ( (rendition->second->getWidth() > 0) && (rendition->second->getHeight() > 0) )
+			{
+				os << " width='" << rendition->second->getWidth() << "' height='" << rendition->second->getHeight() << "'";
+			}
+			os << ">\r\n";
+
+			// keyframe aligned segments do not have a constant duration
+			os << "<SegmentTemplate timescale='90000' media='" << name << "?segment=$Number$' startNumber='" << segments.front()->id() << "'";
+			if (sink->getInitSegment())
+			{
+				os << " initialization='" << name << "?init=" << initId << "'";
+			}
+			os << ">\r\n";
+			// only sealed segments are listed, the segment being written is delivered chunked to LL-HLS clients only
+			os << "<SegmentTimeline>\r\n";
+			std::list<MemorySegmentRef>::iterator it;
+			for (it = segments.begin(); it != segments.end(); ++it)
+			{
+				os << "<S t='" << (*it)->startTime() << "' d='" << (*it)->duration() << "'/>\r\n";
+			}
+			os << "</SegmentTimeline>\r\n";
+			os << "</SegmentTemplate>\r\n";
+			os << "</Representation>\r\n";
+		}
+		if (empty)
+		{
+			return false;
+		}
+		os << "</AdaptationSet></Period>\r\n";
+		os << "</MPD>\r\n";
+		playList = httpServer->setManifest(key, version, os.str());
+	}
 
 	envir() << "send MPEG-DASH playlist:" << urlSuffix <<"\n";
-	const std::string& playList(os.str());
 
 	// send response header
-	this->sendHeader("application/dash+xml", playList.size());
+	this->sendHeader("application/dash+xml", playList->size());
 	
-	// stream body
-	this->streamSource(playList);
+	// stream body, shared with the other viewers
+	this->streamSource(MemorySegmentSource::createNew(envir(), playList));
 
 	return true;
 }
 
+// value of a request header, the name is lower case
+static std::string getHeader(const char* request, const char* name)
+{
+	std::string header(request);
+	size_t end = header.find("\r\n\r\n");
+	if (end != std::string::npos)
+	{
+		header.erase(end);
+	}
+	std::string lower(header);
+	std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+	std::string value;
+	size_t pos = lower.find(std::string("\r\n") + name + ":");
+	if (pos != std::string::npos)
+	{
+		pos += strlen(name) + 3;
+		size_t eol = header.find("\r\n", pos);
+		value = header.substr(pos, (eol == std::string::npos) ? std::string::npos : eol - pos);
+		value.erase(0, value.find_first_not_of(" \t"));
+	}
+	return value;
+}
+
 bool HTTPServer::HTTPClientConnection::sendFile(char const* urlSuffix)
 {
-	bool ok = false;
-	
 	std::string url(urlSuffix);
 	size_t pos = url.find_first_of(" ");
 	if (pos != std::string::npos)
 	{
 		url.erase(0,pos+1);
 	}
-	pos = url.find_first_of(" ");
+	pos = url.find_first_of(" ?");
 	if (pos != std::string::npos)
 	{
 		url.erase(pos);
@@ -192,38 +500,116 @@ bool HTTPServer::HTTPClientConnection::sendFile(char const* urlSuffix)
 		url.erase(pos, pattern.length());
 	}			
 	
-	std::string ext;
-	pos = url.find_last_of(".");
-	if (pos != std::string::npos)
-	{
-		ext.assign(url.substr(pos+1));
-	}
-	
 	if (url.empty())
 	{
 		url = "index.html"; 
-		ext = "html";
 	}
-	if (ext=="js") ext ="javascript";
 	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
 	if (!httpServer->m_webroot.empty()) {
 		url.insert(0, httpServer->m_webroot);
 	}
-	std::ifstream file(url.c_str());
-	if (file.is_open())
+
+	WebrootFileRef file = httpServer->m_webrootCache->lookup(url);
+	if (!file)
 	{
-		envir() << "send file:" << url.c_str() <<"\n";
-		std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-		std::string mime("text/");
-		mime.append(ext);
-		this->sendHeader(mime.c_str(), content.size());
-		this->streamSource(content);
-		ok = true;
+		return false;
+	}
+
+	std::string validators("ETag: " + file->m_etag + "\r\nLast-Modified: " + file->m_lastModified + "\r\n");
+	std::string ifNoneMatch(getHeader(urlSuffix, "if-none-match"));
+	std::string ifModifiedSince(getHeader(urlSuffix, "if-modified-since"));
+	if ( (!ifNoneMatch.empty() && (ifNoneMatch.find(file->m_etag) != std::string::npos))
+		|| (ifNoneMatch.empty() && (ifModifiedSince == file->m_lastModified)) )
+	{
+		// the browser copy is still valid
+		snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
+		   "HTTP/1.1 304 Not Modified\r\n"
+		   "%s"
+		   "%s"
+		   "%s"
+		   "\r\n",
+		   dateHeader(),
+		   validators.c_str(),
+		   this->connectionHeader());
+		send(fClientOutputSocket, (char const*)fResponseBuffer, strlen((char*)fResponseBuffer), 0);
+		fResponseBuffer[0] = '\0';
+		afterStreaming(this);
+		return true;
 	}
-	return ok;
+
+	envir() << "send file:" << url.c_str() <<"\n";
+	this->sendHeader(file->m_mimeType, file->m_size, validators.c_str());
+	if (file->m_content)
+	{
+		this->streamSource(MemorySegmentSource::createNew(envir(), file->m_content));
+	}
+	else
+	{
+		// large file, no copy through user space
+		fFileSender = FileSender::createNew(envir(), fClientOutputSocket, file, afterStreaming, this);
+		if (fFileSender == NULL)
+		{
+			fIsActive = False;
+		}
+	}
+	return true;
 }			
 		
+static bool isHttp10(const char* request)
+{
+	std::string requestLine(request);
+	requestLine.erase(std::min(requestLine.find("\r\n"), requestLine.size()));
+	return (requestLine.find("HTTP/1.0") != std::string::npos);
+}
+
+// HTTP/1.1 connections persist unless the client asks to close, HTTP/1.0 ones only when asked
+static bool isKeepAlive(const char* request)
+{
+	bool keepAlive = !isHttp10(request);
+	std::string connection(getHeader(request, "connection"));
+	std::transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+	if (connection.find("close") != std::string::npos)
+	{
+		keepAlive = false;
+	}
+	else if (connection.find("keep-alive") != std::string::npos)
+	{
+		keepAlive = true;
+	}
+	return keepAlive;
+}
+
+const char* HTTPServer::HTTPClientConnection::connectionHeader()
+{
+	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
+	if (fKeepAlive)
+	{
+		snprintf(fConnectionHeader, sizeof(fConnectionHeader), "Connection: keep-alive\r\nKeep-Alive: timeout=%u\r\n", httpServer->m_keepAliveTimeout);
+	}
+	else
+	{
+		snprintf(fConnectionHeader, sizeof(fConnectionHeader), "Connection: close\r\n");
+	}
+	return fConnectionHeader;
+}
+
 void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const* urlSuffix, char const* fullRequestStr) 
+{
+	envir().taskScheduler().unscheduleDelayedTask(fIdleTask);
+	if ( this->isBusy() || !fRequests.empty() )
+	{
+		// pipelined request, answered when the previous responses are complete
+		fRequests.push_back(std::pair<std::string,std::string>(urlSuffix, fullRequestStr));
+		fResponseBuffer[0] = '\0';
+		return;
+	}
+	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
+	fKeepAlive = (httpServer->m_keepAliveTimeout != 0) && isKeepAlive(fullRequestStr);
+	fChunked = !isHttp10(fullRequestStr);
+	this->handleRequest(urlSuffix, fullRequestStr);
+}
+
+void HTTPServer::HTTPClientConnection::handleRequest(char const* urlSuffix, char const* fullRequestStr) 
 {
 	char const* questionMarkPos = strrchr(urlSuffix, '?');
 	if (strcmp(urlSuffix, "getVersion") == 0) 
@@ -237,35 +623,54 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const* ur
 	}
 	else if (strncmp(urlSuffix, "getStreamList", strlen("getStreamList")) == 0) 
 	{
-		std::ostringstream os;
 		HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
-		ServerMediaSessionIterator it(*httpServer);
-		ServerMediaSession* serverSession = NULL;
-		if (questionMarkPos != NULL) {
-			questionMarkPos++;
-			os << "var " << questionMarkPos << "=";
+		MemorySegmentRef content = httpServer->getStreamList( (questionMarkPos != NULL) ? questionMarkPos+1 : "" );
+		this->sendHeader("text/plain", content->size());
+		this->streamSource(MemorySegmentSource::createNew(envir(), content));
+	}
+	else if ( (questionMarkPos != NULL) && (strncmp(questionMarkPos, "?_HLS_", strlen("?_HLS_")) == 0) )
+	{
+		// LL-HLS blocking playlist reload
+		std::string streamName(urlSuffix, questionMarkPos-urlSuffix);
+		std::string ext;
+		size_t pos = streamName.find_last_of(".");
+		if (pos != std::string::npos)
+		{
+			ext.assign(streamName.substr(pos+1));
+			streamName.erase(pos);
 		}
-		os << "[\n";
-		bool first = true;
-		while ( (serverSession = it.next()) != NULL) {
-			if (serverSession->duration() > 0) {
-				if (first) 
-				{
-					first = false;
-					os << " ";					
-				}
-				else 
-				{
-					os << ",";					
-				}
-				os << "\"" << serverSession->streamName() << "\"";
-				os << "\n";
-			}
+		unsigned int msn = 0;
+		int part = -1;
+		const char* msnPos = strstr(questionMarkPos, "_HLS_msn=");
+		const char* partPos = strstr(questionMarkPos, "_HLS_part=");
+		if (partPos != NULL)
+		{
+			sscanf(partPos, "_HLS_part=%d", &part);
+		}
+
+		MemoryBufferSink* sink = this->getHlsSink(streamName.c_str());
+		if ( (sink == NULL) || (!ext.empty() && (ext != "m3u8") && (ext != "mpd")) )
+		{
+			handleHTTPCmd_notSupported();
+			fIsActive = False;
+		}
+		else if ( (msnPos == NULL) || (sscanf(msnPos, "_HLS_msn=%u", &msn) != 1) || (msn > sink->getCurrentSlice()+2) )
+		{
+			// too far in the future, the player has to reload without blocking
+			this->setStatusResponse("400 Bad Request");
+			send(fClientOutputSocket, (char const*)fResponseBuffer, strlen((char*)fResponseBuffer), 0);
+			fResponseBuffer[0] = '\0';
+			afterStreaming(this);
+		}
+		else if (!sink->isAvailable(msn, part))
+		{
+			this->waitFor(sink, urlSuffix);
+		}
+		else if (!((ext == "mpd") ? this->sendMpdPlayList(streamName.c_str()) : this->sendM3u8PlayList(streamName.c_str())))
+		{
+			handleHTTPCmd_notSupported();
+			fIsActive = False;
 		}
-		os << "]\n";
-		std::string content(os.str());
-		this->sendHeader("text/plain", content.size());
-		this->streamSource(content);
 	}
 	else if (questionMarkPos == NULL) 
 	{
@@ -303,6 +708,40 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const* ur
 			fIsActive = False;
 		}
 	}
+	else if (strncmp(questionMarkPos, "?init", strlen("?init")) == 0)
+	{
+		// fragmented MP4 init segment, by id since the parameter sets may change
+		std::string streamName(urlSuffix, questionMarkPos-urlSuffix);
+		MemoryBufferSink* sink = this->getHlsSink(streamName.c_str());
+		MemorySegmentRef init;
+		unsigned int initId = 0;
+		if (sink != NULL)
+		{
+			init = (sscanf(questionMarkPos, "?init=%u", &initId) == 1) ? sink->getInitSegment(initId) : sink->getInitSegment();
+		}
+		if (!init)
+		{
+			handleHTTPCmd_notSupported();
+			fIsActive = False;
+		}
+		else
+		{
+			this->sendHeader(sink->getMimeType(), init->size());
+			this->streamSource(MemorySegmentSource::createNew(envir(), init));
+		}
+	}
+	else if (strncmp(questionMarkPos, "?part=", strlen("?part=")) == 0)
+	{
+		// LL-HLS part
+		unsigned int part = 0;
+		std::string streamName(urlSuffix, questionMarkPos-urlSuffix);
+		MemoryBufferSink* sink = this->getHlsSink(streamName.c_str());
+		if ( (sink == NULL) || (sscanf(questionMarkPos, "?part=%u", &part) != 1) || !this->sendPart(sink, urlSuffix, part) )
+		{
+			handleHTTPCmd_notSupported();
+			fIsActive = False;
+		}
+	}
 	else
 	{
 		unsigned offsetInSeconds;
@@ -313,6 +752,31 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const* ur
 		}
 		
 		std::string streamName(urlSuffix, questionMarkPos-urlSuffix);
+		MemoryBufferSink* sink = this->getHlsSink(streamName.c_str());
+		if (sink != NULL)
+		{
+			// HLS/DASH segment by sequence number, streamed from the shared buffer
+			MemorySegmentRef segment = sink->getSegment(offsetInSeconds);
+			MemorySegmentRef current = sink->getCurrentSegment();
+			if (!segment && current && (current->id() == offsetInSeconds))
+			{
+				// segment being written, sent while the sink appends to it
+				this->sendChunkedHeader(sink->getMimeType());
+				this->streamSource(ChunkedSegmentSource::createNew(envir(), sink, current, fChunked));
+			}
+			else if (!segment)
+			{
+				handleHTTPCmd_notSupported();
+				fIsActive = False;
+			}
+			else
+			{
+				this->sendHeader(sink->getMimeType(), segment->size());
+				this->streamSource(MemorySegmentSource::createNew(envir(), segment));
+			}
+			return;
+		}
+
 		ServerMediaSubsession* subsession = this->getSubsesion(streamName.c_str());
 		if (subsession == NULL) 
 		{
@@ -355,6 +819,111 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const* ur
 	} 
 }
 
+// the part of the preload hint is sent as soon as it is complete
+bool HTTPServer::HTTPClientConnection::sendPart(MemoryBufferSink* sink, char const* urlSuffix, unsigned int part)
+{
+	MemorySegmentRef segment = sink->getPart(part);
+	if (segment)
+	{
+		this->sendHeader(sink->getMimeType(), segment->size());
+		this->streamSource(MemorySegmentSource::createNew(envir(), segment));
+	}
+	else if (part == sink->getNextPart())
+	{
+		this->waitFor(sink, urlSuffix);
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+// nothing is answered now, the request is handled again when the sink has a new part
+void HTTPServer::HTTPClientConnection::waitFor(MemoryBufferSink* sink, char const* urlSuffix)
+{
+	if (fWaitSink != NULL)
+	{
+		fWaitSink->removeWaiter(this);
+	}
+	fPendingRequest.assign(urlSuffix);
+	fWaitSink = sink;
+	fWaitSink->addWaiter(wakeUpStub, this);
+	if (fWaitTask == NULL)
+	{
+		// LL-HLS servers may block up to three target durations, armed once per request,
+		// a part that does not satisfy it yet does not push the deadline
+		fWaitTask = envir().taskScheduler().scheduleDelayedTask((int64_t)sink->getTargetDuration()*3000000, waitTimeoutStub, this);
+	}
+	fResponseBuffer[0] = '\0';
+}
+
+void HTTPServer::HTTPClientConnection::cancelWait()
+{
+	if (fWaitSink != NULL)
+	{
+		fWaitSink->removeWaiter(this);
+		fWaitSink = NULL;
+	}
+	envir().taskScheduler().unscheduleDelayedTask(fWaitTask);
+	fPendingRequest.clear();
+}
+
+void HTTPServer::HTTPClientConnection::wakeUp()
+{
+	// the sink already removed its waiter, the deadline of the request is kept
+	fWaitSink = NULL;
+	std::string request(fPendingRequest);
+	fPendingRequest.clear();
+
+	if (this->runRequest(request, request))
+	{
+		if (fWaitSink == NULL)
+		{
+			// answered
+			this->cancelWait();
+		}
+		this->nextRequest();
+	}
+}
+
+// handle a request outside of the live555 request parsing, return false when the connection is deleted
+bool HTTPServer::HTTPClientConnection::runRequest(const std::string & urlSuffix, const std::string & fullRequestStr)
+{
+	++fRecursionCount;
+	fResponseBuffer[0] = '\0';
+	this->handleRequest(urlSuffix.c_str(), fullRequestStr.c_str());
+	if (fResponseBuffer[0] != '\0')
+	{
+		send(fClientOutputSocket, (char const*)fResponseBuffer, strlen((char*)fResponseBuffer), 0);
+		fResponseBuffer[0] = '\0';
+	}
+	--fRecursionCount;
+
+	if (!fIsActive)
+	{
+		delete this;
+		return false;
+	}
+	return true;
+}
+
+void HTTPServer::HTTPClientConnection::waitTimeout()
+{
+	fWaitTask = NULL;
+	envir() << "LL-HLS request timeout:" << fPendingRequest.c_str() << "\n";
+	this->cancelWait();
+	this->setStatusResponse("503 Service Unavailable");
+	send(fClientOutputSocket, (char const*)fResponseBuffer, strlen((char*)fResponseBuffer), 0);
+	fResponseBuffer[0] = '\0';
+	if (!fIsActive)
+	{
+		delete this;
+		return;
+	}
+	this->nextRequest();
+}
+
 void HTTPServer::HTTPClientConnection::handleCmd_notFound() {
 	std::ostringstream os;
 	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
@@ -371,22 +940,155 @@ void HTTPServer::HTTPClientConnection::afterStreaming(void* clientData)
 {	
 	HTTPServer::HTTPClientConnection* clientConnection = (HTTPServer::HTTPClientConnection*)clientData;
 	
-	// Arrange to delete the 'client connection' object:
-	if (clientConnection->fRecursionCount > 0) {
-		// We're still in the midst of handling a request
-		clientConnection->fIsActive = False; // will cause the object to get deleted at the end of handling the request
-				
-	} else {
-		// We're no longer handling a request; delete the object now:
-		delete clientConnection;
+	// the sink is still on the stack, the connection is reset or deleted from the event loop
+	clientConnection->fEndTask = clientConnection->envir().taskScheduler().scheduleDelayedTask(0, endResponseStub, clientConnection);
+}
+
+// the response is complete, release its state and answer the next request
+void HTTPServer::HTTPClientConnection::endResponse()
+{
+	fEndTask = NULL;
+	if (!fKeepAlive)
+	{
+		delete this;
+		return;
+	}
+
+	this->streamSource(NULL);
+	delete fFileSender;
+	fFileSender = NULL;
+	if (fSubsession != NULL)
+	{
+		fSubsession->deleteStream(fClientSessionId, fStreamToken);
+		fSubsession = NULL;
+		fStreamToken = NULL;
 	}
+
+	// TCPStreamSink took over the socket handler, read the next request
+	envir().taskScheduler().setBackgroundHandling(fClientInputSocket, SOCKET_READABLE|SOCKET_EXCEPTION, incomingRequestHandler, this);
+	this->nextRequest();
+}
+
+void HTTPServer::HTTPClientConnection::nextRequest()
+{
+	while ( !fRequests.empty() && !this->isBusy() )
+	{
+		std::pair<std::string,std::string> request(fRequests.front());
+		fRequests.pop_front();
+		HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
+		fKeepAlive = (httpServer->m_keepAliveTimeout != 0) && isKeepAlive(request.second.c_str());
+		fChunked = !isHttp10(request.second.c_str());
+		if (!this->runRequest(request.first, request.second))
+		{
+			return;
+		}
+	}
+	if ( fRequests.empty() && !this->isBusy() )
+	{
+		// only after an HTTP response, RTSP connections share this class and stay quiet for long
+		this->startIdleTimer();
+	}
+}
+
+// a response is being sent or waited for
+bool HTTPServer::HTTPClientConnection::isBusy()
+{
+	return ( (fTCPSink != NULL) || (fFileSender != NULL) || (fWaitSink != NULL) || (fEndTask != NULL) );
+}
+
+void HTTPServer::HTTPClientConnection::startIdleTimer()
+{
+	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
+	envir().taskScheduler().unscheduleDelayedTask(fIdleTask);
+	if (httpServer->m_keepAliveTimeout != 0)
+	{
+		fIdleTask = envir().taskScheduler().scheduleDelayedTask((int64_t)httpServer->m_keepAliveTimeout*1000000, idleTimeoutStub, this);
+	}
+}
+
+void HTTPServer::HTTPClientConnection::idleTimeout()
+{
+	fIdleTask = NULL;
+	delete this;
 }
 
 HTTPServer::HTTPClientConnection::~HTTPClientConnection() 
 {
+	envir().taskScheduler().unscheduleDelayedTask(fEndTask);
+	envir().taskScheduler().unscheduleDelayedTask(fIdleTask);
+	this->cancelWait();
+	delete fFileSender;
 	this->streamSource(NULL);
 	
 	if (fSubsession) {
 		fSubsession->deleteStream(fClientSessionId,  fStreamToken);
 	}
 }
+
+// -----------------------------------------
+//    Prebuilt manifests
+// -----------------------------------------
+static MemorySegmentRef makeBuffer(const std::string & content)
+{
+	std::shared_ptr<MemorySegment> buffer(new MemorySegment(content.size()));
+	buffer->append((const unsigned char*)content.data(), content.size());
+	buffer->seal();
+	return buffer;
+}
+
+MemorySegmentRef HTTPServer::getManifest(const std::string & key, unsigned int version)
+{
+	MemorySegmentRef manifest;
+	std::map<std::string, Manifest>::iterator it = m_manifests.find(key);
+	if ( (it != m_manifests.end()) && (it->second.m_version == version) )
+	{
+		manifest = it->second.m_content;
+	}
+	return manifest;
+}
+
+MemorySegmentRef HTTPServer::setManifest(const std::string & key, unsigned int version, const std::string & content)
+{
+	Manifest & manifest = m_manifests[key];
+	manifest.m_version = version;
+	manifest.m_content = makeBuffer(content);
+	return manifest.m_content;
+}
+
+// sessions and their HLS durations are walked at most once per second
+MemorySegmentRef HTTPServer::getStreamList(const std::string & var)
+{
+	timeval now;
+	gettimeofday(&now, NULL);
+	if ( !m_streamList || (var != m_streamListVar) || (now.tv_sec != m_streamListTime) )
+	{
+		std::ostringstream os;
+		ServerMediaSessionIterator it(*this);
+		ServerMediaSession* serverSession = NULL;
+		if (!var.empty()) {
+			os << "var " << var << "=";
+		}
+		os << "[\n";
+		bool first = true;
+		while ( (serverSession = it.next()) != NULL) {
+			if (serverSession->duration() > 0) {
+				if (first) 
+				{
+					first = false;
+					os << " ";					
+				}
+				else 
+				{
+					os << ",";					
+				}
+				os << "\"" << serverSession->streamName() << "\"";
+				os << "\n";
+			}
+		}
+		os << "]\n";
+		m_streamList = makeBuffer(os.str());
+		m_streamListVar = var;
+		m_streamListTime = now.tv_sec;
+	}
+	return m_streamList;
+}
@@ -7,18 +7,50 @@
 ** 
 ** -------------------------------------------------------------------------*/
 
+#include <string.h>
+
+#include "logger.h"
 #include "MemoryBufferSink.h"
 
+// PTS are 33 bits
+#define PTS_MASK 0x1FFFFFFFFULL
+
 // -----------------------------------------
 //    MemoryBufferSink
 // -----------------------------------------
-MemoryBufferSink::MemoryBufferSink(UsageEnvironment& env, unsigned bufferSize, unsigned int sliceDuration) : MediaSink(env), m_bufferSize(bufferSize), m_refTime(0), m_sliceDuration(sliceDuration)
+MemoryBufferSink::MemoryBufferSink(UsageEnvironment& env, unsigned bufferSize, unsigned int sliceDuration, unsigned int windowDuration, unsigned int segmentCapacity, unsigned int partDurationMs) 
+	: MediaSink(env), m_bufferSize(bufferSize), m_initId(0), m_sequence(0), m_segmentCapacity(segmentCapacity), m_overflows(0), m_sliceDuration(sliceDuration)
+	, m_partDuration(partDurationMs*90), m_partSequence(0), m_partIndex(0), m_segmentFirstPart(0), m_partCapacity(0), m_partPts(0), m_notify(false), m_version(0)
+	, m_pmtPid(-1), m_videoPid(-1), m_videoStreamType(0), m_holding(false), m_heldPts(0), m_scanTailSize(0), m_scanResult(-1), m_segmentPts(0), m_timeOrigin(0)
 {
 	m_buffer = new unsigned char[m_bufferSize];
+	m_held.reserve(64*TRANSPORT_PACKET_SIZE);
+
+	// sealed slices of the window plus the one being written
+	unsigned int nbSlices = windowDuration/m_sliceDuration;
+	if (nbSlices < 2)
+	{
+		nbSlices = 2;
+	}
+	m_segments.resize(nbSlices+1);
+	LOG(NOTICE) << "HLS window:" << nbSlices*m_sliceDuration << "s segments:" << m_segments.size() << " capacity:" << m_segmentCapacity;
+
+	if (m_partDuration != 0)
+	{
+		// parts are only announced for the last segments, a GOP may last 3 slices
+		m_parts.resize(3*(3*m_sliceDuration*1000/partDurationMs + 1));
+		m_partCapacity = (unsigned int)((u_int64_t)m_segmentCapacity*partDurationMs/(m_sliceDuration*1000)) + 2*TRANSPORT_PACKET_SIZE;
+		LOG(NOTICE) << "LL-HLS part:" << partDurationMs << "ms parts:" << m_parts.size();
+	}
 }
 
 MemoryBufferSink::~MemoryBufferSink() 
 {
+	std::list<ChunkedSegmentSource*>::iterator it;
+	for (it = m_readers.begin(); it != m_readers.end(); ++it)
+	{
+		(*it)->detach();
+	}
 	delete[] m_buffer;
 }
 
@@ -37,7 +69,7 @@ Boolean MemoryBufferSink::continuePlaying()
 }
 
 
-void MemoryBufferSink::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime) 
+void MemoryBufferSink::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval /*presentationTime*/) 
 {
 	if (numTruncatedBytes > 0) 
 	{
@@ -49,64 +81,795 @@ void MemoryBufferSink::afterGettingFrame(unsigned frameSize, unsigned numTruncat
 	}
 	else
 	{			
-		// append buffer to slice buffer
-		if (m_refTime == 0)
+		// the framer delivers whole transport packets
+		for (unsigned int offset = 0; offset + TRANSPORT_PACKET_SIZE <= frameSize; offset += TRANSPORT_PACKET_SIZE)
 		{
-			m_refTime = presentationTime.tv_sec;
+			this->processPacket(m_buffer + offset);
 		}
-		unsigned int slice = (presentationTime.tv_sec-m_refTime)/m_sliceDuration;
-		std::string& outputBuffer = m_outputBuffers[slice];
-		outputBuffer.append((const char*)m_buffer, frameSize);
-		
-		// remove old buffers
-		while (m_outputBuffers.size()>3)
+		this->notifyWaiters();
+	}
+
+	continuePlaying();
+}
+
+// track PAT/PMT, cut a new segment on the video keyframes, append the packet
+void MemoryBufferSink::processPacket(const unsigned char* packet)
+{
+	if (packet[0] != 0x47)
+	{
+		return;
+	}
+	int pid = ((packet[1]&0x1F)<<8) | packet[2];
+	bool unitStart = (packet[1]&0x40);
+	unsigned int offset = 4;
+	if (packet[3]&0x20)
+	{
+		offset += 1 + packet[4];
+	}
+	bool hasPayload = (packet[3]&0x10) && (offset < TRANSPORT_PACKET_SIZE);
+	const unsigned char* payload = packet + offset;
+	unsigned int payloadSize = TRANSPORT_PACKET_SIZE - offset;
+
+	if ( (pid == 0) && hasPayload )
+	{
+		this->collectSection(m_pat, pid, packet, unitStart, payload, payloadSize);
+	}
+	else if ( (pid == m_pmtPid) && hasPayload )
+	{
+		this->collectSection(m_pmt, pid, packet, unitStart, payload, payloadSize);
+	}
+	else if ( (pid == m_videoPid) && hasPayload )
+	{
+		if ( unitStart && (payloadSize >= 14) 
+			&& (payload[0] == 0) && (payload[1] == 0) && (payload[2] == 1) && ((payload[3]&0xF0) == 0xE0) && (payload[7]&0x80) )
+		{
+			// video PES header, the previous PES did not show a keyframe
+			if (m_holding)
+			{
+				this->cutOnVideoPES(false);
+			}
+			u_int64_t pts = ((u_int64_t)(payload[9]&0x0E)<<29) | (payload[10]<<22) | ((payload[11]&0xFE)<<14) | (payload[12]<<7) | (payload[13]>>1);
+			unsigned int headerSize = 9 + payload[8];
+			this->startVideoPES(pts);
+			this->emitPacket(packet);
+			if (headerSize < payloadSize)
+			{
+				this->scanVideoES(payload + headerSize, payloadSize - headerSize);
+			}
+			return;
+		}
+		if (m_holding)
 		{
-			m_outputBuffers.erase(m_outputBuffers.begin());
+			this->emitPacket(packet);
+			this->scanVideoES(payload, payloadSize);
+			return;
 		}
 	}
 
-	continuePlaying();
+	this->emitPacket(packet);
+}
+
+// packets that follow a video PES start wait with it for the segment decision
+void MemoryBufferSink::emitPacket(const unsigned char* packet)
+{
+	if (m_holding)
+	{
+		m_held.append((const char*)packet, TRANSPORT_PACKET_SIZE);
+		if (m_held.size() >= 64*TRANSPORT_PACKET_SIZE)
+		{
+			// parameter sets and SEI do not take that much, no IRAP came
+			this->cutOnVideoPES(false);
+		}
+	}
+	else if (m_current)
+	{
+		this->appendData(packet, TRANSPORT_PACKET_SIZE);
+	}
+}
+
+void MemoryBufferSink::startVideoPES(u_int64_t pts)
+{
+	m_holding = true;
+	m_heldPts = pts;
+	m_held.clear();
+	m_scanTailSize = 0;
+}
+
+// a PES is a keyframe when an IDR/IRAP NAL comes before any other slice,
+// the SPS, PPS and SEI that precede it may push it beyond the first transport packet
+void MemoryBufferSink::scanVideoES(const unsigned char* es, unsigned int size)
+{
+	// the payload is scanned in place, a start code that spans packets begins in the carried-over bytes
+	unsigned int total = m_scanTailSize + size;
+	int result = -1;
+	for (unsigned int i = 0; (result < 0) && (i + 3 < total); ++i)
+	{
+		unsigned char b0 = (i   < m_scanTailSize) ? m_scanTail[i]   : es[i   - m_scanTailSize];
+		unsigned char b1 = (i+1 < m_scanTailSize) ? m_scanTail[i+1] : es[i+1 - m_scanTailSize];
+		unsigned char b2 = (i+2 < m_scanTailSize) ? m_scanTail[i+2] : es[i+2 - m_scanTailSize];
+		if ( (b0 == 0) && (b1 == 0) && (b2 == 1) )
+		{
+			unsigned char header = es[i+3 - m_scanTailSize];
+			if (m_videoStreamType == 0x24)
+			{
+				int type = (header&0x7E)>>1;
+				if ( (type >= 16) && (type <= 23) )
+				{
+					result = 1;
+				}
+				else if (type < 16)
+				{
+					result = 0;
+				}
+			}
+			else
+			{
+				int type = header&0x1F;
+				if (type == 5)
+				{
+					result = 1;
+				}
+				else if ( (type >= 1) && (type <= 4) )
+				{
+					result = 0;
+				}
+			}
+			i += 2;
+		}
+	}
+	if (result >= 0)
+	{
+		this->cutOnVideoPES(result == 1);
+	}
+	else
+	{
+		// keep the last 3 bytes for the next packet
+		unsigned char tail[3];
+		unsigned int tailSize = (total > 3) ? 3 : total;
+		for (unsigned int i = 0; i < tailSize; ++i)
+		{
+			unsigned int pos = total - tailSize + i;
+			tail[i] = (pos < m_scanTailSize) ? m_scanTail[pos] : es[pos - m_scanTailSize];
+		}
+		memcpy(m_scanTail, tail, tailSize);
+		m_scanTailSize = tailSize;
+	}
+}
+
+// cut before the held video PES if needed, then release the held packets
+void MemoryBufferSink::cutOnVideoPES(bool keyFrame)
+{
+	if (!m_holding)
+	{
+		return;
+	}
+	m_holding = false;
+	if (!m_current)
+	{
+		// wait for a keyframe, players cannot start decoding elsewhere
+		if (keyFrame)
+		{
+			this->openSegment(m_heldPts);
+		}
+	}
+	else if (this->isSegmentEnd(m_heldPts, keyFrame))
+	{
+		this->openSegment(m_heldPts);
+	}
+	else if (this->isPartEnd(m_heldPts))
+	{
+		this->openPart(m_heldPts, keyFrame);
+	}
+	if (m_current)
+	{
+		this->appendData((const unsigned char*)m_held.data(), m_held.size());
+	}
+	m_held.clear();
+}
+
+void MemoryBufferSink::appendData(const unsigned char* data, unsigned int size)
+{
+	if (!m_current->append(data, size))
+	{
+		m_overflows++;
+	}
+	if (m_currentPart)
+	{
+		m_currentPart->append(data, size);
+	}
+}
+
+// a unit start gives the offset of the new section in pointer_field, the bytes before end the previous one
+void MemoryBufferSink::collectSection(PSISection & psi, int pid, const unsigned char* packet, bool unitStart, const unsigned char* payload, unsigned int payloadSize)
+{
+	if (unitStart)
+	{
+		unsigned int pointer = payload[0];
+		if (1 + pointer > payloadSize)
+		{
+			psi.m_assembling = false;
+			return;
+		}
+		if (psi.m_assembling)
+		{
+			psi.m_packets.append((const char*)packet, TRANSPORT_PACKET_SIZE);
+			this->appendSection(psi, pid, payload + 1, pointer);
+		}
+		psi.m_assembling = true;
+		psi.m_section.clear();
+		psi.m_packets.assign((const char*)packet, TRANSPORT_PACKET_SIZE);
+		this->appendSection(psi, pid, payload + 1 + pointer, payloadSize - 1 - pointer);
+	}
+	else if (psi.m_assembling)
+	{
+		psi.m_packets.append((const char*)packet, TRANSPORT_PACKET_SIZE);
+		this->appendSection(psi, pid, payload, payloadSize);
+	}
+}
+
+void MemoryBufferSink::appendSection(PSISection & psi, int pid, const unsigned char* data, unsigned int size)
+{
+	if (!psi.m_assembling)
+	{
+		return;
+	}
+	psi.m_section.append((const char*)data, size);
+	if (psi.m_section.size() < 3)
+	{
+		return;
+	}
+	const unsigned char* section = (const unsigned char*)psi.m_section.data();
+	unsigned int sectionSize = 3 + (((section[1]&0x0F)<<8) | section[2]);
+	if (psi.m_section.size() >= sectionSize)
+	{
+		psi.m_assembling = false;
+		psi.m_table = psi.m_packets;
+		if (pid == 0)
+		{
+			this->parsePAT(section, sectionSize);
+		}
+		else
+		{
+			this->parsePMT(section, sectionSize);
+		}
+	}
+}
+
+// first program of the PAT gives the PMT PID
+void MemoryBufferSink::parsePAT(const unsigned char* section, unsigned int size)
+{
+	if ( (size < 12) || (section[0] != 0) )
+	{
+		return;
+	}
+	unsigned int sectionLength = ((section[1]&0x0F)<<8) | section[2];
+	unsigned int end = 3 + sectionLength - 4;
+	if (end > size)
+	{
+		end = size;
+	}
+	for (unsigned int i = 8; i + 4 <= end; i += 4)
+	{
+		unsigned int programNumber = (section[i]<<8) | section[i+1];
+		if (programNumber != 0)
+		{
+			m_pmtPid = ((section[i+2]&0x1F)<<8) | section[i+3];
+			break;
+		}
+	}
+}
+
+// PMT gives the video PID and its codec
+void MemoryBufferSink::parsePMT(const unsigned char* section, unsigned int size)
+{
+	if ( (size < 16) || (section[0] != 2) )
+	{
+		return;
+	}
+	unsigned int sectionLength = ((section[1]&0x0F)<<8) | section[2];
+	unsigned int end = 3 + sectionLength - 4;
+	if (end > size)
+	{
+		end = size;
+	}
+	unsigned int programInfoLength = ((section[10]&0x0F)<<8) | section[11];
+	for (unsigned int i = 12 + programInfoLength; i + 5 <= end; )
+	{
+		unsigned char streamType = section[i];
+		int pid = ((section[i+1]&0x1F)<<8) | section[i+2];
+		unsigned int esInfoLength = ((section[i+3]&0x0F)<<8) | section[i+4];
+		if ( (streamType == 0x1B) || (streamType == 0x24) )
+		{
+			m_videoPid = pid;
+			m_videoStreamType = streamType;
+			break;
+		}
+		i += 5 + esInfoLength;
+	}
+}
+
+// cut on the first keyframe after a multiple of the slice duration, the renditions of an ABR
+// ladder share the clock of the capture so their segments start on the same frames
+bool MemoryBufferSink::isSegmentEnd(u_int64_t pts, bool keyFrame)
+{
+	u_int64_t slice = m_sliceDuration*90000ULL;
+	u_int64_t elapsed = (pts - m_segmentPts) & PTS_MASK;
+
+	// a GOP longer than the target does not make endless segments
+	return (keyFrame && (pts/slice != m_segmentPts/slice)) || (elapsed >= 3*slice);
+}
+
+// parts follow the same clock grid
+bool MemoryBufferSink::isPartEnd(u_int64_t pts)
+{
+	return (m_partDuration != 0) && (pts/m_partDuration != m_partPts/m_partDuration);
+}
+
+// seal the current segment and take the oldest ring slot for the new one
+void MemoryBufferSink::openSegment(u_int64_t pts)
+{
+	u_int64_t startTime = pts;
+	if (!m_current)
+	{
+		// numbered and timed from the clock, the same way as the other renditions
+		m_sequence = (unsigned int)(pts/(m_sliceDuration*90000ULL));
+		m_timeOrigin = pts;
+	}
+	else
+	{
+		m_current->setDuration((pts - m_segmentPts) & PTS_MASK);
+		if (m_currentPart)
+		{
+			// its last part is sealed by openPart below
+			m_current->setParts(m_segmentFirstPart, m_partSequence + 1 - m_segmentFirstPart);
+		}
+		m_current->seal();
+		startTime = m_current->startTime() + m_current->duration();
+
+		// size the next buffers from the observed bitrate
+		unsigned int capacity = m_current->size() + m_current->size()/4;
+		if (capacity > m_segmentCapacity)
+		{
+			LOG(INFO) << "HLS segment capacity:" << m_segmentCapacity << " => " << capacity << " overflows:" << m_overflows;
+			m_segmentCapacity = capacity;
+		}
+		m_overflows = 0;
+		m_sequence++;
+		m_notify = true;
+		m_version++;
+	}
+
+	std::shared_ptr<MemorySegment> & segment = m_segments[m_sequence % m_segments.size()];
+	if (!segment || (segment.use_count() > 1))
+	{
+		// first round of the ring, or an HTTP client is still reading the old segment
+		segment.reset(new MemorySegment(m_segmentCapacity));
+	}
+	segment->reset(m_sequence, m_segmentCapacity);
+	segment->setStartTime(startTime);
+	segment->setInitId(m_initId);
+	m_current = segment;
+	m_segmentPts = pts;
+
+	if (m_partDuration != 0)
+	{
+		this->openPart(pts, true);
+	}
+
+	// each segment can be decoded alone
+	if ( !m_pat.m_table.empty() && !m_pmt.m_table.empty() )
+	{
+		this->appendData((const unsigned char*)m_pat.m_table.data(), m_pat.m_table.size());
+		this->appendData((const unsigned char*)m_pmt.m_table.data(), m_pmt.m_table.size());
+	}
+}
+
+// seal the current part, the next one starts on this PES
+void MemoryBufferSink::openPart(u_int64_t pts, bool independent)
+{
+	if (m_currentPart)
+	{
+		m_currentPart->setDuration((pts - m_partPts) & PTS_MASK);
+		m_currentPart->seal();
+		if (m_currentPart->size() + m_currentPart->size()/4 > m_partCapacity)
+		{
+			m_partCapacity = m_currentPart->size() + m_currentPart->size()/4;
+		}
+		m_partSequence++;
+		m_partIndex++;
+		m_notify = true;
+		m_version++;
+	}
+
+	if (m_current->size() == 0)
+	{
+		// first part of the segment being opened
+		m_segmentFirstPart = m_partSequence;
+		m_partIndex = 0;
+	}
+
+	std::shared_ptr<MemorySegment> & part = m_parts[m_partSequence % m_parts.size()];
+	if (!part || (part.use_count() > 1))
+	{
+		part.reset(new MemorySegment(m_partCapacity));
+	}
+	part->reset(m_partSequence, m_partCapacity);
+	part->setStartTime(m_current->startTime() + ((pts - m_segmentPts) & PTS_MASK));
+	part->setPart(m_current->id(), m_partIndex, independent);
+	m_currentPart = part;
+	m_partPts = pts;
+}
+
+// oldest sealed segment still in the ring
+unsigned int MemoryBufferSink::firstSlice()
+{
+	unsigned int first = 0;
+	if (m_current)
+	{
+		unsigned int depth = m_segments.size()-1;
+		first = (m_current->id() > depth) ? m_current->id() - depth : 0;
+		while ( (first < m_current->id()) && !this->getSegment(first) )
+		{
+			first++;
+		}
+	}
+	return first;
 }
 
 unsigned int MemoryBufferSink::getBufferSize(unsigned int slice)
 {
 	unsigned int size = 0;
-	std::map<unsigned int,std::string>::iterator it = m_outputBuffers.find(slice);
-	if (it != m_outputBuffers.end())
+	MemorySegmentRef segment = this->getSegment(slice);
+	if (segment)
 	{
-		size = it->second.size();
+		size = segment->size();
 	}
 	return size;
 }
 
-std::string MemoryBufferSink::getBuffer(unsigned int slice)
+// the segment is shared with the caller, it stays valid after its slot is reused
+MemorySegmentRef MemoryBufferSink::getSegment(unsigned int slice)
+{
+	MemorySegmentRef segment;
+	if (!m_segments.empty())
+	{
+		const std::shared_ptr<MemorySegment> & slot = m_segments[slice % m_segments.size()];
+		if ( slot && (slot->id() == slice) && slot->isSealed() )
+		{
+			segment = slot;
+		}
+	}
+	return segment;
+}
+
+// sealed segments from the oldest to the newest
+void MemoryBufferSink::getSegmentList(std::list<MemorySegmentRef> & segments)
+{
+	if (m_current)
+	{
+		for (unsigned int slice = this->firstSlice(); slice < m_current->id(); ++slice)
+		{
+			MemorySegmentRef segment = this->getSegment(slice);
+			if (segment)
+			{
+				segments.push_back(segment);
+			}
+		}
+	}
+}
+
+double MemoryBufferSink::getTime(const MemorySegmentRef & segment)
+{
+	return (segment->startTime() - m_timeOrigin)/90000.0;
+}
+
+// segment that contains the time in seconds from the sink start
+unsigned int MemoryBufferSink::findSegment(double npt)
+{
+	std::list<MemorySegmentRef> segments;
+	this->getSegmentList(segments);
+	unsigned int slice = this->firstSlice();
+	std::list<MemorySegmentRef>::iterator it;
+	for (it = segments.begin(); it != segments.end(); ++it)
+	{
+		if (this->getTime(*it) <= npt)
+		{
+			slice = (*it)->id();
+		}
+	}
+	return slice;
+}
+
+double MemoryBufferSink::firstTime()
+{
+	double firstTime = 0;
+	MemorySegmentRef segment = this->getSegment(this->firstSlice());
+	if (segment)
+	{
+		firstTime = this->getTime(segment);
+	}
+	return firstTime;
+}
+
+double MemoryBufferSink::duration()
+{
+	double duration = 0;
+	std::list<MemorySegmentRef> segments;
+	this->getSegmentList(segments);
+	std::list<MemorySegmentRef>::iterator it;
+	for (it = segments.begin(); it != segments.end(); ++it)
+	{
+		duration += (*it)->getDuration();
+	}
+	return duration;
+}
+
+// EXT-X-STREAM-INF BANDWIDTH : peak bitrate of the segments in bits per second
+unsigned int MemoryBufferSink::getBandwidth()
+{
+	u_int64_t bandwidth = 0;
+	std::list<MemorySegmentRef> segments;
+	this->getSegmentList(segments);
+	std::list<MemorySegmentRef>::iterator it;
+	for (it = segments.begin(); it != segments.end(); ++it)
+	{
+		if ((*it)->duration() > 0)
+		{
+			u_int64_t bitrate = (u_int64_t)(*it)->size()*8*90000/(*it)->duration();
+			if (bitrate > bandwidth)
+			{
+				bandwidth = bitrate;
+			}
+		}
+	}
+	return (unsigned int)bandwidth;
+}
+
+// EXT-X-TARGETDURATION : longest segment rounded up
+unsigned int MemoryBufferSink::getTargetDuration()
+{
+	unsigned int target = m_sliceDuration;
+	std::list<MemorySegmentRef> segments;
+	this->getSegmentList(segments);
+	std::list<MemorySegmentRef>::iterator it;
+	for (it = segments.begin(); it != segments.end(); ++it)
+	{
+		unsigned int duration = ((*it)->duration() + 89999)/90000;
+		if (duration > target)
+		{
+			target = duration;
+		}
+	}
+	return target;
+}
+
+// -----------------------------------------
+//    LL-HLS parts
+// -----------------------------------------
+// EXT-X-PART-INF : parts end on the first PES after the target, use the longest one
+double MemoryBufferSink::getPartTarget()
+{
+	u_int32_t target = m_partDuration;
+	for (unsigned int i = 0; i < m_parts.size(); ++i)
+	{
+		if (m_parts[i] && m_parts[i]->isSealed() && (m_parts[i]->duration() > target))
+		{
+			target = m_parts[i]->duration();
+		}
+	}
+	return target/90000.0;
+}
+
+MemorySegmentRef MemoryBufferSink::getPart(unsigned int part)
+{
+	MemorySegmentRef segment;
+	if (!m_parts.empty())
+	{
+		const std::shared_ptr<MemorySegment> & slot = m_parts[part % m_parts.size()];
+		if ( slot && (slot->id() == part) && slot->isSealed() )
+		{
+			segment = slot;
+		}
+	}
+	return segment;
+}
+
+// sealed parts of a segment, nothing if some of them already left the ring
+void MemoryBufferSink::getPartList(unsigned int slice, std::list<MemorySegmentRef> & parts)
+{
+	unsigned int first = 0;
+	unsigned int count = 0;
+	if (m_current && (slice == m_current->id()))
+	{
+		first = m_segmentFirstPart;
+		count = m_partSequence - m_segmentFirstPart;
+	}
+	else
+	{
+		MemorySegmentRef segment = this->getSegment(slice);
+		if (segment)
+		{
+			first = segment->firstPart();
+			count = segment->nbParts();
+		}
+	}
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		MemorySegmentRef part = this->getPart(first + i);
+		if (!part || (part->msn() != slice))
+		{
+			parts.clear();
+			break;
+		}
+		parts.push_back(part);
+	}
+}
+
+// _HLS_msn/_HLS_part : the segment is sealed or the part of the current segment is
+bool MemoryBufferSink::isAvailable(unsigned int slice, int partIndex)
+{
+	bool available = false;
+	if (m_current)
+	{
+		if (slice < m_current->id())
+		{
+			available = true;
+		}
+		else if ( (slice == m_current->id()) && (partIndex >= 0) )
+		{
+			available = ((unsigned int)partIndex < m_partSequence - m_segmentFirstPart);
+		}
+	}
+	return available;
+}
+
+void MemoryBufferSink::addWaiter(TaskFunc* func, void* clientData, bool onData)
+{
+	std::list< std::pair<TaskFunc*,void*> > & waiters = onData ? m_dataWaiters : m_waiters;
+	waiters.push_back(std::pair<TaskFunc*,void*>(func, clientData));
+}
+
+static void removeFrom(std::list< std::pair<TaskFunc*,void*> > & waiters, void* clientData)
+{
+	std::list< std::pair<TaskFunc*,void*> >::iterator it = waiters.begin();
+	while (it != waiters.end())
+	{
+		if (it->second == clientData)
+		{
+			it = waiters.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void MemoryBufferSink::removeWaiter(void* clientData)
+{
+	removeFrom(m_waiters, clientData);
+	removeFrom(m_dataWaiters, clientData);
+}
+
+static void callOnce(std::list< std::pair<TaskFunc*,void*> > & list)
 {
-	std::string content;
-	std::map<unsigned int,std::string>::iterator it = m_outputBuffers.find(slice);
-	if (it != m_outputBuffers.end())
+	std::list< std::pair<TaskFunc*,void*> > waiters;
+	waiters.swap(list);
+	std::list< std::pair<TaskFunc*,void*> >::iterator it;
+	for (it = waiters.begin(); it != waiters.end(); ++it)
 	{
-		content = it->second;
+		it->first(it->second);
+	}
+}
 
+// waiters are called once, those still waiting register again
+void MemoryBufferSink::notifyWaiters()
+{
+	if (m_notify)
+	{
+		m_notify = false;
+		callOnce(m_waiters);
 	}
-	return content;
+	// chunked readers of the current segment get every append
+	callOnce(m_dataWaiters);
 }
 
-unsigned int MemoryBufferSink::firstTime()
+MemorySegmentRef MemoryBufferSink::getCurrentSegment()
+{
+	return m_current;
+}
+
+// -----------------------------------------
+//    ChunkedSegmentSource
+// -----------------------------------------
+ChunkedSegmentSource* ChunkedSegmentSource::createNew(UsageEnvironment& env, MemoryBufferSink* sink, const MemorySegmentRef & segment, bool chunked)
 {
-	unsigned int firstTime = 0;
-	if (m_outputBuffers.size() != 0)				
+	ChunkedSegmentSource* source = NULL;
+	if ( (sink != NULL) && segment )
 	{
-		firstTime = m_outputBuffers.begin()->first;
+		source = new ChunkedSegmentSource(env, sink, segment, chunked);
 	}
-	return firstTime*m_sliceDuration;
+	return source;
 }
 
-unsigned int MemoryBufferSink::duration()
+ChunkedSegmentSource::ChunkedSegmentSource(UsageEnvironment& env, MemoryBufferSink* sink, const MemorySegmentRef & segment, bool chunked)
+	: FramedSource(env), m_sink(sink), m_segment(segment), m_offset(0), m_done(false), m_chunked(chunked)
 {
-	unsigned int duration = 0;
-	if (m_outputBuffers.size() != 0)				
+	m_sink->addReader(this);
+}
+
+ChunkedSegmentSource::~ChunkedSegmentSource()
+{
+	if (m_sink != NULL)
 	{
-		duration = m_outputBuffers.rbegin()->first - m_outputBuffers.begin()->first;
+		m_sink->removeWaiter(this);
+		m_sink->removeReader(this);
 	}
-	return (duration)*m_sliceDuration;
+}
+
+void ChunkedSegmentSource::doGetNextFrame()
+{
+	this->deliver();
+}
+
+// one HTTP chunk with what was appended since the last one, the last chunk is empty
+void ChunkedSegmentSource::deliver()
+{
+	if (m_done)
+	{
+		handleClosure();
+		return;
+	}
+
+	// the segment buffer may move while it grows, it is only read here on the event loop
+	unsigned int available = m_segment->size() - m_offset;
+	if ( (available == 0) && !m_segment->isSealed() )
+	{
+		if (m_sink == NULL)
+		{
+			// the stream is gone with its sink
+			handleClosure();
+			return;
+		}
+		m_sink->addWaiter(newDataStub, this, true);
+		return;
+	}
+
+	// room for the chunk size line and the trailing CRLF
+	const unsigned int overhead = m_chunked ? 12 : 0;
+	unsigned int size = (fMaxSize > overhead) ? fMaxSize - overhead : 0;
+	if (size > available)
+	{
+		size = available;
+	}
+	if ( (size == 0) && (available != 0) )
+	{
+		// not enough room, the sink will ask again once it flushed its buffer
+		fFrameSize = 0;
+	}
+	else if (!m_chunked)
+	{
+		// plain body, the closure ends it
+		if (size == 0)
+		{
+			handleClosure();
+			return;
+		}
+		memcpy(fTo, m_segment->data() + m_offset, size);
+		fFrameSize = size;
+		m_offset += size;
+	}
+	else
+	{
+		int header = snprintf((char*)fTo, overhead, "%x\r\n", size);
+		memcpy(fTo + header, m_segment->data() + m_offset, size);
+		memcpy(fTo + header + size, "\r\n", 2);
+		fFrameSize = header + size + 2;
+		m_offset += size;
+		m_done = (size == 0);
+	}
+
+	gettimeofday(&fPresentationTime, NULL);
+	fDurationInMicroseconds = 0;
+	FramedSource::afterGetting(this);
 }
@@ -0,0 +1,94 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** MemorySegment.cpp
+** 
+** Immutable HLS/DASH segment shared between the sink and the HTTP readers
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "MemorySegment.h"
+
+// -----------------------------------------
+//    MemorySegment
+// -----------------------------------------
+// return false when the preallocated buffer had to grow
+bool MemorySegment::append(const unsigned char* data, unsigned int size)
+{
+	bool fit = true;
+	if (!m_sealed)
+	{
+		if (m_size + size > m_buffer.size())
+		{
+			m_buffer.resize((m_size + size)*3/2);
+			fit = false;
+		}
+		memcpy(m_buffer.data() + m_size, data, size);
+		m_size += size;
+	}
+	return fit;
+}
+
+// reuse the buffer for a new segment, it should not be shared anymore
+void MemorySegment::reset(unsigned int id, unsigned int capacity)
+{
+	if (m_buffer.size() < capacity)
+	{
+		m_buffer.resize(capacity);
+	}
+	m_size = 0;
+	m_sealed = false;
+	m_id = id;
+	m_startTime = 0;
+	m_duration = 0;
+	m_firstPart = 0;
+	m_nbParts = 0;
+	m_msn = 0;
+	m_partIndex = 0;
+	m_independent = false;
+	m_initId = 0;
+}
+
+// -----------------------------------------
+//    MemorySegmentSource
+// -----------------------------------------
+MemorySegmentSource* MemorySegmentSource::createNew(UsageEnvironment& env, const MemorySegmentRef & segment)
+{
+	MemorySegmentSource* source = NULL;
+	if (segment && segment->isSealed())
+	{
+		source = new MemorySegmentSource(env, segment);
+	}
+	return source;
+}
+
+MemorySegmentSource::MemorySegmentSource(UsageEnvironment& env, const MemorySegmentRef & segment) 
+	: FramedSource(env), m_segment(segment), m_offset(0)
+{
+}
+
+void MemorySegmentSource::doGetNextFrame()
+{
+	if (m_offset >= m_segment->size())
+	{
+		handleClosure();
+		return;
+	}
+
+	fFrameSize = m_segment->size() - m_offset;
+	if (fFrameSize > fMaxSize)
+	{
+		fFrameSize = fMaxSize;
+	}
+	memmove(fTo, m_segment->data() + m_offset, fFrameSize);
+	m_offset += fFrameSize;
+
+	gettimeofday(&fPresentationTime, NULL);
+	fDurationInMicroseconds = 0;
+
+	FramedSource::afterGetting(this);
+}
@@ -9,6 +9,7 @@
 
 #include "MulticastServerMediaSubsession.h"
 #include "DeviceSource.h"
+#include "RTPRateController.h"
 
 // -----------------------------------------
 //    ServerMediaSubsession for Multicast
@@ -18,30 +19,53 @@ MulticastServerMediaSubsession* MulticastServerMediaSubsession::createNew(UsageE
 									, Port rtpPortNum, Port rtcpPortNum
 									, int ttl
 									, StreamReplicator* replicator
-									, const std::string& format) 
+									, const std::string& format
+									, const RTPOutputParameters & params) 
 { 
 	// Create a source
 	FramedSource* source = replicator->createStreamReplica();			
 	FramedSource* videoSource = createSource(env, source, format);
 
 	// Create RTP/RTCP groupsock
-	Groupsock* rtpGroupsock = new Groupsock(env, destinationAddress, rtpPortNum, ttl);
+	RTPOutputGroupsock* rtpGroupsock = new RTPOutputGroupsock(env, destinationAddress, rtpPortNum, ttl, params);
 	Groupsock* rtcpGroupsock = new Groupsock(env, destinationAddress, rtcpPortNum, ttl);
 
 	// Create a RTP sink
-	RTPSink* videoSink = createSink(env, rtpGroupsock, 96, format, dynamic_cast<V4L2DeviceSource*>(replicator->inputSource()));
+	V4L2DeviceSource* deviceSource = dynamic_cast<V4L2DeviceSource*>(replicator->inputSource());
+	if (deviceSource != NULL)
+	{
+		rtpGroupsock->setSource(deviceSource, format);
+		rtpGroupsock->enableRetransmission();
+		rtpGroupsock->enablePacing(&deviceSource->getStats());
+	}
+	OutPacketBufferSize bufferSize(getSinkBufferSize(deviceSource, params.m_sinkBufferHeadroom, params.m_sinkBufferMinSize));
+	RTPSink* videoSink = createSink(env, rtpGroupsock, 96, format, deviceSource);
 
 	// Create 'RTCP instance'
 	const unsigned maxCNAMElen = 100;
 	unsigned char CNAME[maxCNAMElen+1];
 	gethostname((char*)CNAME, maxCNAMElen);
 	CNAME[maxCNAMElen] = '\0'; 
-	RTCPInstance* rtcpInstance = RTCPInstance::createNew(env, rtcpGroupsock,  500, CNAME, videoSink, NULL);
+	RTCPInstance* rtcpInstance = NULL;
+	if (params.m_feedback.m_enable)
+	{
+		rtcpInstance = RTCPFeedbackInstance::createNew(env, rtcpGroupsock,  500, CNAME, videoSink, rtpGroupsock, deviceSource, params.m_feedback);
+	}
+	else
+	{
+		rtcpInstance = RTCPInstance::createNew(env, rtcpGroupsock,  500, CNAME, videoSink, NULL);
+	}
+
+	RTPRateController* rateController = RTPRateController::lookup(replicator->inputSource());
+	if (rateController != NULL)
+	{
+		rateController->addSink(videoSink);
+	}
 
 	// Start Playing the Sink
 	videoSink->startPlaying(*videoSource, NULL, NULL);
 	
-	return new MulticastServerMediaSubsession(replicator, videoSink, rtcpInstance);
+	return new MulticastServerMediaSubsession(replicator, videoSink, rtcpInstance, params.m_feedback.m_enable);
 }
 		
 char const* MulticastServerMediaSubsession::sdpLines() 
@@ -57,6 +81,6 @@ char const* MulticastServerMediaSubsession::sdpLines()
 
 char const* MulticastServerMediaSubsession::getAuxSDPLine(RTPSink* rtpSink,FramedSource* inputSource)
 {
-	return this->getAuxLine(dynamic_cast<V4L2DeviceSource*>(m_replicator->inputSource()), rtpSink->rtpPayloadType());
+	return this->getAuxLine(dynamic_cast<V4L2DeviceSource*>(m_replicator->inputSource()), rtpSink->rtpPayloadType(), m_rtcpFeedback);
 }
 		
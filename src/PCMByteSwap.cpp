@@ -0,0 +1,167 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** PCMByteSwap.cpp
+**
+** Byte order conversion of interleaved PCM samples, SIMD kernel selected at runtime
+**
+** -------------------------------------------------------------------------*/
+
+#include "PCMByteSwap.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define PCM_SWAP_SSSE3
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PCM_SWAP_NEON
+#endif
+
+typedef void (*PCMByteSwapFunc)(unsigned char* dst, const unsigned char* src, size_t size, int width);
+
+// both bytes of a pair are read before writing, the source can be the destination
+void pcmByteSwapCopyScalar(unsigned char* dst, const unsigned char* src, size_t size, int width)
+{
+	if (width < 1)
+	{
+		return;
+	}
+	size_t end = size - size % width;
+	for (size_t i = 0; i < end; i += width)
+	{
+		for (int k = 0; k < width/2; k++)
+		{
+			unsigned char first = src[i + k];
+			unsigned char last = src[i + width - 1 - k];
+			dst[i + k] = last;
+			dst[i + width - 1 - k] = first;
+		}
+		if (width % 2)
+		{
+			dst[i + width/2] = src[i + width/2];
+		}
+	}
+}
+
+void pcmByteSwapScalar(unsigned char* data, size_t size, int width)
+{
+	pcmByteSwapCopyScalar(data, data, size, width);
+}
+
+#ifdef PCM_SWAP_SSSE3
+// pshufb reverses the samples of 16 bytes, 24 bits samples are handled 5 by 5
+__attribute__((target("ssse3")))
+static void pcmByteSwapSSSE3(unsigned char* dst, const unsigned char* src, size_t size, int width)
+{
+	size_t i = 0;
+	if (width == 3)
+	{
+		// the 16th byte is copied unchanged, the next store starts on it
+		// the next block is loaded before this store overlaps it, in place the load would wait on the store
+		const __m128i mask = _mm_setr_epi8(2,1,0, 5,4,3, 8,7,6, 11,10,9, 14,13,12, 15);
+		if (size >= 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)src);
+			for (; i + 31 <= size; i += 15)
+			{
+				__m128i next = _mm_loadu_si128((const __m128i*)(src + i + 15));
+				_mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(v, mask));
+				v = next;
+			}
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(v, mask));
+			i += 15;
+		}
+	}
+	else if ( (width == 2) || (width == 4) )
+	{
+		const __m128i mask = (width == 2) ? _mm_setr_epi8(1,0, 3,2, 5,4, 7,6, 9,8, 11,10, 13,12, 15,14)
+		                                  : _mm_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+		for (; i + 16 <= size; i += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(v, mask));
+		}
+	}
+	pcmByteSwapCopyScalar(dst + i, src + i, size - i, width);
+}
+#endif
+
+#ifdef PCM_SWAP_NEON
+// vrev for 16/32 bits, 24 bits samples are deinterleaved by vld3 and stored with the planes exchanged
+static void pcmByteSwapNEON(unsigned char* dst, const unsigned char* src, size_t size, int width)
+{
+	size_t i = 0;
+	if (width == 2)
+	{
+		for (; i + 16 <= size; i += 16)
+		{
+			vst1q_u8(dst + i, vrev16q_u8(vld1q_u8(src + i)));
+		}
+	}
+	else if (width == 4)
+	{
+		for (; i + 16 <= size; i += 16)
+		{
+			vst1q_u8(dst + i, vrev32q_u8(vld1q_u8(src + i)));
+		}
+	}
+	else if (width == 3)
+	{
+		for (; i + 48 <= size; i += 48)
+		{
+			uint8x16x3_t v = vld3q_u8(src + i);
+			uint8x16_t low = v.val[0];
+			v.val[0] = v.val[2];
+			v.val[2] = low;
+			vst3q_u8(dst + i, v);
+		}
+	}
+	pcmByteSwapCopyScalar(dst + i, src + i, size - i, width);
+}
+#endif
+
+struct PCMByteSwapKernel
+{
+	PCMByteSwapFunc m_func;
+	const char*     m_name;
+};
+
+static PCMByteSwapKernel selectKernel()
+{
+	PCMByteSwapKernel kernel = { pcmByteSwapCopyScalar, "scalar" };
+#if defined(PCM_SWAP_SSSE3)
+	if (__builtin_cpu_supports("ssse3"))
+	{
+		kernel.m_func = pcmByteSwapSSSE3;
+		kernel.m_name = "ssse3";
+	}
+#elif defined(PCM_SWAP_NEON)
+	kernel.m_func = pcmByteSwapNEON;
+	kernel.m_name = "neon";
+#endif
+	return kernel;
+}
+
+// chosen on the first call, the capture threads share it
+static const PCMByteSwapKernel & getKernel()
+{
+	static const PCMByteSwapKernel kernel = selectKernel();
+	return kernel;
+}
+
+void pcmByteSwap(unsigned char* data, size_t size, int width)
+{
+	getKernel().m_func(data, data, size, width);
+}
+
+void pcmByteSwapCopy(unsigned char* dst, const unsigned char* src, size_t size, int width)
+{
+	getKernel().m_func(dst, src, size, width);
+}
+
+const char* pcmByteSwapKernel()
+{
+	return getKernel().m_name;
+}
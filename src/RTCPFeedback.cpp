@@ -0,0 +1,209 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** RTCPFeedback.cpp
+**
+** RTCP feedback (RFC 4585/5104) : generic NACK, PLI and FIR
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+// project
+#include "logger.h"
+#include "RTCPFeedback.h"
+#include "RTPOutputGroupsock.h"
+#include "DeviceSource.h"
+
+// -----------------------------------------
+//    RTP packet cache
+// -----------------------------------------
+RTPPacketCache::RTPPacketCache(unsigned int cacheSize, unsigned int maxPacketSize)
+	: m_maxPacketSize(maxPacketSize), m_data(cacheSize*maxPacketSize), m_slots(cacheSize), m_hits(0), m_misses(0)
+{
+}
+
+void RTPPacketCache::addPacket(const unsigned char* packet, unsigned int size)
+{
+	if ( (size < 12) || m_slots.empty() )
+	{
+		return;
+	}
+	u_int16_t seqNum = (packet[2]<<8)|packet[3];
+	unsigned int index = seqNum % m_slots.size();
+	Slot & slot = m_slots[index];
+	if (size > m_maxPacketSize)
+	{
+		// do not answer a NACK with the packet that was there before
+		slot.m_size = 0;
+		return;
+	}
+	memcpy(&m_data[index*m_maxPacketSize], packet, size);
+	slot.m_size = size;
+	slot.m_seqNum = seqNum;
+}
+
+bool RTPPacketCache::getPacket(u_int16_t seqNum, unsigned char* & packet, unsigned int & size)
+{
+	bool found = false;
+	if (!m_slots.empty())
+	{
+		unsigned int index = seqNum % m_slots.size();
+		const Slot & slot = m_slots[index];
+		if ( (slot.m_size != 0) && (slot.m_seqNum == seqNum) )
+		{
+			packet = &m_data[index*m_maxPacketSize];
+			size = slot.m_size;
+			found = true;
+		}
+	}
+	if (found)
+	{
+		m_hits++;
+	}
+	else
+	{
+		m_misses++;
+	}
+	return found;
+}
+
+// -----------------------------------------
+//    RTCP instance handling feedback
+// -----------------------------------------
+RTCPFeedbackInstance* RTCPFeedbackInstance::createNew(UsageEnvironment& env, Groupsock* RTCPgs, unsigned totSessionBW, unsigned char const* cname, RTPSink* sink
+							, RTPOutputGroupsock* rtpGroupsock, V4L2DeviceSource* source, const RTCPFeedbackParameters & params)
+{
+	return new RTCPFeedbackInstance(env, RTCPgs, totSessionBW, cname, sink, rtpGroupsock, source, params);
+}
+
+RTCPFeedbackInstance::RTCPFeedbackInstance(UsageEnvironment& env, Groupsock* RTCPgs, unsigned totSessionBW, unsigned char const* cname, RTPSink* sink
+							, RTPOutputGroupsock* rtpGroupsock, V4L2DeviceSource* source, const RTCPFeedbackParameters & params)
+	: RTCPInstance(env, RTCPgs, totSessionBW, cname, sink, NULL, False)
+	, m_sink(sink), m_rtpGroupsock(rtpGroupsock), m_source(source), m_params(params)
+	, m_statsSec(0), m_nacks(0), m_retransmits(0), m_plis(0), m_firs(0), m_keyFrameRequests(0)
+{
+	timerclear(&m_lastKeyFrameRequest);
+	this->setAuxilliaryReadHandler(incomingFeedbackStub, this);
+}
+
+RTCPFeedbackInstance::~RTCPFeedbackInstance()
+{
+	this->logStats(true);
+}
+
+// walk the compound RTCP packet, live555 handles SR/RR/SDES/BYE on its own
+void RTCPFeedbackInstance::incomingFeedback(unsigned char* packet, unsigned packetSize)
+{
+	u_int32_t ssrc = m_sink->SSRC();
+	// the unicast RTCP groupsock knows the client that sent the packet
+	RTPOutputGroupsock* rtcpGroupsock = dynamic_cast<RTPOutputGroupsock*>(this->RTCPgs());
+	const struct sockaddr_in* requester = (rtcpGroupsock != NULL) ? rtcpGroupsock->getLastSender() : NULL;
+	while (packetSize >= 4)
+	{
+		if ((packet[0]>>6) != 2)
+		{
+			break;
+		}
+		unsigned char fmt = packet[0]&0x1F;
+		unsigned char pt = packet[1];
+		unsigned int length = (((packet[2]<<8)|packet[3]) + 1)*4;
+		if (length > packetSize)
+		{
+			break;
+		}
+
+		if ( ((pt == RTCP_PT_RTPFB) || (pt == RTCP_PT_PSFB)) && (length >= 12) )
+		{
+			u_int32_t mediaSSRC = (packet[8]<<24)|(packet[9]<<16)|(packet[10]<<8)|packet[11];
+			unsigned char* fci = packet + 12;
+			unsigned int fciSize = length - 12;
+
+			if ( (pt == RTCP_PT_RTPFB) && (fmt == 1) && (mediaSSRC == ssrc) )
+			{
+				// Generic NACK : PID + bitmask of the 16 following lost packets
+				for (unsigned int i = 0; i+4 <= fciSize; i += 4)
+				{
+					this->handleNack((fci[i]<<8)|fci[i+1], (fci[i+2]<<8)|fci[i+3], requester);
+				}
+			}
+			else if ( (pt == RTCP_PT_PSFB) && (fmt == 1) && (mediaSSRC == ssrc) )
+			{
+				// Picture Loss Indication
+				m_plis++;
+				this->handleKeyFrameRequest();
+			}
+			else if ( (pt == RTCP_PT_PSFB) && (fmt == 4) )
+			{
+				// Full Intra Request, the media SSRC is in the FCI
+				for (unsigned int i = 0; i+8 <= fciSize; i += 8)
+				{
+					u_int32_t firSSRC = (fci[i]<<24)|(fci[i+1]<<16)|(fci[i+2]<<8)|fci[i+3];
+					if (firSSRC == ssrc)
+					{
+						m_firs++;
+						this->handleKeyFrameRequest();
+					}
+				}
+			}
+		}
+		packet += length;
+		packetSize -= length;
+	}
+	this->logStats(false);
+}
+
+void RTCPFeedbackInstance::handleNack(u_int16_t pid, u_int16_t blp, const struct sockaddr_in* requester)
+{
+	for (int i = -1; i < 16; ++i)
+	{
+		if ( (i < 0) || (blp & (1<<i)) )
+		{
+			u_int16_t seqNum = pid + (i+1);
+			m_nacks++;
+			if ( (m_rtpGroupsock != NULL) && m_rtpGroupsock->retransmit(seqNum, requester) )
+			{
+				m_retransmits++;
+			}
+		}
+	}
+}
+
+void RTCPFeedbackInstance::handleKeyFrameRequest()
+{
+	timeval now;
+	gettimeofday(&now, NULL);
+	timeval diff;
+	timersub(&now, &m_lastKeyFrameRequest, &diff);
+	unsigned long elapsedMs = diff.tv_sec*1000 + diff.tv_usec/1000;
+	if (timerisset(&m_lastKeyFrameRequest) && (elapsedMs < m_params.m_keyFrameIntervalMs))
+	{
+		// every receiver of a multicast group may ask for the same loss
+		return;
+	}
+	m_lastKeyFrameRequest = now;
+	if ( (m_source != NULL) && m_source->requestKeyFrame() )
+	{
+		m_keyFrameRequests++;
+	}
+}
+
+void RTCPFeedbackInstance::logStats(bool force)
+{
+	timeval now;
+	gettimeofday(&now, NULL);
+	if ( force || (now.tv_sec - m_statsSec >= 10) )
+	{
+		m_statsSec = now.tv_sec;
+		if (m_nacks || m_plis || m_firs)
+		{
+			RTPPacketCache* cache = (m_rtpGroupsock != NULL) ? m_rtpGroupsock->getPacketCache() : NULL;
+			LOG(NOTICE) << "RTCP feedback ssrc:" << std::hex << m_sink->SSRC() << std::dec
+				<< " nack:" << m_nacks << " retransmit:" << m_retransmits
+				<< " cache hit:" << (cache ? cache->getHits() : 0) << " miss:" << (cache ? cache->getMisses() : 0)
+				<< " pli:" << m_plis << " fir:" << m_firs << " keyframe:" << m_keyFrameRequests;
+		}
+	}
+}
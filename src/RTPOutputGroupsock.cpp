@@ -0,0 +1,325 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** RTPOutputGroupsock.cpp
+**
+** Groupsock that sees every RTP packet sent by a sink
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <vector>
+
+// project
+#include "logger.h"
+#include "RTPOutputGroupsock.h"
+
+RTPOutputGroupsock::RTPOutputGroupsock(UsageEnvironment& env, struct in_addr const& groupAddr, Port port, u_int8_t ttl, const RTPOutputParameters & params)
+	: Groupsock(env, groupAddr, port, ttl), m_params(params), m_source(NULL), m_frameTimestamp(0), m_flushTask(NULL), m_pacer(NULL), m_cache(NULL)
+{
+	memset(&m_lastSender, 0, sizeof(m_lastSender));
+}
+
+RTPOutputGroupsock::~RTPOutputGroupsock()
+{
+	env().taskScheduler().unscheduleDelayedTask(m_flushTask);
+	delete m_pacer;
+	delete m_cache;
+	while (!m_interleaved.empty())
+	{
+		m_interleaved.front().m_writer->release();
+		m_interleaved.pop_front();
+	}
+}
+
+void RTPOutputGroupsock::addInterleavedDestination(int socketNum, unsigned char channel)
+{
+	std::list<InterleavedDestination>::iterator it;
+	for (it = m_interleaved.begin(); it != m_interleaved.end(); ++it)
+	{
+		if ( (it->m_writer->getSocket() == socketNum) && (it->m_channel == channel) )
+		{
+			return;
+		}
+	}
+	LOG(NOTICE) << "interleaved destination socket:" << socketNum << " channel:" << (int)channel;
+	m_interleaved.push_back(InterleavedDestination(TCPInterleavedWriter::lookup(env(), socketNum, m_params.m_interleaved), channel));
+}
+
+void RTPOutputGroupsock::removeInterleavedDestination(int socketNum, unsigned char channel)
+{
+	std::list<InterleavedDestination>::iterator it = m_interleaved.begin();
+	while (it != m_interleaved.end())
+	{
+		if ( (it->m_writer->getSocket() == socketNum) && (it->m_channel == channel) )
+		{
+			it->m_writer->release();
+			it = m_interleaved.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+// the source gets the keyframe requests, the format tells how to classify the frames
+void RTPOutputGroupsock::setSource(V4L2DeviceSource* source, const std::string& format)
+{
+	m_source = source;
+	m_format = format;
+}
+
+// keep the sent packets to answer NACK, the SDP offers it for video only and interleaved clients do not lose packets
+void RTPOutputGroupsock::enableRetransmission()
+{
+	if (m_params.m_feedback.m_enable && (m_params.m_feedback.m_cacheSize > 0) && (m_cache == NULL) && (m_format.find("video/") == 0))
+	{
+		LOG(INFO) << m_format << " retransmission cache:" << m_params.m_feedback.m_cacheSize << " packets";
+		m_cache = new RTPPacketCache(m_params.m_feedback.m_cacheSize, m_params.m_feedback.m_maxPacketSize);
+	}
+}
+
+void RTPOutputGroupsock::enablePacing(const V4L2DeviceSource::Stats* stats)
+{
+	// audio frames are small and regular, pacing would only delay them
+	if (m_params.m_pacer.m_enable && (m_pacer == NULL) && (m_format.find("video/") == 0))
+	{
+		m_pacer = new RTPPacer(env(), m_params.m_pacer, stats, sendStub, this);
+	}
+}
+
+Boolean RTPOutputGroupsock::output(UsageEnvironment& env, unsigned char* buffer, unsigned bufferSize, DirectedNetInterface* interfaceNotToFwdBackTo)
+{
+	if (m_cache != NULL)
+	{
+		m_cache->addPacket(buffer, bufferSize);
+	}
+	if (!m_interleaved.empty())
+	{
+		this->gatherPacket(buffer, bufferSize);
+	}
+	if ( (m_pacer != NULL) && (fDests != NULL) )
+	{
+		// UDP destinations get the packet when the token bucket allows it
+		m_pacer->queuePacket(buffer, bufferSize);
+		return True;
+	}
+	return Groupsock::output(env, buffer, bufferSize, interfaceNotToFwdBackTo);
+}
+
+// the RTCP feedback handler needs the client that sent the report
+Boolean RTPOutputGroupsock::handleRead(unsigned char* buffer, unsigned bufferMaxSize, unsigned& bytesRead, struct sockaddr_in& fromAddressAndPort)
+{
+	Boolean ret = Groupsock::handleRead(buffer, bufferMaxSize, bytesRead, fromAddressAndPort);
+	if (ret && (bytesRead > 0))
+	{
+		m_lastSender = fromAddressAndPort;
+	}
+	return ret;
+}
+
+// resend a packet asked by a NACK, it does not wait for the pacer
+// interleaved destinations are reliable and never get it
+// the UDP clients share the groupsock when the source is reused, only the one whose RTCP carried the NACK gets it
+bool RTPOutputGroupsock::retransmit(u_int16_t seqNum, const struct sockaddr_in* requester)
+{
+	unsigned char* packet = NULL;
+	unsigned int size = 0;
+	if ( (m_cache == NULL) || (fDests == NULL) || !m_cache->getPacket(seqNum, packet, size) )
+	{
+		return false;
+	}
+
+	// the RTP port of the client is the one before its RTCP port, or its only port on that address
+	destRecord* target = NULL;
+	destRecord* sameAddress = NULL;
+	unsigned int nbSameAddress = 0;
+	for (destRecord* dest = fDests; dest != NULL; dest = dest->fNext)
+	{
+		struct in_addr addr = dest->fGroupEId.groupAddress();
+		if (IN_MULTICAST(ntohl(addr.s_addr)))
+		{
+			// every receiver of the group gets it
+			return Groupsock::output(env(), packet, size);
+		}
+		if ( (requester != NULL) && (addr.s_addr == requester->sin_addr.s_addr) )
+		{
+			if (ntohs(dest->fGroupEId.portNum()) + 1 == ntohs(requester->sin_port))
+			{
+				target = dest;
+				break;
+			}
+			sameAddress = dest;
+			nbSameAddress++;
+		}
+	}
+	if ( (target == NULL) && (nbSameAddress == 1) )
+	{
+		target = sameAddress;
+	}
+	if (target == NULL)
+	{
+		return false;
+	}
+	return this->write(target->fGroupEId.groupAddress().s_addr, target->fGroupEId.portNum(), this->ttl(), packet, size);
+}
+
+void RTPOutputGroupsock::send(unsigned char* packet, unsigned int size)
+{
+	Groupsock::output(env(), packet, size);
+}
+
+// accumulate the packets of a frame, the frame ends on the marker bit or on a new timestamp
+void RTPOutputGroupsock::gatherPacket(unsigned char* buffer, unsigned bufferSize)
+{
+	if (bufferSize < 12)
+	{
+		return;
+	}
+	u_int32_t timestamp = (buffer[4]<<24)|(buffer[5]<<16)|(buffer[6]<<8)|buffer[7];
+	if (m_frame && (timestamp != m_frameTimestamp))
+	{
+		this->flushFrame();
+	}
+	if (!m_frame)
+	{
+		m_frame.reset(new RTPFrame());
+		m_frameTimestamp = timestamp;
+	}
+	m_frame->addPacket(buffer, bufferSize);
+	m_frame->setType(this->packetType(buffer, bufferSize));
+
+	bool marker = (buffer[1]&0x80);
+	if (marker)
+	{
+		this->flushFrame();
+	}
+	else if (m_flushTask == NULL)
+	{
+		// payloads that never set the marker bit should not wait for the next frame
+		m_flushTask = env().taskScheduler().scheduleDelayedTask(m_params.m_gatherTimeoutUs, flushStub, this);
+	}
+}
+
+void RTPOutputGroupsock::flushFrame()
+{
+	env().taskScheduler().unscheduleDelayedTask(m_flushTask);
+	if (m_frame)
+	{
+		std::shared_ptr<RTPFrame> frame(m_frame);
+		m_frame.reset();
+		if ( (frame->type() == RTPFrame::OTHER) && (m_format.find("video/") == 0) )
+		{
+			// parameter sets alone or an unknown payload, handle it as a reference frame
+			frame->setType(RTPFrame::REFERENCE);
+		}
+
+		std::list<InterleavedDestination>::iterator it = m_interleaved.begin();
+		while (it != m_interleaved.end())
+		{
+			it->m_writer->queueFrame(frame, it->m_channel);
+			if ( it->m_writer->needKeyFrame(it->m_channel) && (m_source != NULL) )
+			{
+				// the client lost a reference frame, it cannot decode before the next keyframe
+				m_source->requestKeyFrame();
+			}
+			if (it->m_writer->isBroken())
+			{
+				// connection closed, live555 will tear down the session
+				it->m_writer->release();
+				it = m_interleaved.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+}
+
+// what the NAL units of an H264/H265 packet bring to the decoder, single NAL, aggregation and fragmentation packets
+RTPFrame::Type RTPOutputGroupsock::packetType(const unsigned char* buffer, unsigned bufferSize)
+{
+	bool hevc = (m_format == "video/H265");
+	if ( !hevc && (m_format != "video/H264") )
+	{
+		return RTPFrame::OTHER;
+	}
+
+	// skip the RTP header, its CSRC list and extension
+	unsigned int offset = 12 + 4*(buffer[0]&0x0F);
+	if ( (buffer[0]&0x10) && (offset + 4 <= bufferSize) )
+	{
+		offset += 4 + 4*((buffer[offset+2]<<8)|buffer[offset+3]);
+	}
+	unsigned int headerSize = hevc ? 2 : 1;
+	if (offset + headerSize + 1 > bufferSize)
+	{
+		return RTPFrame::OTHER;
+	}
+	const unsigned char* payload = buffer + offset;
+	unsigned int size = bufferSize - offset;
+
+	// collect the NAL headers carried by the packet
+	std::vector<unsigned int> nals;
+	int type = hevc ? (payload[0]>>1)&0x3F : payload[0]&0x1F;
+	if ( (hevc && (type == 49)) || (!hevc && (type == 28)) )
+	{
+		// fragmentation unit, the type is in the FU header and the NRI in the indicator
+		nals.push_back(hevc ? ((payload[2]&0x3F)<<1) : ((payload[0]&0x60)|(payload[1]&0x1F)));
+	}
+	else if ( (hevc && (type == 48)) || (!hevc && (type == 24)) )
+	{
+		// aggregation packet, NAL units prefixed with their size
+		unsigned int pos = headerSize;
+		while (pos + 2 + headerSize <= size)
+		{
+			unsigned int nalSize = (payload[pos]<<8)|payload[pos+1];
+			nals.push_back(payload[pos+2]);
+			pos += 2 + nalSize;
+		}
+	}
+	else
+	{
+		nals.push_back(payload[0]);
+	}
+
+	RTPFrame::Type frameType = RTPFrame::OTHER;
+	for (std::vector<unsigned int>::iterator it = nals.begin(); it != nals.end(); ++it)
+	{
+		RTPFrame::Type nalType = RTPFrame::OTHER;
+		if (hevc)
+		{
+			int nal = ((*it)>>1)&0x3F;
+			if ( (nal >= 16) && (nal <= 21) )
+			{
+				nalType = RTPFrame::KEY;
+			}
+			else if (nal < 16)
+			{
+				// even types below 16 are sub-layer non-reference pictures
+				nalType = (nal%2 == 0) ? RTPFrame::NON_REFERENCE : RTPFrame::REFERENCE;
+			}
+		}
+		else
+		{
+			int nal = (*it)&0x1F;
+			if (nal == 5)
+			{
+				nalType = RTPFrame::KEY;
+			}
+			else if ( (nal >= 1) && (nal <= 4) )
+			{
+				nalType = ((*it)&0x60) ? RTPFrame::REFERENCE : RTPFrame::NON_REFERENCE;
+			}
+		}
+		if (nalType > frameType)
+		{
+			frameType = nalType;
+		}
+	}
+	return frameType;
+}
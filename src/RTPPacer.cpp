@@ -0,0 +1,181 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** RTPPacer.cpp
+**
+** Token bucket that spreads the RTP packets of a frame over the frame interval
+**
+** -------------------------------------------------------------------------*/
+
+// project
+#include "logger.h"
+#include "RTPPacer.h"
+
+RTPPacer::RTPPacer(UsageEnvironment& env, const RTPPacerParameters & params, const V4L2DeviceSource::Stats* stats, SendFunc* sendFunc, void* clientData)
+	: m_env(env), m_params(params), m_stats(stats), m_sendFunc(sendFunc), m_clientData(clientData), m_queuedBytes(0), m_rate(0), m_tokens(params.m_burstBytes), m_drainTask(NULL)
+	, m_statsSec(0), m_maxBurst(0), m_maxDelayUs(0), m_sumDelayUs(0), m_nbPackets(0), m_reportMaxBurst(0), m_reportMaxDelayUs(0), m_reportAvgDelayUs(0)
+{
+	this->getTime(m_lastRefill);
+	this->updateRate();
+}
+
+RTPPacer::~RTPPacer()
+{
+	m_env.taskScheduler().unscheduleDelayedTask(m_drainTask);
+	while (!m_queue.empty())
+	{
+		delete m_queue.front().m_data;
+		m_queue.pop_front();
+	}
+	while (!m_buffers.empty())
+	{
+		delete m_buffers.back();
+		m_buffers.pop_back();
+	}
+}
+
+// sending rate in bytes per second, fixed when a frame is complete
+// the base rate sends an average frame within the configured fraction of the frame interval,
+// a frame larger than average (IDR) is spread over the same duration
+void RTPPacer::updateRate()
+{
+	double fps = m_params.m_defaultFps;
+	double bitrate = m_params.m_minRate;
+	if (m_stats != NULL)
+	{
+		if (m_stats->getFps() > 0)
+		{
+			fps = m_stats->getFps();
+		}
+		if (m_stats->getBitrate() > bitrate)
+		{
+			bitrate = m_stats->getBitrate();
+		}
+	}
+	double spread = m_params.m_fraction / fps;
+	m_rate = bitrate / m_params.m_fraction;
+	if (m_queuedBytes / spread > m_rate)
+	{
+		m_rate = m_queuedBytes / spread;
+	}
+}
+
+void RTPPacer::refill(const timeval & now)
+{
+	timeval diff;
+	timersub(&now, &m_lastRefill, &diff);
+	m_lastRefill = now;
+
+	m_tokens += m_rate * (diff.tv_sec + diff.tv_usec/1000000.0);
+	if (m_tokens > m_params.m_burstBytes)
+	{
+		m_tokens = m_params.m_burstBytes;
+	}
+}
+
+void RTPPacer::queuePacket(unsigned char* packet, unsigned int size)
+{
+	timeval now;
+	this->getTime(now);
+	this->refill(now);
+
+	if ( m_queue.empty() && (m_tokens >= size) )
+	{
+		// nothing waits and the bucket allows it, no need to keep a copy
+		this->send(packet, size, now, now);
+	}
+	else
+	{
+		// the sink reuses its buffer, keep a copy in a recycled buffer
+		std::vector<unsigned char>* data = NULL;
+		if (m_buffers.empty())
+		{
+			data = new std::vector<unsigned char>();
+		}
+		else
+		{
+			data = m_buffers.back();
+			m_buffers.pop_back();
+		}
+		data->assign(packet, packet + size);
+		m_queue.push_back(Packet(data, now));
+		m_queuedBytes += size;
+		if (m_queuedBytes > m_maxBurst)
+		{
+			m_maxBurst = m_queuedBytes;
+		}
+	}
+
+	// the marker bit ends the frame, the rate then covers what is left to send
+	bool marker = (size >= 2) && (packet[1]&0x80);
+	if (marker)
+	{
+		this->updateRate();
+	}
+
+	if ( (m_drainTask == NULL) && (!m_queue.empty()) )
+	{
+		this->drain();
+	}
+}
+
+void RTPPacer::send(unsigned char* packet, unsigned int size, const timeval & now, const timeval & queued)
+{
+	timeval diff;
+	timersub(&now, &queued, &diff);
+	this->notify(now, diff.tv_sec*1000000 + diff.tv_usec);
+
+	m_tokens -= size;
+	m_sendFunc(m_clientData, packet, size);
+}
+
+void RTPPacer::drain()
+{
+	m_drainTask = NULL;
+
+	timeval now;
+	this->getTime(now);
+	this->refill(now);
+
+	while ( (!m_queue.empty()) && (m_tokens >= m_queue.front().m_data->size()) )
+	{
+		Packet packet = m_queue.front();
+		m_queue.pop_front();
+		m_queuedBytes -= packet.m_data->size();
+		this->send(packet.m_data->data(), packet.m_data->size(), now, packet.m_queued);
+		m_buffers.push_back(packet.m_data);
+	}
+
+	if (!m_queue.empty())
+	{
+		int64_t delayUs = (m_queue.front().m_data->size() - m_tokens) * 1000000.0 / m_rate;
+		m_drainTask = m_env.taskScheduler().scheduleDelayedTask(delayUs > 0 ? delayUs : 1, drainStub, this);
+	}
+}
+
+void RTPPacer::notify(const timeval & now, unsigned int delayUs)
+{
+	if (now.tv_sec != m_statsSec)
+	{
+		if (m_nbPackets != 0)
+		{
+			m_reportMaxBurst   = m_maxBurst;
+			m_reportMaxDelayUs = m_maxDelayUs;
+			m_reportAvgDelayUs = m_sumDelayUs / m_nbPackets;
+			LOG(INFO) << "pacer tv_sec:" << now.tv_sec << " rate:" << (int)(m_rate/128) << "kbps burst:" << m_reportMaxBurst << " delay max:" << m_reportMaxDelayUs/1000 << "ms avg:" << m_reportAvgDelayUs/1000 << "ms";
+		}
+		m_statsSec = now.tv_sec;
+		m_maxBurst = m_queuedBytes;
+		m_maxDelayUs = 0;
+		m_sumDelayUs = 0;
+		m_nbPackets = 0;
+	}
+	if (delayUs > m_maxDelayUs)
+	{
+		m_maxDelayUs = delayUs;
+	}
+	m_sumDelayUs += delayUs;
+	m_nbPackets++;
+}
@@ -0,0 +1,201 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** RTPRateController.cpp
+**
+** Encoder bitrate adaptation from RTCP receiver reports
+**
+** -------------------------------------------------------------------------*/
+
+// project
+#include "logger.h"
+#include "RTPRateController.h"
+
+std::map<FramedSource*, RTPRateController*> RTPRateController::m_controllers;
+
+RTPRateController* RTPRateController::createNew(UsageEnvironment& env, FramedSource* source, const RTPRateControlParameters & params, SetBitrateFunc* setBitrateFunc, void* clientData)
+{
+	RTPRateController* controller = NULL;
+	if ( (params.m_startKbps == 0) && (params.m_maxKbps == 0) )
+	{
+		LOG(WARN) << "rate control disabled, the encoder bitrate is unknown and no maximum is set";
+	}
+	else if ( (source != NULL) && (lookup(source) == NULL) )
+	{
+		controller = new RTPRateController(env, source, params, setBitrateFunc, clientData);
+		m_controllers[source] = controller;
+	}
+	return controller;
+}
+
+RTPRateController* RTPRateController::lookup(FramedSource* source)
+{
+	RTPRateController* controller = NULL;
+	std::map<FramedSource*, RTPRateController*>::iterator it = m_controllers.find(source);
+	if (it != m_controllers.end())
+	{
+		controller = it->second;
+	}
+	return controller;
+}
+
+// the controller of a source is destroyed before the source and the scheduler it runs on
+void RTPRateController::close(FramedSource* source)
+{
+	delete lookup(source);
+}
+
+RTPRateController::RTPRateController(UsageEnvironment& env, FramedSource* source, const RTPRateControlParameters & params, SetBitrateFunc* setBitrateFunc, void* clientData)
+	: m_env(env), m_source(source), m_params(params), m_setBitrateFunc(setBitrateFunc), m_clientData(clientData), m_evaluateTask(NULL)
+{
+	if (m_params.m_maxKbps == 0)
+	{
+		m_params.m_maxKbps = m_params.m_startKbps;
+	}
+	if (m_params.m_minKbps > m_params.m_maxKbps)
+	{
+		m_params.m_minKbps = m_params.m_maxKbps;
+	}
+	gettimeofday(&m_lastEvaluation, NULL);
+	timerclear(&m_lastDecrease);
+
+	// start from the encoder bitrate, it is only changed when out of bounds
+	// an unknown bitrate is assumed at the maximum until the first congestion
+	m_kbps = m_params.m_startKbps ? m_params.m_startKbps : m_params.m_maxKbps;
+	if (m_kbps < m_params.m_minKbps)
+	{
+		m_kbps = m_params.m_minKbps;
+	}
+	if (m_kbps > m_params.m_maxKbps)
+	{
+		m_kbps = m_params.m_maxKbps;
+	}
+	LOG(NOTICE) << "rate control start:" << m_kbps << "kbps encoder:" << m_params.m_startKbps << "kbps min:" << m_params.m_minKbps << "kbps max:" << m_params.m_maxKbps << "kbps";
+	if ( (m_setBitrateFunc != NULL) && (m_params.m_startKbps != 0) && (m_kbps != m_params.m_startKbps) )
+	{
+		m_setBitrateFunc(m_clientData, m_kbps);
+	}
+	m_evaluateTask = m_env.taskScheduler().scheduleDelayedTask(m_params.m_intervalMs*1000, evaluateStub, this);
+}
+
+RTPRateController::~RTPRateController()
+{
+	m_env.taskScheduler().unscheduleDelayedTask(m_evaluateTask);
+	m_controllers.erase(m_source);
+}
+
+void RTPRateController::addSink(RTPSink* sink)
+{
+	std::list<RTPSink*>::iterator it;
+	for (it = m_sinks.begin(); it != m_sinks.end(); ++it)
+	{
+		if (*it == sink)
+		{
+			return;
+		}
+	}
+	m_sinks.push_back(sink);
+}
+
+void RTPRateController::removeSink(RTPSink* sink)
+{
+	m_sinks.remove(sink);
+}
+
+// the encoder is shared by every receiver, so the most congested one drives the bitrate
+void RTPRateController::evaluate()
+{
+	m_evaluateTask = m_env.taskScheduler().scheduleDelayedTask(m_params.m_intervalMs*1000, evaluateStub, this);
+
+	timeval now;
+	gettimeofday(&now, NULL);
+
+	unsigned int nbReports = 0;
+	double loss = 0;
+	unsigned int jitterMs = 0;
+	std::list<RTPSink*>::iterator it;
+	for (it = m_sinks.begin(); it != m_sinks.end(); ++it)
+	{
+		RTPSink* sink = *it;
+		RTPTransmissionStatsDB::Iterator statsIter(sink->transmissionStatsDB());
+		RTPTransmissionStats* stats = NULL;
+		while ((stats = statsIter.next()) != NULL)
+		{
+			// only use the reports received since the last check
+			if (!timercmp(&stats->lastTimeReceived(), &m_lastEvaluation, >))
+			{
+				continue;
+			}
+			nbReports++;
+			double reportLoss = stats->packetLossRatio()/256.0;
+			if (reportLoss > loss)
+			{
+				loss = reportLoss;
+			}
+			if (sink->rtpTimestampFrequency() != 0)
+			{
+				unsigned int reportJitterMs = (unsigned int)(stats->jitter()*1000.0/sink->rtpTimestampFrequency());
+				if (reportJitterMs > jitterMs)
+				{
+					jitterMs = reportJitterMs;
+				}
+			}
+		}
+	}
+	m_lastEvaluation = now;
+
+	if (nbReports == 0)
+	{
+		return;
+	}
+
+	timeval diff;
+	timersub(&now, &m_lastDecrease, &diff);
+	unsigned long sinceDecreaseMs = diff.tv_sec*1000 + diff.tv_usec/1000;
+
+	double kbps = m_kbps;
+	if ( (loss >= m_params.m_decreaseLoss) || (jitterMs >= m_params.m_maxJitterMs) )
+	{
+		// multiplicative decrease, deeper when the loss is higher
+		double factor = 1.0 - loss/2;
+		if (factor > 1.0 - m_params.m_increaseStep*2)
+		{
+			factor = 1.0 - m_params.m_increaseStep*2;
+		}
+		kbps *= factor;
+		m_lastDecrease = now;
+	}
+	else if ( (loss <= m_params.m_increaseLoss) && (!timerisset(&m_lastDecrease) || (sinceDecreaseMs >= m_params.m_holdMs)) )
+	{
+		double step = kbps*m_params.m_increaseStep;
+		kbps += (step > m_params.m_minChangeKbps) ? step : m_params.m_minChangeKbps;
+	}
+
+	if (kbps < m_params.m_minKbps)
+	{
+		kbps = m_params.m_minKbps;
+	}
+	if (kbps > m_params.m_maxKbps)
+	{
+		kbps = m_params.m_maxKbps;
+	}
+	this->apply((unsigned int)kbps, loss, jitterMs);
+}
+
+void RTPRateController::apply(unsigned int kbps, double loss, unsigned int jitterMs)
+{
+	unsigned int change = (kbps > m_kbps) ? (kbps - m_kbps) : (m_kbps - kbps);
+	bool atBound = ( (kbps == m_params.m_minKbps) || (kbps == m_params.m_maxKbps) );
+	if ( (change == 0) || ((change < m_params.m_minChangeKbps) && !atBound) )
+	{
+		return;
+	}
+	LOG(NOTICE) << "rate control " << m_kbps << "kbps => " << kbps << "kbps loss:" << (int)(loss*100) << "% jitter:" << jitterMs << "ms";
+	m_kbps = kbps;
+	if (m_setBitrateFunc != NULL)
+	{
+		m_setBitrateFunc(m_clientData, m_kbps);
+	}
+}
@@ -101,10 +101,71 @@ RTPSink*  BaseServerMediaSubsession::createSink(UsageEnvironment& env, Groupsock
 		getline(is, channels);	
 		videoSink = SimpleRTPSink::createNew(env, rtpGroupsock,rtpPayloadTypeIfDynamic, atoi(sampleRate.c_str()), "audio", "L16", atoi(channels.c_str()), True, False); 
 	}
+	else if ( (format.find("audio/PCMU") == 0) || (format.find("audio/PCMA") == 0) )
+	{
+		std::istringstream is(format);
+		std::string dummy;
+		getline(is, dummy, '/');	
+		std::string codec;
+		getline(is, codec, '/');	
+		std::string sampleRate("8000");
+		getline(is, sampleRate, '/');	
+		std::string channels("1");
+		getline(is, channels);	
+		// static payload types are for 8000Hz mono only
+		unsigned char payloadType = rtpPayloadTypeIfDynamic;
+		if ( (atoi(sampleRate.c_str()) == 8000) && (atoi(channels.c_str()) == 1) )
+		{
+			payloadType = (codec == "PCMU") ? 0 : 8;
+		}
+		videoSink = SimpleRTPSink::createNew(env, rtpGroupsock, payloadType, atoi(sampleRate.c_str()), "audio", codec.c_str(), atoi(channels.c_str()), True, False); 
+	}
+	else if (format.find("audio/OPUS") == 0)
+	{
+		// one Opus frame per packet
+		videoSink = SimpleRTPSink::createNew(env, rtpGroupsock, rtpPayloadTypeIfDynamic, 48000, "audio", "OPUS", 2, False, False); 
+	}
 	return videoSink;
 }
 
-char const* BaseServerMediaSubsession::getAuxLine(V4L2DeviceSource* source,unsigned char rtpPayloadType)
+// buffer needed by a sink of this source : the peak frame with some headroom,
+// the device buffer until a frame was captured
+// a later IDR may be larger than any frame seen so far, video always gets room for the largest frame
+// the encoder can produce : an uncompressed 4:2:0 picture, bounded by the device buffer
+unsigned int BaseServerMediaSubsession::getSinkBufferSize(V4L2DeviceSource* source, double headroom, unsigned int minSize)
+{
+	unsigned int size = 0;
+	if ( (source != NULL) && (headroom > 0) )
+	{
+		unsigned int deviceSize = source->getBufferSize();
+		size = source->getMaxFrameSize()*headroom;
+		if ( (size == 0) || ((deviceSize != 0) && (size > deviceSize)) )
+		{
+			size = deviceSize;
+		}
+		int width = source->getWidth();
+		int height = source->getHeight();
+		if ( (width > 0) && (height > 0) )
+		{
+			unsigned int frameMaxSize = width*height*3/2;
+			if ( (deviceSize != 0) && (deviceSize < frameMaxSize) )
+			{
+				frameMaxSize = deviceSize;
+			}
+			if (size < frameMaxSize)
+			{
+				size = frameMaxSize;
+			}
+		}
+		if ( (size != 0) && (size < minSize) )
+		{
+			size = minSize;
+		}
+	}
+	return size;
+}
+
+char const* BaseServerMediaSubsession::getAuxLine(V4L2DeviceSource* source,unsigned char rtpPayloadType,bool rtcpFeedback)
 {
 	const char* auxLine = NULL;
 	if (source)
@@ -117,6 +178,11 @@ char const* BaseServerMediaSubsession::getAuxLine(V4L2DeviceSource* source,unsig
 		int height = source->getHeight();
 		if ( (width > 0) && (height>0) ) {
 			os << "a=x-dimensions:" << width << "," <<  height  << "\r\n";				
+			if (rtcpFeedback) {
+				os << "a=rtcp-fb:" << int(rtpPayloadType) << " nack\r\n";
+				os << "a=rtcp-fb:" << int(rtpPayloadType) << " nack pli\r\n";
+				os << "a=rtcp-fb:" << int(rtpPayloadType) << " ccm fir\r\n";
+			}
 		}
 		auxLine = strdup(os.str().c_str());
 	} 
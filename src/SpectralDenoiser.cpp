@@ -0,0 +1,391 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** SpectralDenoiser.cpp
+**
+** Noise suppression by spectral subtraction, stationary noise is tracked per frequency
+**
+** -------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <algorithm>
+
+#include "logger.h"
+#include "SpectralDenoiser.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define DENOISER_KERNEL "sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DENOISER_KERNEL "neon"
+#else
+#define DENOISER_KERNEL "scalar"
+#endif
+
+// frames averaged for the first noise estimate
+#define NOISE_LEARN_FRAMES 20
+// noise subtracted a bit more than estimated, it limits the musical noise
+#define OVER_SUBTRACTION   2.0f
+
+// out = a*b*scale
+static void multiply(float* out, const float* a, const float* b, float scale, unsigned int count)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	__m128 s = _mm_set1_ps(scale);
+	for (; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)), s));
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	for (; i + 4 <= count; i += 4)
+	{
+		vst1q_f32(out + i, vmulq_n_f32(vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)), scale));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		out[i] = a[i]*b[i]*scale;
+	}
+}
+
+// acc += a*b*scale
+static void multiplyAdd(float* acc, const float* a, const float* b, float scale, unsigned int count)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	__m128 s = _mm_set1_ps(scale);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 p = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)), s);
+		_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), p));
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	for (; i + 4 <= count; i += 4)
+	{
+		vst1q_f32(acc + i, vmlaq_f32(vld1q_f32(acc + i), vmulq_n_f32(vld1q_f32(a + i), scale), vld1q_f32(b + i)));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		acc[i] += a[i]*b[i]*scale;
+	}
+}
+
+// re and im *= gain
+static void applyGain(float* re, float* im, const float* gain, unsigned int count)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 g = _mm_loadu_ps(gain + i);
+		_mm_storeu_ps(re + i, _mm_mul_ps(_mm_loadu_ps(re + i), g));
+		_mm_storeu_ps(im + i, _mm_mul_ps(_mm_loadu_ps(im + i), g));
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	for (; i + 4 <= count; i += 4)
+	{
+		float32x4_t g = vld1q_f32(gain + i);
+		vst1q_f32(re + i, vmulq_f32(vld1q_f32(re + i), g));
+		vst1q_f32(im + i, vmulq_f32(vld1q_f32(im + i), g));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		re[i] *= gain[i];
+		im[i] *= gain[i];
+	}
+}
+
+// noise tracking and smoothed subtraction gain of the bins
+// learning averages the power over the first frames (noise*keep + power*learn), then speech peaks only raise it slowly
+static void updateGains(const float* re, const float* im, float* noise, float* gain, unsigned int count, bool learning, float keep, float learn, float floor)
+{
+	unsigned int k = 0;
+#if defined(__SSE2__)
+	__m128 vkeep = _mm_set1_ps(keep);
+	__m128 vlearn = _mm_set1_ps(learn);
+	__m128 vfloor = _mm_set1_ps(floor);
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 half = _mm_set1_ps(0.5f);
+	for (; k + 4 <= count; k += 4)
+	{
+		__m128 r = _mm_loadu_ps(re + k);
+		__m128 i = _mm_loadu_ps(im + k);
+		__m128 power = _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(i, i));
+		__m128 n = _mm_loadu_ps(noise + k);
+		if (learning)
+		{
+			n = _mm_add_ps(_mm_mul_ps(n, vkeep), _mm_mul_ps(power, vlearn));
+		}
+		else
+		{
+			__m128 below = _mm_cmplt_ps(power, _mm_mul_ps(_mm_set1_ps(4.0f), n));
+			__m128 tracked = _mm_add_ps(n, _mm_mul_ps(_mm_set1_ps(0.02f), _mm_sub_ps(power, n)));
+			__m128 raised = _mm_mul_ps(n, _mm_set1_ps(1.001f));
+			n = _mm_or_ps(_mm_and_ps(below, tracked), _mm_andnot_ps(below, raised));
+		}
+		_mm_storeu_ps(noise + k, n);
+
+		// a silent bin gets 0 before the floor, the division by 0 is masked
+		__m128 g = _mm_sub_ps(one, _mm_div_ps(_mm_mul_ps(_mm_set1_ps(OVER_SUBTRACTION), n), power));
+		g = _mm_and_ps(_mm_cmpgt_ps(power, zero), g);
+		g = _mm_max_ps(g, vfloor);
+		_mm_storeu_ps(gain + k, _mm_mul_ps(half, _mm_add_ps(_mm_loadu_ps(gain + k), g)));
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	float32x4_t vfloor = vdupq_n_f32(floor);
+	float32x4_t zero = vdupq_n_f32(0);
+	float32x4_t one = vdupq_n_f32(1.0f);
+	for (; k + 4 <= count; k += 4)
+	{
+		float32x4_t r = vld1q_f32(re + k);
+		float32x4_t i = vld1q_f32(im + k);
+		float32x4_t power = vmlaq_f32(vmulq_f32(r, r), i, i);
+		float32x4_t n = vld1q_f32(noise + k);
+		if (learning)
+		{
+			n = vmlaq_n_f32(vmulq_n_f32(n, keep), power, learn);
+		}
+		else
+		{
+			uint32x4_t below = vcltq_f32(power, vmulq_n_f32(n, 4.0f));
+			float32x4_t tracked = vmlaq_n_f32(n, vsubq_f32(power, n), 0.02f);
+			float32x4_t raised = vmulq_n_f32(n, 1.001f);
+			n = vbslq_f32(below, tracked, raised);
+		}
+		vst1q_f32(noise + k, n);
+
+		// 1/power from the estimate refined twice, a silent bin gets 0 before the floor
+		float32x4_t inverse = vrecpeq_f32(power);
+		inverse = vmulq_f32(inverse, vrecpsq_f32(power, inverse));
+		inverse = vmulq_f32(inverse, vrecpsq_f32(power, inverse));
+		float32x4_t g = vsubq_f32(one, vmulq_f32(vmulq_n_f32(n, OVER_SUBTRACTION), inverse));
+		g = vbslq_f32(vcgtq_f32(power, zero), g, zero);
+		g = vmaxq_f32(g, vfloor);
+		vst1q_f32(gain + k, vmulq_n_f32(vaddq_f32(vld1q_f32(gain + k), g), 0.5f));
+	}
+#endif
+	for (; k < count; ++k)
+	{
+		float power = re[k]*re[k] + im[k]*im[k];
+		if (learning)
+		{
+			noise[k] = noise[k]*keep + power*learn;
+		}
+		else if (power < 4*noise[k])
+		{
+			noise[k] += 0.02f*(power - noise[k]);
+		}
+		else
+		{
+			noise[k] *= 1.001f;
+		}
+
+		float g = (power > 0) ? 1.0f - OVER_SUBTRACTION*noise[k]/power : 0;
+		if (g < floor)
+		{
+			g = floor;
+		}
+		gain[k] = 0.5f*gain[k] + 0.5f*g;
+	}
+}
+
+// radix-2 butterflies of one group, b = a + half, the twiddles of the stage are contiguous
+static void butterflies(float* re, float* im, unsigned int half, const float* wr, const float* wi)
+{
+	float* reb = re + half;
+	float* imb = im + half;
+	unsigned int k = 0;
+#if defined(__SSE2__)
+	for (; k + 4 <= half; k += 4)
+	{
+		__m128 cr = _mm_loadu_ps(wr + k);
+		__m128 ci = _mm_loadu_ps(wi + k);
+		__m128 br = _mm_loadu_ps(reb + k);
+		__m128 bi = _mm_loadu_ps(imb + k);
+		__m128 tr = _mm_sub_ps(_mm_mul_ps(br, cr), _mm_mul_ps(bi, ci));
+		__m128 ti = _mm_add_ps(_mm_mul_ps(br, ci), _mm_mul_ps(bi, cr));
+		__m128 ar = _mm_loadu_ps(re + k);
+		__m128 ai = _mm_loadu_ps(im + k);
+		_mm_storeu_ps(reb + k, _mm_sub_ps(ar, tr));
+		_mm_storeu_ps(imb + k, _mm_sub_ps(ai, ti));
+		_mm_storeu_ps(re + k, _mm_add_ps(ar, tr));
+		_mm_storeu_ps(im + k, _mm_add_ps(ai, ti));
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	for (; k + 4 <= half; k += 4)
+	{
+		float32x4_t cr = vld1q_f32(wr + k);
+		float32x4_t ci = vld1q_f32(wi + k);
+		float32x4_t br = vld1q_f32(reb + k);
+		float32x4_t bi = vld1q_f32(imb + k);
+		float32x4_t tr = vmlsq_f32(vmulq_f32(br, cr), bi, ci);
+		float32x4_t ti = vmlaq_f32(vmulq_f32(br, ci), bi, cr);
+		float32x4_t ar = vld1q_f32(re + k);
+		float32x4_t ai = vld1q_f32(im + k);
+		vst1q_f32(reb + k, vsubq_f32(ar, tr));
+		vst1q_f32(imb + k, vsubq_f32(ai, ti));
+		vst1q_f32(re + k, vaddq_f32(ar, tr));
+		vst1q_f32(im + k, vaddq_f32(ai, ti));
+	}
+#endif
+	for (; k < half; ++k)
+	{
+		float tr = reb[k]*wr[k] - imb[k]*wi[k];
+		float ti = reb[k]*wi[k] + imb[k]*wr[k];
+		reb[k] = re[k] - tr;
+		imb[k] = im[k] - ti;
+		re[k] += tr;
+		im[k] += ti;
+	}
+}
+
+SpectralDenoiser::SpectralDenoiser(unsigned int sampleRate, unsigned int channels, float reduction)
+	: m_channels(channels), m_size(64), m_floor(powf(10.0f, -reduction/20.0f))
+{
+	while (m_size < sampleRate/100)
+	{
+		m_size *= 2;
+	}
+	m_hop = m_size/2;
+
+	// sqrt-Hann twice makes a Hann window, its half overlapped copies sum to 1
+	m_window.resize(m_size);
+	for (unsigned int n = 0; n < m_size; ++n)
+	{
+		m_window[n] = sqrtf(0.5f - 0.5f*cosf(2*M_PI*n/m_size));
+	}
+	// twiddles of the stage of half size h at [h, 2h), contiguous for the butterflies
+	m_cos.resize(m_size);
+	m_sin.resize(m_size);
+	for (unsigned int half = 1; half < m_size; half *= 2)
+	{
+		for (unsigned int k = 0; k < half; ++k)
+		{
+			m_cos[half + k] = cosf(M_PI*k/half);
+			m_sin[half + k] = -sinf(M_PI*k/half);
+		}
+	}
+	unsigned int bits = 0;
+	while ((1U << bits) < m_size)
+	{
+		bits++;
+	}
+	m_reverse.resize(m_size);
+	for (unsigned int n = 0; n < m_size; ++n)
+	{
+		unsigned int reversed = 0;
+		for (unsigned int b = 0; b < bits; ++b)
+		{
+			reversed |= ((n >> b) & 1) << (bits - 1 - b);
+		}
+		m_reverse[n] = reversed;
+	}
+	m_re.resize(m_size);
+	m_im.resize(m_size);
+
+	m_state.resize(m_channels);
+	for (unsigned int c = 0; c < m_channels; ++c)
+	{
+		Channel & channel = m_state[c];
+		channel.m_input.assign(m_size, 0);
+		channel.m_overlap.assign(m_size, 0);
+		channel.m_output.assign(m_hop, 0);
+		channel.m_noise.assign(m_size/2+1, 0);
+		channel.m_gain.assign(m_size/2+1, 1);
+		channel.m_fill = 0;
+		channel.m_frames = 0;
+	}
+	LOG(NOTICE) << "denoiser fft:" << m_size << " hop:" << m_hop*1000/sampleRate << "ms floor:" << -reduction << "dB kernel:" << DENOISER_KERNEL;
+}
+
+// streaming overlap-add, the output is delayed by one frame
+void SpectralDenoiser::process(short* samples, unsigned int frames)
+{
+	for (unsigned int c = 0; c < m_channels; ++c)
+	{
+		Channel & channel = m_state[c];
+		short* sample = samples + c;
+		for (unsigned int i = 0; i < frames; ++i, sample += m_channels)
+		{
+			channel.m_input[m_hop + channel.m_fill] = *sample/32768.0f;
+			float out = channel.m_output[channel.m_fill]*32768.0f;
+			*sample = (out > 32767.0f) ? 32767 : ((out < -32768.0f) ? -32768 : (short)lrintf(out));
+			if (++channel.m_fill == m_hop)
+			{
+				this->processFrame(channel);
+				channel.m_fill = 0;
+			}
+		}
+	}
+}
+
+void SpectralDenoiser::processFrame(Channel & channel)
+{
+	float* re = &m_re[0];
+	float* im = &m_im[0];
+	const float* window = &m_window[0];
+	multiply(re, &channel.m_input[0], window, 1.0f, m_size);
+	std::fill(m_im.begin(), m_im.end(), 0.0f);
+	this->fft(re, im);
+
+	// noise is the mean power of the bins, speech peaks only raise it slowly
+	bool learning = (channel.m_frames < NOISE_LEARN_FRAMES);
+	float learn = 1.0f/(channel.m_frames + 1);
+	updateGains(re, im, &channel.m_noise[0], &channel.m_gain[0], m_size/2+1, learning, channel.m_frames*learn, learn, m_floor);
+	channel.m_frames++;
+
+	// real signal, the upper half mirrors the lower one
+	applyGain(re, im, &channel.m_gain[0], m_size/2+1);
+	for (unsigned int k = 1; k < m_size/2; ++k)
+	{
+		re[m_size - k] = re[k];
+		im[m_size - k] = -im[k];
+	}
+
+	// inverse transform by conjugation
+	for (unsigned int n = 0; n < m_size; ++n)
+	{
+		im[n] = -im[n];
+	}
+	this->fft(re, im);
+
+	float* overlap = &channel.m_overlap[0];
+	multiplyAdd(overlap, re, window, 1.0f/m_size, m_size);
+
+	// first half is complete, slide the buffers by a hop
+	for (unsigned int n = 0; n < m_hop; ++n)
+	{
+		channel.m_output[n] = overlap[n];
+		overlap[n] = overlap[n + m_hop];
+		overlap[n + m_hop] = 0;
+		channel.m_input[n] = channel.m_input[n + m_hop];
+	}
+}
+
+// in place radix-2, the butterflies of a group are vectorized from the 4-point stage
+void SpectralDenoiser::fft(float* re, float* im)
+{
+	for (unsigned int n = 0; n < m_size; ++n)
+	{
+		unsigned int r = m_reverse[n];
+		if (r > n)
+		{
+			float t = re[n]; re[n] = re[r]; re[r] = t;
+			t = im[n]; im[n] = im[r]; im[r] = t;
+		}
+	}
+	for (unsigned int half = 1; half < m_size; half *= 2)
+	{
+		for (unsigned int start = 0; start < m_size; start += 2*half)
+		{
+			butterflies(re + start, im + start, half, &m_cos[half], &m_sin[half]);
+		}
+	}
+}
@@ -0,0 +1,417 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** TCPInterleavedWriter.cpp
+**
+** Vectored writer for RTP-over-RTSP interleaved streaming (RFC 2326 10.12)
+**
+** -------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+// project
+#include "logger.h"
+#include "TCPInterleavedWriter.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// ---------------------------------
+// RTPFrame
+// ---------------------------------
+void RTPFrame::addPacket(const unsigned char* packet, unsigned int size)
+{
+	m_packets.push_back(std::pair<unsigned int,unsigned int>(m_data.size(), size));
+	m_data.append((const char*)packet, size);
+}
+
+const unsigned char* RTPFrame::headers(unsigned char channel)
+{
+	std::map<unsigned char, std::string>::iterator it = m_headers.find(channel);
+	if (it == m_headers.end())
+	{
+		std::string& headers = m_headers[channel];
+		headers.resize(4*m_packets.size());
+		for (unsigned int i = 0; i < m_packets.size(); ++i)
+		{
+			headers[4*i]   = '$';
+			headers[4*i+1] = channel;
+			headers[4*i+2] = (m_packets[i].second&0xFF00)>>8;
+			headers[4*i+3] = m_packets[i].second&0xFF;
+		}
+		return (const unsigned char*)headers.data();
+	}
+	return (const unsigned char*)it->second.data();
+}
+
+// ---------------------------------
+// TCPInterleavedWriter
+// ---------------------------------
+std::map<int, TCPInterleavedWriter*> TCPInterleavedWriter::m_writers;
+
+TCPInterleavedWriter* TCPInterleavedWriter::lookup(UsageEnvironment& env, int socketNum, const TCPInterleavedParameters & params)
+{
+	TCPInterleavedWriter* writer = NULL;
+	std::map<int, TCPInterleavedWriter*>::iterator it = m_writers.find(socketNum);
+	if (it != m_writers.end())
+	{
+		writer = it->second;
+	}
+	else
+	{
+		writer = new TCPInterleavedWriter(env, socketNum, params);
+		m_writers[socketNum] = writer;
+	}
+	writer->m_refCount++;
+	return writer;
+}
+
+void TCPInterleavedWriter::release()
+{
+	if (--m_refCount == 0)
+	{
+		m_writers.erase(m_socket);
+		delete this;
+	}
+}
+
+TCPInterleavedWriter::TCPInterleavedWriter(UsageEnvironment& env, int socketNum, const TCPInterleavedParameters & params)
+	: m_env(env), m_socket(socketNum), m_params(params), m_refCount(0), m_broken(false), m_zeroCopy(false), m_retryTask(NULL), m_pendingBytes(0)
+	, m_zeroCopySeq(0), m_frames(0), m_packets(0), m_syscalls(0), m_shortWrites(0), m_dropped(0)
+{
+#ifdef MSG_ZEROCOPY
+	if (m_params.m_zeroCopyThreshold > 0)
+	{
+		int one = 1;
+		if (setsockopt(m_socket, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0)
+		{
+			m_zeroCopy = true;
+		}
+		else
+		{
+			LOG(NOTICE) << "MSG_ZEROCOPY not available on socket:" << m_socket << " " << strerror(errno);
+		}
+	}
+#endif
+	LOG(NOTICE) << "interleaved writer socket:" << m_socket << " zerocopy:" << m_zeroCopy;
+}
+
+TCPInterleavedWriter::~TCPInterleavedWriter()
+{
+	m_env.taskScheduler().unscheduleDelayedTask(m_retryTask);
+	this->logStats();
+}
+
+void TCPInterleavedWriter::logStats()
+{
+	LOG(NOTICE) << "interleaved writer socket:" << m_socket << " frames:" << m_frames << " packets:" << m_packets << " syscalls:" << m_syscalls << " short writes:" << m_shortWrites << " dropped:" << m_dropped;
+}
+
+void TCPInterleavedWriter::queueFrame(const std::shared_ptr<RTPFrame> & frame, unsigned char channel)
+{
+	if (m_broken || (frame->packetCount() == 0))
+	{
+		return;
+	}
+
+	unsigned int frameBytes = frame->size() + 4*frame->packetCount();
+	bool accept = true;
+	if (m_pendingBytes + frameBytes > m_params.m_maxPendingBytes)
+	{
+		// the peer does not keep up, drop what costs the decoder the least
+		accept = this->dropPending(frameBytes, frame->type());
+		LOG(INFO) << "interleaved writer socket:" << m_socket << " backlog overflow, dropped:" << m_dropped;
+	}
+	if (frame->type() == RTPFrame::KEY)
+	{
+		m_waitKeyFrame.erase(channel);
+	}
+	else if ( (frame->type() != RTPFrame::OTHER) && (m_waitKeyFrame.find(channel) != m_waitKeyFrame.end()) )
+	{
+		// the decoder cannot use it before the next keyframe
+		accept = false;
+	}
+	if (!accept)
+	{
+		m_dropped++;
+		if (frame->type() == RTPFrame::REFERENCE)
+		{
+			this->waitKeyFrame(channel);
+		}
+		return;
+	}
+
+	// make sure the framing headers exist before any byte of the frame may be pinned by the kernel
+	frame->headers(channel);
+	m_queue.push_back(Pending(frame, channel));
+	m_pendingBytes += frameBytes;
+
+	// when a retry is scheduled, the socket was full; wait for it
+	if (m_retryTask == NULL)
+	{
+		this->flush();
+	}
+}
+
+void TCPInterleavedWriter::retry()
+{
+	m_retryTask = NULL;
+	this->flush();
+}
+
+// make room for a frame of frameBytes, a started frame is kept to stay on a packet boundary
+// non-reference frames go first, then reference frames and audio, keyframes only for a newer keyframe
+// returns false when the new frame should be dropped instead
+bool TCPInterleavedWriter::dropPending(unsigned int frameBytes, RTPFrame::Type type)
+{
+	RTPFrame::Type last = (type == RTPFrame::KEY) ? RTPFrame::KEY : RTPFrame::REFERENCE;
+	for (int pass = RTPFrame::NON_REFERENCE; pass <= last; ++pass)
+	{
+		std::list<Pending>::iterator it = m_queue.begin();
+		if ( (it != m_queue.end()) && ( (it->m_packet != 0) || (it->m_offset != 0) ) )
+		{
+			++it;
+		}
+		while ( (it != m_queue.end()) && (m_pendingBytes + frameBytes > m_params.m_maxPendingBytes) )
+		{
+			RTPFrame::Type frameType = it->m_frame->type();
+			if ( (frameType == pass) || ( (pass == RTPFrame::REFERENCE) && (frameType == RTPFrame::OTHER) ) )
+			{
+				it = this->dropFrame(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+	// a keyframe is sent even above the limit, nothing can be decoded without it
+	return (type == RTPFrame::KEY) || (m_pendingBytes + frameBytes <= m_params.m_maxPendingBytes);
+}
+
+// drop a queued frame, the frames of its channel that depend on it up to the next keyframe go with it
+std::list<TCPInterleavedWriter::Pending>::iterator TCPInterleavedWriter::dropFrame(std::list<Pending>::iterator it)
+{
+	RTPFrame::Type type = it->m_frame->type();
+	unsigned char channel = it->m_channel;
+	m_pendingBytes -= it->m_frame->size() + 4*it->m_frame->packetCount();
+	m_dropped++;
+	it = m_queue.erase(it);
+	if (type < RTPFrame::REFERENCE)
+	{
+		return it;
+	}
+
+	std::list<Pending>::iterator next = it;
+	while (next != m_queue.end())
+	{
+		if ( (next->m_channel != channel) || (next->m_frame->type() == RTPFrame::OTHER) )
+		{
+			++next;
+			continue;
+		}
+		if (next->m_frame->type() == RTPFrame::KEY)
+		{
+			// the decoder recovers on a frame that is still queued
+			return it;
+		}
+		m_pendingBytes -= next->m_frame->size() + 4*next->m_frame->packetCount();
+		m_dropped++;
+		bool first = (next == it);
+		next = m_queue.erase(next);
+		if (first)
+		{
+			it = next;
+		}
+	}
+	this->waitKeyFrame(channel);
+	return it;
+}
+
+void TCPInterleavedWriter::waitKeyFrame(unsigned char channel)
+{
+	if (m_waitKeyFrame.find(channel) == m_waitKeyFrame.end())
+	{
+		LOG(NOTICE) << "interleaved writer socket:" << m_socket << " channel:" << (int)channel << " reference frame dropped, wait for a keyframe";
+		m_waitKeyFrame[channel] = true;
+	}
+}
+
+// true once after a reference frame of the channel was dropped, the caller asks the encoder for a keyframe
+bool TCPInterleavedWriter::needKeyFrame(unsigned char channel)
+{
+	std::map<unsigned char, bool>::iterator it = m_waitKeyFrame.find(channel);
+	if ( (it == m_waitKeyFrame.end()) || !it->second )
+	{
+		return false;
+	}
+	it->second = false;
+	return true;
+}
+
+void TCPInterleavedWriter::reapZeroCopy()
+{
+#ifdef MSG_ZEROCOPY
+	if (!m_zeroCopy)
+	{
+		return;
+	}
+	while (!m_inFlight.empty())
+	{
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(m_socket, &msg, MSG_ERRQUEUE|MSG_DONTWAIT) < 0)
+		{
+			break;
+		}
+		for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if ( ((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR))
+			  || ((cmsg->cmsg_level == SOL_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR)) )
+			{
+				struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+				if ( (serr->ee_errno == 0) && (serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY) )
+				{
+					// notifications cover the range [ee_info, ee_data] of send calls
+					while ( (!m_inFlight.empty()) && ((int)(m_inFlight.front().first - serr->ee_data) <= 0) )
+					{
+						m_inFlight.pop_front();
+					}
+				}
+			}
+		}
+	}
+#endif
+}
+
+void TCPInterleavedWriter::flush()
+{
+	this->reapZeroCopy();
+
+	while (!m_queue.empty())
+	{
+		// gather as many packets as one call allows, starting with the rest of a partially sent packet
+		struct iovec iov[IOV_MAX];
+		int nbIov = 0;
+		unsigned int nbFrames = 0;
+		size_t total = 0;
+		bool useZeroCopy = false;
+		for (std::list<Pending>::iterator it = m_queue.begin(); (it != m_queue.end()) && (nbIov+2 <= IOV_MAX); ++it)
+		{
+			const std::shared_ptr<RTPFrame>& frame = it->m_frame;
+			const unsigned char* headers = frame->headers(it->m_channel);
+			unsigned int offset = it->m_offset;
+			for (unsigned int p = it->m_packet; (p < frame->packetCount()) && (nbIov+2 <= IOV_MAX); ++p)
+			{
+				if (offset < 4)
+				{
+					iov[nbIov].iov_base = (void*)&headers[4*p + offset];
+					iov[nbIov].iov_len  = 4 - offset;
+					total += iov[nbIov].iov_len;
+					nbIov++;
+					offset = 4;
+				}
+				iov[nbIov].iov_base = (void*)(frame->packet(p) + offset - 4);
+				iov[nbIov].iov_len  = frame->packetSize(p) - (offset - 4);
+				total += iov[nbIov].iov_len;
+				nbIov++;
+				offset = 0;
+			}
+			nbFrames++;
+			if (m_zeroCopy && (frame->size() >= m_params.m_zeroCopyThreshold))
+			{
+				useZeroCopy = true;
+			}
+		}
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = nbIov;
+		int flags = MSG_NOSIGNAL|MSG_DONTWAIT;
+#ifdef MSG_ZEROCOPY
+		if (useZeroCopy)
+		{
+			flags |= MSG_ZEROCOPY;
+		}
+#endif
+		ssize_t ret = sendmsg(m_socket, &msg, flags);
+		m_syscalls++;
+		if (ret < 0)
+		{
+			if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) || (errno == ENOBUFS) )
+			{
+				m_retryTask = m_env.taskScheduler().scheduleDelayedTask(m_params.m_retryDelayUs, retryStub, this);
+			}
+			else
+			{
+				LOG(ERROR) << "interleaved writer socket:" << m_socket << " error:" << strerror(errno);
+				m_broken = true;
+				m_queue.clear();
+				m_pendingBytes = 0;
+			}
+			return;
+		}
+
+		if (useZeroCopy)
+		{
+			// keep every frame referenced by this call alive until the kernel releases it
+			std::list<Pending>::iterator it = m_queue.begin();
+			for (unsigned int i = 0; i < nbFrames; ++i, ++it)
+			{
+				m_inFlight.push_back(std::pair<unsigned int, std::shared_ptr<RTPFrame> >(m_zeroCopySeq, it->m_frame));
+			}
+			m_zeroCopySeq++;
+		}
+
+		// account what was sent, a packet the kernel only partially accepted keeps its offset
+		// and its end goes first on the next call, nothing else may be written before its last byte
+		bool full = ((size_t)ret < total);
+		size_t left = ret;
+		while ( (left > 0) && (!m_queue.empty()) )
+		{
+			Pending& cur = m_queue.front();
+			unsigned int packetBytes = 4 + cur.m_frame->packetSize(cur.m_packet);
+			if (left < packetBytes - cur.m_offset)
+			{
+				m_shortWrites++;
+				cur.m_offset += left;
+				break;
+			}
+			left -= packetBytes - cur.m_offset;
+			cur.m_offset = 0;
+			m_pendingBytes -= packetBytes;
+			m_packets++;
+			if (++cur.m_packet == cur.m_frame->packetCount())
+			{
+				m_queue.pop_front();
+				m_frames++;
+			}
+		}
+
+		if (full)
+		{
+			// socket buffer is full, come back later without blocking the event loop
+			m_retryTask = m_env.taskScheduler().scheduleDelayedTask(m_params.m_retryDelayUs, retryStub, this);
+			return;
+		}
+	}
+}
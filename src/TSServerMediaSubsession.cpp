@@ -7,37 +7,89 @@
 ** 
 ** -------------------------------------------------------------------------*/
 
+#include "logger.h"
+
 #include "TSServerMediaSubsession.h"
+#include "CMAFMemoryBufferSink.h"
+#include "AACEncoderSource.h"
 #include "AddH26xMarkerFilter.h"
+#include "DeviceSource.h"
+
+// the TS framer delivers whole transport packets whatever the buffer size
+#define HLS_SINK_BUFFER_SIZE (350*TRANSPORT_PACKET_SIZE)
+// bytes per second assumed for the first segments
+#define HLS_DEFAULT_BITRATE  (512*1024)
 
-TSServerMediaSubsession::TSServerMediaSubsession(UsageEnvironment& env, StreamReplicator* videoreplicator, const std::string& videoformat, StreamReplicator* audioreplicator, const std::string& audioformat, unsigned int sliceDuration) 
-		: UnicastServerMediaSubsession(env, videoreplicator, "video/MP2T"), m_slice(0)
+TSServerMediaSubsession::TSServerMediaSubsession(UsageEnvironment& env, StreamReplicator* videoreplicator, const std::string& videoformat, StreamReplicator* audioreplicator, const std::string& audioformat, unsigned int sliceDuration, unsigned int windowDuration, unsigned int partDurationMs, bool cmaf, const std::string& rendition) 
+		: UnicastServerMediaSubsession(env, videoreplicator, "video/MP2T"), m_slice(0), m_rendition(rendition), m_width(0), m_height(0)
 {
 	// Create a source
 	FramedSource* source = videoreplicator->createStreamReplica();
+	unsigned int filterBufferSize = this->getSinkBufferSize();
+	if (filterBufferSize == 0)
+	{
+		filterBufferSize = OutPacketBuffer::maxSize;
+	}
+
+	// first segments are sized from the measured bitrate, or from a guess before the capture started
+	unsigned int bitrate = HLS_DEFAULT_BITRATE;
+	V4L2DeviceSource* deviceSource = dynamic_cast<V4L2DeviceSource*>(videoreplicator->inputSource());
+	if ( (deviceSource != NULL) && (deviceSource->getStats().getBitrate() > 0) )
+	{
+		bitrate = deviceSource->getStats().getBitrate();
+	}
+	unsigned int segmentCapacity = bitrate*sliceDuration*5/4;
+	if (deviceSource != NULL)
+	{
+		m_width = deviceSource->getWidth();
+		m_height = deviceSource->getHeight();
+	}
+
+	if ( cmaf && (deviceSource != NULL) && ((videoformat == "video/H264") || (videoformat == "video/H265")) )
+	{
+		// fragmented MP4 straight from the elementary stream, no TS muxing
+		if (audioreplicator != NULL)
+		{
+			LOG(WARN) << "CMAF segments carry the video only, the audio is not streamed in HLS";
+		}
+		m_hlsSink = CMAFMemoryBufferSink::createNew(env, videoformat, m_width, m_height, filterBufferSize, sliceDuration, windowDuration, segmentCapacity, partDurationMs);
+		m_hlsSink->startPlaying(*source, NULL, NULL);
+		return;
+	}
+
 	MPEG2TransportStreamFromESSource* muxer = MPEG2TransportStreamFromESSource::createNew(env);
-	
 	if (videoformat == "video/H264") {
 		// add marker
-		FramedSource* filter = new AddH26xMarkerFilter(env, source);
+		FramedSource* filter = new AddH26xMarkerFilter(env, source, filterBufferSize);
 		// mux to TS		
 		muxer->addNewVideoSource(filter, 5);
 	} else if (videoformat == "video/H265") {
 		// add marker
-		FramedSource* filter = new AddH26xMarkerFilter(env, source);
+		FramedSource* filter = new AddH26xMarkerFilter(env, source, filterBufferSize);
 		// mux to TS		
 		muxer->addNewVideoSource(filter, 6);
 	}
 
-	if (audioformat == "audio/MPEG") {
-		// mux to TS		
-		muxer->addNewAudioSource(source, 1);
+	if (audioreplicator != NULL) {
+		FramedSource* audioSource = audioreplicator->createStreamReplica();
+		if (audioformat == "audio/MPEG") {
+			// mux to TS		
+			muxer->addNewAudioSource(audioSource, 1);
+		} else {
+			// PCM is not allowed in HLS, encode to AAC ADTS
+			FramedSource* aac = AACEncoderSource::createNew(env, audioSource, audioformat);
+			if (aac != NULL) {
+				muxer->addNewAudioSource(aac, 4);
+			} else {
+				Medium::close(audioSource);
+			}
+		}
 	}
 	
 	FramedSource* tsSource = createSource(env, muxer, m_format);
 	
 	// Start Playing the HLS Sink
-	m_hlsSink = MemoryBufferSink::createNew(env, OutPacketBuffer::maxSize, sliceDuration);
+	m_hlsSink = MemoryBufferSink::createNew(env, HLS_SINK_BUFFER_SIZE, sliceDuration, windowDuration, segmentCapacity, partDurationMs);
 	m_hlsSink->startPlaying(*tsSource, NULL, NULL);			
 }
 
@@ -58,22 +110,18 @@ float TSServerMediaSubsession::duration() const
 
 void TSServerMediaSubsession::seekStream(unsigned clientSessionId, void* streamToken, double& seekNPT, double streamDuration, u_int64_t& numBytes) 
 {
-	m_slice = seekNPT / m_hlsSink->getSliceDuration();
-	seekNPT = m_slice * m_hlsSink->getSliceDuration();
+	m_slice = m_hlsSink->findSegment(seekNPT);
+	MemorySegmentRef segment = m_hlsSink->getSegment(m_slice);
+	if (segment)
+	{
+		seekNPT = m_hlsSink->getTime(segment);
+	}
 	numBytes = m_hlsSink->getBufferSize(m_slice);
 	std::cout << "seek seekNPT:" << seekNPT << " slice:" << m_slice << " numBytes:" << numBytes << std::endl;	
 }	
 
 FramedSource* TSServerMediaSubsession::getStreamSource(void* streamToken) 
 {
-	FramedSource* source = NULL;
-	
-	std::string buffer = m_hlsSink->getBuffer(m_slice);
-	unsigned int size = buffer.size();
-	if ( size != 0 ) {
-		u_int8_t* content = new u_int8_t[size];
-		memcpy(content, buffer.c_str(), size);
-		source = ByteStreamMemoryBufferSource::createNew(envir(), content, size);			
-	}
-	return source;			
+	// stream the segment from the sink memory, the source keeps it alive
+	return MemorySegmentSource::createNew(envir(), m_hlsSink->getSegment(m_slice));
 }					
@@ -8,15 +8,17 @@
 ** -------------------------------------------------------------------------*/
 
 
+#include "logger.h"
 #include "UnicastServerMediaSubsession.h"
 #include "DeviceSource.h"
+#include "RTPRateController.h"
 
 // -----------------------------------------
 //    ServerMediaSubsession for Unicast
 // -----------------------------------------
-UnicastServerMediaSubsession* UnicastServerMediaSubsession::createNew(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format) 
+UnicastServerMediaSubsession* UnicastServerMediaSubsession::createNew(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format, const RTPOutputParameters & params) 
 { 
-	return new UnicastServerMediaSubsession(env,replicator,format);
+	return new UnicastServerMediaSubsession(env,replicator,format,params);
 }
 					
 FramedSource* UnicastServerMediaSubsession::createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate)
@@ -27,11 +29,110 @@ FramedSource* UnicastServerMediaSubsession::createNewStreamSource(unsigned clien
 		
 RTPSink* UnicastServerMediaSubsession::createNewRTPSink(Groupsock* rtpGroupsock,  unsigned char rtpPayloadTypeIfDynamic, FramedSource* inputSource)
 {
-	return createSink(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic, m_format, dynamic_cast<V4L2DeviceSource*>(m_replicator->inputSource()));
+	V4L2DeviceSource* source = dynamic_cast<V4L2DeviceSource*>(m_replicator->inputSource());
+	RTPOutputGroupsock* groupsock = dynamic_cast<RTPOutputGroupsock*>(rtpGroupsock);
+	if ( (groupsock != NULL) && (source != NULL) )
+	{
+		groupsock->setSource(source, m_format);
+		groupsock->enablePacing(&source->getStats());
+	}
+	OutPacketBufferSize bufferSize(this->getSinkBufferSize());
+	return createSink(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic, m_format, source);
 }
 		
 char const* UnicastServerMediaSubsession::getAuxSDPLine(RTPSink* rtpSink,FramedSource* inputSource)
 {
-	return this->getAuxLine(dynamic_cast<V4L2DeviceSource*>(m_replicator->inputSource()), rtpSink->rtpPayloadType());
+	return this->getAuxLine(dynamic_cast<V4L2DeviceSource*>(m_replicator->inputSource()), rtpSink->rtpPayloadType(), m_params.m_feedback.m_enable);
+}
+
+Groupsock* UnicastServerMediaSubsession::createGroupsock(struct in_addr const& addr, Port port)
+{
+	return new RTPOutputGroupsock(envir(), addr, port, 255, m_params);
+}
+
+RTPOutputGroupsock* UnicastServerMediaSubsession::getRTPGroupsock(void* streamToken)
+{
+	RTPOutputGroupsock* groupsock = NULL;
+	StreamState* streamState = (StreamState*)streamToken;
+	if ( (streamState != NULL) && (streamState->rtpSink() != NULL) )
+	{
+		groupsock = dynamic_cast<RTPOutputGroupsock*>(&streamState->rtpSink()->groupsockBeingUsed());
+	}
+	return groupsock;
+}
+
+unsigned int UnicastServerMediaSubsession::getSinkBufferSize()
+{
+	unsigned int size = BaseServerMediaSubsession::getSinkBufferSize(dynamic_cast<V4L2DeviceSource*>(m_replicator->inputSource()), m_params.m_sinkBufferHeadroom, m_params.m_sinkBufferMinSize);
+	if (size != 0)
+	{
+		LOG(INFO) << m_format << " sink buffer size:" << size;
+	}
+	return size;
+}
+
+Destinations* UnicastServerMediaSubsession::getDestinations(unsigned clientSessionId)
+{
+	return (Destinations*)(fDestinationsHashTable->Lookup((char const*)(uintptr_t)clientSessionId));
+}
+
+void UnicastServerMediaSubsession::startStream(unsigned clientSessionId, void* streamToken, TaskFunc* rtcpRRHandler, void* rtcpRRHandlerClientData, unsigned short& rtpSeqNum, unsigned& rtpTimestamp, ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler, void* serverRequestAlternativeByteHandlerClientData)
+{
+	{
+		// H264/H265 sinks allocate their fragmenter when they start playing
+		OutPacketBufferSize bufferSize(this->getSinkBufferSize());
+		OnDemandServerMediaSubsession::startStream(clientSessionId, streamToken, rtcpRRHandler, rtcpRRHandlerClientData, rtpSeqNum, rtpTimestamp, serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
+	}
+
+	// receiver reports of this client drive the encoder bitrate
+	StreamState* streamState = (StreamState*)streamToken;
+	RTPRateController* rateController = RTPRateController::lookup(m_replicator->inputSource());
+	if ( (rateController != NULL) && (streamState != NULL) && (streamState->rtpSink() != NULL) )
+	{
+		rateController->addSink(streamState->rtpSink());
+	}
+
+	Destinations* destinations = this->getDestinations(clientSessionId);
+	RTPOutputGroupsock* groupsock = this->getRTPGroupsock(streamToken);
+	if ( (destinations != NULL) && !destinations->isTCP && (groupsock != NULL) )
+	{
+		// UDP clients may ask for lost packets
+		groupsock->enableRetransmission();
+	}
+
+	// take over RTP-over-TCP from live555 that writes each packet with its own send()
+	if (m_params.m_vectoredInterleaved && (destinations != NULL) && destinations->isTCP && (groupsock != NULL))
+	{
+		streamState->rtpSink()->removeStreamSocket(destinations->tcpSocketNum, destinations->rtpChannelId);
+		groupsock->addInterleavedDestination(destinations->tcpSocketNum, destinations->rtpChannelId);
+	}
+}
+
+void UnicastServerMediaSubsession::deleteStream(unsigned clientSessionId, void*& streamToken)
+{
+	Destinations* destinations = this->getDestinations(clientSessionId);
+	RTPOutputGroupsock* groupsock = this->getRTPGroupsock(streamToken);
+	if ( (destinations != NULL) && destinations->isTCP && (groupsock != NULL) )
+	{
+		groupsock->removeInterleavedDestination(destinations->tcpSocketNum, destinations->rtpChannelId);
+	}
+	StreamState* streamState = (StreamState*)streamToken;
+	RTPRateController* rateController = RTPRateController::lookup(m_replicator->inputSource());
+	if ( (rateController != NULL) && (streamState != NULL) && (streamState->rtpSink() != NULL) && (streamState->referenceCount() <= 1) )
+	{
+		// a reused stream keeps its sink until the last client leaves
+		rateController->removeSink(streamState->rtpSink());
+	}
+	OnDemandServerMediaSubsession::deleteStream(clientSessionId, streamToken);
+}
+
+RTCPInstance* UnicastServerMediaSubsession::createRTCP(Groupsock* RTCPgs, unsigned totSessionBW, unsigned char const* cname, RTPSink* sink)
+{
+	if (!m_params.m_feedback.m_enable || (sink == NULL))
+	{
+		return OnDemandServerMediaSubsession::createRTCP(RTCPgs, totSessionBW, cname, sink);
+	}
+	RTPOutputGroupsock* groupsock = dynamic_cast<RTPOutputGroupsock*>(&sink->groupsockBeingUsed());
+	V4L2DeviceSource* source = dynamic_cast<V4L2DeviceSource*>(m_replicator->inputSource());
+	return RTCPFeedbackInstance::createNew(envir(), RTCPgs, totSessionBW, cname, sink, groupsock, source, m_params.m_feedback);
 }
-		
@@ -0,0 +1,254 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** VoiceActivity.cpp
+**
+** Voice activity detection, the silent periods are not streamed
+**
+** -------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <string.h>
+#include <sys/types.h>
+#include <alsa/asoundlib.h>
+
+#include "logger.h"
+#include "VoiceActivity.h"
+#include "PCMByteSwap.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// below this level (dBFS) a period is silent whatever the noise floor
+#define VAD_MIN_LEVEL        -55.0
+// zero crossings by sample of the unvoiced consonants, they are weaker than the vowels
+#define VAD_UNVOICED_ZCR     0.3
+// noise floor tracking by period, and its rise during a long voice
+#define VAD_NOISE_SMOOTHING  0.05
+#define VAD_NOISE_RISE       1.0023
+
+// sum of the squares and sign changes between a sample and the next one of its channel (step samples later)
+static void measure(const short* samples, unsigned int count, unsigned int step, u_int64_t & energy, unsigned int & crossings)
+{
+	energy = 0;
+	crossings = 0;
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	// halved samples, a madd of two squares cannot overflow
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_setzero_si128();
+	__m128i zc = _mm_setzero_si128();
+	for (; i + 8 + step <= count; i += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(samples + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(samples + i + step));
+		__m128i h = _mm_srai_epi16(a, 1);
+		__m128i squares = _mm_madd_epi16(h, h);
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(squares, zero));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(squares, zero));
+		zc = _mm_add_epi16(zc, _mm_srli_epi16(_mm_xor_si128(a, b), 15));
+	}
+	u_int64_t sums[2];
+	unsigned short counts[8];
+	_mm_storeu_si128((__m128i*)sums, acc);
+	_mm_storeu_si128((__m128i*)counts, zc);
+	energy = (sums[0] + sums[1])*4;
+	for (int k = 0; k < 8; ++k)
+	{
+		crossings += counts[k];
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	uint64x2_t acc = vdupq_n_u64(0);
+	uint16x8_t zc = vdupq_n_u16(0);
+	for (; i + 8 + step <= count; i += 8)
+	{
+		int16x8_t a = vld1q_s16(samples + i);
+		int16x8_t b = vld1q_s16(samples + i + step);
+		int16x8_t h = vshrq_n_s16(a, 1);
+		acc = vpadalq_u32(acc, vreinterpretq_u32_s32(vmull_s16(vget_low_s16(h), vget_low_s16(h))));
+		acc = vpadalq_u32(acc, vreinterpretq_u32_s32(vmull_s16(vget_high_s16(h), vget_high_s16(h))));
+		zc = vaddq_u16(zc, vshrq_n_u16(vreinterpretq_u16_s16(veorq_s16(a, b)), 15));
+	}
+	unsigned short counts[8];
+	vst1q_u16(counts, zc);
+	energy = (vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1))*4;
+	for (int k = 0; k < 8; ++k)
+	{
+		crossings += counts[k];
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		energy += samples[i]*samples[i];
+		if ( (i + step < count) && ((samples[i] ^ samples[i + step]) < 0) )
+		{
+			crossings++;
+		}
+	}
+}
+
+VoiceActivityDevice* VoiceActivityDevice::createNew(DeviceInterface* device, unsigned int sampleRate, unsigned int channels, int format, float threshold, unsigned int hangover, unsigned int keepAlive)
+{
+	snd_pcm_format_t fmt = (snd_pcm_format_t)format;
+	if ( (fmt != SND_PCM_FORMAT_S16_LE) && (fmt != SND_PCM_FORMAT_S16_BE) )
+	{
+		LOG(WARN) << "voice activity detection needs 16 bits samples, format:" << format;
+		return NULL;
+	}
+	if ( (sampleRate == 0) || (channels == 0) )
+	{
+		return NULL;
+	}
+	return new VoiceActivityDevice(device, sampleRate, channels, threshold, hangover, keepAlive);
+}
+
+VoiceActivityDevice::VoiceActivityDevice(DeviceInterface* device, unsigned int sampleRate, unsigned int channels, float threshold, unsigned int hangover, unsigned int keepAlive)
+	: m_device(device), m_sampleRate(sampleRate), m_channels(channels), m_threshold(threshold)
+	, m_hangoverFrames(sampleRate*hangover/1000), m_keepAliveFrames(sampleRate*keepAlive/1000)
+	, m_noise(0), m_hangoverLeft(0), m_silentFrames(0), m_skippedFrames(0), m_seed(1), m_reportTime(time(NULL))
+{
+	LOG(NOTICE) << "voice activity detection threshold:" << threshold << "dB hangover:" << hangover << "ms keep-alive:" << keepAlive << "ms";
+}
+
+VoiceActivityDevice::~VoiceActivityDevice()
+{
+	LOG(NOTICE) << "voice activity periods:" << m_stats.m_periods << " voice:" << m_stats.m_voice << " hangover:" << m_stats.m_hangover
+		<< " suppressed:" << m_stats.m_suppressed << " keep-alive:" << m_stats.m_keepAlives;
+	delete m_device;
+}
+
+// the silent periods are read in the loop, the capture thread waits for the next voice or keep-alive
+size_t VoiceActivityDevice::read(char* buffer, size_t bufferSize)
+{
+	m_skippedFrames = 0;
+	int size = 0;
+	while (true)
+	{
+		size = m_device->read(buffer, bufferSize);
+		if (size <= 0)
+		{
+			break;
+		}
+		unsigned int frames = size / (2*m_channels);
+		m_stats.m_periods++;
+		if (this->detect((unsigned char*)buffer, size))
+		{
+			m_stats.m_voice++;
+			m_hangoverLeft = m_hangoverFrames;
+			m_silentFrames = 0;
+			break;
+		}
+		if (m_hangoverLeft > 0)
+		{
+			m_stats.m_hangover++;
+			m_hangoverLeft -= (frames < m_hangoverLeft) ? frames : m_hangoverLeft;
+			m_silentFrames = 0;
+			break;
+		}
+		m_silentFrames += frames;
+		if ( (m_keepAliveFrames > 0) && (m_silentFrames >= m_keepAliveFrames) )
+		{
+			m_stats.m_keepAlives++;
+			this->comfortNoise((unsigned char*)buffer, size);
+			m_silentFrames = 0;
+			break;
+		}
+		m_stats.m_suppressed++;
+		m_skippedFrames += frames;
+	}
+	this->updateStats();
+	return size;
+}
+
+// the returned period started after the suppressed ones
+void VoiceActivityDevice::adjustPresentationTime(timeval & tv)
+{
+	m_device->adjustPresentationTime(tv);
+	u_int64_t usec = tv.tv_usec + (u_int64_t)m_skippedFrames*1000000/m_sampleRate;
+	tv.tv_sec += usec/1000000;
+	tv.tv_usec = usec%1000000;
+}
+
+// energy above the noise floor, or a bit less with the zero crossings of a consonant
+bool VoiceActivityDevice::detect(const unsigned char* data, size_t size)
+{
+	unsigned int count = size/2;
+	if (count <= m_channels)
+	{
+		return false;
+	}
+	m_samples.resize(count);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	pcmByteSwapCopy((unsigned char*)&m_samples[0], data, count*2, 2);
+#else
+	memcpy(&m_samples[0], data, count*2);
+#endif
+	u_int64_t energy = 0;
+	unsigned int crossings = 0;
+	measure(&m_samples[0], count, m_channels, energy, crossings);
+
+	double power = (double)energy/count;
+	double zcr = (double)crossings/(count - m_channels);
+	if (m_noise <= 0)
+	{
+		m_noise = power + 1;
+	}
+	double level = 10*log10(power + 1);
+	double noiseLevel = 10*log10(m_noise);
+	double fullScale = 10*log10(32768.0*32768.0);
+
+	bool voice = (level - fullScale > VAD_MIN_LEVEL)
+		&& ( (level > noiseLevel + m_threshold) || ((level > noiseLevel + m_threshold/2) && (zcr > VAD_UNVOICED_ZCR)) );
+	if (voice)
+	{
+		// a lasting loud noise ends up being the floor
+		m_noise *= VAD_NOISE_RISE;
+	}
+	else
+	{
+		m_noise += VAD_NOISE_SMOOTHING*(power + 1 - m_noise);
+	}
+	return voice;
+}
+
+// white noise at the level of the floor, it keeps the NAT bindings and the players alive
+void VoiceActivityDevice::comfortNoise(unsigned char* data, size_t size)
+{
+	double amplitude = sqrt(3*m_noise);
+	if (amplitude > 32767)
+	{
+		amplitude = 32767;
+	}
+	for (size_t i = 0; i + 1 < size; i += 2)
+	{
+		m_seed = m_seed*1103515245 + 12345;
+		short sample = (short)(amplitude*(((m_seed >> 16) & 0x7FFF)/16383.5 - 1));
+		data[i]   = (unsigned char)((sample >> 8) & 0xFF);
+		data[i+1] = (unsigned char)(sample & 0xFF);
+	}
+}
+
+// counters of the last 10s
+void VoiceActivityDevice::updateStats()
+{
+	time_t now = time(NULL);
+	if (now - m_reportTime >= 10)
+	{
+		unsigned long periods = m_stats.m_periods - m_reportStats.m_periods;
+		unsigned long suppressed = m_stats.m_suppressed - m_reportStats.m_suppressed;
+		LOG(NOTICE) << "voice activity periods:" << periods
+			<< " voice:" << (m_stats.m_voice - m_reportStats.m_voice)
+			<< " hangover:" << (m_stats.m_hangover - m_reportStats.m_hangover)
+			<< " suppressed:" << suppressed
+			<< " keep-alive:" << (m_stats.m_keepAlives - m_reportStats.m_keepAlives)
+			<< " saved:" << ((periods > 0) ? suppressed*100/periods : 0) << "%"
+			<< " noise:" << (int)(10*log10(m_noise) - 10*log10(32768.0*32768.0)) << "dBFS";
+		m_reportStats = m_stats;
+		m_reportTime = now;
+	}
+}
@@ -0,0 +1,323 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** WebrootCache.cpp
+**
+** Cache of the webroot files invalidated by inotify, large files are sent with sendfile
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/sendfile.h>
+#include <sstream>
+
+#include "logger.h"
+#include "WebrootCache.h"
+
+// sorted by extension
+static const struct
+{
+	const char* m_extension;
+	const char* m_mimeType;
+} s_mimeTypes[] = {
+	{ "css",   "text/css"                        },
+	{ "gif",   "image/gif"                       },
+	{ "htm",   "text/html"                       },
+	{ "html",  "text/html"                       },
+	{ "ico",   "image/x-icon"                    },
+	{ "jpeg",  "image/jpeg"                      },
+	{ "jpg",   "image/jpeg"                      },
+	{ "js",    "application/javascript"          },
+	{ "json",  "application/json"                },
+	{ "m3u8",  "application/vnd.apple.mpegurl"   },
+	{ "map",   "application/json"                },
+	{ "mp4",   "video/mp4"                       },
+	{ "mpd",   "application/dash+xml"            },
+	{ "png",   "image/png"                       },
+	{ "svg",   "image/svg+xml"                   },
+	{ "ts",    "video/mp2t"                      },
+	{ "txt",   "text/plain"                      },
+	{ "wasm",  "application/wasm"                },
+	{ "woff",  "font/woff"                       },
+	{ "woff2", "font/woff2"                      },
+	{ "xml",   "application/xml"                 },
+};
+
+static std::string dirName(const std::string & path)
+{
+	size_t pos = path.find_last_of('/');
+	return (pos == std::string::npos) ? std::string(".") : path.substr(0, pos);
+}
+
+static std::string baseName(const std::string & path)
+{
+	size_t pos = path.find_last_of('/');
+	return (pos == std::string::npos) ? path : path.substr(pos+1);
+}
+
+// -----------------------------------------
+//    WebrootCache
+// -----------------------------------------
+WebrootCache* WebrootCache::createNew(UsageEnvironment& env, unsigned int maxCachedSize)
+{
+	return new WebrootCache(env, maxCachedSize);
+}
+
+WebrootCache::WebrootCache(UsageEnvironment& env, unsigned int maxCachedSize)
+	: m_env(env), m_maxCachedSize(maxCachedSize), m_hits(0), m_misses(0)
+{
+	m_inotifyFd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (m_inotifyFd < 0)
+	{
+		// without notification every lookup checks the file date
+		LOG(WARN) << "webroot cache without inotify:" << strerror(errno);
+	}
+	else
+	{
+		m_env.taskScheduler().setBackgroundHandling(m_inotifyFd, SOCKET_READABLE, inotifyHandlerStub, this);
+	}
+}
+
+WebrootCache::~WebrootCache()
+{
+	if (m_inotifyFd >= 0)
+	{
+		m_env.taskScheduler().disableBackgroundHandling(m_inotifyFd);
+		close(m_inotifyFd);
+	}
+	LOG(NOTICE) << "webroot cache hits:" << m_hits << " misses:" << m_misses;
+}
+
+const char* WebrootCache::getMimeType(const std::string & path)
+{
+	const char* mimeType = "application/octet-stream";
+	size_t pos = path.find_last_of('.');
+	if (pos != std::string::npos)
+	{
+		std::string extension(path.substr(pos+1));
+		int first = 0;
+		int last = sizeof(s_mimeTypes)/sizeof(s_mimeTypes[0]) - 1;
+		while (first <= last)
+		{
+			int middle = (first + last)/2;
+			int cmp = strcasecmp(extension.c_str(), s_mimeTypes[middle].m_extension);
+			if (cmp == 0)
+			{
+				mimeType = s_mimeTypes[middle].m_mimeType;
+				break;
+			}
+			else if (cmp < 0)
+			{
+				last = middle - 1;
+			}
+			else
+			{
+				first = middle + 1;
+			}
+		}
+	}
+	return mimeType;
+}
+
+WebrootFileRef WebrootCache::lookup(const std::string & path)
+{
+	std::map<std::string, WebrootFileRef>::iterator it = m_files.find(path);
+	if ( (it != m_files.end()) && (m_inotifyFd >= 0) )
+	{
+		// still valid, inotify removes the modified files
+		m_hits++;
+		return it->second;
+	}
+
+	struct stat st;
+	if ( (stat(path.c_str(), &st) != 0) || !S_ISREG(st.st_mode) )
+	{
+		if (it != m_files.end())
+		{
+			m_files.erase(it);
+		}
+		return WebrootFileRef();
+	}
+	if ( (it != m_files.end()) && (it->second->m_mtime == st.st_mtime) && (it->second->m_size == st.st_size) )
+	{
+		m_hits++;
+		return it->second;
+	}
+	m_misses++;
+
+	// watch before reading, a change during the read drops the entry
+	this->watch(path);
+
+	std::shared_ptr<WebrootFile> file(new WebrootFile());
+	file->m_path = path;
+	file->m_size = st.st_size;
+	file->m_mtime = st.st_mtime;
+	file->m_mimeType = getMimeType(path);
+
+	std::ostringstream etag;
+	etag << "\"" << std::hex << st.st_size << "-" << st.st_mtime << "\"";
+	file->m_etag = etag.str();
+
+	char lastModified[64];
+	struct tm tm;
+	gmtime_r(&st.st_mtime, &tm);
+	strftime(lastModified, sizeof(lastModified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	file->m_lastModified = lastModified;
+
+	if (st.st_size <= (off_t)m_maxCachedSize)
+	{
+		int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+		if (fd < 0)
+		{
+			return WebrootFileRef();
+		}
+		std::shared_ptr<MemorySegment> content(new MemorySegment(st.st_size));
+		unsigned char buffer[16*1024];
+		ssize_t size = 0;
+		while ((size = read(fd, buffer, sizeof(buffer))) > 0)
+		{
+			content->append(buffer, size);
+		}
+		close(fd);
+		content->seal();
+		file->m_content = content;
+		file->m_size = content->size();
+	}
+
+	m_files[path] = file;
+	return file;
+}
+
+void WebrootCache::watch(const std::string & path)
+{
+	if (m_inotifyFd < 0)
+	{
+		return;
+	}
+	std::string dir(dirName(path));
+	std::map<int, std::string>::iterator it;
+	for (it = m_watches.begin(); it != m_watches.end(); ++it)
+	{
+		if (it->second == dir)
+		{
+			return;
+		}
+	}
+	int wd = inotify_add_watch(m_inotifyFd, dir.c_str(), IN_MODIFY|IN_CLOSE_WRITE|IN_ATTRIB|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE|IN_DELETE_SELF|IN_MOVE_SELF);
+	if (wd >= 0)
+	{
+		m_watches[wd] = dir;
+	}
+	else
+	{
+		LOG(WARN) << "inotify watch " << dir << " failed:" << strerror(errno);
+	}
+}
+
+// drop the entries of the changed files, they are read again on the next request
+void WebrootCache::inotifyHandler()
+{
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t size = 0;
+	while ((size = read(m_inotifyFd, buffer, sizeof(buffer))) > 0)
+	{
+		for (char* ptr = buffer; ptr < buffer + size; )
+		{
+			const struct inotify_event* event = (const struct inotify_event*)ptr;
+			ptr += sizeof(struct inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				m_files.clear();
+				continue;
+			}
+			std::map<int, std::string>::iterator watch = m_watches.find(event->wd);
+			if (watch == m_watches.end())
+			{
+				continue;
+			}
+			std::string dir(watch->second);
+			std::string name( (event->len > 0) ? event->name : "" );
+			if (event->mask & IN_IGNORED)
+			{
+				m_watches.erase(watch);
+			}
+
+			std::map<std::string, WebrootFileRef>::iterator it = m_files.begin();
+			while (it != m_files.end())
+			{
+				if ( (dirName(it->first) == dir) && (name.empty() || (baseName(it->first) == name)) )
+				{
+					LOG(INFO) << "webroot cache invalidate:" << it->first;
+					m_files.erase(it++);
+				}
+				else
+				{
+					++it;
+				}
+			}
+		}
+	}
+}
+
+// -----------------------------------------
+//    FileSender
+// -----------------------------------------
+FileSender* FileSender::createNew(UsageEnvironment& env, int socket, const WebrootFileRef & file, TaskFunc* afterFunc, void* clientData)
+{
+	FileSender* sender = NULL;
+	int fd = file ? open(file->m_path.c_str(), O_RDONLY|O_CLOEXEC) : -1;
+	if (fd >= 0)
+	{
+		sender = new FileSender(env, socket, fd, file, afterFunc, clientData);
+		sender->send();
+	}
+	return sender;
+}
+
+FileSender::FileSender(UsageEnvironment& env, int socket, int fd, const WebrootFileRef & file, TaskFunc* afterFunc, void* clientData)
+	: m_env(env), m_socket(socket), m_fd(fd), m_file(file), m_offset(0), m_afterFunc(afterFunc), m_clientData(clientData)
+{
+}
+
+FileSender::~FileSender()
+{
+	if (m_afterFunc != NULL)
+	{
+		// deleted before the end, stop waiting for the socket
+		m_env.taskScheduler().disableBackgroundHandling(m_socket);
+	}
+	close(m_fd);
+}
+
+// zero copy from the page cache to the socket, wait when the socket buffer is full
+void FileSender::send()
+{
+	while (m_offset < m_file->m_size)
+	{
+		ssize_t size = sendfile(m_socket, m_fd, &m_offset, m_file->m_size - m_offset);
+		if ( (size < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) )
+		{
+			m_env.taskScheduler().setBackgroundHandling(m_socket, SOCKET_WRITABLE, writableHandlerStub, this);
+			return;
+		}
+		if (size <= 0)
+		{
+			// connection closed or file truncated
+			break;
+		}
+	}
+
+	m_env.taskScheduler().disableBackgroundHandling(m_socket);
+	TaskFunc* afterFunc = m_afterFunc;
+	m_afterFunc = NULL;
+	afterFunc(m_clientData);
+}
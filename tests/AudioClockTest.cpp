@@ -0,0 +1,95 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioClockTest.cpp
+**
+** Delay-locked loop of the audio presentation times, on a simulated clock
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <math.h>
+#include <alsa/asoundlib.h>
+
+#include "TestHarness.h"
+#include "FakeDevice.h"
+#include "AudioClock.h"
+
+// the reads are timed by the test instead of the system clocks
+class SimulatedClock : public AudioClockDevice
+{
+	public:
+		SimulatedClock(unsigned int sampleRate) : AudioClockDevice(new FakeDevice(), sampleRate, 4, 0.05) {}
+
+		// returns the presentation time of the period in seconds
+		double read(unsigned int frames, double now)
+		{
+			timeval wall;
+			long long usec = (long long)((WALL_OFFSET + now)*1e6);
+			wall.tv_sec = usec/1000000;
+			wall.tv_usec = usec%1000000;
+			this->update(frames, now, wall);
+			timeval tv;
+			timerclear(&tv);
+			this->adjustPresentationTime(tv);
+			return tv.tv_sec + tv.tv_usec/1e6 - WALL_OFFSET;
+		}
+
+		static const long WALL_OFFSET = 1000000000;
+};
+
+// a device 50ppm slower than its nominal rate, read with up to 3ms of scheduling latency
+TEST(audioClockLocksOnSkew)
+{
+	const unsigned int rate = 48000;
+	const unsigned int frames = rate/100;
+	const double skew = 50e-6;
+	const double period = frames*(1 + skew)/rate;
+	SimulatedClock clock(rate);
+	srand(1);
+	double previous = 0;
+	double maxSpacingError = 0;
+	for (unsigned int k = 1; k <= 12000; k++)
+	{
+		double now = 5 + k*period + 0.003*rand()/RAND_MAX;
+		double time = clock.read(frames, now);
+		if (k > 6000)
+		{
+			maxSpacingError = std::max(maxSpacingError, fabs(time - previous - period));
+		}
+		previous = time;
+	}
+	const AudioClockStats & stats = clock.getStats();
+	std::cout << "  skew:" << stats.m_skew << "ppm spacing error:" << maxSpacingError*1e6 << "us resyncs:" << stats.m_resyncs << std::endl;
+	CHECK(fabs(stats.m_skew - 50) < 5);
+	CHECK(maxSpacingError < 20e-6);
+	CHECK(stats.m_resyncs == 1);
+}
+
+// an xrun loses samples, the loop starts again instead of slewing for minutes
+TEST(audioClockResyncs)
+{
+	const unsigned int rate = 48000;
+	const unsigned int frames = rate/100;
+	SimulatedClock clock(rate);
+	double now = 5;
+	for (unsigned int k = 0; k < 100; k++)
+	{
+		now += 0.01;
+		clock.read(frames, now);
+	}
+	now += 0.5;
+	double time = clock.read(frames, now);
+	CHECK(clock.getStats().m_resyncs == 2);
+	// the period read after the gap starts 10ms before its read
+	CHECK(fabs(time - (now - 0.01)) < 1e-3);
+}
+
+TEST(audioClockRejectsFormat)
+{
+	FakeDevice device;
+	CHECK(AudioClockDevice::createNew(&device, 0, 2, SND_PCM_FORMAT_S16_LE) == NULL);
+	CHECK(AudioClockDevice::createNew(&device, 48000, 0, SND_PCM_FORMAT_S16_LE) == NULL);
+}
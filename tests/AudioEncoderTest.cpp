@@ -0,0 +1,149 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioEncoderTest.cpp
+**
+** G.711 encoding stage
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <errno.h>
+#include <vector>
+#include <alsa/asoundlib.h>
+
+#include "TestHarness.h"
+#include "FakeDevice.h"
+#include "AudioEncoder.h"
+
+// 16 bits network order samples covering the whole range
+static std::string rampPeriod(std::vector<short> & samples)
+{
+	std::string period;
+	for (int value = -32768; value < 32768; value += 7)
+	{
+		samples.push_back(value);
+		period += (char)((value >> 8) & 0xff);
+		period += (char)(value & 0xff);
+	}
+	return period;
+}
+
+// the decoded samples stay within the quantization step of their segment
+static void checkG711(const char* codec, bool ulaw)
+{
+	std::vector<short> samples;
+	FakeDevice* device = new FakeDevice();
+	device->pushData(rampPeriod(samples));
+	AudioEncoderDevice* encoder = AudioEncoderDevice::createNew(device, codec, 8000, 1, SND_PCM_FORMAT_S16_BE);
+	CHECK(encoder != NULL);
+	if (encoder == NULL)
+	{
+		delete device;
+		return;
+	}
+	CHECK(encoder->getRtpFormat() == std::string("audio/") + codec + "/8000/1");
+	std::vector<char> buffer(samples.size()*2);
+	CHECK(encoder->read(&buffer[0], buffer.size()) == samples.size());
+
+	std::vector<short> decoded(samples.size());
+	decodeG711((const unsigned char*)&buffer[0], samples.size(), &decoded[0], ulaw);
+	int maxRelativeError = 0;
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		int error = abs(decoded[i] - samples[i]);
+		int magnitude = abs(samples[i]);
+		// 4 bits mantissa : half a step is 1/32 of the segment start, 1/16 of the magnitude at most
+		if (magnitude < 32000)
+		{
+			CHECK(error <= magnitude/16 + 16);
+		}
+		if (magnitude > 256)
+		{
+			maxRelativeError = std::max(maxRelativeError, error*1000/magnitude);
+		}
+	}
+	std::cout << "  " << codec << " max error:" << maxRelativeError/10.0 << "%" << std::endl;
+	delete encoder;
+}
+
+TEST(g711Ulaw)
+{
+	checkG711("PCMU", true);
+}
+
+TEST(g711Alaw)
+{
+	checkG711("PCMA", false);
+}
+
+// G.711 is only defined at 8000Hz, an error of the capture is forwarded unencoded
+TEST(g711EncoderDevice)
+{
+	FakeDevice device;
+	CHECK(AudioEncoderDevice::createNew(&device, "PCMU", 16000, 1, SND_PCM_FORMAT_S16_BE) == NULL);
+	CHECK(AudioEncoderDevice::createNew(&device, "PCMA", 8000, 1, SND_PCM_FORMAT_S24_3LE) == NULL);
+
+	FakeDevice* failing = new FakeDevice();
+	failing->pushError(-EIO);
+	AudioEncoderDevice* encoder = AudioEncoderDevice::createNew(failing, "PCMU", 8000, 1, SND_PCM_FORMAT_S16_BE);
+	CHECK(encoder != NULL);
+	if (encoder != NULL)
+	{
+		char buffer[320];
+		CHECK((ssize_t)encoder->read(buffer, sizeof(buffer)) == -EIO);
+		delete encoder;
+	}
+}
+
+#ifdef HAVE_OPUS
+// periods of 100ms are longer than the longest Opus frame, a read returns a buffered frame before reading
+// the device again so the backlog does not grow, the frames get the time of their first sample
+TEST(opusPeriodLongerThanFrame)
+{
+	const unsigned int rate = 48000;
+	const unsigned int periodFrames = rate/10;
+	FakeDevice* device = new FakeDevice(periodFrames*2);
+	std::string period(periodFrames*2, 0);
+	for (unsigned int k = 0; k < 30; k++)
+	{
+		timeval tv = { 1000 + k/10, (suseconds_t)(k%10)*100000 };
+		device->pushData(period, tv);
+	}
+	AudioEncoderDevice* encoder = AudioEncoderDevice::createNew(device, "OPUS", rate, 1, SND_PCM_FORMAT_S16_BE);
+	CHECK(encoder != NULL);
+	if (encoder == NULL)
+	{
+		delete device;
+		return;
+	}
+	char buffer[4000];
+	bool spaced = true;
+	for (unsigned int n = 0; n < 50; n++)
+	{
+		CHECK((ssize_t)encoder->read(buffer, sizeof(buffer)) > 0);
+		timeval tv;
+		timerclear(&tv);
+		encoder->adjustPresentationTime(tv);
+		long long usec = (long long)(tv.tv_sec - 1000)*1000000 + tv.tv_usec;
+		spaced = spaced && (usec == n*60000);
+	}
+	// 50 frames of 60ms take 30 periods of 100ms
+	CHECK(device->reads() == 30);
+	CHECK(spaced);
+	delete encoder;
+}
+#endif
+
+BENCH(g711Encode)
+{
+	std::vector<short> samples;
+	std::string period = rampPeriod(samples);
+	FakeDevice* device = new FakeDevice();
+	AudioEncoderDevice* encoder = AudioEncoderDevice::createNew(device, "PCMU", 8000, 1, SND_PCM_FORMAT_S16_BE);
+	std::vector<char> buffer(period.size());
+	benchThroughput("PCMU encode", period.size(), [&]() { device->pushData(period); encoder->read(&buffer[0], buffer.size()); });
+	delete encoder;
+}
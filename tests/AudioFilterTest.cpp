@@ -0,0 +1,129 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioFilterTest.cpp
+**
+** Filter stage and spectral denoiser
+**
+** -------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <vector>
+#include <alsa/asoundlib.h>
+
+#include "TestHarness.h"
+#include "FakeDevice.h"
+#include "AudioFilter.h"
+#include "SpectralDenoiser.h"
+
+static double rms(const std::vector<short> & samples, size_t start, size_t end)
+{
+	double sum = 0;
+	for (size_t i = start; i < end; i++)
+	{
+		sum += (double)samples[i]*samples[i];
+	}
+	return sqrt(sum/(end - start));
+}
+
+static short noiseSample(int amplitude)
+{
+	return (rand() % (2*amplitude + 1)) - amplitude;
+}
+
+TEST(denoiserAttenuatesNoise)
+{
+	const unsigned int rate = 48000;
+	std::vector<short> input(3*rate);
+	for (size_t i = 0; i < input.size(); i++)
+	{
+		input[i] = noiseSample(1000);
+	}
+	std::vector<short> output(input);
+	SpectralDenoiser denoiser(rate, 1);
+	for (size_t i = 0; i < output.size(); i += rate/100)
+	{
+		denoiser.process(&output[i], rate/100);
+	}
+	double reduction = 20*log10(rms(input, 2*rate, 3*rate)/rms(output, 2*rate, 3*rate));
+	std::cout << "  noise reduction: " << reduction << " dB" << std::endl;
+	CHECK(reduction > 10);
+}
+
+// the noise is learned first, a tone above it goes through
+TEST(denoiserPassesTone)
+{
+	const unsigned int rate = 48000;
+	std::vector<short> input(3*rate);
+	std::vector<short> tone(input.size(), 0);
+	for (size_t i = 0; i < input.size(); i++)
+	{
+		if (i >= rate)
+		{
+			tone[i] = (short)(8000*sin(2*M_PI*440*i/rate));
+		}
+		input[i] = tone[i] + noiseSample(300);
+	}
+	std::vector<short> output(input);
+	SpectralDenoiser denoiser(rate, 1);
+	for (size_t i = 0; i < output.size(); i += rate/100)
+	{
+		denoiser.process(&output[i], rate/100);
+	}
+	double level = 20*log10(rms(output, 2*rate, 3*rate)/rms(tone, 2*rate, 3*rate));
+	std::cout << "  tone level: " << level << " dB" << std::endl;
+	CHECK(fabs(level) < 1);
+}
+
+class CountingFilter : public AudioFilter
+{
+	public:
+		CountingFilter() : m_frames(0) {}
+		virtual const char* getName() { return "counter"; }
+		virtual void process(short*, unsigned int frames) { m_frames += frames; }
+		unsigned int m_frames;
+};
+
+// an error of the capture reaches the source unprocessed
+TEST(filterDeviceForwardsErrors)
+{
+	CHECK(AudioFilterDevice::createNew(new FakeDevice(), 48000, 2, SND_PCM_FORMAT_S24_3LE) == NULL);
+
+	FakeDevice* device = new FakeDevice();
+	std::vector<short> samples(480*2, 0x0102);
+	device->pushData(&samples[0], samples.size());
+	device->pushError(-EIO);
+	AudioFilterDevice* filterDevice = AudioFilterDevice::createNew(device, 48000, 2, SND_PCM_FORMAT_S16_BE);
+	CHECK(filterDevice != NULL);
+	if (filterDevice != NULL)
+	{
+		CountingFilter* filter = new CountingFilter();
+		filterDevice->addFilter(filter);
+		std::vector<char> buffer(samples.size()*sizeof(short));
+		CHECK(filterDevice->read(&buffer[0], buffer.size()) == buffer.size());
+		CHECK(filter->m_frames == 480);
+		CHECK(memcmp(&buffer[0], &samples[0], buffer.size()) == 0);
+		CHECK((ssize_t)filterDevice->read(&buffer[0], buffer.size()) == -EIO);
+		CHECK(filter->m_frames == 480);
+		delete filterDevice;
+	}
+}
+
+BENCH(denoiserPeriod)
+{
+	const unsigned int rate = 48000;
+	const unsigned int period = rate/100;
+	std::vector<short> samples(2*period);
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		samples[i] = noiseSample(1000);
+	}
+	SpectralDenoiser denoiser(rate, 2);
+	double throughput = benchThroughput("denoiser 48kHz stereo", samples.size()*sizeof(short), [&]() { denoiser.process(&samples[0], period); });
+	// 10ms of audio is 1920 bytes
+	std::cout << "  per 10ms period: " << samples.size()*sizeof(short)/throughput << " us" << std::endl;
+}
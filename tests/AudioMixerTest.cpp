@@ -0,0 +1,167 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioMixerTest.cpp
+**
+** Mix of several captures and failures of its inputs
+**
+** -------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <vector>
+#include <alsa/asoundlib.h>
+
+#include "TestHarness.h"
+#include "FakeDevice.h"
+#include "AudioMixer.h"
+
+static const unsigned int FRAMES = 480;
+
+// a 10ms stereo period of a constant value in network order
+static std::string constantPeriod(short value)
+{
+	std::string period;
+	for (unsigned int i = 0; i < FRAMES*2; i++)
+	{
+		period += (char)((value >> 8) & 0xff);
+		period += (char)(value & 0xff);
+	}
+	return period;
+}
+
+// presentation time of the period k, the inputs are stamped by the test so that their alignment does not
+// depend on the time between their reads
+static timeval periodTime(unsigned int k)
+{
+	timeval tv;
+	tv.tv_sec = 1000 + k/100;
+	tv.tv_usec = (k%100)*10000;
+	return tv;
+}
+
+// first sample of the mix, -1000000 when the read returned nothing
+static int mixPeriod(AudioMixerDevice* mixer, ssize_t & size)
+{
+	std::vector<char> buffer(FRAMES*4);
+	size = mixer->read(&buffer[0], buffer.size());
+	if (size <= 0)
+	{
+		return -1000000;
+	}
+	const unsigned char* data = (const unsigned char*)&buffer[0];
+	return (short)((data[0] << 8) | data[1]);
+}
+
+static AudioMixerDevice* createMixer(FakeDevice* first, FakeDevice* second)
+{
+	std::vector<DeviceInterface*> inputs;
+	inputs.push_back(first);
+	inputs.push_back(second);
+	return AudioMixerDevice::createNew(inputs, 48000, 2, SND_PCM_FORMAT_S16_BE);
+}
+
+TEST(mixerGains)
+{
+	FakeDevice* first = new FakeDevice(FRAMES*4);
+	FakeDevice* second = new FakeDevice(FRAMES*4);
+	for (int i = 0; i < 4; i++)
+	{
+		first->pushData(constantPeriod((i == 3) ? 30000 : 1000), periodTime(i));
+		second->pushData(constantPeriod((i == 3) ? 30000 : 2000), periodTime(i));
+	}
+	AudioMixerDevice* mixer = createMixer(first, second);
+	CHECK(mixer != NULL);
+	if (mixer == NULL)
+	{
+		return;
+	}
+	ssize_t size = 0;
+	CHECK(mixPeriod(mixer, size) == 3000);
+	CHECK(size == FRAMES*4);
+	mixer->setGain(1, 0.5f);
+	CHECK(mixPeriod(mixer, size) == 2000);
+	mixer->setMute(0, true);
+	CHECK(mixPeriod(mixer, size) == 1000);
+	mixer->setMute(0, false);
+	mixer->setGain(1, 1.0f);
+	// saturated
+	CHECK(mixPeriod(mixer, size) == 32767);
+	delete mixer;
+}
+
+// a secondary input that misses a period is silent for it, only a persistent failure stops reading it
+TEST(mixerSecondaryFailures)
+{
+	FakeDevice* first = new FakeDevice(FRAMES*4);
+	FakeDevice* second = new FakeDevice(FRAMES*4);
+	for (int i = 0; i < 20; i++)
+	{
+		first->pushData(constantPeriod(1000), periodTime(i));
+	}
+	second->pushError(-EIO);
+	second->pushData(constantPeriod(2000), periodTime(1));
+	AudioMixerDevice* mixer = createMixer(first, second);
+	if (mixer == NULL)
+	{
+		CHECK(mixer != NULL);
+		return;
+	}
+	ssize_t size = 0;
+	CHECK(mixPeriod(mixer, size) == 1000);
+	CHECK(mixPeriod(mixer, size) == 3000);
+
+	// the script is empty, each read of the second input fails
+	for (int i = 0; i < 12; i++)
+	{
+		CHECK(mixPeriod(mixer, size) == 1000);
+	}
+	unsigned int reads = second->reads();
+	CHECK(mixPeriod(mixer, size) == 1000);
+	CHECK(second->reads() == reads);
+	delete mixer;
+}
+
+// the first input gives the pace, its transient errors are retried and a persistent one is returned
+TEST(mixerFirstFailures)
+{
+	FakeDevice* first = new FakeDevice(FRAMES*4);
+	FakeDevice* second = new FakeDevice(FRAMES*4);
+	first->pushError(-EIO);
+	first->pushData(constantPeriod(1000), periodTime(0));
+	for (int i = 0; i < 20; i++)
+	{
+		first->pushError(-EIO);
+	}
+	second->pushData(constantPeriod(2000), periodTime(0));
+	AudioMixerDevice* mixer = createMixer(first, second);
+	if (mixer == NULL)
+	{
+		CHECK(mixer != NULL);
+		return;
+	}
+	ssize_t size = 0;
+	CHECK(mixPeriod(mixer, size) == 3000);
+	mixPeriod(mixer, size);
+	CHECK(size == -EIO);
+	mixPeriod(mixer, size);
+	CHECK(size <= 0);
+	delete mixer;
+}
+
+BENCH(mixerPeriod)
+{
+	FakeDevice* first = new FakeDevice(FRAMES*4);
+	FakeDevice* second = new FakeDevice(FRAMES*4);
+	AudioMixerDevice* mixer = createMixer(first, second);
+	std::string period = constantPeriod(1000);
+	std::vector<char> buffer(FRAMES*4);
+	double throughput = benchThroughput("2 inputs 48kHz stereo", period.size(), [&]() {
+		first->pushData(period);
+		second->pushData(period);
+		mixer->read(&buffer[0], buffer.size());
+	});
+	std::cout << "  per 10ms period: " << period.size()/throughput << " us" << std::endl;
+	delete mixer;
+}
@@ -0,0 +1,147 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AudioResamplerTest.cpp
+**
+** Down-mix and polyphase resampling stage
+**
+** -------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <errno.h>
+#include <vector>
+#include <alsa/asoundlib.h>
+
+#include "TestHarness.h"
+#include "FakeDevice.h"
+#include "AudioResampler.h"
+
+// 10ms periods of a stereo tone in network order, both channels equal
+static FakeDevice* toneDevice(unsigned int rate, double frequency, double amplitude, unsigned int periods)
+{
+	unsigned int frames = rate/100;
+	FakeDevice* device = new FakeDevice(frames*4);
+	unsigned int n = 0;
+	for (unsigned int p = 0; p < periods; p++)
+	{
+		std::string period;
+		for (unsigned int i = 0; i < frames; i++, n++)
+		{
+			short value = (short)lrint(amplitude*sin(2*M_PI*frequency*n/rate));
+			for (int channel = 0; channel < 2; channel++)
+			{
+				period += (char)((value >> 8) & 0xff);
+				period += (char)(value & 0xff);
+			}
+		}
+		device->pushData(period);
+	}
+	return device;
+}
+
+static std::vector<short> readAll(AudioResamplerDevice* resampler, unsigned int periods)
+{
+	std::vector<short> samples;
+	std::vector<char> buffer(resampler->getBufferSize());
+	for (unsigned int p = 0; p < periods; p++)
+	{
+		size_t size = resampler->read(&buffer[0], buffer.size());
+		const unsigned char* data = (const unsigned char*)&buffer[0];
+		for (size_t i = 0; i + 1 < size; i += 2)
+		{
+			samples.push_back((short)((data[i] << 8) | data[i+1]));
+		}
+	}
+	return samples;
+}
+
+// amplitude of a frequency, by correlation with a sine and a cosine
+static double toneAmplitude(const std::vector<short> & samples, size_t start, unsigned int rate, double frequency)
+{
+	double re = 0;
+	double im = 0;
+	for (size_t i = start; i < samples.size(); i++)
+	{
+		re += samples[i]*cos(2*M_PI*frequency*i/rate);
+		im += samples[i]*sin(2*M_PI*frequency*i/rate);
+	}
+	return 2*sqrt(re*re + im*im)/(samples.size() - start);
+}
+
+static double rms(const std::vector<short> & samples, size_t start)
+{
+	double sum = 0;
+	for (size_t i = start; i < samples.size(); i++)
+	{
+		sum += (double)samples[i]*samples[i];
+	}
+	return sqrt(sum/(samples.size() - start));
+}
+
+TEST(resamplerPassband)
+{
+	const unsigned int periods = 100;
+	AudioResamplerDevice* resampler = AudioResamplerDevice::createNew(toneDevice(44100, 1000, 10000, periods), 44100, 2, SND_PCM_FORMAT_S16_BE, 16000, 1);
+	CHECK(resampler != NULL);
+	if (resampler == NULL)
+	{
+		return;
+	}
+	CHECK(resampler->getRtpFormat() == "audio/L16/16000/1");
+	std::vector<short> samples = readAll(resampler, periods);
+	// 1s of capture, the filter delay is the only difference
+	CHECK(samples.size() > 15900);
+	CHECK(samples.size() <= 16000);
+	double level = 20*log10(toneAmplitude(samples, 1600, 16000, 1000)/10000);
+	std::cout << "  1kHz level: " << level << " dB, " << samples.size() << " samples" << std::endl;
+	CHECK(fabs(level) < 0.1);
+	delete resampler;
+}
+
+// a tone above the new Nyquist frequency must not fold back into the band
+TEST(resamplerStopband)
+{
+	const unsigned int periods = 100;
+	AudioResamplerDevice* resampler = AudioResamplerDevice::createNew(toneDevice(44100, 12000, 10000, periods), 44100, 2, SND_PCM_FORMAT_S16_BE, 16000, 1);
+	CHECK(resampler != NULL);
+	if (resampler == NULL)
+	{
+		return;
+	}
+	std::vector<short> samples = readAll(resampler, periods);
+	double attenuation = 20*log10(rms(samples, 1600)*sqrt(2)/10000);
+	std::cout << "  12kHz alias: " << attenuation << " dB" << std::endl;
+	CHECK(attenuation < -60);
+	delete resampler;
+}
+
+TEST(resamplerForwardsErrors)
+{
+	FakeDevice device;
+	CHECK(AudioResamplerDevice::createNew(&device, 44100, 2, SND_PCM_FORMAT_S24_3LE, 16000, 1) == NULL);
+	CHECK(AudioResamplerDevice::createNew(&device, 44100, 2, SND_PCM_FORMAT_S16_BE, 16000, 3) == NULL);
+
+	FakeDevice* failing = new FakeDevice(1764);
+	failing->pushError(-EIO);
+	AudioResamplerDevice* resampler = AudioResamplerDevice::createNew(failing, 44100, 2, SND_PCM_FORMAT_S16_BE, 16000, 1);
+	CHECK(resampler != NULL);
+	if (resampler != NULL)
+	{
+		std::vector<char> buffer(resampler->getBufferSize());
+		CHECK((ssize_t)resampler->read(&buffer[0], buffer.size()) == -EIO);
+		delete resampler;
+	}
+}
+
+BENCH(resamplerPeriod)
+{
+	FakeDevice* device = toneDevice(44100, 1000, 10000, 1);
+	AudioResamplerDevice* resampler = AudioResamplerDevice::createNew(device, 44100, 2, SND_PCM_FORMAT_S16_BE, 16000, 1);
+	std::vector<char> buffer(resampler->getBufferSize());
+	std::string period(1764, 0);
+	double throughput = benchThroughput("44.1kHz stereo to 16kHz mono", period.size(), [&]() { device->pushData(period); resampler->read(&buffer[0], buffer.size()); });
+	std::cout << "  per 10ms period: " << period.size()/throughput << " us" << std::endl;
+	delete resampler;
+}
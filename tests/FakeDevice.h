@@ -0,0 +1,81 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FakeDevice.h
+**
+** Device that returns scripted reads, the input of the audio stages under test
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string.h>
+#include <sys/time.h>
+#include <list>
+#include <string>
+
+#include "DeviceInterface.h"
+
+class FakeDevice : public DeviceInterface
+{
+	public:
+		FakeDevice(unsigned long bufferSize = 65536) : m_bufferSize(bufferSize), m_reads(0) { timerclear(&m_time); }
+
+		// each read returns the next scripted block, or the error as a negative size
+		// a block with a time gives it as presentation time, instead of the time of the read
+		void pushData(const std::string & data) { m_script.push_back(Read(0, data)); }
+		void pushData(const std::string & data, const timeval & time) { m_script.push_back(Read(0, data, time)); }
+		void pushData(const short* samples, size_t count) { this->pushData(std::string((const char*)samples, count*sizeof(short))); }
+		void pushError(int err)                 { m_script.push_back(Read(err, "")); }
+		unsigned int reads()                    { return m_reads; }
+
+		virtual size_t read(char* buffer, size_t bufferSize)
+		{
+			m_reads++;
+			if (m_script.empty())
+			{
+				return 0;
+			}
+			Read next = m_script.front();
+			m_script.pop_front();
+			if (next.m_err < 0)
+			{
+				return (ssize_t)next.m_err;
+			}
+			m_time = next.m_time;
+			size_t size = std::min(bufferSize, next.m_data.size());
+			memcpy(buffer, next.m_data.data(), size);
+			return size;
+		}
+		virtual void adjustPresentationTime(timeval & tv)
+		{
+			if (timerisset(&m_time))
+			{
+				tv = m_time;
+			}
+		}
+		virtual int getFd()                        { return -1; }
+		virtual unsigned long getBufferSize()      { return m_bufferSize; }
+		virtual int getWidth()                     { return 0; }
+		virtual int getHeight()                    { return 0; }
+		virtual int getCaptureFormat()             { return 0; }
+		virtual bool requestKeyFrame()             { return false; }
+		virtual bool setBitrate(unsigned int)      { return false; }
+		virtual unsigned int getBitrate()          { return 0; }
+
+	protected:
+		struct Read
+		{
+			Read(int err, const std::string & data) : m_err(err), m_data(data) { timerclear(&m_time); }
+			Read(int err, const std::string & data, const timeval & time) : m_err(err), m_data(data), m_time(time) {}
+			int           m_err;
+			std::string   m_data;
+			timeval       m_time;
+		};
+		unsigned long     m_bufferSize;
+		std::list<Read>   m_script;
+		unsigned int      m_reads;
+		timeval           m_time;     // of the last read
+};
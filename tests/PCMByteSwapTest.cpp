@@ -0,0 +1,111 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** PCMByteSwapTest.cpp
+**
+** SIMD byte swap against the scalar reference
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "TestHarness.h"
+#include "PCMByteSwap.h"
+
+static void fillRandom(std::vector<unsigned char> & buffer)
+{
+	for (size_t i = 0; i < buffer.size(); i++)
+	{
+		buffer[i] = rand() & 0xff;
+	}
+}
+
+TEST(pcmByteSwapScalarReference)
+{
+	unsigned char s16[] = { 1,2, 3,4, 5 };
+	pcmByteSwapScalar(s16, sizeof(s16), 2);
+	const unsigned char e16[] = { 2,1, 4,3, 5 };
+	CHECK(memcmp(s16, e16, sizeof(s16)) == 0);
+
+	unsigned char s24[] = { 1,2,3, 4,5,6, 7,8 };
+	pcmByteSwapScalar(s24, sizeof(s24), 3);
+	const unsigned char e24[] = { 3,2,1, 6,5,4, 7,8 };
+	CHECK(memcmp(s24, e24, sizeof(s24)) == 0);
+
+	unsigned char s32[] = { 1,2,3,4, 5,6,7 };
+	pcmByteSwapScalar(s32, sizeof(s32), 4);
+	const unsigned char e32[] = { 4,3,2,1, 5,6,7 };
+	CHECK(memcmp(s32, e32, sizeof(s32)) == 0);
+}
+
+// odd lengths leave a trailing incomplete sample, offsets make the buffers unaligned
+TEST(pcmByteSwapInPlace)
+{
+	std::cout << "  kernel: " << pcmByteSwapKernel() << std::endl;
+	for (int width = 2; width <= 4; width++)
+	{
+		for (size_t offset = 0; offset < 16; offset++)
+		{
+			for (size_t size = 0; size < 200; size++)
+			{
+				std::vector<unsigned char> input(offset + size);
+				fillRandom(input);
+				std::vector<unsigned char> reference(input);
+				std::vector<unsigned char> output(input);
+				pcmByteSwapScalar(&reference[offset], size, width);
+				pcmByteSwap(&output[offset], size, width);
+				CHECK(output == reference);
+			}
+		}
+	}
+}
+
+TEST(pcmByteSwapCopy)
+{
+	for (int width = 2; width <= 4; width++)
+	{
+		for (size_t srcOffset = 0; srcOffset < 8; srcOffset++)
+		{
+			for (size_t dstOffset = 0; dstOffset < 8; dstOffset++)
+			{
+				size_t size = 4099 + srcOffset;
+				std::vector<unsigned char> src(srcOffset + size);
+				fillRandom(src);
+				std::vector<unsigned char> reference(src.begin() + srcOffset, src.end());
+				pcmByteSwapScalar(&reference[0], size, width);
+
+				// bytes past a trailing incomplete sample are not written
+				std::vector<unsigned char> dst(dstOffset + size, 0xa5);
+				pcmByteSwapCopy(&dst[dstOffset], &src[srcOffset], size, width);
+				size_t end = size - size % width;
+				CHECK(std::equal(reference.begin(), reference.begin() + end, dst.begin() + dstOffset));
+				for (size_t i = end; i < size; i++)
+				{
+					CHECK(dst[dstOffset + i] == 0xa5);
+				}
+			}
+		}
+	}
+}
+
+BENCH(pcmByteSwapThroughput)
+{
+	std::cout << "  kernel: " << pcmByteSwapKernel() << std::endl;
+	std::vector<unsigned char> buffer(1 << 20);
+	fillRandom(buffer);
+	std::vector<unsigned char> copy(buffer.size());
+	const char* scalarLabels[] = { "", "", "scalar S16", "scalar S24_3", "scalar S32" };
+	const char* kernelLabels[] = { "", "", "kernel S16", "kernel S24_3", "kernel S32" };
+	const char* copyLabels[] = { "", "", "kernel copy S16", "kernel copy S24_3", "kernel copy S32" };
+	for (int width = 2; width <= 4; width++)
+	{
+		double scalar = benchThroughput(scalarLabels[width], buffer.size(), [&]() { pcmByteSwapScalar(&buffer[0], buffer.size(), width); });
+		double kernel = benchThroughput(kernelLabels[width], buffer.size(), [&]() { pcmByteSwap(&buffer[0], buffer.size(), width); });
+		benchThroughput(copyLabels[width], buffer.size(), [&]() { pcmByteSwapCopy(&copy[0], &buffer[0], buffer.size(), width); });
+		std::cout << "  speedup: " << kernel / scalar << std::endl;
+	}
+}
@@ -0,0 +1,107 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** RTPOutputGroupsockTest.cpp
+**
+** Retransmission to the UDP client that asked for it, on the loopback
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <vector>
+
+#include "BasicUsageEnvironment.hh"
+
+#include "TestHarness.h"
+#include "RTPOutputGroupsock.h"
+
+// UDP socket of a client on the loopback, returns its port in host order
+static int openClient(unsigned short & port)
+{
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(sock, (struct sockaddr*)&addr, sizeof(addr));
+	socklen_t len = sizeof(addr);
+	getsockname(sock, (struct sockaddr*)&addr, &len);
+	port = ntohs(addr.sin_port);
+	return sock;
+}
+
+// RTP sequence numbers received by the client
+static std::vector<unsigned int> receive(int sock)
+{
+	std::vector<unsigned int> seqNums;
+	unsigned char buffer[2048];
+	ssize_t size;
+	while ( (size = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT)) >= 12 )
+	{
+		seqNums.push_back((buffer[2]<<8)|buffer[3]);
+	}
+	return seqNums;
+}
+
+// two clients share the groupsock of a reused source, a NACK is answered to the one whose RTCP sent it
+TEST(retransmitToRequester)
+{
+	TaskScheduler* scheduler = BasicTaskScheduler::createNew();
+	UsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
+
+	unsigned short port1 = 0;
+	unsigned short port2 = 0;
+	int client1 = openClient(port1);
+	int client2 = openClient(port2);
+
+	RTPOutputParameters params;
+	params.m_feedback.m_enable = true;
+	struct in_addr any;
+	any.s_addr = INADDR_ANY;
+	{
+		RTPOutputGroupsock groupsock(*env, any, Port(0), 255, params);
+		groupsock.setSource(NULL, "video/H264");
+		groupsock.enableRetransmission();
+		struct in_addr loopback;
+		loopback.s_addr = htonl(INADDR_LOOPBACK);
+		groupsock.addDestination(loopback, Port(port1), 1);
+		groupsock.addDestination(loopback, Port(port2), 2);
+
+		unsigned char packet[100];
+		memset(packet, 0, sizeof(packet));
+		packet[0] = 0x80;
+		packet[1] = 0x80|96;
+		packet[3] = 42;
+		groupsock.output(*env, packet, sizeof(packet));
+		usleep(10000);
+		CHECK(receive(client1).size() == 1);
+		CHECK(receive(client2).size() == 1);
+
+		// RTCP of the second client, on the port after its RTP port
+		struct sockaddr_in requester;
+		memset(&requester, 0, sizeof(requester));
+		requester.sin_family = AF_INET;
+		requester.sin_addr = loopback;
+		requester.sin_port = htons(port2 + 1);
+		CHECK(groupsock.retransmit(42, &requester));
+		usleep(10000);
+		CHECK(receive(client1).empty());
+		std::vector<unsigned int> seqNums = receive(client2);
+		CHECK( (seqNums.size() == 1) && (seqNums[0] == 42) );
+
+		// a requester that is not a destination gets nothing
+		requester.sin_addr.s_addr = htonl(0x7F000002);
+		CHECK(!groupsock.retransmit(42, &requester));
+		CHECK(!groupsock.retransmit(42, NULL));
+	}
+	close(client1);
+	close(client2);
+	env->reclaim();
+	delete scheduler;
+}
@@ -0,0 +1,150 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** RTPPacerTest.cpp
+**
+** Spread of a frame over the frame interval, on a simulated clock
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <vector>
+
+#include "BasicUsageEnvironment.hh"
+
+#include "TestHarness.h"
+#include "RTPPacer.h"
+
+// frame rate and bitrate as measured by the source
+class MeasuredStats : public V4L2DeviceSource::Stats
+{
+	public:
+		MeasuredStats(int fps, int bitrate) : V4L2DeviceSource::Stats("test")
+		{
+			m_lastFps = fps;
+			m_lastSize = bitrate;
+		}
+};
+
+// the pacer reads the time of the test, the drain task is run when the test advances the time
+class SimulatedPacer : public RTPPacer
+{
+	public:
+		SimulatedPacer(UsageEnvironment& env, const RTPPacerParameters & params, const V4L2DeviceSource::Stats* stats, SendFunc* sendFunc, void* clientData)
+			: RTPPacer(env, params, stats, sendFunc, clientData)
+		{
+			m_now.tv_sec = 1000;
+			m_now.tv_usec = 0;
+			m_lastRefill = m_now;
+		}
+
+		double seconds() { return m_now.tv_sec + m_now.tv_usec/1e6; }
+
+		// advance the time by steps of stepUs and run the pending drain task at each step
+		void advance(unsigned int durationUs, unsigned int stepUs)
+		{
+			for (unsigned int elapsed = 0; elapsed < durationUs; elapsed += stepUs)
+			{
+				timeval step = { 0, (suseconds_t)stepUs };
+				timeradd(&m_now, &step, &m_now);
+				if (m_drainTask != NULL)
+				{
+					m_env.taskScheduler().unscheduleDelayedTask(m_drainTask);
+					this->drain();
+				}
+			}
+		}
+
+	protected:
+		virtual void getTime(timeval & now) { now = m_now; }
+
+	protected:
+		timeval m_now;
+};
+
+struct SentPackets
+{
+	SentPackets() : m_pacer(NULL) {}
+	SimulatedPacer*         m_pacer;
+	std::vector<double>     m_times;
+	std::vector<unsigned>   m_sizes;
+};
+
+static void recordPacket(void* clientData, unsigned char*, unsigned int size)
+{
+	SentPackets* sent = (SentPackets*)clientData;
+	sent->m_times.push_back(sent->m_pacer->seconds());
+	sent->m_sizes.push_back(size);
+}
+
+// an IDR of 140kB at 25fps and 1Mbps is spread evenly over half of the 40ms frame interval
+TEST(pacerSpreadsFrame)
+{
+	TaskScheduler* scheduler = BasicTaskScheduler::createNew();
+	UsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
+	MeasuredStats stats(25, 125000);
+	RTPPacerParameters params;
+	params.m_enable = true;
+	params.m_fraction = 0.5;
+
+	const unsigned int packets = 100;
+	SentPackets sent;
+	{
+		SimulatedPacer pacer(*env, params, &stats, recordPacket, &sent);
+		sent.m_pacer = &pacer;
+		std::vector<unsigned char> packet(1400, 0);
+		double start = pacer.seconds();
+		for (unsigned int i = 0; i < packets; i++)
+		{
+			packet[1] = (i == packets - 1) ? 0x80 : 0;
+			pacer.queuePacket(&packet[0], packet.size());
+		}
+		pacer.advance(40000, 50);
+
+		double duration = sent.m_times.back() - start;
+		// bytes sent in the first half of the spread
+		unsigned int firstHalf = 0;
+		for (unsigned int i = 0; i < sent.m_times.size(); i++)
+		{
+			if (sent.m_times[i] - start < duration/2)
+			{
+				firstHalf += sent.m_sizes[i];
+			}
+		}
+		double share = 100.0*firstHalf/(packets*packet.size());
+		std::cout << "  spread:" << duration*1000 << "ms first half:" << share << "%" << std::endl;
+		CHECK(sent.m_times.size() == packets);
+		CHECK(duration > 0.019);
+		CHECK(duration < 0.021);
+		CHECK( (share > 45) && (share < 55) );
+	}
+	env->reclaim();
+	delete scheduler;
+}
+
+// small packets within the bucket depth are sent at once
+TEST(pacerSendsWithinBurst)
+{
+	TaskScheduler* scheduler = BasicTaskScheduler::createNew();
+	UsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
+	MeasuredStats stats(25, 125000);
+	RTPPacerParameters params;
+	params.m_enable = true;
+
+	SentPackets sent;
+	{
+		SimulatedPacer pacer(*env, params, &stats, recordPacket, &sent);
+		sent.m_pacer = &pacer;
+		std::vector<unsigned char> packet(1000, 0);
+		packet[1] = 0x80;
+		for (unsigned int i = 0; i < 3; i++)
+		{
+			pacer.queuePacket(&packet[0], packet.size());
+		}
+		CHECK(sent.m_times.size() == 3);
+	}
+	env->reclaim();
+	delete scheduler;
+}
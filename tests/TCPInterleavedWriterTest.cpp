@@ -0,0 +1,104 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** TCPInterleavedWriterTest.cpp
+**
+** Interleaved framing through a socket that only accepts part of the frame
+**
+** -------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <vector>
+#include <memory>
+
+#include "BasicUsageEnvironment.hh"
+
+#include "TestHarness.h"
+#include "TCPInterleavedWriter.h"
+
+static void stopLoop(void* clientData)
+{
+	*(char*)clientData = 1;
+}
+
+// read what the writer sent so far
+static void drain(int socket, std::vector<unsigned char> & received)
+{
+	unsigned char buffer[65536];
+	ssize_t size;
+	while ( (size = recv(socket, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0 )
+	{
+		received.insert(received.end(), buffer, buffer + size);
+	}
+}
+
+// a frame larger than the socket buffer is written without blocking, the packet cut by the kernel is
+// resumed from the retry task and the peer gets the packets whole and in order
+TEST(interleavedResumesShortWrite)
+{
+	TaskScheduler* scheduler = BasicTaskScheduler::createNew();
+	UsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
+
+	int sockets[2];
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+	int size = 16*1024;
+	setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	fcntl(sockets[0], F_SETFL, fcntl(sockets[0], F_GETFL) | O_NONBLOCK);
+
+	TCPInterleavedParameters params;
+	params.m_retryDelayUs = 1000;
+	TCPInterleavedWriter* writer = TCPInterleavedWriter::lookup(*env, sockets[0], params);
+
+	// packets of different sizes so that the cut falls inside headers and payloads
+	const unsigned int packets = 200;
+	std::shared_ptr<RTPFrame> frame(new RTPFrame());
+	std::vector<unsigned char> packet;
+	for (unsigned int i = 0; i < packets; i++)
+	{
+		packet.assign(1000 + 7*i, i&0xFF);
+		frame->addPacket(&packet[0], packet.size());
+	}
+	frame->setType(RTPFrame::KEY);
+	writer->queueFrame(frame, 2);
+	CHECK(!writer->isBroken());
+
+	std::vector<unsigned char> received;
+	for (int loop = 0; (loop < 1000) && (received.size() < frame->size() + 4*packets); loop++)
+	{
+		drain(sockets[1], received);
+		char watch = 0;
+		env->taskScheduler().scheduleDelayedTask(2000, stopLoop, &watch);
+		env->taskScheduler().doEventLoop(&watch);
+	}
+	drain(sockets[1], received);
+	CHECK(!writer->isBroken());
+	CHECK(received.size() == frame->size() + 4*packets);
+
+	unsigned int pos = 0;
+	unsigned int count = 0;
+	bool valid = true;
+	while (valid && (pos + 4 <= received.size()))
+	{
+		unsigned int packetSize = (received[pos+2]<<8)|received[pos+3];
+		valid = (received[pos] == '$') && (received[pos+1] == 2) && (packetSize == 1000 + 7*count) && (pos + 4 + packetSize <= received.size());
+		for (unsigned int i = 0; valid && (i < packetSize); i++)
+		{
+			valid = (received[pos + 4 + i] == (count&0xFF));
+		}
+		pos += 4 + packetSize;
+		count++;
+	}
+	CHECK(valid);
+	CHECK(count == packets);
+
+	writer->release();
+	close(sockets[0]);
+	close(sockets[1]);
+	env->reclaim();
+	delete scheduler;
+}
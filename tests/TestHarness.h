@@ -0,0 +1,64 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** TestHarness.h
+**
+** Minimal checks and throughput measurements of the media kernels
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stddef.h>
+#include <iostream>
+#include <chrono>
+
+typedef void (*TestFunc)();
+
+// tests register themselves, benchmarks only run with --bench
+struct TestRegistrar
+{
+	TestRegistrar(const char* name, TestFunc func, bool bench);
+};
+
+int & testFailures();
+
+#define TEST(name) \
+	static void name(); \
+	static TestRegistrar name##Registrar(#name, name, false); \
+	static void name()
+
+#define BENCH(name) \
+	static void name(); \
+	static TestRegistrar name##Registrar(#name, name, true); \
+	static void name()
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			testFailures()++; \
+			std::cerr << __FILE__ << ":" << __LINE__ << " CHECK failed: " << #cond << std::endl; \
+		} \
+	} while (0)
+
+// runs the function for at least 200ms and prints the throughput in MB/s
+template<typename Func>
+double benchThroughput(const char* label, size_t bytesPerRun, Func func)
+{
+	typedef std::chrono::steady_clock Clock;
+	unsigned long runs = 0;
+	Clock::time_point start = Clock::now();
+	double elapsed = 0;
+	do
+	{
+		func();
+		runs++;
+		elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	}
+	while (elapsed < 0.2);
+	double throughput = bytesPerRun * (double)runs / elapsed / 1e6;
+	std::cout << "  " << label << ": " << throughput << " MB/s" << std::endl;
+	return throughput;
+}
@@ -0,0 +1,76 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** main.cpp
+**
+** Runs the registered tests, and the benchmarks with --bench
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <list>
+
+#include "TestHarness.h"
+
+struct TestCase
+{
+	const char* m_name;
+	TestFunc    m_func;
+	bool        m_bench;
+};
+
+static std::list<TestCase> & testCases()
+{
+	static std::list<TestCase> cases;
+	return cases;
+}
+
+TestRegistrar::TestRegistrar(const char* name, TestFunc func, bool bench)
+{
+	TestCase test = { name, func, bench };
+	testCases().push_back(test);
+}
+
+int & testFailures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+int main(int argc, char* argv[])
+{
+	bool bench = false;
+	const char* filter = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--bench") == 0)
+		{
+			bench = true;
+		}
+		else
+		{
+			filter = argv[i];
+		}
+	}
+
+	std::list<TestCase>::iterator it;
+	for (it = testCases().begin(); it != testCases().end(); ++it)
+	{
+		if ( (it->m_bench != bench) || ((filter != NULL) && (strstr(it->m_name, filter) == NULL)) )
+		{
+			continue;
+		}
+		int failures = testFailures();
+		std::cout << it->m_name << std::endl;
+		it->m_func();
+		if (testFailures() != failures)
+		{
+			std::cout << it->m_name << " FAILED" << std::endl;
+		}
+	}
+
+	std::cout << (testFailures() ? "FAILED" : "OK") << " " << testFailures() << " failure(s)" << std::endl;
+	return testFailures() ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+#-------------------------------------------------
+#
+# Checks and benchmarks of the media kernels
+#   qmake && make && ./tests          run the checks
+#   ./tests --bench [name]            measure the throughput
+#
+#-------------------------------------------------
+
+QT       -= core gui
+CONFIG   += console c++11
+CONFIG   -= app_bundle qt
+
+TARGET = tests
+TEMPLATE = app
+
+QMAKE_CXXFLAGS += -O2
+
+INCLUDEPATH += ../inc ../libv4l2wrapper/inc
+INCLUDEPATH += $$PWD/../../3rdlibs/live/BasicUsageEnvironment/include
+INCLUDEPATH += $$PWD/../../3rdlibs/live/UsageEnvironment/include
+INCLUDEPATH += $$PWD/../../3rdlibs/live/groupsock/include
+INCLUDEPATH += $$PWD/../../3rdlibs/live/liveMedia/include
+
+LIBS += $$PWD/../../3rdlibs/live/liveMedia/libliveMedia.a
+LIBS += $$PWD/../../3rdlibs/live/UsageEnvironment/libUsageEnvironment.a
+LIBS += $$PWD/../../3rdlibs/live/groupsock/libgroupsock.a
+LIBS += $$PWD/../../3rdlibs/live/BasicUsageEnvironment/libBasicUsageEnvironment.a
+LIBS += -lasound
+# the Opus checks run when its development package is installed
+CONFIG += link_pkgconfig
+packagesExist(opus) {
+    DEFINES += HAVE_OPUS
+    PKGCONFIG += opus
+}
+
+SOURCES += main.cpp \
+    PCMByteSwapTest.cpp \
+    AudioFilterTest.cpp \
+    AudioEncoderTest.cpp \
+    AudioResamplerTest.cpp \
+    AudioClockTest.cpp \
+    AudioMixerTest.cpp \
+    RTPPacerTest.cpp \
+    TCPInterleavedWriterTest.cpp \
+    RTPOutputGroupsockTest.cpp \
+    ../src/PCMByteSwap.cpp \
+    ../src/AudioFilter.cpp \
+    ../src/SpectralDenoiser.cpp \
+    ../src/AudioEncoder.cpp \
+    ../src/AudioResampler.cpp \
+    ../src/AudioClock.cpp \
+    ../src/AudioMixer.cpp \
+    ../src/RTPPacer.cpp \
+    ../src/TCPInterleavedWriter.cpp \
+    ../src/RTPOutputGroupsock.cpp \
+    ../src/RTCPFeedback.cpp \
+    ../src/DeviceSource.cpp \
+    ../libv4l2wrapper/src/logger.cpp
+
+HEADERS += TestHarness.h \
+    FakeDevice.h
@@ -29,12 +29,20 @@
 #include "UnicastServerMediaSubsession.h"
 #include "MulticastServerMediaSubsession.h"
 #include "TSServerMediaSubsession.h"
+#include "RTPRateController.h"
 #include "HTTPServer.h"
 
 #define HAVE_ALSA 1
 
 #ifdef HAVE_ALSA
 #include "ALSACapture.h"
+#include "AudioFilter.h"
+#include "SpectralDenoiser.h"
+#include "AudioEncoder.h"
+#include "AudioResampler.h"
+#include "VoiceActivity.h"
+#include "AudioClock.h"
+#include "AudioMixer.h"
 #endif
 
 #include <QDebug>
@@ -67,10 +75,10 @@ UserAuthenticationDatabase* createUserAuthenticationDatabase(const std::list<std
 // -----------------------------------------
 //    create RTSP server
 // -----------------------------------------
-RTSPServer* createRTSPServer(UsageEnvironment& env, unsigned short rtspPort, unsigned short rtspOverHTTPPort, int timeout, unsigned int hlsSegment, const std::list<std::string> & userPasswordList, const char* realm, const std::string & webroot)
+RTSPServer* createRTSPServer(UsageEnvironment& env, unsigned short rtspPort, unsigned short rtspOverHTTPPort, int timeout, unsigned int hlsSegment, const std::list<std::string> & userPasswordList, const char* realm, const std::string & webroot, unsigned int httpKeepAlive)
 {
     UserAuthenticationDatabase* auth = createUserAuthenticationDatabase(userPasswordList, realm);
-    RTSPServer* rtspServer = HTTPServer::createNew(env, rtspPort, auth, timeout, hlsSegment, webroot);
+    RTSPServer* rtspServer = HTTPServer::createNew(env, rtspPort, auth, timeout, hlsSegment, webroot, httpKeepAlive);
     if (rtspServer != NULL)
     {
         // set http tunneling
@@ -156,6 +164,39 @@ std::string getVideoRtpFormat(int format)
     return rtpFormat;
 }
 
+// -----------------------------------------
+//    create a replicated video source from a V4L2 device
+// -----------------------------------------
+StreamReplicator* createVideoReplicator(UsageEnvironment* env, const V4L2DeviceParameters & param, V4l2Access::IoType ioType, bool useThread, bool repeatConfig, std::string & rtpFormat)
+{
+    StreamReplicator* replicator = NULL;
+    qDebug()<<"<info>:create video source:"<<param.m_devName.c_str();
+
+    V4l2Capture* videoCapture=V4l2Capture::create(param,ioType);
+    if (videoCapture)
+    {
+        rtpFormat.assign(getVideoRtpFormat(videoCapture->getFormat()));
+        if(rtpFormat.empty())
+        {
+            delete videoCapture;
+            qDebug()<<"<error>:no streaming format supported for device"<<param.m_devName.c_str();
+        }else{
+            int outfd=-1;//we do not dump h264 to local file,so here set to -1.
+            int queueSize=10;//Number of frame queue.
+            FramedSource* videoSource=createFramedSource(env,videoCapture->getFormat(),new DeviceCaptureAccess<V4l2Capture>(videoCapture),outfd,queueSize,useThread,repeatConfig);
+            if(videoSource==NULL)
+            {
+                delete videoCapture;
+                qDebug()<<"<error>:failed to create video source"<<param.m_devName.c_str();
+            }else{
+                replicator=StreamReplicator::createNew(*env,videoSource,false);
+                qDebug()<<"<info>:video source okay"<<param.m_devName.c_str();
+            }
+        }
+    }
+    return replicator;
+}
+
 // -----------------------------------------
 //    convert string video format to fourcc
 // -----------------------------------------
@@ -382,7 +423,7 @@ std::string  getV4l2Alsa(const std::string& v4l2device) {
 
 ZUsbThread::ZUsbThread()
 {
-
+    this->m_audioMixer=NULL;
 }
 qint32 ZUsbThread::ZStartThread()
 {
@@ -394,6 +435,26 @@ qint32 ZUsbThread::ZStopThread()
     this->m_quit=1;
     return 0;
 }
+qint32 ZUsbThread::ZSetAudioGain(qint32 input,float gain)
+{
+#ifdef HAVE_ALSA
+    if(this->m_audioMixer && this->m_audioMixer->setGain(input,gain))
+    {
+        return 0;
+    }
+#endif
+    return -1;
+}
+qint32 ZUsbThread::ZSetAudioMute(qint32 input,bool mute)
+{
+#ifdef HAVE_ALSA
+    if(this->m_audioMixer && this->m_audioMixer->setMute(input,mute))
+    {
+        return 0;
+    }
+#endif
+    return -1;
+}
 void ZUsbThread::run()
 {
     V4l2Access::IoType ioTypeIn  = V4l2Access::IOTYPE_MMAP;
@@ -427,11 +488,21 @@ void ZUsbThread::run()
     unsigned short rtspOverHTTPPort=0;
     int timeout=65;
     unsigned int hlsSegment=0;
+    unsigned int hlsWindow=30;//seconds of HLS segments kept in memory (DVR window).
+    unsigned int hlsPart=500;//LL-HLS partial segment duration in ms, 0 disables LL-HLS.
+    bool hlsCmaf=false;//fragmented MP4 segments instead of MPEG-TS for H264/H265,video only:the audio needs MPEG-TS.
+    //HLS/DASH renditions (ABR ladder) beside the camera one,name and V4L2 device of each.
+    //the other encoders (e.g. GStreamer branches to v4l2loopback) must use the same GOP,
+    //segments are cut on the keyframes following the same slice boundaries.
+    std::list<std::pair<std::string,std::string> > hlsRenditions;
+    //hlsRenditions.push_back(std::make_pair("720p","/dev/video3"));
+    //hlsRenditions.push_back(std::make_pair("360p","/dev/video4"));
     std::list<std::string> userPasswordList;
     userPasswordList.push_back("zhangshaoyan:12345678");
     const char* realm=NULL;
     std::string webroot;
-    RTSPServer *rtspServer=createRTSPServer(*env,rtspPort,rtspOverHTTPPort,timeout,hlsSegment,userPasswordList,realm,webroot);
+    unsigned int httpKeepAlive=15;//seconds an idle HTTP connection is kept open, 0 closes it after each response.
+    RTSPServer *rtspServer=createRTSPServer(*env,rtspPort,rtspOverHTTPPort,timeout,hlsSegment,userPasswordList,realm,webroot,httpKeepAlive);
     if(rtspServer==NULL)
     {
         qDebug()<<"<error>:failed to create RTSP server:"<<env->getResultMsg();
@@ -458,34 +529,25 @@ void ZUsbThread::run()
         //int verbose=1;//verbose.
         //int verbose=2;//very verbose.
 
-        qDebug()<<"<info>:create video source:"<<videoDev.c_str();
-
         V4L2DeviceParameters param(videoDev.c_str(),V4L2_PIX_FMT_H264,width,height,fps,verbose);
-        V4l2Capture* videoCapture=V4l2Capture::create(param,ioTypeIn);
-        if (videoCapture)
+        videoReplicator=createVideoReplicator(env,param,ioTypeIn,useThread,repeatConfig,rtpFormat);
+        if(videoReplicator)
         {
-            rtpFormat.assign(getVideoRtpFormat(videoCapture->getFormat()));
-            if(rtpFormat.empty())
+            FramedSource* videoSource=videoReplicator->inputSource();
+
+            //adapt the encoder bitrate to the RTCP receiver reports.
+            V4L2DeviceSource* videoDevice=dynamic_cast<V4L2DeviceSource*>(videoSource);
+            RTPRateControlParameters rateParams;
+            rateParams.m_enable=(videoDevice!=NULL);
+            rateParams.m_startKbps=videoDevice?videoDevice->getBitrate():0;//start from the encoder bitrate,0 if it cannot be read.
+            rateParams.m_minKbps=500;//lowest encoder bitrate.
+            rateParams.m_maxKbps=4000;//highest encoder bitrate.
+            rateParams.m_decreaseLoss=0.10;//reduce bitrate from 10% loss.
+            rateParams.m_increaseLoss=0.02;//grow bitrate under 2% loss.
+            rateParams.m_holdMs=5000;//wait 5s after a reduction before growing.
+            if(rateParams.m_enable)
             {
-                delete videoCapture;
-                qDebug()<<"<error>:no streaming format supported for device"<<videoDev.c_str();
-            }else{
-                int outfd=-1;//we do not dump h264 to local file,so here set to -1.
-                int queueSize=10;//Number of frame queue.
-                FramedSource* videoSource=createFramedSource(env,videoCapture->getFormat(),new DeviceCaptureAccess<V4l2Capture>(videoCapture),outfd,queueSize,useThread,repeatConfig);
-                if(videoSource==NULL)
-                {
-                    delete videoCapture;
-                    qDebug()<<"<error>:failed to create video source"<<videoDev.c_str();
-                }else{
-                    //extend buffer size if needed.
-                    if(videoCapture->getBufferSize()>OutPacketBuffer::maxSize)
-                    {
-                        OutPacketBuffer::maxSize=videoCapture->getBufferSize();
-                    }
-                    videoReplicator=StreamReplicator::createNew(*env,videoSource,false);
-                    qDebug()<<"<info>:video source okay"<<videoDev.c_str();
-                }
+                RTPRateController::createNew(*env,videoSource,rateParams,V4L2DeviceSource::setBitrateStub,videoDevice);
             }
         }
     }
@@ -496,11 +558,24 @@ void ZUsbThread::run()
     if(1)
     {
         std::string audioDev="plughw:CARD=USBSA,DEV=0";
+        std::list<std::string> audioMixDevs;//other microphones mixed with audioDev,same rate,channels and format.
+        //audioMixDevs.push_back("plughw:CARD=Device,DEV=0");
         std::list<snd_pcm_format_t> audioFmtList;
         audioFmtList.push_back(SND_PCM_FORMAT_S16_LE);
         audioFmtList.push_back(SND_PCM_FORMAT_S16_BE);
         int audioFreq=44100;//ALSA capture frequency.
         int audioNbChannels=2;//ALSA capture channels.
+        bool audioClock=true;//stamp the periods from the samples count locked on the system clock,it follows the drift of the USB clock.
+        unsigned int audioOutFreq=16000;//rate sent to the clients,0 keeps the capture rate,G.711 is always sent at 8000Hz.
+        unsigned int audioOutChannels=1;//channels sent to the clients (stereo is mixed down to mono),0 keeps the capture channels.
+        bool audioDenoise=true;//spectral subtraction noise suppression of the microphone.
+        float audioDenoiseDb=20.0f;//highest attenuation of the noise in dB.
+        bool audioVad=true;//do not stream the silence (energy and zero crossing voice detection).
+        float audioVadThreshold=9.0f;//voice level above the noise floor in dB.
+        unsigned int audioVadHangover=300;//ms still streamed after the voice,it keeps the end of the words.
+        unsigned int audioVadKeepAlive=200;//ms between two comfort noise periods during the silence,0 sends nothing.
+        std::string audioCodec="PCMU";//PCMU,PCMA,OPUS (needs HAVE_OPUS and 8/12/16/24/48kHz) or empty for L16.
+        unsigned int audioBitrate=32000;//Opus bitrate in bits per second.
 
         int verbose=0;//no verbose.
         //int verbose=1;//verbose.
@@ -509,24 +584,134 @@ void ZUsbThread::run()
         qDebug()<<"<info>:create audio source:"<<audioDev.c_str();
 
         ALSACaptureParameters param(audioDev.c_str(),audioFmtList,audioFreq,audioNbChannels,verbose);
+        param.m_mmap=true;//copy the periods from the driver ring (snd-aloop/snd-dummy support it too),falls back to read.
+        param.m_periodTime=10000;//10ms periods for the intercom,0 keeps the driver default (often 100ms).
+        param.m_bufferTime=40000;//4 periods of margin before an overrun.
         ALSACapture* audioCapture=ALSACapture::createNew(param);
         if(audioCapture)
         {
             int outfd=-1;//we do not dump pcm to local file,so here set to -1.
             int queueSize=10;//Number of frame queue.
-            FramedSource* audioSource=V4L2DeviceSource::createNew(*env,new DeviceCaptureAccess<ALSACapture>(audioCapture),outfd,queueSize,useThread);
+            DeviceInterface* audioDevice=new DeviceCaptureAccess<ALSACapture>(audioCapture);
+            unsigned int audioRate=audioCapture->getSampleRate();
+            unsigned int audioChannels=audioCapture->getChannels();
+            if(audioClock)
+            {
+                AudioClockDevice* clockDevice=AudioClockDevice::createNew(audioDevice,audioRate,audioChannels,audioCapture->getFormat());
+                if(clockDevice)
+                {
+                    audioDevice=clockDevice;
+                }
+            }
+            //the mix is aligned on the presentation times of each microphone,audioClock makes them accurate.
+            if(!audioMixDevs.empty())
+            {
+                std::vector<DeviceInterface*> mixInputs;
+                mixInputs.push_back(audioDevice);
+                std::list<std::string>::iterator it;
+                for(it=audioMixDevs.begin();it!=audioMixDevs.end();++it)
+                {
+                    ALSACaptureParameters mixParam(param);
+                    mixParam.m_devName=*it;
+                    ALSACapture* mixCapture=ALSACapture::createNew(mixParam);
+                    if(mixCapture==NULL)
+                    {
+                        qDebug()<<"<error>:failed to init audio device"<<it->c_str();
+                        continue;
+                    }
+                    if(mixCapture->getSampleRate()!=audioRate||mixCapture->getChannels()!=audioChannels||mixCapture->getFormat()!=audioCapture->getFormat())
+                    {
+                        qDebug()<<"<error>:audio device"<<it->c_str()<<"does not capture like"<<audioDev.c_str();
+                        delete mixCapture;
+                        continue;
+                    }
+                    DeviceInterface* mixDevice=new DeviceCaptureAccess<ALSACapture>(mixCapture);
+                    if(audioClock)
+                    {
+                        AudioClockDevice* clockDevice=AudioClockDevice::createNew(mixDevice,audioRate,audioChannels,mixCapture->getFormat());
+                        if(clockDevice)
+                        {
+                            mixDevice=clockDevice;
+                        }
+                    }
+                    mixInputs.push_back(mixDevice);
+                    qDebug()<<"<info>:mix audio source:"<<it->c_str();
+                }
+                if(mixInputs.size()>1)
+                {
+                    AudioMixerDevice* mixerDevice=AudioMixerDevice::createNew(mixInputs,audioRate,audioChannels,audioCapture->getFormat());
+                    if(mixerDevice)
+                    {
+                        audioDevice=mixerDevice;
+                        this->m_audioMixer=mixerDevice;
+                    }else{
+                        for(unsigned int i=1;i<mixInputs.size();i++)
+                        {
+                            delete mixInputs[i];
+                        }
+                    }
+                }
+            }
+            //convert first,the next stages process 5 times less samples for 44.1kHz stereo to 16kHz mono.
+            //G.711 is defined at 8000Hz only,the clients would play another rate at the wrong speed.
+            if(audioCodec=="PCMU"||audioCodec=="PCMA")
+            {
+                audioOutFreq=8000;
+            }
+            AudioResamplerDevice* resamplerDevice=NULL;
+            if((audioOutFreq&&audioOutFreq!=audioRate)||(audioOutChannels&&audioOutChannels!=audioChannels))
+            {
+                resamplerDevice=AudioResamplerDevice::createNew(audioDevice,audioRate,audioChannels,audioCapture->getFormat(),audioOutFreq?audioOutFreq:audioRate,audioOutChannels?audioOutChannels:audioChannels);
+                if(resamplerDevice)
+                {
+                    audioDevice=resamplerDevice;
+                    audioRate=resamplerDevice->getSampleRate();
+                    audioChannels=resamplerDevice->getChannels();
+                }
+            }
+            if(audioDenoise)
+            {
+                AudioFilterDevice* filterDevice=AudioFilterDevice::createNew(audioDevice,audioRate,audioChannels,audioCapture->getFormat());
+                if(filterDevice)
+                {
+                    filterDevice->addFilter(new SpectralDenoiser(audioRate,audioChannels,audioDenoiseDb));
+                    audioDevice=filterDevice;
+                }
+            }
+            if(audioVad)
+            {
+                VoiceActivityDevice* vadDevice=VoiceActivityDevice::createNew(audioDevice,audioRate,audioChannels,audioCapture->getFormat(),audioVadThreshold,audioVadHangover,audioVadKeepAlive);
+                if(vadDevice)
+                {
+                    audioDevice=vadDevice;
+                }
+            }
+            //G.711 halves the L16 bandwidth,Opus divides it by 20 or more.
+            AudioEncoderDevice* encoderDevice=NULL;
+            if(!audioCodec.empty())
+            {
+                encoderDevice=AudioEncoderDevice::createNew(audioDevice,audioCodec,audioRate,audioChannels,audioCapture->getFormat(),audioBitrate);
+                if(encoderDevice)
+                {
+                    audioDevice=encoderDevice;
+                }
+            }
+            FramedSource* audioSource=V4L2DeviceSource::createNew(*env,audioDevice,outfd,queueSize,useThread);
             if(audioSource==NULL)
             {
-                delete audioCapture;
+                //the outermost stage owns the whole chain down to the capture.
+                delete audioDevice;
+                this->m_audioMixer=NULL;
                 qDebug()<<"<error>:failed to init audio device"<<audioDev.c_str();
 
             }else{
-                rtpAudioFormat.assign(getAudioRtpFormat(audioCapture->getFormat(),audioCapture->getSampleRate(),audioCapture->getChannels()));
-
-                //extend buffer size if needed.
-                if(audioCapture->getBufferSize()>OutPacketBuffer::maxSize)
+                if(encoderDevice)
                 {
-                    OutPacketBuffer::maxSize=audioCapture->getBufferSize();
+                    rtpAudioFormat.assign(encoderDevice->getRtpFormat());
+                }else if(resamplerDevice){
+                    rtpAudioFormat.assign(resamplerDevice->getRtpFormat());
+                }else{
+                    rtpAudioFormat.assign(getAudioRtpFormat(audioCapture->getFormat(),audioCapture->getSampleRate(),audioCapture->getChannels()));
                 }
                 audioReplicator=StreamReplicator::createNew(*env,audioSource,false);
                 qDebug()<<"<info>:audio source okay"<<audioDev.c_str();
@@ -541,15 +726,28 @@ void ZUsbThread::run()
 
     int nbSource=0;
 
+    //RTP output.
+    RTPOutputParameters rtpParams;
+    rtpParams.m_vectoredInterleaved=true;//one writev() per frame for RTP-over-RTSP clients.
+    rtpParams.m_reuseFirstSource=true;//all unicast clients share one replica,framer and sink.
+    rtpParams.m_sinkBufferHeadroom=1.5;//sink buffer is 1.5x the peak frame size of its stream,video gets at least a raw picture.
+    rtpParams.m_sinkBufferMinSize=8*1024;
+    rtpParams.m_interleaved.m_zeroCopyThreshold=64*1024;//MSG_ZEROCOPY for frames bigger than 64KB,0 to disable.
+    rtpParams.m_interleaved.m_maxPendingBytes=2*1024*1024;//drop frames when a client lags more than this.
+    rtpParams.m_pacer.m_enable=true;//spread UDP packets of a frame instead of bursting them.
+    rtpParams.m_pacer.m_fraction=0.5;//a frame is sent within half of the frame interval.
+    rtpParams.m_feedback.m_enable=true;//answer RTCP NACK/PLI/FIR from the receivers.
+    rtpParams.m_feedback.m_cacheSize=512;//sent packets kept for retransmission (about 750KB per stream).
+
     //1.Create Unicast Session.
     std::list<ServerMediaSubsession*> subSession;
     if(videoReplicator)
     {
-        subSession.push_back(UnicastServerMediaSubsession::createNew(*env,videoReplicator,rtpFormat));
+        subSession.push_back(UnicastServerMediaSubsession::createNew(*env,videoReplicator,rtpFormat,rtpParams));
     }
     if(audioReplicator)
     {
-        subSession.push_back(UnicastServerMediaSubsession::createNew(*env,audioReplicator,rtpAudioFormat));
+        subSession.push_back(UnicastServerMediaSubsession::createNew(*env,audioReplicator,rtpAudioFormat,rtpParams));
     }
     nbSource+=addSession(rtspServer,url,subSession);
 
@@ -564,7 +762,7 @@ void ZUsbThread::run()
         std::list<ServerMediaSubsession*> subSession;
         if(videoReplicator)
         {
-            subSession.push_back(MulticastServerMediaSubsession::createNew(*env, destinationAddress, Port(rtpPortNum), Port(rtcpPortNum), ttl, videoReplicator, rtpFormat));
+            subSession.push_back(MulticastServerMediaSubsession::createNew(*env, destinationAddress, Port(rtpPortNum), Port(rtcpPortNum), ttl, videoReplicator, rtpFormat, rtpParams));
             //increment ports for next sessions.
             rtpPortNum+=2;
             rtcpPortNum+=2;
@@ -572,7 +770,7 @@ void ZUsbThread::run()
 
         if(audioReplicator)
         {
-            subSession.push_back(MulticastServerMediaSubsession::createNew(*env, destinationAddress, Port(rtpPortNum), Port(rtcpPortNum), ttl, audioReplicator, rtpAudioFormat));
+            subSession.push_back(MulticastServerMediaSubsession::createNew(*env, destinationAddress, Port(rtpPortNum), Port(rtcpPortNum), ttl, audioReplicator, rtpAudioFormat, rtpParams));
 
             //increment ports for next sessions.
             rtpPortNum+=2;
@@ -587,7 +785,22 @@ void ZUsbThread::run()
         std::list<ServerMediaSubsession*> subSession;
         if (videoReplicator)
         {
-            subSession.push_back(TSServerMediaSubsession::createNew(*env, videoReplicator, rtpFormat, audioReplicator, rtpAudioFormat, hlsSegment));
+            //camera rendition first,the others are served as <tsurl>_<name>.
+            std::string rendition(hlsRenditions.empty() ? "" : "source");
+            subSession.push_back(TSServerMediaSubsession::createNew(*env, videoReplicator, rtpFormat, audioReplicator, rtpAudioFormat, hlsSegment, hlsWindow, hlsPart, hlsCmaf, rendition));
+
+            std::list<std::pair<std::string,std::string> >::iterator it;
+            for (it = hlsRenditions.begin(); it != hlsRenditions.end(); ++it)
+            {
+                //keep the format set by the encoder that feeds the device.
+                V4L2DeviceParameters param(it->second.c_str(),V4L2_PIX_FMT_H264,0,0,0,0);
+                std::string renditionFormat;
+                StreamReplicator* renditionReplicator=createVideoReplicator(env,param,ioTypeIn,useThread,repeatConfig,renditionFormat);
+                if(renditionReplicator)
+                {
+                    subSession.push_back(TSServerMediaSubsession::createNew(*env, renditionReplicator, renditionFormat, audioReplicator, rtpAudioFormat, hlsSegment, hlsWindow, hlsPart, hlsCmaf, it->first));
+                }
+            }
         }
         nbSource+=addSession(rtspServer,tsurl,subSession);
 
@@ -605,6 +818,12 @@ void ZUsbThread::run()
         qDebug()<<"Exiting...";
     }
 
+    this->m_audioMixer=NULL;
+    //stop the rate control before its sinks,its source and the scheduler go.
+    if(videoReplicator)
+    {
+        RTPRateController::close(videoReplicator->inputSource());
+    }
     Medium::close(rtspServer);
     env->reclaim();
     delete scheduler;
@@ -3,6 +3,8 @@
 
 #include <QThread>
 
+class AudioMixerDevice;
+
 class ZUsbThread : public QThread
 {
     Q_OBJECT
@@ -11,11 +13,16 @@ public:
 
     qint32 ZStartThread();
     qint32 ZStopThread();
+
+    //gain and mute of the microphones,0 is the main one,then the mixed ones.
+    qint32 ZSetAudioGain(qint32 input,float gain);
+    qint32 ZSetAudioMute(qint32 input,bool mute);
 protected:
     void run();
 
 private:
     char m_quit;
+    AudioMixerDevice* m_audioMixer;
 };
 
 #endif // ZUSBTHREAD_H